@@ -2,3 +2,52 @@ map = "GDC1";
 init_x = 14.7;
 init_y = 14.24;
 init_r = 0; -- in degrees
+global_localization = false; -- start over the whole map instead of at the initial pose above
+
+-- likelihood field observation model; set false to ray cast every beam
+use_likelihood_field = true;
+likelihood_field_resolution = 0.05; -- m
+likelihood_field_max_distance = 1.0; -- m, distances are clamped to this
+likelihood_field_downsampling = 1; -- use every Nth beam
+-- lazy evaluation: every lazy_beam_stride-th beam is scored first, and the other beams only for particles that may still
+-- come within lazy_beam_margin (in log weight) of the best particle; the others keep the weight of the scored beams.
+-- Pays off while the particles are spread out, after global localization or a kidnapping, rather than when tracking
+lazy_beams = false;
+lazy_beam_stride = 4;
+lazy_beam_margin = 20;
+
+-- beam observation model, used when the likelihood field is off: every Nth beam is ray cast, ranges more than d_short
+-- before or d_long after the predicted range count as uniform, sigma_s is the std deviation of the LiDAR measurements
+-- and gamma scales the weight update of each beam
+laser_downsampling = 10;
+d_short = 0.5; -- m
+d_long = 1.0; -- m
+sigma_s = 0.75; -- m
+gamma = 0.75;
+
+-- number of worker threads used to propagate and weight particles
+num_threads = 8;
+
+-- particle count; with kld_sampling the count adapts between min_particles and max_particles at every resample,
+-- otherwise num_particles are kept. num_particles is also the count seeded by an initial pose.
+num_particles = 35;
+kld_sampling = true;
+min_particles = 35;
+max_particles = 2000;
+kld_epsilon = 0.05; -- bound on the KL divergence between the samples and the posterior
+kld_z = 2.33; -- upper standard normal quantile for the bound to hold with 99% probability
+kld_bin_size_xy = 0.25; -- m
+kld_bin_size_theta = 10; -- in degrees
+
+-- global localization: hypotheses seeded over the free space of the map, scored on the first scan with a coarse
+-- pass using every Nth beam, after which only the best are kept
+global_particles = 20000;
+global_min_clearance = 0.2; -- m
+global_coarse_downsampling = 20;
+global_keep_particles = 2000;
+
+-- "ess": resample when the effective sample size falls below resampling_ess_threshold * particle count
+-- "interval": resample every resampling_interval updates, regardless of the weights
+resampling_policy = "ess";
+resampling_ess_threshold = 0.5;
+resampling_interval = 15;
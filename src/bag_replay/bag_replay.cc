@@ -0,0 +1,142 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    bag_replay.cc
+\brief   Offline replay of a bag straight into the callbacks of a node, as
+         fast as they run, for end-to-end benchmarks.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ros/ros.h"
+#include "rosbag/bag.h"
+#include "rosbag/view.h"
+
+#include "shared/util/timer.h"
+#include "bag_replay.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+void PrintLatencies(const string& name, vector<double> latencies) {
+  if (latencies.empty()) {
+    printf("%-32s %9d\n", name.c_str(), 0);
+    return;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  double total = 0;
+  for (const double latency : latencies) total += latency;
+  auto percentile = [&latencies](double q) {
+    const size_t i = q * (latencies.size() - 1) + 0.5;
+    return 1e3 * latencies[i];
+  };
+  printf("%-32s %9lu %9.3f %9.3f %9.3f %9.3f %9.3f\n", name.c_str(),
+         latencies.size(), 1e3 * total / latencies.size(), percentile(0.5),
+         percentile(0.9), percentile(0.99), 1e3 * latencies.back());
+}
+
+}  // namespace
+
+namespace bag_replay {
+
+void BagReplay::AddTimer(const string& name,
+                         double period,
+                         const std::function<void()>& callback) {
+  Timer timer;
+  timer.name = name;
+  timer.period = period;
+  timer.next = 0;
+  timer.callback = callback;
+  timers_.push_back(timer);
+}
+
+bool BagReplay::Run(const string& file) {
+  rosbag::Bag bag;
+  try {
+    bag.open(file, rosbag::bagmode::Read);
+  } catch (const rosbag::BagException& e) {
+    fprintf(stderr, "ERROR: Unable to open bag %s: %s\n", file.c_str(),
+            e.what());
+    return false;
+  }
+  vector<string> topics;
+  for (const auto& stream : streams_) topics.push_back(stream.first);
+  rosbag::View view(bag, rosbag::TopicQuery(topics));
+  if (view.size() == 0) {
+    fprintf(stderr, "ERROR: No messages on the subscribed topics in %s\n",
+            file.c_str());
+    return false;
+  }
+
+  const double bag_start = view.getBeginTime().toSec();
+  for (Timer& timer : timers_) timer.next = bag_start + timer.period;
+  const double wall_start = GetMonotonicTime();
+  for (const rosbag::MessageInstance& m : view) {
+    const double t = m.getTime().toSec();
+    RunTimers(t);
+    ros::Time::setNow(m.getTime());
+    Stream& stream = streams_[Resolve(m.getTopic())];
+    const double start = GetMonotonicTime();
+    if (stream.callback(m)) {
+      stream.latencies.push_back(GetMonotonicTime() - start);
+      ++messages_;
+    }
+    bag_time_ = t - bag_start;
+  }
+  wall_time_ = GetMonotonicTime() - wall_start;
+  bag.close();
+  return true;
+}
+
+void BagReplay::PrintStatistics() const {
+  printf("Replayed %lu messages, %.1f s of bag in %.2f s, %.1fx real time, "
+         "%.0f messages/s\n", messages_, bag_time_, wall_time_,
+         bag_time_ / std::max(wall_time_, 1e-9),
+         messages_ / std::max(wall_time_, 1e-9));
+  printf("%-32s %9s %9s %9s %9s %9s %9s\n", "callback", "calls", "mean ms",
+         "p50 ms", "p90 ms", "p99 ms", "max ms");
+  for (const auto& stream : streams_) {
+    PrintLatencies(stream.first, stream.second.latencies);
+  }
+  for (const Timer& timer : timers_) {
+    PrintLatencies(timer.name, timer.latencies);
+  }
+}
+
+string BagReplay::Resolve(const string& topic) {
+  return (!topic.empty() && topic[0] == '/') ? topic : "/" + topic;
+}
+
+void BagReplay::RunTimers(double t) {
+  for (Timer& timer : timers_) {
+    for (; timer.next <= t; timer.next += timer.period) {
+      ros::Time::setNow(ros::Time(timer.next));
+      const double start = GetMonotonicTime();
+      timer.callback();
+      timer.latencies.push_back(GetMonotonicTime() - start);
+    }
+  }
+}
+
+}  // namespace bag_replay
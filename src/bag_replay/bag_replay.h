@@ -0,0 +1,103 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    bag_replay.h
+\brief   Offline replay of a bag straight into the callbacks of a node, as
+         fast as they run, for end-to-end benchmarks.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ros/ros.h"
+#include "rosbag/bag.h"
+#include "rosbag/view.h"
+
+#ifndef BAG_REPLAY_H
+#define BAG_REPLAY_H
+
+namespace bag_replay {
+
+// Feeds the messages of a bag to the callbacks of a node in the order they
+// were recorded, without a ROS master and without waiting between them.
+// ros::Time::now() follows the time the messages were recorded at, so that
+// the node behaves as it did on the robot. The time every callback takes is
+// recorded for PrintStatistics.
+class BagReplay {
+ public:
+  BagReplay() : messages_(0), bag_time_(0), wall_time_(0) {}
+
+  // Call callback with the messages on topic, of type M. Topics are resolved
+  // in the root namespace, as those of a node started without one.
+  template <typename M, typename Callback>
+  void Subscribe(const std::string& topic, Callback callback) {
+    Stream& stream = streams_[Resolve(topic)];
+    stream.name = Resolve(topic);
+    stream.callback = [callback](const rosbag::MessageInstance& m) {
+      const auto msg = m.instantiate<M>();
+      if (!msg) return false;
+      callback(*msg);
+      return true;
+    };
+  }
+
+  // Call callback every period seconds of bag time, as a ros::Timer or a
+  // RateLoop of the node would.
+  void AddTimer(const std::string& name,
+                double period,
+                const std::function<void()>& callback);
+
+  // Replay the subscribed topics of file. False if it could not be read.
+  bool Run(const std::string& file);
+
+  // Print the replay speed, and the calls and latency of every callback.
+  void PrintStatistics() const;
+
+ private:
+  struct Stream {
+    std::string name;
+    std::function<bool(const rosbag::MessageInstance&)> callback;
+    std::vector<double> latencies;
+  };
+
+  struct Timer {
+    std::string name;
+    double period;
+    double next;
+    std::function<void()> callback;
+    std::vector<double> latencies;
+  };
+
+  static std::string Resolve(const std::string& topic);
+
+  // Run the timers due up to time t of the bag.
+  void RunTimers(double t);
+
+  std::map<std::string, Stream> streams_;
+  std::vector<Timer> timers_;
+  // Messages handed to a callback, seconds of the bag they span and seconds
+  // it took to replay them.
+  size_t messages_;
+  double bag_time_;
+  double wall_time_;
+};
+
+}  // namespace bag_replay
+
+#endif  // BAG_REPLAY_H
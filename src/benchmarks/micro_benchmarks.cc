@@ -0,0 +1,255 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    micro_benchmarks.cc
+\brief   Timings of the geometry and scan matching primitives the nodes spend
+         their time in, to compare against micro_benchmarks_baseline.json.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/geometry.h"
+#include "shared/math/line2d.h"
+#include "slam/motion_model.hpp"
+#include "slam/rasterization.hpp"
+
+using geometry::line2f;
+using std::vector;
+using Eigen::Vector2f;
+
+namespace {
+
+// Inputs are drawn once and cycled through, a power of two of them so the
+// index wraps with a mask.
+const size_t kPoolSize = 1024;
+
+// Segments of a few meters within the range of a scan. Most pairs are told
+// apart by their bounding boxes, as map lines are against a ray.
+vector<line2f> RandomSegments(size_t count, std::mt19937* rng) {
+  std::uniform_real_distribution<float> position(-10, 10);
+  std::uniform_real_distribution<float> length(0.5, 5);
+  std::uniform_real_distribution<float> angle(-M_PI, M_PI);
+  vector<line2f> segments;
+  for (size_t i = 0; i < count; ++i) {
+    const Vector2f p0(position(*rng), position(*rng));
+    segments.push_back(line2f(p0, p0 + length(*rng) *
+                                  geometry::Heading(angle(*rng))));
+  }
+  return segments;
+}
+
+// Points of a scan of the given size, on walls of a room around the sensor.
+vector<Vector2f> RandomScan(size_t count, std::mt19937* rng) {
+  std::normal_distribution<float> noise(0, 0.02);
+  vector<Vector2f> points;
+  for (size_t i = 0; i < count; ++i) {
+    const float angle = -0.75 * M_PI + 1.5 * M_PI * i / count;
+    const Vector2f dir = geometry::Heading(angle);
+    const float range = 4 / std::max(std::fabs(dir.x()), std::fabs(dir.y()));
+    points.push_back((range + noise(*rng)) * dir);
+  }
+  return points;
+}
+
+void BM_LineIntersection(benchmark::State& state) {
+  std::mt19937 rng(1);
+  const vector<line2f> a = RandomSegments(kPoolSize, &rng);
+  const vector<line2f> b = RandomSegments(kPoolSize, &rng);
+  size_t i = 0;
+  Vector2f intersection(0, 0);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(a[i].Intersection(b[i], &intersection));
+    benchmark::DoNotOptimize(intersection);
+    i = (i + 1) & (kPoolSize - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LineIntersection);
+
+void BM_LineIntersects(benchmark::State& state) {
+  std::mt19937 rng(1);
+  const vector<line2f> a = RandomSegments(kPoolSize, &rng);
+  const vector<line2f> b = RandomSegments(kPoolSize, &rng);
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(a[i].Intersects(b[i]));
+    i = (i + 1) & (kPoolSize - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LineIntersects);
+
+void BM_LineClosestApproach(benchmark::State& state) {
+  std::mt19937 rng(1);
+  const vector<line2f> a = RandomSegments(kPoolSize, &rng);
+  const vector<line2f> b = RandomSegments(kPoolSize, &rng);
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(a[i].ClosestApproach(b[i]));
+    i = (i + 1) & (kPoolSize - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LineClosestApproach);
+
+void BM_MinDistanceLineLine(benchmark::State& state) {
+  std::mt19937 rng(1);
+  const vector<line2f> a = RandomSegments(kPoolSize, &rng);
+  const vector<line2f> b = RandomSegments(kPoolSize, &rng);
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        geometry::MinDistanceLineLine(a[i].p0, a[i].p1, b[i].p0, b[i].p1));
+    i = (i + 1) & (kPoolSize - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MinDistanceLineLine);
+
+// Map lines against the arcs of the path options of the local planner, which
+// turn left or right through up to a quarter turn.
+void BM_MinDistanceLineArc(benchmark::State& state) {
+  std::mt19937 rng(1);
+  const vector<line2f> lines = RandomSegments(kPoolSize, &rng);
+  std::uniform_real_distribution<float> radius(1, 20);
+  std::uniform_real_distribution<float> sweep(0, 0.5 * M_PI);
+  vector<float> radii;
+  vector<float> sweeps;
+  vector<int> signs;
+  for (size_t i = 0; i < kPoolSize; ++i) {
+    radii.push_back(radius(rng));
+    sweeps.push_back(sweep(rng));
+    signs.push_back(i % 2 == 0 ? 1 : -1);
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    // The arc starts at the robot, with its center to the side it turns to.
+    const Vector2f center(0, signs[i] * radii[i]);
+    const float start = -signs[i] * 0.5 * M_PI;
+    benchmark::DoNotOptimize(geometry::MinDistanceLineArc(
+        lines[i].p0, lines[i].p1, center, radii[i], start,
+        start + signs[i] * sweeps[i], signs[i]));
+    i = (i + 1) & (kPoolSize - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MinDistanceLineArc);
+
+void BM_LookupTableBuild(benchmark::State& state) {
+  std::mt19937 rng(1);
+  const vector<Vector2f> scan = RandomScan(state.range(0), &rng);
+  for (auto _ : state) {
+    rasterization::LookupTable table(scan, LOOKUP_TABLE_RESOLUTION,
+                                     LOOKUP_TABLE_SIGMA);
+    benchmark::DoNotOptimize(table.evaluate(scan[0]));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LookupTableBuild)->Arg(1081)->Unit(benchmark::kMicrosecond);
+
+// Points of one scan looked up one by one, as scoreCandidate does.
+void BM_LookupTableEvaluate(benchmark::State& state) {
+  std::mt19937 rng(1);
+  rasterization::LookupTable table(RandomScan(1081, &rng),
+                                   LOOKUP_TABLE_RESOLUTION,
+                                   LOOKUP_TABLE_SIGMA);
+  const vector<Vector2f> points = RandomScan(state.range(0), &rng);
+  for (auto _ : state) {
+    double sum = 0;
+    for (const Vector2f& point : points) {
+      sum += table.evaluate(point);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LookupTableEvaluate)->Arg(1081);
+
+// The same scan summed in grid coordinates, as the translation search does.
+void BM_LookupTableSumShifted(benchmark::State& state) {
+  std::mt19937 rng(1);
+  rasterization::LookupTable table(RandomScan(1081, &rng),
+                                   LOOKUP_TABLE_RESOLUTION,
+                                   LOOKUP_TABLE_SIGMA);
+  vector<float> x;
+  vector<float> y;
+  for (const Vector2f& point : RandomScan(state.range(0), &rng)) {
+    const Vector2f grid = table.gridCoordinates(point);
+    x.push_back(grid.x());
+    y.push_back(grid.y());
+  }
+  const Vector2f shift(1.5, -2.5);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(table.sumShifted(x, y, shift));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LookupTableSumShifted)->Arg(1081);
+
+void BM_MotionModelEvaluate(benchmark::State& state) {
+  const motion_model::MultivariateMotionModel model(
+      Eigen::Vector3d(0.5, 0.1, 0.2), Eigen::Vector3d(0.5, 0.1, 0.2));
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> offset(-0.3, 0.3);
+  vector<Eigen::Vector3d> poses;
+  for (size_t i = 0; i < kPoolSize; ++i) {
+    poses.push_back(Eigen::Vector3d(0.5 + offset(rng), 0.1 + offset(rng),
+                                    0.2 + offset(rng)));
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(model.evaluate(poses[i]));
+    i = (i + 1) & (kPoolSize - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MotionModelEvaluate);
+
+// The prior over a whole candidate lattice of the given side, with 61
+// headings, as scoreCandidates precomputes it.
+void BM_MotionLattice(benchmark::State& state) {
+  const motion_model::MultivariateMotionModel model(
+      Eigen::Vector3d(0.5, 0.1, 0.2), Eigen::Vector3d(0.5, 0.1, 0.2));
+  const int side = state.range(0);
+  vector<Vector2f> positions;
+  for (int x = 0; x < side; ++x) {
+    for (int y = 0; y < side; ++y) {
+      positions.push_back(Vector2f(0.5 + 0.03 * (x - side / 2),
+                                   0.1 + 0.03 * (y - side / 2)));
+    }
+  }
+  vector<float> headings;
+  for (int k = 0; k < 61; ++k) {
+    headings.push_back(0.2 + 0.01 * (k - 30));
+  }
+  for (auto _ : state) {
+    const motion_model::MotionLattice lattice(model, positions, headings);
+    benchmark::DoNotOptimize(lattice.evaluate(0, 0));
+  }
+  state.SetItemsProcessed(state.iterations() * positions.size() *
+                          headings.size());
+}
+BENCHMARK(BM_MotionLattice)->Arg(41)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
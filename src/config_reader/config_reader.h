@@ -33,6 +33,7 @@ extern "C" {
 #include <atomic>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <thread>
@@ -41,6 +42,7 @@ extern "C" {
 
 #include "config_reader/lua_script.h"
 #include "config_reader/macros.h"
+#include "config_reader/snapshot.h"
 #include "config_reader/types/config_generic.h"
 #include "config_reader/types/config_numeric.h"
 #include "config_reader/types/type_interface.h"
@@ -48,6 +50,8 @@ extern "C" {
 namespace config_reader {
 
 inline void LuaRead(const std::vector<std::string>& files) {
+  // Snapshots must not see a half written load
+  std::lock_guard<std::mutex> lock(*SnapshotRegistry::Mutex());
   // Create the LuaScript object
   LuaScript script(files);
   // Loop through the unordered map
@@ -60,6 +64,7 @@ inline void LuaRead(const std::vector<std::string>& files) {
     t->SetValue(&script);
   }
   *MapSingleton::NewKeyAdded() = false;
+  SnapshotRegistry::PublishAll();
 }
 
 class ConfigReader {
@@ -0,0 +1,133 @@
+// Copyright 2024 Daniel Meza, Jared Rosenbaum, Steven Swanbeck
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_SNAPSHOT_H_
+#define CONFIGREADER_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace config_reader {
+
+class SnapshotInterface {
+ public:
+  virtual ~SnapshotInterface() = default;
+  // Read the config variables into a new snapshot and make it the current
+  // one. Only called with SnapshotRegistry::Mutex() held.
+  virtual void Publish() = 0;
+};
+
+// Snapshots to publish after every load of the config files. Loads hold
+// Mutex() while they write the config variables, so that snapshots are only
+// ever read from complete loads.
+class SnapshotRegistry {
+ public:
+  static std::mutex* Mutex() {
+    static std::mutex mutex;
+    return &mutex;
+  }
+
+  static std::vector<SnapshotInterface*>* Snapshots() {
+    static std::vector<SnapshotInterface*> snapshots;
+    return &snapshots;
+  }
+
+  // Publish every snapshot, with Mutex() held.
+  static void PublishAll() {
+    for (SnapshotInterface* snapshot : *Snapshots()) {
+      snapshot->Publish();
+    }
+  }
+};
+
+// Immutable copy of a set of config variables, in a struct T that read fills
+// from the CONFIG_ variables. A new copy is published after every load, while
+// readers keep using the one they hold. Hot loops hold a Handle, refresh it
+// once per cycle and read plain fields from it, which costs a single atomic
+// load when nothing changed and never races with the reload thread.
+template <typename T>
+class Snapshot : public SnapshotInterface {
+ public:
+  // A reader's copy of the snapshot, only valid after the first Refresh.
+  class Handle {
+   public:
+    Handle() : version_(0) {}
+    const T& operator*() const { return *current_; }
+    const T* operator->() const { return current_.get(); }
+
+   private:
+    friend class Snapshot;
+    uint64_t version_;
+    std::shared_ptr<const T> current_;
+  };
+
+  explicit Snapshot(const std::function<void(T*)>& read)
+      : read_(read), version_(0) {
+    std::lock_guard<std::mutex> lock(*SnapshotRegistry::Mutex());
+    SnapshotRegistry::Snapshots()->push_back(this);
+    Publish();
+  }
+
+  ~Snapshot() {
+    std::lock_guard<std::mutex> lock(*SnapshotRegistry::Mutex());
+    auto* snapshots = SnapshotRegistry::Snapshots();
+    snapshots->erase(std::remove(snapshots->begin(), snapshots->end(), this),
+                     snapshots->end());
+  }
+
+  Snapshot(const Snapshot&) = delete;
+  Snapshot& operator=(const Snapshot&) = delete;
+
+  // Point handle at the latest snapshot, unless it already is. The one it
+  // held stays alive as long as another handle holds it.
+  void Refresh(Handle* handle) const {
+    const uint64_t version = version_.load(std::memory_order_acquire);
+    if (handle->version_ == version) return;
+    handle->current_ = std::atomic_load(&current_);
+    handle->version_ = version;
+  }
+
+  // The latest snapshot.
+  std::shared_ptr<const T> Get() const { return std::atomic_load(&current_); }
+
+  void Publish() override {
+    std::shared_ptr<T> next(new T());
+    read_(next.get());
+    std::atomic_store(&current_, std::shared_ptr<const T>(std::move(next)));
+    version_.fetch_add(1, std::memory_order_release);
+  }
+
+ private:
+  const std::function<void(T*)> read_;
+  // Only accessed through std::atomic_load and std::atomic_store.
+  std::shared_ptr<const T> current_;
+  // Bumped after every new snapshot is stored.
+  std::atomic<uint64_t> version_;
+};
+
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_SNAPSHOT_H_
@@ -0,0 +1,215 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    fast_random.cc
+\brief   Fast uniform and Gaussian random numbers, drawn one at a time or
+         a whole array at once, from independent streams of one seed.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fast_random.h"
+
+namespace {
+
+inline uint64_t Rotate(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+uint64_t SplitMix64(uint64_t* x) {
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// One xoshiro256 step of a single generator.
+inline void Step(uint64_t s[4]) {
+  const uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = Rotate(s[3], 45);
+}
+
+// Advance s by the number of steps the jump polynomial stands for, 2^128 for
+// kJump and 2^192 for kLongJump.
+const uint64_t kJump[4] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                           0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+const uint64_t kLongJump[4] = {0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+                               0x77710069854ee241ULL, 0x39109bb02acbe635ULL};
+
+void Jump(const uint64_t polynomial[4], uint64_t s[4]) {
+  uint64_t t[4] = {0, 0, 0, 0};
+  for (int i = 0; i < 4; ++i) {
+    for (int b = 0; b < 64; ++b) {
+      if (polynomial[i] & (1ULL << b)) {
+        for (int w = 0; w < 4; ++w) t[w] ^= s[w];
+      }
+      Step(s);
+    }
+  }
+  for (int w = 0; w < 4; ++w) s[w] = t[w];
+}
+
+// Uniform in [0, 1) from the upper 53 bits, the lower ones of xoshiro256+
+// are weaker.
+inline double ToDouble(uint64_t x) {
+  return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+inline float ToFloat(uint64_t x) {
+  return (x >> 40) * (1.0f / 16777216.0f);
+}
+
+// Layers of the Ziggurat of Marsaglia and Tsang, "The Ziggurat Method for
+// Generating Random Variables", 2000. A draw inside layer i is accepted as
+// is when its magnitude is below k[i], w[i] scales it to the layer width
+// and f[i] is the density at the layer edge.
+const int kLayers = 128;
+const double kTail = 3.442619855899;
+
+struct Ziggurat {
+  uint32_t k[kLayers];
+  double w[kLayers];
+  double f[kLayers];
+
+  Ziggurat() {
+    const double m = 2147483648.0;
+    const double v = 9.91256303526217e-3;
+    double d = kTail;
+    double t = d;
+    const double q = v / exp(-0.5 * d * d);
+    k[0] = (d / q) * m;
+    k[1] = 0;
+    w[0] = q / m;
+    w[kLayers - 1] = d / m;
+    f[0] = 1;
+    f[kLayers - 1] = exp(-0.5 * d * d);
+    for (int i = kLayers - 2; i >= 1; --i) {
+      d = sqrt(-2 * log(v / d + exp(-0.5 * d * d)));
+      k[i + 1] = (d / t) * m;
+      t = d;
+      f[i] = exp(-0.5 * d * d);
+      w[i] = d / m;
+    }
+  }
+};
+
+const Ziggurat& Layers() {
+  static const Ziggurat ziggurat;
+  return ziggurat;
+}
+
+}  // namespace
+
+namespace fast_random {
+
+FastRandom::FastRandom(uint64_t seed, int stream) :
+    seed_(seed), next_(kBlock) {
+  uint64_t x = seed;
+  uint64_t s[4];
+  for (int w = 0; w < 4; ++w) s[w] = SplitMix64(&x);
+  for (int i = 0; i < stream; ++i) Jump(kLongJump, s);
+  for (int l = 0; l < kLanes; ++l) {
+    for (int w = 0; w < 4; ++w) state_[w][l] = s[w];
+    Jump(kJump, s);
+  }
+}
+
+void FastRandom::Refill() {
+  uint64_t* s0 = state_[0];
+  uint64_t* s1 = state_[1];
+  uint64_t* s2 = state_[2];
+  uint64_t* s3 = state_[3];
+  for (int r = 0; r < kBlock; r += kLanes) {
+    for (int l = 0; l < kLanes; ++l) {
+      block_[r + l] = s0[l] + s3[l];
+      const uint64_t t = s1[l] << 17;
+      s2[l] ^= s0[l];
+      s3[l] ^= s1[l];
+      s1[l] ^= s2[l];
+      s0[l] ^= s3[l];
+      s2[l] ^= t;
+      s3[l] = Rotate(s3[l], 45);
+    }
+  }
+  next_ = 0;
+}
+
+double FastRandom::UniformRandom() {
+  return ToDouble(Next());
+}
+
+double FastRandom::UniformRandom(double a, double b) {
+  return (b - a) * UniformRandom() + a;
+}
+
+double FastRandom::Gaussian(double mean, double stddev) {
+  return mean + stddev * StandardGaussian();
+}
+
+void FastRandom::FillUniform(float* data, size_t size, float a, float b) {
+  const float scale = b - a;
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = scale * ToFloat(Next()) + a;
+  }
+}
+
+void FastRandom::FillGaussian(float* data,
+                              size_t size,
+                              float mean,
+                              float stddev) {
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = mean + stddev * StandardGaussian();
+  }
+}
+
+double FastRandom::StandardGaussian() {
+  const Ziggurat& z = Layers();
+  for (;;) {
+    // The layer from the top 7 bits, a signed 32 bit position in it from the
+    // ones below; the low bits of xoshiro256+ are its weakest.
+    const uint64_t bits = Next();
+    const int i = static_cast<int>(bits >> 57);
+    const int32_t h = static_cast<int32_t>(static_cast<uint32_t>(bits >> 25));
+    const uint32_t magnitude = (h < 0) ? -static_cast<int64_t>(h) : h;
+    const double x = h * z.w[i];
+    // Nearly every draw lies inside the rectangle under the density.
+    if (magnitude < z.k[i]) return x;
+    if (i == 0) {
+      // Beyond the base layer, sample the tail of the density.
+      double tail_x, tail_y;
+      do {
+        tail_x = -log(1 - UniformRandom()) / kTail;
+        tail_y = -log(1 - UniformRandom());
+      } while (tail_y + tail_y < tail_x * tail_x);
+      return (h > 0) ? kTail + tail_x : -kTail - tail_x;
+    }
+    // In the wedge between the rectangle and the density.
+    if (z.f[i] + UniformRandom() * (z.f[i - 1] - z.f[i]) <
+        exp(-0.5 * x * x)) {
+      return x;
+    }
+  }
+}
+
+}  // namespace fast_random
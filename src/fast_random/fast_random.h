@@ -0,0 +1,91 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    fast_random.h
+\brief   Fast uniform and Gaussian random numbers, drawn one at a time or
+         a whole array at once, from independent streams of one seed.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef FAST_RANDOM_H
+#define FAST_RANDOM_H
+
+namespace fast_random {
+
+// xoshiro256+ generators, kLanes of them interleaved so that the compiler
+// vectorizes refilling a block of raw numbers, and a Ziggurat sampler for
+// Gaussians. A drop-in for util_random::Random where numbers are drawn in
+// hot loops.
+//
+// Stream(i) of the same seed are 2^192 draws apart, so every thread of a
+// parallel loop can own one and the results only depend on the seed and
+// the number of threads.
+class FastRandom {
+ public:
+  explicit FastRandom(uint64_t seed = 1) : FastRandom(seed, 0) {}
+
+  // Another stream of the seed this one was made from.
+  FastRandom Stream(int stream) const { return FastRandom(seed_, stream); }
+
+  // Generate random numbers between 0, inclusive, and 1, exclusive.
+  double UniformRandom();
+
+  // Generate random numbers between a and b.
+  double UniformRandom(double a, double b);
+
+  // Return a random value drawn from a Normal distribution.
+  double Gaussian(double mean, double stddev);
+
+  // Set data[0] ... data[size - 1] to uniform random numbers between a and
+  // b.
+  void FillUniform(float* data, size_t size, float a = 0, float b = 1);
+
+  // Set data[0] ... data[size - 1] to random values of a Normal
+  // distribution.
+  void FillGaussian(float* data, size_t size, float mean = 0,
+                    float stddev = 1);
+
+  // Next 64 random bits.
+  uint64_t Next() {
+    if (next_ == kBlock) Refill();
+    return block_[next_++];
+  }
+
+ private:
+  static const int kLanes = 4;
+  static const int kBlock = 4 * kLanes;
+
+  FastRandom(uint64_t seed, int stream);
+
+  // Draw the next kBlock numbers of the lanes.
+  void Refill();
+
+  // Gaussian of the Ziggurat sampler, in units of its standard deviation.
+  double StandardGaussian();
+
+  uint64_t seed_;
+  // State word w of lane l is state_[w][l].
+  uint64_t state_[4][kLanes];
+  uint64_t block_[kBlock];
+  int next_;
+};
+
+}  // namespace fast_random
+
+#endif  // FAST_RANDOM_H
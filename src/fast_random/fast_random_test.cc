@@ -0,0 +1,148 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    fast_random_test.cc
+\brief   Checks the distributions and streams of fast_random::FastRandom,
+         and times it against util_random::Random.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "fast_random/fast_random.h"
+#include "shared/util/random.h"
+#include "shared/util/timer.h"
+
+using fast_random::FastRandom;
+using std::vector;
+
+namespace {
+
+const int kSamples = 1000000;
+
+bool Near(const char* name, double value, double expected, double tolerance) {
+  if (fabs(value - expected) <= tolerance) return true;
+  printf("ERROR: %s is %f, expected %f +- %f\n", name, value, expected,
+         tolerance);
+  return false;
+}
+
+bool CheckGaussian() {
+  FastRandom rng(7);
+  vector<float> samples(kSamples);
+  rng.FillGaussian(samples.data(), samples.size(), 1, 2);
+  double sum = 0, sq_sum = 0, fourth = 0;
+  int within_sigma = 0, tail = 0;
+  for (const float x : samples) {
+    const double z = (x - 1) / 2;
+    sum += z;
+    sq_sum += z * z;
+    fourth += z * z * z * z;
+    within_sigma += fabs(z) < 1;
+    tail += fabs(z) > 3.442619855899;
+  }
+  const double mean = sum / kSamples;
+  const double variance = sq_sum / kSamples - mean * mean;
+  bool ok = Near("Gaussian mean", mean, 0, 0.005);
+  ok = Near("Gaussian variance", variance, 1, 0.01) && ok;
+  ok = Near("Gaussian kurtosis", fourth / kSamples, 3, 0.05) && ok;
+  ok = Near("Gaussian mass within 1 sigma", double(within_sigma) / kSamples,
+            0.682689, 0.002) && ok;
+  // The tail beyond the base layer is sampled separately.
+  ok = Near("Gaussian tail", double(tail) / kSamples, 5.76e-4,
+            1e-4) && ok;
+  printf("Gaussian: mean %f, variance %f, %d tail samples\n", mean, variance,
+         tail);
+  return ok;
+}
+
+bool CheckUniform() {
+  FastRandom rng(7);
+  vector<float> samples(kSamples);
+  rng.FillUniform(samples.data(), samples.size(), -2, 2);
+  vector<int> histogram(16, 0);
+  double sum = 0;
+  for (const float x : samples) {
+    if (x < -2 || x > 2) {
+      printf("ERROR: uniform sample %f outside [-2, 2]\n", x);
+      return false;
+    }
+    sum += x;
+    ++histogram[std::min(15, static_cast<int>((x + 2) * 4))];
+  }
+  bool ok = Near("uniform mean", sum / kSamples, 0, 0.005);
+  for (const int count : histogram) {
+    ok = Near("uniform bin", double(count) / kSamples, 1.0 / 16, 0.002) && ok;
+  }
+  return ok;
+}
+
+// Streams of one seed differ, and repeat when made again.
+bool CheckStreams() {
+  const FastRandom master(3);
+  vector<float> a(1000), b(1000), c(1000);
+  FastRandom stream_1 = master.Stream(1);
+  FastRandom stream_2 = master.Stream(2);
+  FastRandom stream_1_again = master.Stream(1);
+  stream_1.FillGaussian(a.data(), a.size());
+  stream_2.FillGaussian(b.data(), b.size());
+  stream_1_again.FillGaussian(c.data(), c.size());
+  double correlation = 0;
+  for (size_t i = 0; i < a.size(); ++i) correlation += a[i] * b[i];
+  correlation /= a.size();
+  bool ok = Near("correlation of two streams", correlation, 0, 0.15);
+  if (a != c) {
+    printf("ERROR: the same stream gave different numbers\n");
+    ok = false;
+  }
+  return ok;
+}
+
+void Benchmark() {
+  vector<float> samples(kSamples);
+  util_random::Random reference(1);
+  FastRandom rng(1);
+  const double t_start = GetMonotonicTime();
+  for (float& x : samples) x = reference.Gaussian(0, 1);
+  const double t_reference = GetMonotonicTime();
+  rng.FillGaussian(samples.data(), samples.size());
+  const double t_fast = GetMonotonicTime();
+  for (float& x : samples) x = reference.UniformRandom();
+  const double t_reference_uniform = GetMonotonicTime();
+  rng.FillUniform(samples.data(), samples.size());
+  const double t_fast_uniform = GetMonotonicTime();
+  printf("%d Gaussians: util_random %.1f ms, fast_random %.1f ms\n",
+         kSamples, 1e3 * (t_reference - t_start), 1e3 * (t_fast - t_reference));
+  printf("%d uniforms: util_random %.1f ms, fast_random %.1f ms\n", kSamples,
+         1e3 * (t_reference_uniform - t_fast),
+         1e3 * (t_fast_uniform - t_reference_uniform));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  bool ok = CheckGaussian();
+  ok = CheckUniform() && ok;
+  ok = CheckStreams() && ok;
+  if (!ok) return 1;
+  Benchmark();
+  printf("All fast random checks passed\n");
+  return 0;
+}
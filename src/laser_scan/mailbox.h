@@ -0,0 +1,90 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    mailbox.h
+\brief   Lock-free single slot handoff of the newest sensor message from a
+         callback to the worker thread that processes it.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+namespace laser_scan {
+
+// Newest message posted by one producer thread, for one consumer thread.
+// Posting never waits: a message the consumer has not taken yet is replaced
+// and counted as dropped, so a slow consumer always works on the latest data
+// instead of falling behind a queue.
+//
+// Three buffers rotate between the producer, the slot and the consumer, so
+// neither side ever touches a buffer the other one is using, and buffers keep
+// their capacity from one message to the next.
+template <typename T>
+class Mailbox {
+ public:
+  Mailbox() : slot_(1), write_(0), read_(2), posted_(0), dropped_(0) {}
+
+  // Producer side.
+  void Post(const T& value) {
+    buffers_[write_] = value;
+    const int previous =
+        slot_.exchange(write_ | kFresh, std::memory_order_acq_rel);
+    if (previous & kFresh) {
+      dropped_.store(dropped_.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+    }
+    posted_.store(posted_.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+    write_ = previous & kIndex;
+  }
+
+  // Consumer side. The newest message posted since the last call, or nullptr
+  // when there is none. It stays valid until the next call.
+  const T* Take() {
+    if (!(slot_.load(std::memory_order_acquire) & kFresh)) return nullptr;
+    read_ = slot_.exchange(read_, std::memory_order_acq_rel) & kIndex;
+    return &buffers_[read_];
+  }
+
+  // Counters, safe to read from any thread.
+  uint64_t Posted() const { return posted_.load(std::memory_order_relaxed); }
+  uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  Mailbox(const Mailbox&);
+  Mailbox& operator=(const Mailbox&);
+
+  // The slot holds the index of its buffer, and kFresh until it is taken.
+  static const int kIndex = 3;
+  static const int kFresh = 4;
+
+  T buffers_[3];
+  std::atomic<int> slot_;
+  int write_;  // Only used by the producer.
+  int read_;   // Only used by the consumer.
+  // Only the producer writes them.
+  std::atomic<uint64_t> posted_;
+  std::atomic<uint64_t> dropped_;
+};
+
+}  // namespace laser_scan
+
+#endif  // MAILBOX_H
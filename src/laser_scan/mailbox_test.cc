@@ -0,0 +1,110 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    mailbox_test.cc
+\brief   Checks that a Mailbox hands a slow consumer whole, ever newer
+         messages, and counts the ones it skips.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "laser_scan/mailbox.h"
+
+namespace {
+
+// Every range of a scan holds its sequence number, a scan torn between two
+// posts would mix them.
+struct Scan {
+  int seq;
+  std::vector<float> ranges;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int kScans = 200000;
+  const int kRanges = 1081;
+  laser_scan::Mailbox<Scan> mailbox;
+  int failures = 0;
+
+  if (mailbox.Take() != nullptr) {
+    printf("FAIL: empty mailbox handed out a message\n");
+    ++failures;
+  }
+
+  std::atomic_bool done(false);
+  std::thread producer([&]() {
+    Scan scan;
+    scan.ranges.resize(kRanges);
+    for (int i = 0; i < kScans; ++i) {
+      scan.seq = i;
+      for (float& range : scan.ranges) range = i;
+      mailbox.Post(scan);
+    }
+    done = true;
+  });
+
+  int taken = 0;
+  int last = -1;
+  while (true) {
+    const bool finished = done;
+    const Scan* scan = mailbox.Take();
+    if (scan == nullptr) {
+      if (finished) break;
+      std::this_thread::yield();
+      continue;
+    }
+    ++taken;
+    if (scan->seq <= last) {
+      printf("FAIL: scan %d taken after %d\n", scan->seq, last);
+      ++failures;
+    }
+    for (const float range : scan->ranges) {
+      if (range != scan->seq) {
+        printf("FAIL: scan %d holds a range of scan %.0f\n", scan->seq, range);
+        ++failures;
+        break;
+      }
+    }
+    last = scan->seq;
+  }
+
+  producer.join();
+  if (last != kScans - 1) {
+    printf("FAIL: last scan taken was %d of %d\n", last, kScans);
+    ++failures;
+  }
+  if (mailbox.Posted() != static_cast<uint64_t>(kScans) ||
+      mailbox.Posted() - mailbox.Dropped() != static_cast<uint64_t>(taken)) {
+    printf("FAIL: %lu posted, %lu dropped, %d taken\n",
+           static_cast<unsigned long>(mailbox.Posted()),
+           static_cast<unsigned long>(mailbox.Dropped()), taken);
+    ++failures;
+  }
+  printf("%d scans posted, %d taken, %lu dropped\n", kScans, taken,
+         static_cast<unsigned long>(mailbox.Dropped()));
+  if (failures > 0) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("All tests passed\n");
+  return 0;
+}
@@ -0,0 +1,84 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    scan_cloud.cc
+\brief   Laser scan to point cloud conversion with a cached table of beam
+         directions, shared by the navigation, localization and SLAM nodes.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <cmath>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "scan_cloud.h"
+
+using std::vector;
+using Eigen::Vector2f;
+
+namespace laser_scan {
+
+const vector<Vector2f>& BeamDirections::Get(float angle_min,
+                                            float angle_increment,
+                                            int count) {
+  if (count == count_ && angle_min == angle_min_ &&
+      angle_increment == angle_increment_) {
+    return directions_;
+  }
+  angle_min_ = angle_min;
+  angle_increment_ = angle_increment;
+  count_ = count;
+  directions_.resize(count);
+  for (int i = 0; i < count; i++) {
+    const float angle = angle_min + i * angle_increment;
+    directions_[i] = Vector2f(std::cos(angle), std::sin(angle));
+  }
+  return directions_;
+}
+
+void ScanCloud::SetDownsampling(float min_spacing, float max_range) {
+  min_spacing_ = min_spacing;
+  max_range_ = max_range;
+}
+
+const vector<Vector2f>& ScanCloud::Convert(const vector<float>& ranges,
+                                           float range_max,
+                                           float angle_min,
+                                           float angle_increment,
+                                           const Vector2f& sensor_loc) {
+  const vector<Vector2f>& directions =
+      directions_.Get(angle_min, angle_increment, ranges.size());
+  if (max_range_ > 0 && max_range_ < range_max) range_max = max_range_;
+  // Clearing keeps the capacity, so after the first scan nothing is allocated.
+  cloud_.clear();
+  for (size_t i = 0; i < ranges.size(); i++) {
+    if (ranges[i] >= range_max) continue;
+    Add(ranges[i] * directions[i] + sensor_loc);
+  }
+  return cloud_;
+}
+
+const vector<Vector2f>& ScanCloud::Filter(const vector<Vector2f>& cloud) {
+  cloud_.clear();
+  for (const Vector2f& p : cloud) {
+    if (max_range_ > 0 && p.squaredNorm() >= max_range_ * max_range_) continue;
+    Add(p);
+  }
+  return cloud_;
+}
+
+}  // namespace laser_scan
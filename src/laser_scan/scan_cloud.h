@@ -0,0 +1,102 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    scan_cloud.h
+\brief   Laser scan to point cloud conversion with a cached table of beam
+         directions, shared by the navigation, localization and SLAM nodes.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#ifndef SCAN_CLOUD_H
+#define SCAN_CLOUD_H
+
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+namespace laser_scan {
+
+// Sensor-frame unit vector of every beam of a scan. The table only depends on
+// the scan geometry, so it is recomputed only when that changes.
+class BeamDirections {
+ public:
+  BeamDirections() : angle_min_(0), angle_increment_(0), count_(-1) {}
+
+  // Directions of count beams, the i'th one at angle_min + i * angle_increment.
+  const std::vector<Eigen::Vector2f>& Get(float angle_min,
+                                          float angle_increment,
+                                          int count);
+
+ private:
+  // Geometry the table was computed for.
+  float angle_min_;
+  float angle_increment_;
+  int count_;
+  std::vector<Eigen::Vector2f> directions_;
+};
+
+// Reusable point cloud buffer. Converting a scan only writes into the buffer,
+// and consumers get a const view of it instead of a copy.
+//
+// Points can be decimated on the way in: consecutive beams of a scan land
+// much closer together at short range than far away, so a point is dropped
+// when it lies within min_spacing of the last point kept. Far beams, which
+// are already sparse, are all kept.
+class ScanCloud {
+ public:
+  ScanCloud() : min_spacing_(0), max_range_(0) {}
+
+  // Keep points at least min_spacing apart, and drop the ones farther than
+  // max_range. Either is disabled with 0.
+  void SetDownsampling(float min_spacing, float max_range);
+
+  // Convert the beams shorter than range_max into points in the frame of the
+  // robot, with the sensor mounted at sensor_loc and facing forward. The view
+  // stays valid until the next Convert or Filter.
+  const std::vector<Eigen::Vector2f>& Convert(
+      const std::vector<float>& ranges,
+      float range_max,
+      float angle_min,
+      float angle_increment,
+      const Eigen::Vector2f& sensor_loc);
+
+  // Downsample an already converted cloud into the buffer, with max_range
+  // measured from the origin of the cloud.
+  const std::vector<Eigen::Vector2f>& Filter(
+      const std::vector<Eigen::Vector2f>& cloud);
+
+  // Cloud of the last converted scan.
+  const std::vector<Eigen::Vector2f>& Cloud() const { return cloud_; }
+
+ private:
+  // Append p unless it is within min_spacing of the last point kept.
+  void Add(const Eigen::Vector2f& p) {
+    if (min_spacing_ > 0 && !cloud_.empty() &&
+        (p - cloud_.back()).squaredNorm() < min_spacing_ * min_spacing_) {
+      return;
+    }
+    cloud_.push_back(p);
+  }
+
+  float min_spacing_;
+  float max_range_;
+  BeamDirections directions_;
+  std::vector<Eigen::Vector2f> cloud_;
+};
+
+}  // namespace laser_scan
+
+#endif  // SCAN_CLOUD_H
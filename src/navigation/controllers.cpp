@@ -17,8 +17,20 @@ namespace controllers {
 namespace time_optimal_1D {
 
 Controller::Controller(vehicles::Car *car, float control_interval, float margin, float max_clearance, float curvature_sampling_interval) 
-: car_(car), control_interval_(control_interval), margin_(margin), max_clearance_(max_clearance), curvature_sampling_interval_(curvature_sampling_interval), previous_curvature_(0.f)
-{}
+: car_(car), control_interval_(control_interval), margin_(margin), max_clearance_(max_clearance), curvature_sampling_interval_(curvature_sampling_interval), previous_curvature_(0.f), window_velocities_(0), window_curvatures_(N_PATHS), speed_weight_(0.f)
+{
+  swept_.build(N_PATHS, *car_, SWEPT_FOOTPRINT_RESOLUTION);
+}
+
+void Controller::setDynamicWindow(int velocity_samples, int curvature_samples, float speed_weight)
+{
+  window_velocities_ = std::max(velocity_samples, 0);
+  window_curvatures_ = std::max(curvature_samples, 2);
+  speed_weight_ = speed_weight;
+  if (swept_.numOptions() != pathCount()) {
+    swept_.build(pathCount(), *car_, SWEPT_FOOTPRINT_RESOLUTION);
+  }
+}
 
 float Controller::calculateControlSpeed(float current_speed, const float free_path_length)
 {
@@ -82,7 +94,22 @@ float Controller::calculateControlSpeed(float current_speed, const float free_pa
 
 Command Controller::generateCommand(const std::vector<Vector2f>& point_cloud, const float current_speed, std::vector<path_generation::Path> &paths, path_generation::Path &best_path, const Vector2f goal, const Vector2f global_goal)
 {
-  paths = path_generation::samplePathOptions(N_PATHS, point_cloud, *car_, goal, global_goal);
+  paths = path_generation::samplePathOptions(Controller::pathCount(), point_cloud, swept_, *car_, goal, global_goal);
+  return Controller::selectCommand(current_speed, paths, best_path);
+}
+
+Command Controller::generateCommand(const local_planners::LocalCostmap& costmap, const Vector2f& loc, const float angle, const float current_speed, std::vector<path_generation::Path> &paths, path_generation::Path &best_path, const Vector2f goal, const Vector2f global_goal)
+{
+  paths = path_generation::samplePathOptions(Controller::pathCount(), costmap, loc, angle, *car_, max_clearance_, goal, global_goal);
+  return Controller::selectCommand(current_speed, paths, best_path);
+}
+
+Command Controller::selectCommand(const float current_speed, const std::vector<path_generation::Path> &paths, path_generation::Path &best_path)
+{
+  if (window_velocities_ > 0) {
+    return Controller::selectWindowCommand(current_speed, paths, best_path);
+  }
+
   int best_path_index {path_generation::selectPath(paths)};
   best_path = paths[best_path_index];
   
@@ -92,6 +119,46 @@ Command Controller::generateCommand(const std::vector<Vector2f>& point_cloud, co
   return Command(speed, paths[best_path_index].curvature);
 }
 
+Command Controller::selectWindowCommand(const float current_speed, const std::vector<path_generation::Path> &paths, path_generation::Path &best_path)
+{
+  // speeds reachable within one control interval
+  const float max_acceleration {car_->limits_.max_acceleration_};
+  const float speed_change {max_acceleration * control_interval_};
+  const float min_speed {std::max(current_speed - speed_change, 0.f)};
+  const float max_speed {std::max(std::min(current_speed + speed_change, car_->limits_.max_speed_), min_speed)};
+
+  int best_path_index {-1};
+  float best_speed {min_speed};
+  float best_score {-std::numeric_limits<float>::max()};
+  for (int j = 0; j < window_velocities_; j++) {
+    const float speed {window_velocities_ > 1 ? min_speed + (max_speed - min_speed) * j / (window_velocities_ - 1) : max_speed};
+    // the car covers the interval at the average speed, then has to be able to stop within the free path length
+    const float stopping_distance {(current_speed + speed) / 2 * control_interval_ + speed * speed / (2 * max_acceleration)};
+    const float speed_score {speed_weight_ * speed / car_->limits_.max_speed_};
+    for (std::size_t i = 0; i < paths.size(); i++) {
+      const path_generation::Path &path {paths[i]};
+      if (stopping_distance > path.free_path_length) {
+        continue;
+      }
+      const float s {path_generation::score(path.free_path_length, path.curvature, path.clearance, path.dist_to_goal) + speed_score};
+      if (s > best_score) {
+        best_score = s;
+        best_speed = speed;
+        best_path_index = i;
+      }
+    }
+  }
+
+  // nothing can stop in time, brake as hard as possible along the best arc
+  if (best_path_index < 0) {
+    best_path_index = path_generation::selectPath(paths);
+    best_speed = min_speed;
+  }
+  best_path = paths[best_path_index];
+
+  return Command(best_speed, paths[best_path_index].curvature);
+}
+
 float Controller::getControlInterval()
 {
   return control_interval_;
@@ -105,11 +172,82 @@ float Controller::getControlInterval()
 
 namespace latency_compensation {
 
+// -------------------------------------------------------------------------
+// & command history
+// -------------------------------------------------------------------------
+CommandHistory::CommandHistory(std::size_t capacity, float control_interval)
+: capacity_(std::max<std::size_t>(capacity, 1)), control_interval_(control_interval), head_(0), size_(0)
+{
+  entries_.reserve(capacity_);
+}
+
+void CommandHistory::push(const CommandStamped &command)
+{
+  // chain onto the previous command, or start over from the origin when nothing is in flight
+  const Pose before {size_ > 0 ? entry(size_ - 1).after : Pose {0, 0, 0}};
+
+  // drive the command for one control interval from there
+  const double distance_traveled {command.command.velocity * control_interval_};
+  double dx {distance_traveled};
+  double dy {0};
+  double dtheta {0};
+  if (std::abs(command.command.curvature) > 0.01) { // updating for curved case
+    dtheta = distance_traveled * command.command.curvature;
+    dx = sin(dtheta) / command.command.curvature;
+    dy = (1 - cos(dtheta)) / command.command.curvature;
+  }
+  const Pose after {before.x + cos(before.theta) * dx - sin(before.theta) * dy,
+                    before.y + sin(before.theta) * dx + cos(before.theta) * dy,
+                    before.theta + dtheta};
+
+  const Entry new_entry {command, before, after};
+  if (entries_.size() < capacity_) {
+    entries_.push_back(new_entry);
+    size_++;
+  } else if (size_ < capacity_) {
+    entries_[(head_ + size_) % capacity_] = new_entry;
+    size_++;
+  } else {
+    entries_[head_] = new_entry;
+    head_ = (head_ + 1) % capacity_;
+  }
+}
+
+void CommandHistory::expire(double time)
+{
+  while (size_ > 0 && entry(0).command.timestamp < time) {
+    head_ = (head_ + 1) % capacity_;
+    size_--;
+  }
+}
+
+State2D CommandHistory::motion() const
+{
+  State2D state;
+  state.position = Eigen::Vector2f {0.f, 0.f};
+  state.theta = 0;
+  state.speed = 0;
+  if (size_ == 0) {
+    return state;
+  }
+
+  // pose after the newest command, in the frame of the car before the oldest one
+  const Pose &start {entry(0).before};
+  const Pose &end {entry(size_ - 1).after};
+  const double dx {end.x - start.x};
+  const double dy {end.y - start.y};
+  state.position.x() = cos(start.theta) * dx + sin(start.theta) * dy;
+  state.position.y() = -sin(start.theta) * dx + cos(start.theta) * dy;
+  state.theta = end.theta - start.theta;
+  state.speed = entry(size_ - 1).command.command.velocity;
+  return state;
+}
+
 // -------------------------------------------------------------------------
 // & constructor & destructor
 // -------------------------------------------------------------------------
 // Controller::Controller(vehicles::Car car, float control_interval, float margin, float max_clearance, float curvature_sampling_interval, float latency) : car_(car), latency_(latency)
-Controller::Controller(vehicles::Car *car, float control_interval, float margin, float max_clearance, float curvature_sampling_interval, float latency) : latency_(latency)
+Controller::Controller(vehicles::Car *car, float control_interval, float margin, float max_clearance, float curvature_sampling_interval, float latency) : latency_(latency), command_history_(COMMAND_HISTORY_SIZE, control_interval)
 {
   // create a new TimeOptimalController to use
   toc_ = new time_optimal_1D::Controller(car, control_interval, margin, max_clearance, curvature_sampling_interval);
@@ -120,20 +258,25 @@ Controller::~Controller()
   delete toc_;
 }
 
+void Controller::setDynamicWindow(int velocity_samples, int curvature_samples, float speed_weight)
+{
+  toc_->setDynamicWindow(velocity_samples, curvature_samples, speed_weight);
+}
+
 // -------------------------------------------------------------------------
 // & adding to command history
 // -------------------------------------------------------------------------
 void Controller::recordCommand(const CommandStamped command)
 {
   // add the command to the command history
-  command_history_.push_back(command);
+  command_history_.push(command);
   // std::cout << "New command recorded for timestamp " << command.timestamp << std::endl;
 }
 
 void Controller::recordCommand(const time_optimal_1D::Command command)
 {
   // add the command to the command history
-  Controller::recordCommand(CommandStamped(command));
+  Controller::recordCommand(CommandStamped(command, ros::Time::now().toSec()));
 }
 
 // -------------------------------------------------------------------------
@@ -146,7 +289,7 @@ time_optimal_1D::Command Controller::generateCommand(const std::vector<Vector2f>
   State2D projected_state {Controller::projectState(current_speed, last_data_timestamp)};
 
   // use this forward projection to transform the point cloud
-  auto cloud {Controller::transformCloud(point_cloud, projected_state)};
+  const std::vector<Eigen::Vector2f> &cloud {Controller::transformCloud(point_cloud, projected_state)};
 
   // feed these updated parameters into the 1D time-optimal controller
   time_optimal_1D::Command command {toc_->generateCommand(cloud, projected_state.speed, paths, best_path, goal, global_goal)};
@@ -157,52 +300,37 @@ time_optimal_1D::Command Controller::generateCommand(const std::vector<Vector2f>
   return command;
 }
 
-State2D Controller::projectState(const float current_speed, const double last_msg_timestamp)
+time_optimal_1D::Command Controller::generateCommand(const local_planners::LocalCostmap& costmap, const Vector2f& loc, const float angle, const float current_speed, const double last_data_timestamp, std::vector<path_generation::Path> &paths, path_generation::Path &best_path, const Vector2f goal, const Vector2f global_goal)
 {
-  // setting state to reflect the starting state of the robot
-  State2D state;
-  state.speed = current_speed;
-  state.position = Eigen::Vector2f {0.f, 0.f};
-  state.theta = 0;
+  State2D projected_state {Controller::projectState(current_speed, last_data_timestamp)};
 
-  if (command_history_.size() < 1) {
-    return state;
-  }
+  // the costmap stays in map frame, so the car is moved to the projected state instead of the obstacles
+  const Eigen::Vector2f projected_loc {loc + Eigen::Rotation2Df(angle) * projected_state.position};
+  const float projected_angle {angle + static_cast<float>(projected_state.theta)};
 
-  double time_threshold {ros::Time::now().toSec()};
-  while (!command_history_.empty()) {
-    if ((time_threshold - command_history_.front().timestamp) < latency_) {
-      break;
-    }
-//    std::cout << "Removing command with diff " << time_threshold - command_history_.front().timestamp << " from command history for latency " << latency_ << std::endl;
-    command_history_.pop_front();
-  }
-
-  // project the future state of the car
-//  std::cout << "Considering " << command_history_.size() << " previous commands to compensate for latency..." << std::endl;
-  for (const auto &command : command_history_) {
-    // std::cout << "Latency: " << latency_ << ", Diff: " << command.timestamp - last_msg_timestamp << std::endl;
-    double distance_traveled {command.command.velocity * toc_->getControlInterval()};
-
-    // std::cout << "Speed: " << command.command.velocity << ", Curvature: " << command.command.curvature << std::endl;
-    if (std::abs(command.command.curvature) > 0.01) { // updating for curved case
-      double radius {1 / command.command.curvature};
-      double theta {distance_traveled / radius};
-      state.position.x() += distance_traveled * cos(theta);
-      state.position.y() += distance_traveled * sin(theta);
-      state.theta += theta;
-    } else { // updating for straight case
-      state.position.x() += distance_traveled;
-    }
-    state.speed = command.command.velocity;
+  time_optimal_1D::Command command {toc_->generateCommand(costmap, projected_loc, projected_angle, projected_state.speed, paths, best_path, goal, global_goal)};
+
+  Controller::recordCommand(command);
 
-    // std::cout << "Updated state: ";
-    // Controller::printState(state);
+  return command;
+}
+
+State2D Controller::projectState(const float current_speed, const double last_msg_timestamp)
+{
+  // commands sent more than one latency before the scan had already moved the car when it was taken; whatever was
+  // sent since is still to be applied to it
+  command_history_.expire(last_msg_timestamp - latency_);
+
+  if (command_history_.empty()) {
+    State2D state;
+    state.speed = current_speed;
+    state.position = Eigen::Vector2f {0.f, 0.f};
+    state.theta = 0;
+    return state;
   }
 
-  // std::cout << "Returning state: ";
-  // Controller::printState(state);
-  return state;
+  // the history keeps the pose reached after every command, so this does not depend on how many are in flight
+  return command_history_.motion();
 }
 
 void Controller::printState(const State2D &state)
@@ -210,27 +338,22 @@ void Controller::printState(const State2D &state)
   std::cout << "State is: \n\tPosition:\t(" << state.position.x() << ", " << state.position.y() << ")\n\tTheta:\t\t" << state.theta << "\n\tSpeed:\t\t" << state.speed << std::endl;
 }
 
-std::vector<Eigen::Vector2f> Controller::transformCloud(std::vector<Eigen::Vector2f> cloud, const State2D &state)
+const std::vector<Eigen::Vector2f> &Controller::transformCloud(const std::vector<Eigen::Vector2f> &cloud, const State2D &state)
 {
-  // generate a transformation matrix from projected state
-  Eigen::Matrix3f transformation_matrix;
-  transformation_matrix << 
-        cos(state.theta), -1 * sin(state.theta), state.position.x(),
-        sin(state.theta),      cos(state.theta), state.position.y(),
-                       0,                     0,                  1;
-
-  // TODO expressly taking the inverse is more expensive than it needs to be, consider replacing this with a more efficient split-up calculation
-  auto inv_transformation_matrix {transformation_matrix.inverse()};
+  // without commands in flight the projected state is the current one, and the cloud can be used as is
+  if (state.theta == 0 && state.position.x() == 0 && state.position.y() == 0) {
+    return cloud;
+  }
 
-  // use it to transform the cloud points
+  // inverse of the projected pose applied directly: rotate by -theta after removing the translation
+  const float c {static_cast<float>(cos(state.theta))};
+  const float s {static_cast<float>(sin(state.theta))};
+  transformed_cloud_.resize(cloud.size());
   for (std::size_t i = 0; i < cloud.size(); i++) {
-    // std::cout << "Point before: " << cloud[i].transpose() << std::endl;
-    Eigen::Vector3f augmented_point {cloud[i].x(), cloud[i].y(), 1};
-    Eigen::Vector3f transformed_point {inv_transformation_matrix * augmented_point};
-    cloud[i] = Eigen::Vector2f(transformed_point.x(), transformed_point.y());
-    // std::cout << "Point after: " << cloud[i].transpose() << std::endl;
+    const Eigen::Vector2f d {cloud[i] - state.position};
+    transformed_cloud_[i] = Eigen::Vector2f(c * d.x() + s * d.y(), -s * d.x() + c * d.y());
   }
-  return cloud;
+  return transformed_cloud_;
 }
 
 } // namespace latency_compensation
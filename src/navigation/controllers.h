@@ -8,10 +8,11 @@
 
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <limits>
 #include <vector>
-#include <deque>
 #include <chrono>
 #include "eigen3/Eigen/Dense"
 #include "ros/ros.h"
@@ -53,9 +54,28 @@ class Controller {
 
     Command generateCommand(const std::vector<Vector2f>& point_cloud, const float current_speed, std::vector<path_generation::Path> &paths, path_generation::Path &best_path, const Vector2f goal, const Vector2f global_goal);
 
+    // Same as above with the arcs evaluated on the costmap, the car being at (loc, angle) in its frame
+    Command generateCommand(const local_planners::LocalCostmap& costmap, const Vector2f& loc, const float angle, const float current_speed, std::vector<path_generation::Path> &paths, path_generation::Path &best_path, const Vector2f goal, const Vector2f global_goal);
+
+    // Search (velocity, curvature) pairs jointly instead of picking the curvature first, with velocity_samples
+    // speeds reachable within one control interval and curvature_samples arcs. A pair is only admissible when the
+    // car can still stop within the free path length of the arc, and speed_weight rewards the faster ones.
+    // 0 velocity samples turns it off. The swept footprints built by the constructor are only rebuilt when the number
+    // of arcs changes.
+    void setDynamicWindow(int velocity_samples, int curvature_samples, float speed_weight);
+
     float getControlInterval();
 
   private:
+    // Arcs sampled per cycle
+    int pathCount() const {return window_velocities_ > 0 ? window_curvatures_ : N_PATHS;}
+
+    // Pick the command among the evaluated arcs
+    Command selectCommand(const float current_speed, const std::vector<path_generation::Path> &paths, path_generation::Path &best_path);
+
+    // Every reachable speed is scored on each of the arcs, which were only evaluated once
+    Command selectWindowCommand(const float current_speed, const std::vector<path_generation::Path> &paths, path_generation::Path &best_path);
+
     vehicles::Car *car_;
     float control_interval_;    // Time step period
     float margin_;              // Margin of error around car
@@ -63,6 +83,12 @@ class Controller {
     float curvature_sampling_interval_; // Dicretization of curvature paths
 
     float previous_curvature_; // used to pick paths more similar to previously generated ones
+
+    int window_velocities_;     // Speeds sampled by the dynamic window, 0 when it is off
+    int window_curvatures_;     // Arcs sampled by the dynamic window
+    float speed_weight_;        // Score of driving at max speed in the dynamic window
+
+    path_generation::SweptFootprints swept_;   // Arcs of pathCount, for the point cloud
 };
 
 } // namespace time_optimal_1D
@@ -74,11 +100,50 @@ namespace latency_compensation {
 struct CommandStamped {
   time_optimal_1D::Command command;
   double timestamp;
-  CommandStamped (time_optimal_1D::Command com) : command(com) {
-    timestamp = ros::Time::now().toSec();
-  }
+  CommandStamped (time_optimal_1D::Command com, double stamp) : command(com), timestamp(stamp) {}
 }; // struct CommandStamped
 
+// Fixed-capacity ring of the commands sent, oldest first. Every entry also keeps the pose of the car before and
+// after its command ran, chained from wherever the car was when the history was last empty, so the motion over any
+// run of commands is a single pose difference instead of a re-integration of all of them.
+class CommandHistory {
+  public:
+    CommandHistory(std::size_t capacity, float control_interval);
+
+    // Append a command, overwriting the oldest one when full
+    void push(const CommandStamped &command);
+
+    // Drop the commands sent before time
+    void expire(double time);
+
+    bool empty() const {return size_ == 0;}
+    std::size_t size() const {return size_;}
+
+    // Motion of the car from the start of the oldest command to the end of the newest, at the speed of the newest
+    State2D motion() const;
+
+  private:
+    struct Pose {
+      double x;
+      double y;
+      double theta;
+    };
+
+    struct Entry {
+      CommandStamped command;
+      Pose before;
+      Pose after;
+    };
+
+    const Entry &entry(std::size_t i) const {return entries_[(head_ + i) % capacity_];}
+
+    std::size_t capacity_;
+    float control_interval_;
+    std::vector<Entry> entries_;    // grows to capacity_ once, then slots are reused
+    std::size_t head_;              // slot of the oldest command
+    std::size_t size_;
+}; // class CommandHistory
+
 class Controller {
 
   public:
@@ -87,21 +152,31 @@ class Controller {
 
     time_optimal_1D::Command generateCommand(const std::vector<Vector2f>& point_cloud, const float current_speed, const double last_data_timestamp, std::vector<path_generation::Path> &paths, path_generation::Path &best_path, const Vector2f goal, const Vector2f global_goal);
 
+    // Same as above on the costmap, the car being at (loc, angle) in its frame when the last scan was taken
+    time_optimal_1D::Command generateCommand(const local_planners::LocalCostmap& costmap, const Vector2f& loc, const float angle, const float current_speed, const double last_data_timestamp, std::vector<path_generation::Path> &paths, path_generation::Path &best_path, const Vector2f goal, const Vector2f global_goal);
+
+    void setDynamicWindow(int velocity_samples, int curvature_samples, float speed_weight);
+
     void recordCommand(const time_optimal_1D::Command command);
   private:
     vehicles::Car *car_;
 
+    // State of the car once the commands still in flight for the scan taken at last_msg_timestamp have run, relative
+    // to where the car was when the scan was taken
     State2D projectState(const float current_speed, const double last_msg_timestamp);
 
-    std::vector<Eigen::Vector2f> transformCloud (std::vector<Eigen::Vector2f> cloud, const State2D &state);
+    // Cloud as seen from the projected state. Returns the cloud itself when the state did not move, and a view of
+    // transformed_cloud_ otherwise.
+    const std::vector<Eigen::Vector2f> &transformCloud(const std::vector<Eigen::Vector2f> &cloud, const State2D &state);
 
     void recordCommand(const CommandStamped command);
 
     void printState(const State2D &state);
 
     float latency_;
-    std::deque<CommandStamped> command_history_;
+    CommandHistory command_history_;
     time_optimal_1D::Controller *toc_;
+    std::vector<Eigen::Vector2f> transformed_cloud_;    // reused by transformCloud
 
 }; // class Controller
 
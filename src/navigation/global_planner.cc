@@ -7,10 +7,14 @@
 //========================================================================
 
 #include "global_planner.h"
+#include "shared/util/timer.h"
+#include "profiler/profiler.h"
 
 namespace global_planner {
 
-GlobalPlanner::GlobalPlanner(const vector_map::VectorMap map, ros::NodeHandle* n) :
+GlobalPlanner::GlobalPlanner(const vector_map::VectorMap &map, ros::NodeHandle* n) :
+  viz_period_(0.1),
+  next_viz_time_(0),
   map_(map),
   goal_(0, 0),
   goal_threshold_(0.5),
@@ -19,14 +23,30 @@ GlobalPlanner::GlobalPlanner(const vector_map::VectorMap map, ros::NodeHandle* n
   // narrow_collision_width_(0.05),
   collision_proximity_(0.15),
   sample_buffer_(5.0),
-  optimization_radius_(1.5) {
-    node_map_.clear();
-    viz_pub_ = n->advertise<amrl_msgs::VisualizationMsg>("visualization", 1);
+  optimization_radius_(1.5),
+  goal_bias_(0),
+  node_index_(optimization_radius_ / 4),
+  threads_(1),
+  trees_done_(false),
+  service_running_(false),
+  request_pending_(false),
+  searching_(false),
+  cancel_(false),
+  solution_version_(0),
+  cancelled_version_(0),
+  tree_cache_size_(0) {
+    nodes_.clear();
+    cspace_ = map_.Inflate(collision_proximity_);
+    if (n != nullptr) {
+      visualization_.Init(n);
+    }
     viz_msg_ = visualization::NewVisualizationMessage(
       "map", "GlobalPlanner");
   }
 
-GlobalPlanner::GlobalPlanner(const vector_map::VectorMap map, ros::NodeHandle* n, const float goal_threshold, const float graph_resolution, const float collision_proximity, const float sample_buffer, const float optimization_radius) :
+GlobalPlanner::GlobalPlanner(const vector_map::VectorMap &map, ros::NodeHandle* n, const float goal_threshold, const float graph_resolution, const float collision_proximity, const float sample_buffer, const float optimization_radius) :
+  viz_period_(0.1),
+  next_viz_time_(0),
   map_(map),
   goal_(0, 0),
   goal_threshold_(goal_threshold),
@@ -35,21 +55,40 @@ GlobalPlanner::GlobalPlanner(const vector_map::VectorMap map, ros::NodeHandle* n
   // narrow_collision_width_(0.05),
   collision_proximity_(collision_proximity),
   sample_buffer_(sample_buffer),
-  optimization_radius_(optimization_radius) {
-    node_map_.clear();
-    viz_pub_ = n->advertise<amrl_msgs::VisualizationMsg>("visualization", 1);
+  optimization_radius_(optimization_radius),
+  goal_bias_(0),
+  node_index_(optimization_radius / 4),
+  threads_(1),
+  trees_done_(false),
+  service_running_(false),
+  request_pending_(false),
+  searching_(false),
+  cancel_(false),
+  solution_version_(0),
+  cancelled_version_(0),
+  tree_cache_size_(0) {
+    nodes_.clear();
+    cspace_ = map_.Inflate(collision_proximity_);
+    if (n != nullptr) {
+      visualization_.Init(n);
+    }
     viz_msg_ = visualization::NewVisualizationMessage(
       "map", "GlobalPlanner");
   }
 
+GlobalPlanner::~GlobalPlanner() {
+  StopPlanningService();
+}
+
 void GlobalPlanner::ClearPath(void) {
   goal_reached_ = false;
-  node_map_.clear();
+  nodes_.clear();
+  node_index_.Clear();
   path_.clear();
 
   // Restart visualization
   visualization::ClearVisualizationMsg(viz_msg_);
-  viz_pub_.publish(viz_msg_);
+  PublishVisualization(true);
 }
 
 void GlobalPlanner::SetRobotLocation(const Eigen::Vector2f loc) {
@@ -60,8 +99,9 @@ void GlobalPlanner::SetRobotLocation(const Eigen::Vector2f loc) {
   node.loc = loc;
   node.cost = 0;
 
-  // Add to map of nodes
-  node_map_.insert({node.id, node});
+  // Add to the tree
+  nodes_.push_back(node);
+  node_index_.Insert(node.id, node.loc);
 
   std::cout << "[GlobalPlanner] Set robot location at (" << loc[0] << ", " << loc[1] << ")" << std::endl;
 }
@@ -73,158 +113,542 @@ void GlobalPlanner::SetGoalLocation(const Eigen::Vector2f loc) {
   std::cout << "[GlobalPlanner] Set goal location at (" << loc[0] << ", " << loc[1] << ")" << std::endl;
 }
 
-bool GlobalPlanner::CalculatePath(unsigned int max_iterations) {
+void GlobalPlanner::UseGridSearch(const float resolution) {
+  grid_planner_.Build(map_, collision_proximity_, resolution);
+}
+
+bool GlobalPlanner::UseRoadmap(const std::string& file) {
+  Roadmap roadmap;
+  if (!roadmap.Load(file, map_)) {
+    std::cout << "[GlobalPlanner] No roadmap for this map at " << file << std::endl;
+    return false;
+  }
+  if (roadmap.Clearance() < collision_proximity_) {
+    std::cout << "[GlobalPlanner] Roadmap " << file << " keeps " << roadmap.Clearance() << " from the map, less than the collision proximity " << collision_proximity_ << std::endl;
+    return false;
+  }
+  roadmap_ = std::move(roadmap);
+  std::cout << "[GlobalPlanner] Loaded roadmap of " << roadmap_.NumNodes() << " nodes and " << roadmap_.NumEdges() << " edges" << std::endl;
+  return true;
+}
+
+void GlobalPlanner::ReuseTrees(const unsigned int cache_size) {
+  tree_cache_size_ = cache_size;
+  if (tree_cache_.size() > cache_size) {
+    tree_cache_.resize(cache_size);
+  }
+}
+
+void GlobalPlanner::SetVisualizationRate(const float rate) {
+  viz_period_ = (rate > 0) ? 1.0 / rate : 0;
+}
+
+void GlobalPlanner::SetGoalBias(const float goal_bias) {
+  goal_bias_ = goal_bias;
+}
+
+void GlobalPlanner::SetPlanningThreads(const unsigned int threads) {
+#ifdef _OPENMP
+  threads_ = std::max(threads, 1u);
+#else
+  // Without workers, the trees would only be grown one after the other
+  (void)threads;
+  threads_ = 1;
+#endif
+  streams_.clear();
+  for (unsigned int i = 1; i < threads_; i++) {
+    streams_.push_back(rng_.Stream(i));
+  }
+  worker_neighbors_.assign(threads_ - 1, std::vector<unsigned int>());
+}
+
+bool GlobalPlanner::CalculatePath(unsigned int max_iterations, unsigned int refine_iterations, float refine_time) {
+  PROFILE_SCOPE("CalculatePath");
+  if (!roadmap_.Empty() && CalculateRoadmapPath()) {
+    return true;
+  }
+  if (!grid_planner_.Empty()) {
+    return CalculateGridPath();
+  }
+
   std::cout << "[GlobalPlanner] Calculating path... " << std::endl;
 
   // Draw goal
-  visualization::DrawCross(goal_, 0.1, 0xb30b0b, viz_msg_);
+  if (Visualizing()) {
+    visualization::DrawCross(goal_, 0.1, 0xb30b0b, viz_msg_);
+  }
+
+  // A reused tree may reach the goal already, its path is published before any sampling
+  float best_cost = std::numeric_limits<float>::max();
+  const Node* best_node = nullptr;
+  node_index_.Radius(goal_, goal_threshold_, &neighbors_);
+  for (const unsigned int id : neighbors_) {
+    const float cost = nodes_[id].cost + (nodes_[id].loc - goal_).norm();
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_node = &nodes_[id];
+    }
+  }
+  if (best_node != nullptr) {
+    std::cout << "[GlobalPlanner] Tree already reaches goal" << std::endl;
+    goal_reached_ = true;
+    ConstructPath(*best_node);
+    PublishSolution();
+  }
 
   // Loop performing RRT* path planning algorithm
   counter_ = 0;   // Exit condition if goal is unreachable
-  while (counter_ < max_iterations && !goal_reached_) {
-    counter_++;
+  trees_done_ = false;
+  if (threads_ == 1) {
+    GrowTree(0, &nodes_, &node_index_, max_iterations, refine_iterations, refine_time, &best_cost);
+  } else {
+    // Every worker grows a tree of its own from a copy of the current one, and the cheapest path any of them finds
+    // is kept. The trees share nothing while they grow, and every one is as deep as the single threaded search.
+    worker_trees_.assign(threads_ - 1, Tree {nodes_, node_index_});
+    std::vector<float> costs(threads_, best_cost);
+    std::vector<unsigned int> goal_ids(threads_, 0);
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(threads_) schedule(static, 1)
+#endif
+    for (int worker = 0; worker < static_cast<int>(threads_); worker++) {
+      std::vector<Node>* nodes = (worker == 0) ? &nodes_ : &worker_trees_[worker - 1].nodes;
+      NodeIndex* index = (worker == 0) ? &node_index_ : &worker_trees_[worker - 1].index;
+      goal_ids[worker] = GrowTree(worker, nodes, index, max_iterations, refine_iterations, refine_time, &costs[worker]);
+    }
 
-    // Sample a random point in the state space
-    Eigen::Vector2f sampled_loc = SamplePoint(node_map_.at(0).loc, goal_);
+    // The first worker has already published its own path, any cheaper one replaces its tree
+    const unsigned int best = std::min_element(costs.begin(), costs.end()) - costs.begin();
+    if (best > 0 && costs[best] < costs[0]) {
+      nodes_.swap(worker_trees_[best - 1].nodes);
+      std::swap(node_index_, worker_trees_[best - 1].index);
+      goal_reached_ = true;
+      ConstructPath(nodes_[goal_ids[best]]);
+      PublishSolution();
+    }
+    worker_trees_.clear();
+  }
 
-    // Find closest node to sampled point, if possible
-    Node closest_node = FindClosestNode(sampled_loc);
+  // Show the final tree or path, whatever the throttle held back
+  PublishVisualization(true);
 
-    // Project closest node in the direction of the sampled point and create a new node
-    Node new_node = CreateChildNode(closest_node, sampled_loc);
+  if (cancel_) {
+    std::cout << "[GlobalPlanner] Search cancelled after " << counter_ << " iterations" << std::endl;
+  }
+  else if (!goal_reached_) {
+    std::cout << "[GlobalPlanner] Could not reach goal after " << counter_ << " iterations" << std::endl;
+  }
 
-    // Check for any collisions with the map
-    if (CheckMapCollision(new_node.loc, node_map_.at(new_node.parent).loc)) {
-      continue;   // obstacle found, retry!
+  return goal_reached_;
+}
+
+std::vector<Eigen::Vector2f> GlobalPlanner::GetPath(void) {
+  return path_;
+}
+
+bool GlobalPlanner::CalculateGridPath(void) {
+  std::cout << "[GlobalPlanner] Calculating grid path... " << std::endl;
+
+  // The search is exhaustive, there is nothing left to refine once it returns
+  goal_reached_ = grid_planner_.Plan(nodes_[0].loc, goal_, goal_threshold_, &path_);
+  if (!goal_reached_) {
+    std::cout << "[GlobalPlanner] Could not reach goal after expanding " << grid_planner_.Expanded() << " cells" << std::endl;
+    return false;
+  }
+
+  const float length = PublishPath();
+  std::cout << "[GlobalPlanner] Constructed grid path of length " << length << " after expanding " << grid_planner_.Expanded() << " cells" << std::endl;
+  return true;
+}
+
+bool GlobalPlanner::CalculateRoadmapPath(void) {
+  // Ends that cannot be joined to the roadmap leave the request to the other searches
+  if (!roadmap_.Plan(nodes_[0].loc, goal_, cspace_, &path_)) {
+    std::cout << "[GlobalPlanner] Roadmap query failed, falling back to search" << std::endl;
+    path_.clear();
+    return false;
+  }
+  goal_reached_ = true;
+  const float length = PublishPath();
+  std::cout << "[GlobalPlanner] Constructed roadmap path of length " << length << " after expanding " << roadmap_.Expanded() << " nodes" << std::endl;
+  return true;
+}
+
+float GlobalPlanner::PublishPath(void) {
+  float length = 0;
+  visualization::ClearVisualizationMsg(viz_msg_);
+  visualization::DrawCross(goal_, 0.1, 0xb30b0b, viz_msg_);
+  for (std::size_t i = 1; i < path_.size(); i++) {
+    if (Visualizing()) {
+      visualization::DrawLine(path_[i - 1], path_[i], 0, viz_msg_);
     }
+    length += (path_[i] - path_[i - 1]).norm();
+  }
+  PublishVisualization(true);
+  PublishSolution();
+  return length;
+}
 
-    // If possible, optimize path
-    OptimizePathToNode(&new_node);
+void GlobalPlanner::StartPlanningService(unsigned int max_iterations, unsigned int refine_iterations, float refine_time) {
+  if (service_thread_.joinable()) {
+    return;
+  }
+  service_running_ = true;
+  service_thread_ = std::thread(&GlobalPlanner::RunPlanningService, this, max_iterations, refine_iterations, refine_time);
+}
 
-    // Finally, add node to the node_map
-    node_map_.insert({new_node.id, new_node});
+void GlobalPlanner::StopPlanningService(void) {
+  if (!service_thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(service_mutex_);
+    service_running_ = false;
+    cancel_ = true;
+  }
+  service_cv_.notify_one();
+  service_thread_.join();
+}
 
-    visualization::DrawPoint(new_node.loc, 0, viz_msg_);
-    visualization::DrawLine(new_node.loc, node_map_.at(new_node.parent).loc, 0xccf2c9, viz_msg_);
+void GlobalPlanner::RequestPath(const Eigen::Vector2f start, const Eigen::Vector2f goal) {
+  {
+    std::lock_guard<std::mutex> lock(service_mutex_);
+    request_start_ = start;
+    request_goal_ = goal;
+    request_pending_ = true;
+    cancel_ = true;   // A search in progress is for an outdated request
+  }
+  service_cv_.notify_one();
+}
 
-    viz_msg_.header.stamp = ros::Time::now();
-    viz_pub_.publish(viz_msg_);
+void GlobalPlanner::CancelPath(void) {
+  std::lock_guard<std::mutex> lock(service_mutex_);
+  request_pending_ = false;
+  cancel_ = true;
+  cancelled_version_ = solution_version_;   // Published but not fetched yet, it is as outdated as the search
+}
 
-    // Exit when goal is reached
-    float dist_to_goal = (new_node.loc - goal_).norm();
-    if (dist_to_goal <= goal_threshold_) {
-      std::cout << "[GlobalPlanner] Reached goal after " << counter_ << " iterations" << std::endl;
-      goal_reached_ = true;
+bool GlobalPlanner::GetLatestPath(std::vector<Eigen::Vector2f>* path, unsigned int* version) {
+  std::lock_guard<std::mutex> lock(service_mutex_);
+  if (solution_version_ == *version || solution_version_ == cancelled_version_) {
+    return false;
+  }
+  *path = solution_;
+  *version = solution_version_;
+  return true;
+}
 
-      // std::cout << "Press Enter to continue..." << std::endl;
-      // std::cin.get();
+bool GlobalPlanner::Planning(void) {
+  std::lock_guard<std::mutex> lock(service_mutex_);
+  return request_pending_ || searching_;
+}
 
-      // Construct path to goal
-      ConstructPath(new_node);
-      return goal_reached_;
+void GlobalPlanner::ServeRequest(unsigned int max_iterations, unsigned int refine_iterations) {
+  Eigen::Vector2f start, goal;
+  {
+    std::lock_guard<std::mutex> lock(service_mutex_);
+    if (!request_pending_) {
+      return;
     }
+    TakeRequest(&start, &goal);
   }
+  Search(start, goal, max_iterations, refine_iterations, 0);
+}
 
-  std::cout << "[GlobalPlanner] Could not reach goal after " << counter_ << " iterations" << std::endl;
-
-  return goal_reached_;
+void GlobalPlanner::RunPlanningService(unsigned int max_iterations, unsigned int refine_iterations, float refine_time) {
+  while (true) {
+    Eigen::Vector2f start, goal;
+    {
+      std::unique_lock<std::mutex> lock(service_mutex_);
+      service_cv_.wait(lock, [this] { return request_pending_ || !service_running_; });
+      if (!service_running_) {
+        return;
+      }
+      TakeRequest(&start, &goal);
+    }
+    Search(start, goal, max_iterations, refine_iterations, refine_time);
+  }
 }
 
-std::vector<Eigen::Vector2f> GlobalPlanner::GetPath(void) {
-  return path_;
+void GlobalPlanner::TakeRequest(Eigen::Vector2f* start, Eigen::Vector2f* goal) {
+  *start = request_start_;
+  *goal = request_goal_;
+  request_pending_ = false;
+  searching_ = true;
+  cancel_ = false;
 }
 
-Eigen::Vector2f GlobalPlanner::SamplePoint(const Eigen::Vector2f robot_loc, const Eigen::Vector2f goal_loc) {
-  // Calculate search space based on distance from robot location to goal
-  Eigen::Vector2f midpoint = (robot_loc - goal_loc) / 2 + goal_loc;
-  float search_radius = (robot_loc - goal_loc).norm() + sample_buffer_;
+void GlobalPlanner::Search(const Eigen::Vector2f start, const Eigen::Vector2f goal, unsigned int max_iterations,
+                           unsigned int refine_iterations, float refine_time) {
+  if (!RestoreTree(start, goal)) {
+    ClearPath();
+    SetRobotLocation(start);
+  }
+  SetGoalLocation(goal);
+  if (CalculatePath(max_iterations, refine_iterations, refine_time)) {
+    CacheTree();
+  }
 
-  // Randomly sample a point from the range in x and y
-  Eigen::Vector2f point(
-    rng_.UniformRandom(midpoint[0] - search_radius, midpoint[0] + search_radius),
-    rng_.UniformRandom(midpoint[1] - search_radius, midpoint[1] + search_radius)
-  );
+  std::lock_guard<std::mutex> lock(service_mutex_);
+  searching_ = false;
+}
 
-  return point;
+void GlobalPlanner::CacheTree(void) {
+  // Grid and roadmap searches keep no tree
+  if (tree_cache_size_ == 0 || !grid_planner_.Empty() || nodes_.size() < 2) {
+    return;
+  }
+
+  // The entry for this goal, or the least recently used one, moves to the front
+  unsigned int entry = 0;
+  while (entry < tree_cache_.size() && (tree_cache_[entry].goal - goal_).norm() > goal_threshold_) {
+    entry++;
+  }
+  if (entry == tree_cache_.size()) {
+    if (tree_cache_.size() < tree_cache_size_) {
+      tree_cache_.emplace_back();
+    } else {
+      entry--;
+    }
+  }
+  std::rotate(tree_cache_.begin(), tree_cache_.begin() + entry, tree_cache_.begin() + entry + 1);
+  tree_cache_[0].goal = goal_;
+  tree_cache_[0].nodes = nodes_;
 }
 
-Node GlobalPlanner::FindClosestNode(const Eigen::Vector2f loc) {
-  float min_dist = 1000;
-  Node closest_node = node_map_.at(0);  // Default closest node is tree top
+bool GlobalPlanner::RestoreTree(const Eigen::Vector2f start, const Eigen::Vector2f goal) {
+  for (unsigned int entry = 0; entry < tree_cache_.size(); entry++) {
+    if ((tree_cache_[entry].goal - goal).norm() > goal_threshold_) {
+      continue;
+    }
+    std::rotate(tree_cache_.begin(), tree_cache_.begin() + entry, tree_cache_.begin() + entry + 1);
+
+    ClearPath();
+    nodes_ = tree_cache_[0].nodes;
+    if (RerootTree(start)) {
+      std::cout << "[GlobalPlanner] Reusing tree of " << nodes_.size() << " nodes, re-rooted at (" << start[0] << ", " << start[1] << ")" << std::endl;
+      return true;
+    }
+    ClearPath();
+    return false;
+  }
+  return false;
+}
 
-  // Loop through node map to find closest node
-  for (auto const& index : node_map_) {
-    Node node = index.second;   // retrieve node from node_map
+bool GlobalPlanner::RerootTree(const Eigen::Vector2f loc) {
+  // Map lines never move, so every edge of the old tree is still collision free. The tree edges, plus the free
+  // connections from loc to the nodes around it, form a graph whose shortest path tree from loc is the new tree.
+  const unsigned int size = nodes_.size();
+  const unsigned int root = size;   // loc, appended after the old nodes
+  std::vector<std::vector<unsigned int>> adjacency(size + 1);
+  for (unsigned int id = 1; id < size; id++) {
+    adjacency[id].push_back(nodes_[id].parent);
+    adjacency[nodes_[id].parent].push_back(id);
+  }
+  for (unsigned int id = 0; id < size; id++) {
+    if ((nodes_[id].loc - loc).norm() <= optimization_radius_ && !CheckMapCollision(loc, nodes_[id].loc)) {
+      adjacency[root].push_back(id);
+      adjacency[id].push_back(root);
+    }
+  }
+  if (adjacency[root].empty()) {
+    return false;
+  }
 
-    // Check for a smaller distance and update
-    float dist = (node.loc - loc).norm();
-    if (dist < min_dist) {
-      min_dist = dist;
-      closest_node = node;
+  // Dijkstra from loc. Nodes are popped after their parents, so the pop order numbers the new tree
+  auto location = [&](const unsigned int id) { return id == root ? loc : nodes_[id].loc; };
+  std::vector<float> cost(size + 1, std::numeric_limits<float>::max());
+  std::vector<unsigned int> parent(size + 1, root);
+  std::vector<unsigned int> new_id(size + 1, 0);
+  std::vector<uint8_t> popped(size + 1, false);
+  IndexedHeap<float> open(size + 1);
+  std::vector<Node> tree;
+  tree.reserve(size + 1);
+  cost[root] = 0;
+  open.Push(root, 0);
+  while (!open.Empty()) {
+    const unsigned int id = open.Pop();
+    popped[id] = true;
+    new_id[id] = tree.size();
+    tree.push_back({new_id[id], new_id[parent[id]], location(id), cost[id]});
+    for (const unsigned int neighbor : adjacency[id]) {
+      const float neighbor_cost = cost[id] + (location(id) - location(neighbor)).norm();
+      if (!popped[neighbor] && neighbor_cost < cost[neighbor]) {
+        cost[neighbor] = neighbor_cost;
+        parent[neighbor] = id;
+        open.Push(neighbor, neighbor_cost);
+      }
     }
   }
 
-  return closest_node;
+  nodes_.swap(tree);
+  node_index_.Clear();
+  for (const Node& node : nodes_) {
+    node_index_.Insert(node.id, node.loc);
+  }
+  return true;
 }
 
-bool GlobalPlanner::CheckMapCollision(const Eigen::Vector2f point1, const Eigen::Vector2f point2) {
-  // Create line between node and its parent.
-  line2f line(point1[0], point1[1],
-              point2[0], point2[1]);
-
-  // Note we are also checking two parallel lines that are very close to each other to handle the scenario where parts of the map are not connected (there's a tiny gap)
-  // float theta = atan2((point2[1] - point1[1]), (point2[2] - point1[2]));
-  // float dx = narrow_collision_width_ / 2 * cos(90 - theta);
-  // float dy = narrow_collision_width_ / 2 * sin(90 - theta);
-  // line2f line1(point1[0] - dx, point1[1] + dy,
-  //              point2[0] - dx, point2[1] + dy);
-  // line2f line2(point1[0] + dx, point1[1] - dy,
-  //              point2[0] + dx, point2[1] - dy);
-
-  // Loop through map lines checking for instersections and proximity
-  bool collision_flag = false;
-  for (size_t j = 0; j < map_.lines.size(); ++j) {
-    // Retrieve map line
-    const line2f map_line = map_.lines[j];
-
-    // Extend the line by the collision proximity
-    float dx_ext = (map_line.p1[0] - map_line.p0[0]) * collision_proximity_ / (map_line.p1 - map_line.p0).norm();
-    float dy_ext = (map_line.p1[1] - map_line.p0[1]) * collision_proximity_ / (map_line.p1 - map_line.p0).norm();
-    line2f map_line_ext(map_line.p0[0] - dx_ext, map_line.p0[1] - dy_ext,
-                           map_line.p1[0] + dx_ext, map_line.p1[1] + dy_ext);
-
-    // Create a perimeter around the line to check for proximity to obstacles
-    float theta = atan2((map_line.p1[1] - map_line.p0[1]), (map_line.p1[0] - map_line.p0[0]));
-    float dx_per = collision_proximity_ * cos(M_PI / 2 - theta);
-    float dy_per = collision_proximity_ * sin(M_PI / 2 - theta);
-    line2f map_line_1(map_line_ext.p0[0] - dx_per, map_line_ext.p0[1] + dy_per,
-                      map_line_ext.p1[0] - dx_per, map_line_ext.p1[1] + dy_per);
-    line2f map_line_2(map_line_ext.p0[0] + dx_per, map_line_ext.p0[1] - dy_per,
-                      map_line_ext.p1[0] + dx_per, map_line_ext.p1[1] - dy_per);
-    line2f map_line_3(map_line_ext.p0[0] - dx_per, map_line_ext.p0[1] + dy_per,
-                      map_line_ext.p0[0] + dx_per, map_line_ext.p0[1] - dy_per);
-    line2f map_line_4(map_line_ext.p1[0] - dx_per, map_line_ext.p1[1] + dy_per,
-                      map_line_ext.p1[0] + dx_per, map_line_ext.p1[1] - dy_per);
-
-    // Check for instersection
-    Eigen::Vector2f intersection_point;
-    // bool intersects = map_line.Intersection(line, &intersection_point);
-    bool intersects_1 = map_line_1.Intersection(line, &intersection_point);
-    bool intersects_2 = map_line_2.Intersection(line, &intersection_point);
-    bool intersects_3 = map_line_3.Intersection(line, &intersection_point);
-    bool intersects_4 = map_line_4.Intersection(line, &intersection_point);
-
-    // Intersect found
-    if (intersects_1 || intersects_2 || intersects_3 || intersects_4) {
-      collision_flag = true;
+bool GlobalPlanner::Visualizing(void) const {
+  return viz_period_ > 0;
+}
+
+void GlobalPlanner::PublishVisualization(const bool force) {
+  if (!Visualizing()) {
+    return;
+  }
+  // Every publish serializes the whole message, which grows with the tree
+  const double now = GetMonotonicTime();
+  if (!force && now < next_viz_time_) {
+    return;
+  }
+  next_viz_time_ = now + viz_period_;
+  viz_msg_.header.stamp = ros::Time::now();
+  visualization_.Publish(viz_msg_);
+}
+
+void GlobalPlanner::PublishSolution(void) {
+  std::lock_guard<std::mutex> lock(service_mutex_);
+  // Checked under the lock a new request sets cancel_ with, so an outdated path is never handed out
+  if (cancel_) {
+    return;
+  }
+  solution_ = path_;
+  solution_version_++;
+}
+
+unsigned int GlobalPlanner::GrowTree(const unsigned int worker, std::vector<Node>* nodes, NodeIndex* index,
+                                     const unsigned int max_iterations, const unsigned int refine_iterations,
+                                     const float refine_time, float* best_cost) {
+  const bool first = (worker == 0);
+  fast_random::FastRandom* rng = first ? &rng_ : &streams_[worker - 1];
+  std::vector<unsigned int>* neighbors = first ? &neighbors_ : &worker_neighbors_[worker - 1];
+  unsigned int goal_id = 0;
+  bool reached = *best_cost < std::numeric_limits<float>::max();
+
+  unsigned int counter = 0;
+  unsigned int refine_counter = 0;   // Samples spent improving the path once the goal is reached
+  double refine_deadline = reached ? GetMonotonicTime() + refine_time : 0;
+  while (counter < max_iterations && !cancel_ && !(reached && refine_counter >= refine_iterations)) {
+    // A tree still short of the goal gives up once another one has found and refined its path
+    if (!reached && trees_done_) {
       break;
     }
+    counter++;
+    if (reached) {
+      refine_counter++;
+      // Checking the clock every 64 samples keeps it out of the loop's cost
+      if (refine_time > 0 && refine_counter % 64 == 0 && GetMonotonicTime() > refine_deadline) {
+        break;
+      }
+    }
+
+    // Sample a random point in the state space
+    Eigen::Vector2f sampled_loc = SamplePoint((*nodes)[0].loc, goal_, *best_cost, rng);
+
+    // Find closest node to sampled point, if possible
+    const Node& closest_node = FindClosestNode(*nodes, *index, sampled_loc);
+
+    // Project closest node in the direction of the sampled point and create a new node
+    Node new_node = CreateChildNode(*nodes, closest_node, sampled_loc);
+
+    // Check for any collisions with the map
+    if (CheckMapCollision(new_node.loc, (*nodes)[new_node.parent].loc)) {
+      continue;   // obstacle found, retry!
+    }
+
+    // If possible, optimize path
+    OptimizePathToNode(*nodes, *index, &new_node, neighbors);
+
+    // Finally, add node to the tree
+    nodes->push_back(new_node);
+    index->Insert(new_node.id, new_node.loc);
+
+    // The tree is only drawn until the first path replaces it
+    if (first && !reached && Visualizing()) {
+      visualization::DrawPoint(new_node.loc, 0, viz_msg_);
+      visualization::DrawLine(new_node.loc, (*nodes)[new_node.parent].loc, 0xccf2c9, viz_msg_);
+      PublishVisualization(false);
+    }
+
+    // Keep the cheapest node that reaches the goal, node costs never change once in the tree
+    float dist_to_goal = (new_node.loc - goal_).norm();
+    if (dist_to_goal <= goal_threshold_ && new_node.cost + dist_to_goal < *best_cost) {
+      if (!reached) {
+        std::cout << "[GlobalPlanner] Reached goal after " << counter << " iterations";
+        std::cout << ((threads_ > 1) ? " in tree " + std::to_string(worker) : std::string()) << std::endl;
+        refine_deadline = GetMonotonicTime() + refine_time;
+      }
+      reached = true;
+      *best_cost = new_node.cost + dist_to_goal;
+      goal_id = new_node.id;
+
+      // Only the first tree is the one drawn and handed out while the search runs
+      if (first) {
+        goal_reached_ = true;
+        ConstructPath(nodes_.back());
+        PublishSolution();
+      }
+    }
+  }
+
+  if (reached) {
+    trees_done_ = true;
+  }
+  if (first) {
+    counter_ = counter;
+  }
+  return goal_id;
+}
+
+Eigen::Vector2f GlobalPlanner::SamplePoint(const Eigen::Vector2f robot_loc, const Eigen::Vector2f goal_loc, const float best_cost, fast_random::FastRandom* rng) {
+  // Calculate search space based on distance from robot location to goal
+  Eigen::Vector2f midpoint = (robot_loc - goal_loc) / 2 + goal_loc;
+  float distance = (robot_loc - goal_loc).norm();
+
+  if (best_cost < std::numeric_limits<float>::max()) {
+    // Informed sampling: only points whose distances to robot and goal sum to less than the best cost can shorten
+    // the path, which is the ellipse with those foci and best_cost as its major axis. A uniform point of the unit
+    // disk is stretched onto it.
+    float radius = std::sqrt(rng->UniformRandom());
+    float angle = rng->UniformRandom(-M_PI, M_PI);
+    float major = best_cost / 2;
+    float minor = std::sqrt(std::max(best_cost * best_cost - distance * distance, 0.f)) / 2;
+    Eigen::Vector2f axis = (distance > 0) ? Eigen::Vector2f((goal_loc - robot_loc) / distance) : Eigen::Vector2f(1, 0);
+    float u = major * radius * std::cos(angle);
+    float v = minor * radius * std::sin(angle);
+    return midpoint + u * axis + v * Eigen::Vector2f(-axis[1], axis[0]);
   }
 
-  return collision_flag;
+  // Goal biasing pulls the tree towards the goal until it is reached
+  if (goal_bias_ > 0 && rng->UniformRandom() < goal_bias_) {
+    return goal_loc;
+  }
+
+  float search_radius = distance + sample_buffer_;
+
+  // Randomly sample a point from the range in x and y
+  Eigen::Vector2f point(
+    rng->UniformRandom(midpoint[0] - search_radius, midpoint[0] + search_radius),
+    rng->UniformRandom(midpoint[1] - search_radius, midpoint[1] + search_radius)
+  );
+
+  return point;
 }
 
-Node GlobalPlanner::CreateChildNode(Node parent, const Eigen::Vector2f loc) {
+const Node& GlobalPlanner::FindClosestNode(const std::vector<Node>& nodes, const NodeIndex& index,
+                                           const Eigen::Vector2f loc) {
+  unsigned int closest_id = 0;  // Default closest node is tree top
+  index.Nearest(loc, &closest_id);
+  return nodes[closest_id];
+}
+
+bool GlobalPlanner::CheckMapCollision(const Eigen::Vector2f point1, const Eigen::Vector2f point2) {
+  // The configuration space already keeps the collision proximity around every map line, so only the
+  // segment between the two nodes has to be tested against it
+  return cspace_.Intersects(point1, point2);
+}
+
+Node GlobalPlanner::CreateChildNode(const std::vector<Node>& nodes, const Node& parent, const Eigen::Vector2f loc) {
   // Calculate the projection in the direction from parent node to loc
   Eigen::Vector2f vect = (loc - parent.loc);
   Eigen::Vector2f proj;
@@ -240,7 +664,7 @@ Node GlobalPlanner::CreateChildNode(Node parent, const Eigen::Vector2f loc) {
 
   // Create new child node
   Node node;
-  node.id = counter_;
+  node.id = nodes.size();   // id of the node once added to the tree
   node.parent = parent.id;
   node.loc = parent.loc + proj;
   node.cost = parent.cost + proj.norm();
@@ -248,32 +672,33 @@ Node GlobalPlanner::CreateChildNode(Node parent, const Eigen::Vector2f loc) {
   return node;
 }
 
-void GlobalPlanner::OptimizePathToNode(Node* node) {
+void GlobalPlanner::OptimizePathToNode(const std::vector<Node>& nodes, const NodeIndex& index, Node* node,
+                                       std::vector<unsigned int>* neighbors) {
   float min_cost = node->cost;        // cost of current path
   unsigned int best_neighbor = node->parent;  // current parent
 
   // Search for all neighbors within a set radius
-  for (auto const& index : node_map_) {
-    Node neighbor = index.second;   // retrieve node from node_map
+  index.Radius(node->loc, optimization_radius_, neighbors);
+  for (const unsigned int neighbor_id : *neighbors) {
+    const Node& neighbor = nodes[neighbor_id];
 
     // Ignore oneself
     if (neighbor.id == node->id) {
       continue;
     }
 
-    // Calculate distance to neighbor and see if it is within optimization radius
+    // Calculate distance to neighbor, the index only returns those within the optimization radius
     float dist_to_neighbor = (node->loc - neighbor.loc).norm();
-    if (dist_to_neighbor < optimization_radius_) {
-      // Calculate new path cost and check if its the best option
-      float cost = neighbor.cost + dist_to_neighbor;
-      if (cost < min_cost) {
-
-        // Ensure this does not creates a collision with the map
-        if (!CheckMapCollision(node->loc, neighbor.loc)) {
-          // Update best neighbot
-          best_neighbor = neighbor.id;
-          min_cost = cost;
-        }
+
+    // Calculate new path cost and check if its the best option
+    float cost = neighbor.cost + dist_to_neighbor;
+    if (cost < min_cost) {
+
+      // Ensure this does not creates a collision with the map
+      if (!CheckMapCollision(node->loc, neighbor.loc)) {
+        // Update best neighbot
+        best_neighbor = neighbor.id;
+        min_cost = cost;
       }
     }
   }
@@ -285,30 +710,34 @@ void GlobalPlanner::OptimizePathToNode(Node* node) {
   }
 }
 
-void GlobalPlanner::ConstructPath(const Node goal_node) {
+void GlobalPlanner::ConstructPath(const Node& goal_node) {
   unsigned int steps = 0;
+  path_.clear();
 
-  // Clear the search tree after a slight delay
-  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  // Replace the search tree with the path
+  const bool visualize = Visualizing();
   visualization::ClearVisualizationMsg(viz_msg_);
 
   // Draw goal
-  visualization::DrawCross(goal_, 0.1, 0xb30b0b, viz_msg_);
+  if (visualize) {
+    visualization::DrawCross(goal_, 0.1, 0xb30b0b, viz_msg_);
+  }
 
   // Loop backwards up the tree, constructing the path.
-  Node curr_node = goal_node;  // Current node is last node in the path
-  while (curr_node.id > 0) {
+  const Node* curr_node = &goal_node;  // Current node is last node in the path
+  while (curr_node->id > 0) {
     // Draw path segment
-    visualization::DrawPoint(curr_node.loc, 0, viz_msg_);
-    visualization::DrawLine(curr_node.loc, node_map_.at(curr_node.parent).loc, 0, viz_msg_);
-    
-    path_.insert(path_.begin(), curr_node.loc);
-    curr_node = node_map_.at(curr_node.parent);
-    steps++;
+    if (visualize) {
+      visualization::DrawPoint(curr_node->loc, 0, viz_msg_);
+      visualization::DrawLine(curr_node->loc, nodes_[curr_node->parent].loc, 0, viz_msg_);
+    }
 
-    viz_pub_.publish(viz_msg_);
+    path_.insert(path_.begin(), curr_node->loc);
+    curr_node = &nodes_[curr_node->parent];
+    steps++;
   }
-  path_.insert(path_.begin(), node_map_.at(0).loc); // Insert robot location node
+  PublishVisualization(false);   // Refinement may replace the path many times a second
+  path_.insert(path_.begin(), nodes_[0].loc); // Insert robot location node
   path_.push_back(goal_); // Insert goal location as node
 
   std::cout << "[GlobalPlanner] Constructed global path of length " << goal_node.cost << " with " << steps << " steps" << std::endl;
@@ -10,16 +10,26 @@
 
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <eigen3/Eigen/Dense>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 
 #include "ros/ros.h"
 #include "ros/package.h"
 #include "vector_map/vector_map.h"
 #include "shared/math/line2d.h"
-#include "shared/util/random.h"
+#include "fast_random/fast_random.h"
 #include "amrl_msgs/VisualizationMsg.h"
 #include "visualization/visualization.h"
+#include "visualization/visualization_manager.h"
+#include "node_index.h"
+#include "grid_planner.h"
+#include "roadmap.h"
 
 using geometry::line2f;
 
@@ -34,9 +44,11 @@ struct Node {
 
 class GlobalPlanner {
   public:
-    GlobalPlanner(const vector_map::VectorMap map, ros::NodeHandle* n);
+    GlobalPlanner(const vector_map::VectorMap &map, ros::NodeHandle* n);
 
-    GlobalPlanner(const vector_map::VectorMap map, ros::NodeHandle* n, const float goal_threshold, const float graph_resolution, const float collision_proximity, const float sample_buffer, const float optimization_radius);
+    GlobalPlanner(const vector_map::VectorMap &map, ros::NodeHandle* n, const float goal_threshold, const float graph_resolution, const float collision_proximity, const float sample_buffer, const float optimization_radius);
+
+    ~GlobalPlanner();
 
     void ClearPath(void);
 
@@ -44,30 +56,124 @@ class GlobalPlanner {
 
     void SetGoalLocation(const Eigen::Vector2f loc);
 
-    bool CalculatePath(unsigned int max_iterations);
+    // Replace the RRT* search with A* over an occupancy grid of the given resolution. Requests the roadmap cannot
+    // answer go to the grid too, and a goal the grid cannot reach is reported unreachable without trying RRT*.
+    void UseGridSearch(const float resolution);
+
+    // Answer requests on the roadmap stored in file, built offline by roadmap_builder, falling back to the grid or
+    // RRT* search when an end cannot be joined to it. Returns false when file holds no roadmap for this map, or one
+    // with less clearance than the collision proximity.
+    bool UseRoadmap(const std::string& file);
+
+    // Keep the trees of the last cache_size searches that reached their goal, and grow a request to a nearby goal
+    // from the cached tree re-rooted at its start instead of an empty one
+    void ReuseTrees(const unsigned int cache_size);
+
+    // Publish the search at most rate times a second, or not at all when rate is 0. Results are always published
+    // when a search finishes.
+    void SetVisualizationRate(const float rate);
+
+    // Fraction of the samples drawn at the goal until it is first reached
+    void SetGoalBias(const float goal_bias);
+
+    // Grow threads independent trees, each from a copy of the current one with a random stream of its own, and
+    // keep the cheapest path any of them finds. Which trees are cut short depends on timing, so only 1, the default
+    // and the only choice of builds without OpenMP, replays the same search from the same seed.
+    void SetPlanningThreads(const unsigned int threads);
+
+    // Plan until the goal is first reached, then keep refining for refine_iterations more samples, or until
+    // refine_time seconds have passed when it is positive. A loaded roadmap is tried first, then the grid search when
+    // one was built, and RRT* otherwise.
+    bool CalculatePath(unsigned int max_iterations, unsigned int refine_iterations = 0, float refine_time = 0);
 
     std::vector<Eigen::Vector2f> GetPath(void);
 
+    // Planning service: runs CalculatePath on a worker thread so callers never block on a search
+    void StartPlanningService(unsigned int max_iterations, unsigned int refine_iterations, float refine_time = 0);
+
+    void StopPlanningService(void);
+
+    // Queue a search from start to goal, cancelling the one in progress
+    void RequestPath(const Eigen::Vector2f start, const Eigen::Vector2f goal);
+
+    // Copy out the latest solution if it is newer than *version, which is then updated
+    bool GetLatestPath(std::vector<Eigen::Vector2f>* path, unsigned int* version);
+
+    // Drop the queued request and stop the search in progress. The latest solution is kept but no longer handed out
+    void CancelPath(void);
+
+    // Whether a request is queued or being searched
+    bool Planning(void);
+
+    // Search the queued request, if any, on the calling thread, for callers that drive the planner without the
+    // service. The refinement is bounded by refine_iterations alone, so replaying the same input plans the same path.
+    void ServeRequest(unsigned int max_iterations, unsigned int refine_iterations);
+
   private:
-    Eigen::Vector2f SamplePoint(const Eigen::Vector2f robot_loc, const Eigen::Vector2f goal_loc);
+    // Uniform in a box around robot and goal, or inside the ellipse of points that can still shorten a path of
+    // best_cost once one is known
+    Eigen::Vector2f SamplePoint(const Eigen::Vector2f robot_loc, const Eigen::Vector2f goal_loc, const float best_cost, fast_random::FastRandom* rng);
 
-    Node FindClosestNode(const Eigen::Vector2f loc);
+    const Node& FindClosestNode(const std::vector<Node>& nodes, const NodeIndex& index, const Eigen::Vector2f loc);
 
-    Node CreateChildNode(Node parent, const Eigen::Vector2f loc);
+    Node CreateChildNode(const std::vector<Node>& nodes, const Node& parent, const Eigen::Vector2f loc);
 
     bool CheckMapCollision(const Eigen::Vector2f point1, const Eigen::Vector2f point2);
 
-    void OptimizePathToNode(Node* node);
+    // Reparent node to the neighbor that reaches it most cheaply, neighbors is scratch for the radius query
+    void OptimizePathToNode(const std::vector<Node>& nodes, const NodeIndex& index, Node* node,
+                            std::vector<unsigned int>* neighbors);
 
-    void ConstructPath(const Node goal_node);
+    // RRT* on the tree of worker until the goal is reached and refined, max_iterations samples are spent, the search
+    // is cancelled, or another tree is done while this one has yet to reach the goal. *best_cost is the cost of the
+    // path the tree already has, and is lowered as it finds cheaper ones. Returns the id of the node that reaches the
+    // goal most cheaply, 0 when no new one does. The tree of the first worker, nodes_, is drawn and its paths
+    // published as they are found.
+    unsigned int GrowTree(const unsigned int worker, std::vector<Node>* nodes, NodeIndex* index,
+                          const unsigned int max_iterations, const unsigned int refine_iterations,
+                          const float refine_time, float* best_cost);
 
-    ros::Publisher viz_pub_;
+    void ConstructPath(const Node& goal_node);
+
+    bool CalculateGridPath(void);
+
+    bool CalculateRoadmapPath(void);
+
+    // Draw and publish path_ once a search that leaves no tree has found it, returning its length
+    float PublishPath(void);
+
+    void CacheTree(void);
+
+    bool RestoreTree(const Eigen::Vector2f start, const Eigen::Vector2f goal);
+
+    bool RerootTree(const Eigen::Vector2f loc);
+
+    void RunPlanningService(unsigned int max_iterations, unsigned int refine_iterations, float refine_time);
+
+    // Move the queued request to the search, with service_mutex_ held
+    void TakeRequest(Eigen::Vector2f* start, Eigen::Vector2f* goal);
+
+    // CalculatePath from start to goal, from a cached tree when there is one
+    void Search(const Eigen::Vector2f start, const Eigen::Vector2f goal, unsigned int max_iterations,
+                unsigned int refine_iterations, float refine_time);
+
+    void PublishSolution(void);
+
+    bool Visualizing(void) const;
+
+    // Publish viz_msg_, unless less than a visualization period passed since the last publish and force is unset
+    void PublishVisualization(const bool force);
+
+    visualization::VisualizationManager visualization_;
     amrl_msgs::VisualizationMsg viz_msg_;
+    double viz_period_;      // Minimum time between publishes in a search, 0 when headless
+    double next_viz_time_;
 
     unsigned int counter_;
 
     vector_map::VectorMap map_;   // Map of the environment
-    util_random::Random rng_;     // Random number generator
+    vector_map::VectorMap cspace_;   // Map lines inflated by the collision proximity
+    fast_random::FastRandom rng_; // Random number generator, of the first worker
 
     Eigen::Vector2f goal_;     // Goal location (x,y)
     float goal_threshold_;     // Set distance from goal for success
@@ -77,10 +183,47 @@ class GlobalPlanner {
     float graph_resolution_;    // minimum distance between nodes
     // float narrow_collision_width_; // map has tiny gaps that need to be addressed when checking collisions
     float collision_proximity_;  // nodes should be a distance away from the map lines
-    std::map<unsigned int, Node> node_map_;   // Map of nodes
-
     float sample_buffer_;       // Search space buffer used for sampling random points
     float optimization_radius_; // Radius to search within for optimized path
+    float goal_bias_;           // Probability of sampling the goal before it is reached
+
+    std::vector<Node> nodes_;   // Tree nodes, indexed by id
+    NodeIndex node_index_;      // Node locations, for nearest neighbor and radius queries
+    std::vector<unsigned int> neighbors_;   // Scratch buffer for radius queries
+
+    struct Tree {
+      std::vector<Node> nodes;
+      NodeIndex index;
+    };
+    unsigned int threads_;      // Workers growing a tree each
+    std::vector<fast_random::FastRandom> streams_;   // Random streams of the workers after the first
+    std::vector<std::vector<unsigned int>> worker_neighbors_;   // Radius query scratch of the workers after the first
+    std::vector<Tree> worker_trees_;   // Trees of the workers after the first, the first grows nodes_
+    std::atomic<bool> trees_done_;     // A tree has reached the goal and finished refining it
+
+    GridPlanner grid_planner_;   // Grid search, used instead of RRT* once built
+    Roadmap roadmap_;            // Tried before any other search once loaded
+
+    // Planning service state, guarded by service_mutex_
+    std::thread service_thread_;
+    std::mutex service_mutex_;
+    std::condition_variable service_cv_;
+    bool service_running_;
+    bool request_pending_;      // A request is waiting for the worker
+    bool searching_;            // The worker is inside CalculatePath
+    Eigen::Vector2f request_start_;
+    Eigen::Vector2f request_goal_;
+    std::atomic<bool> cancel_;  // Set by a new request, polled by the search loop
+    std::vector<Eigen::Vector2f> solution_;   // Latest published path
+    unsigned int solution_version_;
+    unsigned int cancelled_version_;          // Last version CancelPath withdrew
+
+    struct CachedTree {
+      Eigen::Vector2f goal;
+      std::vector<Node> nodes;
+    };
+    std::vector<CachedTree> tree_cache_;   // Most recently used first
+    unsigned int tree_cache_size_;
 };
 
 } // namespace GlobalPlanner
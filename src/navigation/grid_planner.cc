@@ -0,0 +1,189 @@
+//========================================================================
+/*!
+\file    grid_planner.cc
+\brief   Deterministic A* over an 8-connected occupancy grid of the map,
+         an alternative to the RRT* search in GlobalPlanner.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "vector_map/distance_field.h"
+#include "grid_planner.h"
+
+namespace global_planner {
+
+namespace {
+
+// Neighbor offsets, the four sides first
+const int kOffsetX[8] = {1, -1, 0, 0, 1, 1, -1, -1};
+const int kOffsetY[8] = {0, 0, 1, -1, 1, -1, 1, -1};
+const float kStep[8] = {1, 1, 1, 1, M_SQRT2, M_SQRT2, M_SQRT2, M_SQRT2};
+
+} // namespace
+
+GridPlanner::GridPlanner() :
+  origin_(0, 0),
+  resolution_(1),
+  width_(0),
+  height_(0),
+  search_(0),
+  expanded_(0) {}
+
+void GridPlanner::Build(const vector_map::VectorMap& map, const float clearance, const float resolution) {
+  const float padded_clearance = clearance + resolution / 2;
+  vector_map::DistanceField distances;
+  map.GetDistanceField(resolution, 2 * padded_clearance, &distances);
+
+  resolution_ = resolution;
+  origin_ = distances.Origin();
+  width_ = distances.Width();
+  height_ = distances.Height();
+  const unsigned int size = width_ * height_;
+  blocked_.resize(size);
+  for (unsigned int cell = 0; cell < size; cell++) {
+    blocked_[cell] = distances.Distance(Center(cell)) < padded_clearance;
+  }
+
+  cost_.assign(size, 0);
+  parent_.assign(size, 0);
+  visited_.assign(size, 0);
+  closed_.assign(size, 0);
+  search_ = 0;
+  open_.Reset(size);
+}
+
+bool GridPlanner::Empty(void) const {
+  return blocked_.empty();
+}
+
+bool GridPlanner::Plan(const Eigen::Vector2f& start, const Eigen::Vector2f& goal, const float goal_tolerance,
+                       std::vector<Eigen::Vector2f>* path) {
+  path->clear();
+  expanded_ = 0;
+  unsigned int start_cell, goal_cell;
+  if (!CellOf(start, &start_cell) || !CellOf(goal, &goal_cell)) {
+    std::cout << "[GridPlanner] Start or goal lies outside of the map" << std::endl;
+    return false;
+  }
+  if (blocked_[goal_cell] && !ClosestFreeCell(goal, goal_tolerance, &goal_cell)) {
+    std::cout << "[GridPlanner] Goal is too close to the map" << std::endl;
+    return false;
+  }
+
+  // New stamp, wrapping around only after four billion searches
+  if (++search_ == 0) {
+    std::fill(visited_.begin(), visited_.end(), 0);
+    std::fill(closed_.begin(), closed_.end(), 0);
+    search_ = 1;
+  }
+  open_.Clear();
+
+  // The start cell may be blocked when the robot is close to a wall, it is expanded anyway
+  cost_[start_cell] = 0;
+  parent_[start_cell] = start_cell;
+  visited_[start_cell] = search_;
+  open_.Push(start_cell, Heuristic(start_cell, goal_cell));
+
+  bool found = false;
+  while (!open_.Empty()) {
+    const unsigned int cell = open_.Pop();
+    if (cell == goal_cell) {
+      found = true;
+      break;
+    }
+    // The octile heuristic is consistent, expanded cells never need to be reopened
+    closed_[cell] = search_;
+    expanded_++;
+
+    const int x = cell % width_;
+    const int y = cell / width_;
+    for (int k = 0; k < 8; k++) {
+      const int nx = x + kOffsetX[k];
+      const int ny = y + kOffsetY[k];
+      if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_) {
+        continue;
+      }
+      const unsigned int neighbor = ny * width_ + nx;
+      if (blocked_[neighbor] || closed_[neighbor] == search_) {
+        continue;
+      }
+      // Diagonal moves may not cut the corner of a blocked cell
+      if (k >= 4 && (blocked_[y * width_ + nx] || blocked_[ny * width_ + x])) {
+        continue;
+      }
+      const float cost = cost_[cell] + kStep[k] * resolution_;
+      if (visited_[neighbor] != search_ || cost < cost_[neighbor]) {
+        visited_[neighbor] = search_;
+        cost_[neighbor] = cost;
+        parent_[neighbor] = cell;
+        open_.Push(neighbor, cost + Heuristic(neighbor, goal_cell));
+      }
+    }
+  }
+
+  if (!found) {
+    return false;
+  }
+
+  // Walk back from the goal, the cells of start and goal are replaced by the exact locations
+  path->push_back(goal);
+  for (unsigned int cell = parent_[goal_cell]; cell != start_cell; cell = parent_[cell]) {
+    path->push_back(Center(cell));
+  }
+  path->push_back(start);
+  std::reverse(path->begin(), path->end());
+  return true;
+}
+
+unsigned int GridPlanner::Expanded(void) const {
+  return expanded_;
+}
+
+bool GridPlanner::CellOf(const Eigen::Vector2f& loc, unsigned int* cell) const {
+  const Eigen::Vector2f grid_loc = (loc - origin_) / resolution_;
+  const int x = static_cast<int>(std::floor(grid_loc.x()));
+  const int y = static_cast<int>(std::floor(grid_loc.y()));
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) {
+    return false;
+  }
+  *cell = y * width_ + x;
+  return true;
+}
+
+bool GridPlanner::ClosestFreeCell(const Eigen::Vector2f& loc, const float radius, unsigned int* cell) const {
+  const int reach = static_cast<int>(std::ceil(radius / resolution_));
+  const int x = *cell % width_;
+  const int y = *cell / width_;
+  float best_distance = radius;
+  bool found = false;
+  for (int ny = std::max(0, y - reach); ny <= std::min(height_ - 1, y + reach); ny++) {
+    for (int nx = std::max(0, x - reach); nx <= std::min(width_ - 1, x + reach); nx++) {
+      const unsigned int neighbor = ny * width_ + nx;
+      const float distance = (Center(neighbor) - loc).norm();
+      if (!blocked_[neighbor] && distance <= best_distance) {
+        best_distance = distance;
+        *cell = neighbor;
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+Eigen::Vector2f GridPlanner::Center(const unsigned int cell) const {
+  return origin_ + resolution_ * Eigen::Vector2f(cell % width_ + 0.5, cell / width_ + 0.5);
+}
+
+float GridPlanner::Heuristic(const unsigned int cell, const unsigned int goal) const {
+  // Octile distance, exact on an empty 8-connected grid
+  const int dx = std::abs(static_cast<int>(cell % width_) - static_cast<int>(goal % width_));
+  const int dy = std::abs(static_cast<int>(cell / width_) - static_cast<int>(goal / width_));
+  return resolution_ * (std::max(dx, dy) + (M_SQRT2 - 1) * std::min(dx, dy));
+}
+
+} // namespace global_planner
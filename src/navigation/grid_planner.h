@@ -0,0 +1,66 @@
+//========================================================================
+/*!
+\file    grid_planner.h
+\brief   Deterministic A* over an 8-connected occupancy grid of the map,
+         an alternative to the RRT* search in GlobalPlanner.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include "vector_map/vector_map.h"
+#include "indexed_heap.h"
+
+namespace global_planner {
+
+class GridPlanner {
+  public:
+    GridPlanner();
+
+    // Rasterize the free space of the map. A cell is blocked when its center lies within clearance of a map line,
+    // padded by half a cell so that moves between free cell centers keep the clearance too.
+    void Build(const vector_map::VectorMap& map, const float clearance, const float resolution);
+
+    bool Empty(void) const;
+
+    // Shortest 8-connected path between the cells of start and goal. A blocked goal cell is replaced by the closest
+    // free cell within goal_tolerance. The path runs through cell centers, with start and goal themselves at its
+    // ends. Returns false when no goal cell is free, or it is off the grid or unreachable.
+    bool Plan(const Eigen::Vector2f& start, const Eigen::Vector2f& goal, const float goal_tolerance,
+              std::vector<Eigen::Vector2f>* path);
+
+    // Cells expanded by the last Plan
+    unsigned int Expanded(void) const;
+
+  private:
+    bool CellOf(const Eigen::Vector2f& loc, unsigned int* cell) const;
+
+    Eigen::Vector2f Center(const unsigned int cell) const;
+
+    // Search the cells within radius of loc around *cell, which is replaced by the closest free one
+    bool ClosestFreeCell(const Eigen::Vector2f& loc, const float radius, unsigned int* cell) const;
+
+    float Heuristic(const unsigned int cell, const unsigned int goal) const;
+
+    Eigen::Vector2f origin_;   // World location of the corner of cell (0, 0)
+    float resolution_;         // Cell size
+    int width_;
+    int height_;
+    std::vector<uint8_t> blocked_;   // Row-major occupancy
+
+    // Search state. Entries only count when their stamp matches search_, so a plan never clears the whole grid
+    std::vector<float> cost_;          // Cost from start
+    std::vector<unsigned int> parent_;
+    std::vector<uint32_t> visited_;    // Stamp of the search that last reached the cell
+    std::vector<uint32_t> closed_;     // Stamp of the search that expanded the cell
+    uint32_t search_;
+    IndexedHeap<float> open_;
+    unsigned int expanded_;
+};
+
+} // namespace global_planner
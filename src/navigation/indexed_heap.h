@@ -0,0 +1,148 @@
+//========================================================================
+/*!
+\file    indexed_heap.h
+\brief   Binary min-heap over dense integer ids with decrease-key, for
+         graph searches where SimpleQueue's linear scans do not scale.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+namespace global_planner {
+
+// Ids must lie in [0, capacity). The heap position of every id is kept in a
+// flat array, so Exists and priority updates are O(1) and O(log n) instead of
+// a scan over the queue.
+template <class Priority>
+class IndexedHeap {
+  public:
+    explicit IndexedHeap(const unsigned int capacity = 0) : position_(capacity, kAbsent) {}
+
+    // Grow the id range, dropping whatever is queued.
+    void Reset(const unsigned int capacity) {
+      heap_.clear();
+      position_.assign(capacity, kAbsent);
+    }
+
+    // Empty the queue in time proportional to its size, not the id range.
+    void Clear(void) {
+      for (const Entry& entry : heap_) {
+        position_[entry.id] = kAbsent;
+      }
+      heap_.clear();
+    }
+
+    // Insert id, or move it to the new priority if it is already queued.
+    void Push(const unsigned int id, const Priority& priority) {
+      unsigned int i = position_[id];
+      if (i == kAbsent) {
+        i = heap_.size();
+        heap_.push_back({id, priority});
+        position_[id] = i;
+        SiftUp(i);
+        return;
+      }
+      const bool decreased = priority < heap_[i].priority;
+      heap_[i].priority = priority;
+      if (decreased) {
+        SiftUp(i);
+      } else {
+        SiftDown(i);
+      }
+    }
+
+    // Remove and return the id with the lowest priority.
+    unsigned int Pop(void) {
+      if (heap_.empty()) {
+        fprintf(stderr, "ERROR: Pop() called on an empty heap!\n");
+        exit(1);
+      }
+      const unsigned int id = heap_[0].id;
+      position_[id] = kAbsent;
+      if (heap_.size() > 1) {
+        heap_[0] = heap_.back();
+        position_[heap_[0].id] = 0;
+        heap_.pop_back();
+        SiftDown(0);
+      } else {
+        heap_.pop_back();
+      }
+      return id;
+    }
+
+    const Priority& TopPriority(void) const {
+      return heap_[0].priority;
+    }
+
+    bool Empty(void) const {
+      return heap_.empty();
+    }
+
+    size_t Size(void) const {
+      return heap_.size();
+    }
+
+    bool Exists(const unsigned int id) const {
+      return position_[id] != kAbsent;
+    }
+
+  private:
+    struct Entry {
+      unsigned int id;
+      Priority priority;
+    };
+
+    static constexpr unsigned int kAbsent = ~0u;
+
+    void SiftUp(unsigned int i) {
+      const Entry entry = heap_[i];
+      while (i > 0) {
+        const unsigned int parent = (i - 1) / 2;
+        if (!(entry.priority < heap_[parent].priority)) {
+          break;
+        }
+        Place(i, heap_[parent]);
+        i = parent;
+      }
+      Place(i, entry);
+    }
+
+    void SiftDown(unsigned int i) {
+      const Entry entry = heap_[i];
+      const unsigned int size = heap_.size();
+      while (true) {
+        unsigned int child = 2 * i + 1;
+        if (child >= size) {
+          break;
+        }
+        if (child + 1 < size && heap_[child + 1].priority < heap_[child].priority) {
+          child++;
+        }
+        if (!(heap_[child].priority < entry.priority)) {
+          break;
+        }
+        Place(i, heap_[child]);
+        i = child;
+      }
+      Place(i, entry);
+    }
+
+    void Place(const unsigned int i, const Entry& entry) {
+      heap_[i] = entry;
+      position_[entry.id] = i;
+    }
+
+    std::vector<Entry> heap_;
+    std::vector<unsigned int> position_;   // Heap slot of every id, kAbsent when not queued
+};
+
+template <class Priority>
+constexpr unsigned int IndexedHeap<Priority>::kAbsent;
+
+} // namespace global_planner
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "indexed_heap.h"
+
+// Checks the heap against a brute force scan over random pushes, priority updates and pops.
+int main() {
+  const unsigned int kIds = 200;
+  global_planner::IndexedHeap<float> heap(kIds);
+  std::vector<float> reference(kIds, -1);   // Queued priority of every id, -1 when absent
+  srand(42);
+
+  int errors = 0;
+  for (int step = 0; step < 100000; ++step) {
+    const unsigned int id = rand() % kIds;
+    if (rand() % 3 != 0) {
+      const float priority = rand() % 1000;
+      heap.Push(id, priority);
+      reference[id] = priority;
+      continue;
+    }
+    if (heap.Empty()) continue;
+
+    float best = -1;
+    for (const float p : reference) {
+      if (p >= 0 && (best < 0 || p < best)) best = p;
+    }
+    const float top = heap.TopPriority();
+    const unsigned int popped = heap.Pop();
+    if (top != best || reference[popped] != best) {
+      printf("Step %d: popped %u with priority %f, expected priority %f\n", step, popped, reference[popped], best);
+      errors++;
+    }
+    reference[popped] = -1;
+    if (heap.Exists(popped)) {
+      printf("Step %d: %u still queued after Pop\n", step, popped);
+      errors++;
+    }
+  }
+
+  heap.Clear();
+  printf("Empty after Clear?: %d\n", heap.Empty());
+  printf("%d errors\n", errors);
+  return errors == 0 && heap.Empty() ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+//========================================================================
+/*!
+\file    local_costmap.cc
+\brief   Rolling grid of obstacle distances around the robot, filled from
+         the static map and the latest scan, shared by the local planner
+         and the controller.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+#include "local_costmap.h"
+
+namespace local_planners {
+
+LocalCostmap::LocalCostmap() :
+  resolution_(1),
+  inv_resolution_(1),
+  max_distance_(0),
+  size_(0),
+  origin_x_(0),
+  origin_y_(0),
+  placed_(false) {}
+
+void LocalCostmap::Build(const vector_map::VectorMap& map, const float size, const float resolution,
+                         const float max_distance) {
+  map.GetDistanceField(resolution, max_distance, &static_field_);
+  resolution_ = resolution;
+  inv_resolution_ = 1 / resolution;
+  max_distance_ = max_distance;
+  size_ = static_cast<int>(std::ceil(size / resolution));
+  const unsigned int cells = size_ * size_;
+  static_.assign(cells, max_distance);
+  cells_.assign(cells, max_distance);
+  squared_.assign(cells, 0);
+  line_.assign(size_, 0);
+  hull_.assign(size_, 0);
+  bounds_.assign(size_ + 1, 0);
+  placed_ = false;
+}
+
+bool LocalCostmap::Empty(void) const {
+  return cells_.empty();
+}
+
+void LocalCostmap::Recenter(const Eigen::Vector2f& center) {
+  if (Empty()) {
+    return;
+  }
+  const int x = static_cast<int>(std::floor(center.x() * inv_resolution_)) - size_ / 2;
+  const int y = static_cast<int>(std::floor(center.y() * inv_resolution_)) - size_ / 2;
+  const int dx = x - origin_x_;
+  const int dy = y - origin_y_;
+  origin_x_ = x;
+  origin_y_ = y;
+  if (!placed_ || std::abs(dx) >= size_ || std::abs(dy) >= size_) {
+    placed_ = true;
+    Seed(x, x + size_, y, y + size_);
+    return;
+  }
+  // Only the columns and rows that entered the window are new, the slots they take over are reseeded
+  if (dx > 0) {
+    Seed(x + size_ - dx, x + size_, y, y + size_);
+  } else if (dx < 0) {
+    Seed(x, x - dx, y, y + size_);
+  }
+  if (dy > 0) {
+    Seed(x, x + size_, y + size_ - dy, y + size_);
+  } else if (dy < 0) {
+    Seed(x, x + size_, y, y - dy);
+  }
+}
+
+void LocalCostmap::InsertScan(const std::vector<Eigen::Vector2f>& cloud, const Eigen::Vector2f& loc,
+                              const float angle) {
+  if (Empty()) {
+    return;
+  }
+  // Cells with a point are at 0, the rest further than anything in the window
+  const float far = 2.f * size_;
+  std::fill(squared_.begin(), squared_.end(), far);
+  const Eigen::Rotation2Df rotation(angle);
+  for (const Eigen::Vector2f& point : cloud) {
+    const Eigen::Vector2f p = loc + rotation * point;
+    const int x = static_cast<int>(std::floor(p.x() * inv_resolution_)) - origin_x_;
+    const int y = static_cast<int>(std::floor(p.y() * inv_resolution_)) - origin_y_;
+    if (x >= 0 && y >= 0 && x < size_ && y < size_) {
+      squared_[y * size_ + x] = 0;
+    }
+  }
+
+  // Separable transform. Along the columns the distance to the closest marked cell is counted by a sweep each way,
+  // row by row so that all columns advance together.
+  for (int y = 1; y < size_; y++) {
+    const float* previous = &squared_[(y - 1) * size_];
+    float* current = &squared_[y * size_];
+    for (int x = 0; x < size_; x++) {
+      current[x] = std::min(current[x], previous[x] + 1);
+    }
+  }
+  for (int y = size_ - 2; y >= 0; y--) {
+    const float* next = &squared_[(y + 1) * size_];
+    float* current = &squared_[y * size_];
+    for (int x = 0; x < size_; x++) {
+      current[x] = std::min(current[x], next[x] + 1);
+    }
+  }
+  // Along the rows the squared column distances are combined exactly. Rows that are beyond max_distance everywhere
+  // stay that way.
+  const float reach = max_distance_ * inv_resolution_;
+  for (int y = 0; y < size_; y++) {
+    float* row = &squared_[y * size_];
+    float closest = far;
+    for (int x = 0; x < size_; x++) {
+      row[x] *= row[x];
+      closest = std::min(closest, row[x]);
+    }
+    if (closest < reach * reach) {
+      Transform(row, size_);
+    }
+  }
+
+  // The scan replaces the previous one everywhere, on top of the static map
+  const int column0 = Wrap(origin_x_);
+  for (int y = 0; y < size_; y++) {
+    const unsigned int row = Wrap(origin_y_ + y) * size_;
+    const float* squared = &squared_[y * size_];
+    int column = column0;
+    for (int x = 0; x < size_; x++, column = (column + 1 == size_) ? 0 : column + 1) {
+      const unsigned int slot = row + column;
+      const float distance = std::min(std::sqrt(squared[x]) * resolution_, max_distance_);
+      cells_[slot] = std::min(static_[slot], distance);
+    }
+  }
+}
+
+void LocalCostmap::Transform(float* values, const int count) {
+  // Lower envelope of the parabolas rooted at every cell (Felzenszwalb and Huttenlocher). All values are integers
+  // well within float precision, only the bounds between parabolas are fractional.
+  for (int i = 0; i < count; i++) {
+    line_[i] = values[i];
+  }
+  int k = 0;
+  hull_[0] = 0;
+  bounds_[0] = -std::numeric_limits<float>::max();
+  bounds_[1] = std::numeric_limits<float>::max();
+  for (int q = 1; q < count; q++) {
+    // Parabolas of the hull that the new one is lower than beyond their start are dropped
+    float s = Intersection(q, hull_[k]);
+    while (s <= bounds_[k]) {
+      k--;
+      s = Intersection(q, hull_[k]);
+    }
+    k++;
+    hull_[k] = q;
+    bounds_[k] = s;
+    bounds_[k + 1] = std::numeric_limits<float>::max();
+  }
+  k = 0;
+  for (int q = 0; q < count; q++) {
+    while (bounds_[k + 1] < q) {
+      k++;
+    }
+    const int v = hull_[k];
+    values[q] = (q - v) * (q - v) + line_[v];
+  }
+}
+
+void LocalCostmap::Seed(const int x0, const int x1, const int y0, const int y1) {
+  for (int y = y0; y < y1; y++) {
+    for (int x = x0; x < x1; x++) {
+      const unsigned int slot = Slot(x, y);
+      static_[slot] = static_field_.Distance(Eigen::Vector2f((x + 0.5f) * resolution_, (y + 0.5f) * resolution_));
+      cells_[slot] = static_[slot];
+    }
+  }
+}
+
+} // namespace local_planners
@@ -0,0 +1,104 @@
+//========================================================================
+/*!
+\file    local_costmap.h
+\brief   Rolling grid of obstacle distances around the robot, filled from
+         the static map and the latest scan, shared by the local planner
+         and the controller.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include "vector_map/distance_field.h"
+#include "vector_map/vector_map.h"
+
+namespace local_planners {
+
+// Square window of cells, in map frame, that follows the robot. Cells are addressed by their global grid
+// coordinates modulo the window size, so moving the window only touches the rows and columns that enter it. Every
+// cell holds the distance from its center to the closest obstacle, static or scanned, truncated at max_distance.
+// Scanned obstacles are measured from the center of the cell they fall in.
+class LocalCostmap {
+  public:
+    LocalCostmap();
+
+    // Rasterize the static map, and size the window to cover size (m) around its center
+    void Build(const vector_map::VectorMap& map, const float size, const float resolution, const float max_distance);
+
+    bool Empty(void) const;
+
+    // Move the window so that it is centered on center. Cells that enter it start from the static map.
+    void Recenter(const Eigen::Vector2f& center);
+
+    // Replace the obstacles of the previous scan by the points of cloud, given in the frame of the robot at
+    // (loc, angle). Points outside of the window are dropped. Every point only marks its cell, the distances of the
+    // whole window are then updated by one distance transform, so the cost does not grow with the reach.
+    void InsertScan(const std::vector<Eigen::Vector2f>& cloud, const Eigen::Vector2f& loc, const float angle);
+
+    // Whether p lies in the window
+    bool Contains(const Eigen::Vector2f& p) const {
+      const int x = static_cast<int>(std::floor(p.x() * inv_resolution_)) - origin_x_;
+      const int y = static_cast<int>(std::floor(p.y() * inv_resolution_)) - origin_y_;
+      return x >= 0 && y >= 0 && x < size_ && y < size_;
+    }
+
+    // Distance (m) from p to the closest obstacle, looked up from the cell that contains p. max_distance outside
+    // of the window.
+    float Distance(const Eigen::Vector2f& p) const {
+      const int x = static_cast<int>(std::floor(p.x() * inv_resolution_));
+      const int y = static_cast<int>(std::floor(p.y() * inv_resolution_));
+      if (x < origin_x_ || y < origin_y_ || x >= origin_x_ + size_ || y >= origin_y_ + size_) {
+        return max_distance_;
+      }
+      return cells_[Slot(x, y)];
+    }
+
+    float Resolution(void) const {return resolution_;}
+    float MaxDistance(void) const {return max_distance_;}
+
+  private:
+    unsigned int Slot(const int x, const int y) const {
+      return Wrap(y) * size_ + Wrap(x);
+    }
+
+    int Wrap(const int i) const {
+      const int r = i % size_;
+      return r < 0 ? r + size_ : r;
+    }
+
+    // Reset the cells of global columns [x0, x1) and rows [y0, y1) to the static map
+    void Seed(const int x0, const int x1, const int y0, const int y1);
+
+    // Exact squared distance transform of count values, in place
+    void Transform(float* values, const int count);
+
+    // Where the parabolas of cells q and v of the line being transformed cross
+    float Intersection(const int q, const int v) const {
+      return ((line_[q] + q * q) - (line_[v] + v * v)) / (2.f * (q - v));
+    }
+
+    vector_map::DistanceField static_field_;
+    float resolution_;
+    float inv_resolution_;
+    float max_distance_;
+    int size_;       // Cells along each side of the window
+    int origin_x_;   // Global grid coordinates of the lowest corner cell of the window
+    int origin_y_;
+    bool placed_;    // Whether the window was centered since Build
+    std::vector<float> static_;       // Static map distance of every slot
+    std::vector<float> cells_;        // Static and scan distance of every slot
+
+    // Scratch space of InsertScan, in window order with the lowest corner first
+    std::vector<float> squared_;      // Distance to the scan, in cells, squared once the columns are done
+    std::vector<float> line_;
+    std::vector<int> hull_;
+    std::vector<float> bounds_;
+};
+
+} // namespace local_planners
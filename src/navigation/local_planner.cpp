@@ -18,8 +18,8 @@ CarrotPlanner::CarrotPlanner(float stick_length, float goal_tolerance, float dev
 : stick_length_(stick_length), goal_tolerance_(goal_tolerance), deviation_tolerance_(deviation_tolerance)
 {}
 
-void CarrotPlanner::populatePath(std::vector<Vector2f> path){
-    full_path_ = path;
+void CarrotPlanner::populatePath(const std::vector<Vector2f> &path){
+    path_.set(path);
     init = true;
     return;
 }
@@ -44,14 +44,20 @@ bool CarrotPlanner::planStillValid(Vector2f robot_xy){
         std::cout << "[LocalPlanner] No path!" << std::endl;
         return false;
     }
+    // Only the vertices count, as the carrot is always one of them. Those from the cursor on are checked first,
+    // the ones behind it only when none of them is close.
     bool near_path = false;
-    for (int i = full_path_.size()-1; i >= 0; i--){
-        Vector2f to_edge = full_path_[i] - robot_xy;
+    path_.track(robot_xy, window());
+    for (std::size_t i = path_.cursor(); i < path_.size() && !near_path; i++){
+        Vector2f to_edge = path_.point(i) - robot_xy;
         float edge_dist = to_edge.norm();
         if (edge_dist <= deviation_tolerance_){
             near_path = true;
         }
     }
+    for (std::size_t i = 0; i < path_.cursor() && !near_path; i++){
+        near_path = (path_.point(i) - robot_xy).norm() <= deviation_tolerance_;
+    }
     // If yes, continue to plan!
     if (near_path){
         return true;
@@ -69,9 +75,14 @@ Vector2f CarrotPlanner::feedCarrot(Vector2f robot_xy){
         return robot_xy;
     }
     int best_index = -1;
-    // Work backwards from the goal to the start
-    for (int i = full_path_.size()-1; i >= 0; i--){
-        Vector2f to_edge = full_path_[i] - robot_xy;
+    // Work backwards from the end of the window ahead of the robot
+    path_.track(robot_xy, window());
+    int last = path_.cursor();
+    while (last + 1 < static_cast<int>(path_.size()) && path_.arc(last + 1) <= path_.progress() + window()) {
+        last++;
+    }
+    for (int i = last; i >= static_cast<int>(path_.cursor()); i--){
+        Vector2f to_edge = path_.point(i) - robot_xy;
         float edge_dist = to_edge.norm();
         // Once an edge is found that is within the carrot planners allowed radius, make that the carrot.
         if (edge_dist <= stick_length_){
@@ -85,19 +96,23 @@ Vector2f CarrotPlanner::feedCarrot(Vector2f robot_xy){
         return robot_xy;
     }
     else{
-        return full_path_[best_index];
+        return path_.point(best_index);
     }
 }
 
 // -------------------------------------------------------------------------
 // * INTERPOLATING PLANNER
 // -------------------------------------------------------------------------
-SmoothedPlanner::SmoothedPlanner(const vector_map::VectorMap map, float stick_length, float goal_tolerance, float deviation_tolerance)
+SmoothedPlanner::SmoothedPlanner(const vector_map::VectorMap &map, float stick_length, float goal_tolerance, float deviation_tolerance)
 : map_(map), stick_length_(stick_length), goal_tolerance_(goal_tolerance), deviation_tolerance_(deviation_tolerance)
 {}
 
-void SmoothedPlanner::populatePath(std::vector<Vector2f> path){
-    full_path_ = path;
+void SmoothedPlanner::setCostmap(const LocalCostmap *costmap){
+    costmap_ = costmap;
+}
+
+void SmoothedPlanner::populatePath(const std::vector<Vector2f> &path){
+    path_.set(path);
     init = true;
     return;
 }
@@ -109,7 +124,7 @@ bool SmoothedPlanner::reachedGoal(Vector2f robot_xy, Vector2f goal_xy){
     }
 
     //. Calculate the distance from the robot to the goal
-    Vector2f to_goal = full_path_[full_path_.size()-1] - robot_xy;
+    Vector2f to_goal = path_.back() - robot_xy;
     float goal_dist = to_goal.norm();
     //. Decide if the robot should continue to move
     if (goal_dist > goal_tolerance_){
@@ -126,31 +141,9 @@ bool SmoothedPlanner::planStillValid(Vector2f robot_xy){
         std::cout << "[LocalPlanner] No path!" << std::endl;
         return false;
     }
-    //. Is the robot within a tolerance of any point on the path?
-    bool near_path = false;
-    for (int i = full_path_.size()-1; i > 0; i--){
-        Vector2f a = full_path_[i];
-        Vector2f b = full_path_[i-1];
-        float a_b_norm = (a-b).norm();
-        // std::cout << i << std::endl << std::endl;
-        for (float j = 0; j<= a_b_norm; j+=0.25){
-            // Get point
-            Vector2f point = a-((a-b)*(j/a_b_norm));
-            Vector2f to_edge = point - robot_xy;
-            float edge_dist = to_edge.norm();
-            if (edge_dist <= deviation_tolerance_){
-                near_path = true;
-            }
-        }
-    }
-
-    // for (int i = full_path_.size()-1; i >= 0; i--){
-    //     Vector2f to_edge = full_path_[i] - robot_xy;
-    //     float edge_dist = to_edge.norm();
-    //     if (edge_dist <= deviation_tolerance_){
-    //         near_path = true;
-    //     }
-    // }
+    //. Is the robot within a tolerance of the path? The window ahead of it is checked first, the rest of the path
+    //. ahead only when the robot is not close to it
+    bool near_path = nearPath(robot_xy);
 
     //. If yes, continue to plan!
     if (near_path){
@@ -169,18 +162,38 @@ bool SmoothedPlanner::checkMapCollision(const Eigen::Vector2f point1, const Eige
                 point2[0], point2[1]);
     // Note: These seven lines allow for collision checks to have an added margin. Can be added later, but shouldn't be necessary
     float collision_check_width_ = CAR_WIDTH + 2 * CAR_MARGIN; // 0.24f; // 0.15;
-    float theta = atan2((point2[1] - point1[1]), (point2[0] - point1[0]));
-    // float dx = collision_check_width_ / 2 * cos(M_PI / 2 - theta);
-    // float dy = collision_check_width_ / 2 * sin(M_PI / 2 - theta);
-    float dx {collision_check_width_ / 2 * sin(theta)};
-    float dy {collision_check_width_ / 2 * cos(theta)};
+    //. Offset along the segment normal, taken from the direction directly instead of through atan2, sin and cos
+    Eigen::Vector2f direction {point2 - point1};
+    float length {direction.norm()};
+    direction = (length > 0) ? Eigen::Vector2f(direction / length) : Eigen::Vector2f(1, 0);
+    float dx {collision_check_width_ / 2 * direction.y()};
+    float dy {collision_check_width_ / 2 * direction.x()};
     line2f line1(point1[0] - dx, point1[1] + dy,
                 point2[0] - dx, point2[1] + dy);
     line2f line2(point1[0] + dx, point1[1] - dy,
                 point2[0] + dx, point2[1] - dy);
+    //. Inside the costmap the corridor is walked one cell at a time, its center line has to stay half the width away
+    //. from everything
+    if (costmap_ != nullptr && costmap_->Contains(point1) && costmap_->Contains(point2)) {
+        const float step {costmap_->Resolution()};
+        for (float s = 0; s < length + step; s += step) {
+            if (costmap_->Distance(point1 + std::min(s, length) * direction) < collision_check_width_ / 2) {
+                l1 = line1;
+                l2 = line2;
+                return true;
+            }
+        }
+        return false;
+    }
+    //. Only map lines near the swept corridor can intersect it
+    float search_radius = collision_check_width_ / 2;
+    std::vector<int> nearby_lines;
+    map_.GetLinesInBox(point1.cwiseMin(point2) - Eigen::Vector2f(search_radius, search_radius),
+                       point1.cwiseMax(point2) + Eigen::Vector2f(search_radius, search_radius),
+                       &nearby_lines);
     //. Loop through map lines checking for instersections
     bool collision_flag = false;
-    for (size_t j = 0; j < map_.lines.size(); ++j) {
+    for (const int j : nearby_lines) {
         const line2f map_line = map_.lines[j];
         //. Check for instersection
         Eigen::Vector2f intersection_point;
@@ -199,35 +212,35 @@ bool SmoothedPlanner::checkMapCollision(const Eigen::Vector2f point1, const Eige
     return collision_flag;
 }
 
+bool SmoothedPlanner::nearPath(Vector2f robot_xy){
+    if (path_.track(robot_xy, window()) <= deviation_tolerance_) {
+        return true;
+    }
+    return path_.track(robot_xy, std::numeric_limits<float>::max()) <= deviation_tolerance_;
+}
+
 Vector2f SmoothedPlanner::interpolatePath(Vector2f robot_xy, float robot_angle, float interpolation_threshold, geometry::line2f &l1, geometry::line2f &l2){
     Vector2f goal = robot_xy;
     if (!init) {
         std::cout << "[LocalPlanner] No path!" << std::endl;
         return goal;
     }
-    for (int i = full_path_.size()-1; i > 0; i--){
-        Vector2f a = full_path_[i];
-        Vector2f b = full_path_[i-1];
-        float a_b_norm = (a-b).norm();
-        // std::cout << i << std::endl << std::endl;
-        for (float j = 0; j<= a_b_norm; j+=interpolation_threshold){
-            // Get point
-            Vector2f point = a-((a-b)*(j/a_b_norm));
-            // std::cout << point.transpose() << std::endl;
-            // Check for intersection, if intersection free make goal
-            if ((point-robot_xy).norm() <= stick_length_) {
-                if (checkMapCollision(robot_xy, point, l1, l2) == false) {
-                    // std::cout << "index: " << i << " far point: " << a.transpose() << " near point: " << b.transpose() << " interpolated point: " << point.transpose() << std::endl;
-                    // push the carrot forward a bit if it would be stuck inside the robot (helps get around tight corners)
-                    // bool pushed {false};
-                    if ((i != static_cast<int>(full_path_.size()) - 1) && (point-robot_xy).norm() <= 0.5) {
-                        point.x() += 0.5 * cos(robot_angle);
-                        point.y() += 0.5 * sin(robot_angle);
-                        // pushed = true;
-                    }
-                    // std::cout << "i: " << i << ", path_size: " << static_cast<int>(full_path_.size()) - 1 << ", point: " << point.transpose() << ", pushed: " << pushed << std::endl;
-                    return point;
+    //. Walk back from the end of the window ahead of the robot, the furthest point in reach and in sight is the goal
+    path_.track(robot_xy, window());
+    const float window_start {path_.arc(path_.cursor())};
+    const float window_end {std::min(path_.length(), path_.progress() + window())};
+    std::size_t segment;
+    for (float s = window_end; s >= window_start; s -= interpolation_threshold){
+        Vector2f point = path_.pointAt(s, segment);
+        //. Check for intersection, if intersection free make goal
+        if ((point-robot_xy).norm() <= stick_length_) {
+            if (checkMapCollision(robot_xy, point, l1, l2) == false) {
+                //. push the carrot forward a bit if it would be stuck inside the robot (helps get around tight corners)
+                if ((segment + 2 != path_.size()) && (point-robot_xy).norm() <= 0.5) {
+                    point.x() += 0.5 * cos(robot_angle);
+                    point.y() += 0.5 * sin(robot_angle);
                 }
+                return point;
             }
         }
     }
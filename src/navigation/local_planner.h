@@ -21,6 +21,8 @@
 
 #include "vehicles.hpp"
 #include "functions.h"
+#include "tracked_path.h"
+#include "local_costmap.h"
 
 using Eigen::Vector2f;
 using geometry::line2f;
@@ -32,7 +34,7 @@ class CarrotPlanner{
     public:
         CarrotPlanner(float stick_length, float goal_tolerance, float deviation_tolerance);
 
-        void populatePath(std::vector<Vector2f> path);
+        void populatePath(const std::vector<Vector2f> &path);
 
         bool reachedGoal(Vector2f robot_xy, Vector2f goal_xy);
 
@@ -44,7 +46,11 @@ class CarrotPlanner{
 
 
     private:
-        std::vector<Vector2f> full_path_;
+        // Stretch of path ahead of the robot that queries look at. Path beyond it is ignored even where it
+        // loops back within reach.
+        float window() const {return 2 * stick_length_;}
+
+        TrackedPath path_;
         bool init = false;
         float stick_length_; // Radius around car to check for intersection with path
         float goal_tolerance_; // How close (radially) to the goal must the car be to stop planning?
@@ -56,9 +62,13 @@ class CarrotPlanner{
 //. Other local planners can go here
 class SmoothedPlanner{
     public:
-        SmoothedPlanner(const vector_map::VectorMap map, float stick_length, float goal_tolerance, float deviation_tolerance);
+        SmoothedPlanner(const vector_map::VectorMap &map, float stick_length, float goal_tolerance, float deviation_tolerance);
+
+        void populatePath(const std::vector<Vector2f> &path);
 
-        void populatePath(std::vector<Vector2f> path);
+        // Check carrots against the costmap, which also holds the scanned obstacles, wherever it covers them. The
+        // costmap is not owned and nullptr goes back to the map only.
+        void setCostmap(const LocalCostmap *costmap);
 
         bool reachedGoal(Vector2f robot_xy, Vector2f goal_xy);
 
@@ -69,9 +79,14 @@ class SmoothedPlanner{
         Vector2f interpolatePath(Vector2f robot_xy, float robot_angle, float interpolation_threshold, geometry::line2f &l1, geometry::line2f &l2);
         // Vector2f feedCarrot(Vector2f robot_xy);
     private:
-        std::vector<Vector2f> full_path_;
+        float window() const {return 2 * stick_length_;}
+
+        bool nearPath(Vector2f robot_xy);
+
+        TrackedPath path_;
         bool init = false;
-        vector_map::VectorMap map_;   // Map of the environment
+        const vector_map::VectorMap &map_;   // Map of the environment, owned by the caller
+        const LocalCostmap *costmap_ = nullptr;    // Map and scan around the robot
         float stick_length_; // Radius around car to check for intersection with path
         float goal_tolerance_; // How close (radially) to the goal must the car be to stop planning?
         float deviation_tolerance_; // How close to the path must the robot be for it to not require a replanning? DEVIATION TOLERANCE MUST BE LESS THAN STICK LENGTH
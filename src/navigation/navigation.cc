@@ -32,7 +32,9 @@
 #include "shared/util/timer.h"
 #include "shared/ros/ros_helpers.h"
 #include "navigation.h"
+#include "profiler/profiler.h"
 #include "visualization/visualization.h"
+#include "visualization/visualization_manager.h"
 #include "navigation/path_generation.h"
 
 using Eigen::Vector2f;
@@ -48,10 +50,16 @@ using namespace ros_helpers;
 
 namespace {
 ros::Publisher drive_pub_;
-ros::Publisher viz_pub_;
+visualization::VisualizationManager visualization_;
 VisualizationMsg local_viz_msg_;
 VisualizationMsg global_viz_msg_;
 AckermannCurvatureDriveMsg drive_msg_;
+// Visualization built by the control loop, published from another thread.
+struct VisualizationFrame {
+  VisualizationMsg local;
+  VisualizationMsg global;
+};
+navigation::Snapshot<VisualizationFrame> viz_frame_;
 // Epsilon value for handling limited numerical precision.
 const float kEpsilon = 1e-5;
 
@@ -72,14 +80,23 @@ Navigation::Navigation(const string& map_name, ros::NodeHandle* n) :
     robot_angle_(0),
     robot_vel_(0, 0),
     robot_omega_(0),
+    odom_started_(false),
     nav_complete_(true),
     nav_goal_loc_(0, 0),
-    nav_goal_angle_(0)
+    nav_goal_angle_(0),
+    goal_pending_(false),
+    pending_goal_loc_(0, 0),
+    pending_goal_angle_(0),
+    scan_loc_(0, 0),
+    scan_angle_(0),
+    scan_inserted_(false)
     {
   map_.Load(GetMapFileFromName(map_name));
-  drive_pub_ = n->advertise<AckermannCurvatureDriveMsg>(
-      "ackermann_curvature_drive", 1);
-  viz_pub_ = n->advertise<VisualizationMsg>("visualization", 1);
+  if (n != nullptr) {
+    drive_pub_ = n->advertise<AckermannCurvatureDriveMsg>(
+        "ackermann_curvature_drive", 1);
+    visualization_.Init(n);
+  }
   local_viz_msg_ = visualization::NewVisualizationMessage(
       "base_link", "navigation_local");
   global_viz_msg_ = visualization::NewVisualizationMessage(
@@ -94,6 +111,9 @@ Navigation::Navigation(const string& map_name, ros::NodeHandle* n) :
   controller_ = new controllers::time_optimal_1D::Controller(car_, TIME_STEP, CAR_MARGIN, MAX_CLEARANCE, CURVATURE_SAMPLING_INTERVAL);
 
   latency_controller_ = new controllers::latency_compensation::Controller(car_, TIME_STEP, CAR_MARGIN, MAX_CLEARANCE, CURVATURE_SAMPLING_INTERVAL, LATENCY);
+  if (DYNAMIC_WINDOW) {
+    latency_controller_->setDynamicWindow(DYNAMIC_WINDOW_VELOCITIES, DYNAMIC_WINDOW_CURVATURES, DYNAMIC_WINDOW_SPEED_WEIGHT);
+  }
 
   //* instantiating the local planner
   // Simple path for testing purposes
@@ -106,79 +126,176 @@ Navigation::Navigation(const string& map_name, ros::NodeHandle* n) :
   // }
   // carrot_planner_ = new local_planners::CarrotPlanner(STICK_LENGTH, GOAL_TOL, PATH_DEV_TOL);
   smoothed_planner_ = new local_planners::SmoothedPlanner(map_, STICK_LENGTH, GOAL_TOL, PATH_DEV_TOL);
+  if (LOCAL_COSTMAP) {
+    // Distances are kept as far as the clearance of the footprint is scored
+    path_generation::Footprint footprint;
+    footprint.set(*car_);
+    costmap_.Build(map_, COSTMAP_SIZE, COSTMAP_RESOLUTION, footprint.radius + MAX_CLEARANCE);
+    smoothed_planner_->setCostmap(&costmap_);
+  }
 
   // robot_config_ = NavigationParams();
   // +
 
   // instantiate a global planner
   global_planner_ = new global_planner::GlobalPlanner(map_, n, GOAL_THRESHOLD, GRAPH_RESOLUTION, COLLISION_PROXIMITY, SAMPLE_BUFFER, OPTIMIZATION_RADIUS);
+  if (GRID_SEARCH) {
+    global_planner_->UseGridSearch(GRID_SEARCH_RESOLUTION);
+  }
+  if (ROADMAP) {
+    global_planner_->UseRoadmap(GetMapFileFromName(map_name) + ".roadmap");
+  }
+  global_planner_->ReuseTrees(TREE_CACHE_SIZE);
+  global_planner_->SetGoalBias(GOAL_BIAS);
+  global_planner_->SetPlanningThreads(PLANNER_THREADS);
+  global_planner_->SetVisualizationRate(PLANNER_VISUALIZATION_RATE);
   global_path_found_ = false;
+  global_path_version_ = 0;
+  path_requested_ = false;
+  synchronous_planning_ = false;
+
+  // Searches run on the planner's own thread so the control loop keeps publishing
+  global_planner_->StartPlanningService(MAX_SAMPLING_ITERATIONS, REFINEMENT_ITERATIONS, REFINEMENT_TIME);
+}
+
+void Navigation::PlanSynchronously() {
+  global_planner_->StopPlanningService();
+  synchronous_planning_ = true;
 }
 
 void Navigation::SetNavGoal(const Vector2f& loc, float angle) {
+  std::lock_guard<std::mutex> lock(goal_mutex_);
+  pending_goal_loc_ = loc;
+  pending_goal_angle_ = angle;
+  goal_pending_ = true;
+}
+
+void Navigation::StartNavigation(const Vector2f& loc, float angle) {
   // Update navigation goal
   nav_goal_loc_ = loc;
   nav_goal_angle_ = angle;
 
   std::cout << "[Navigation] Calculating global path from (" << robot_loc_[0] << ", " << robot_loc_[1] << ") to (" << loc[0] << ", " << loc[1] << ")" << std::endl;
 
-  // Clear previous global path
-  global_path_found_ = false;
-  global_planner_->ClearPath();
-
-  // Calculate global path from planner
-  global_planner_->SetRobotLocation(robot_loc_);
-  global_planner_->SetGoalLocation(nav_goal_loc_);
-  global_path_found_ = global_planner_->CalculatePath(MAX_SAMPLING_ITERATIONS);
-
-  if (global_path_found_) {
-    std::cout << "[Navigation] Global path ready!" << std::endl;
-  }
-  else{
-    std::cout << "[Navigation] Global path not found!" << std::endl;
-  }
+  // Replaces any search in progress, the current path is followed until the new one arrives
+  global_planner_->RequestPath(robot_loc_, nav_goal_loc_);
+  path_requested_ = true;
   nav_complete_ = false;
 }
 
 void Navigation::UpdateLocation(const Eigen::Vector2f& loc, float angle) {
-  localization_initialized_ = true;
-  robot_loc_ = loc;
-  robot_angle_ = angle;
+  LocalizationState& localization = localization_.Back();
+  localization.initialized = true;
+  localization.loc = loc;
+  localization.angle = angle;
+  localization_.Publish();
 }
 
 void Navigation::UpdateOdometry(const Vector2f& loc,
                                 float angle,
                                 const Vector2f& vel,
                                 float ang_vel) {
-  robot_omega_ = ang_vel;
-  robot_vel_ = vel;
-  if (!odom_initialized_) {
+  if (!odom_started_) {
     odom_start_angle_ = angle;
     odom_start_loc_ = loc;
-    odom_initialized_ = true;
-    odom_loc_ = loc;
-    odom_angle_ = angle;
-    return;
+    odom_started_ = true;
   }
-  odom_loc_ = loc;
-  odom_angle_ = angle;
+  OdometryState& odometry = odometry_.Back();
+  odometry.initialized = true;
+  odometry.loc = loc;
+  odometry.angle = angle;
+  odometry.vel = vel;
+  odometry.omega = ang_vel;
+  odometry_.Publish();
 }
 
 void Navigation::ObservePointCloud(const vector<Vector2f>& cloud,
                                    double time) {
-  point_cloud_ = cloud;   
-  last_msg_timestamp_ = time;                       
+  ScanState& scan = scan_.Back();
+  scan.cloud.SetDownsampling(SCAN_MIN_SPACING, SCAN_MAX_RANGE);
+  scan.cloud.Filter(cloud);
+  scan.timestamp = time;
+  scan_.Publish();
+}
+
+void Navigation::ObserveLaser(const vector<float>& ranges,
+                              float range_max,
+                              float angle_min,
+                              float angle_increment,
+                              const Vector2f& laser_loc,
+                              double time) {
+  ScanState& scan = scan_.Back();
+  scan.cloud.SetDownsampling(SCAN_MIN_SPACING, SCAN_MAX_RANGE);
+  scan.cloud.Convert(ranges, range_max, angle_min, angle_increment, laser_loc);
+  scan.timestamp = time;
+  scan_.Publish();
+}
+
+void Navigation::PublishVisualization() {
+  if (!viz_frame_.Acquire()) return;
+  visualization_.Publish(viz_frame_.Front().local);
+  visualization_.Publish(viz_frame_.Front().global);
 }
 
 void Navigation::Run() {
+  PROFILE_SCOPE("Navigation::Run");
   // TODO Testing
   drive_msg_.curvature = 0.1;
   drive_msg_.velocity = -1.0;
   drive_msg_.header.stamp = ros::Time::now();
-  drive_pub_.publish(drive_msg_);
+  if (drive_pub_) {
+    drive_pub_.publish(drive_msg_);
+  }
 
   // This function gets called 20 times a second to form the control loop.
 
+  // Take the newest sensor state, the callbacks keep writing while the loop runs
+  odometry_.Acquire();
+  localization_.Acquire();
+  const bool new_scan = scan_.Acquire();
+  const OdometryState& odometry = odometry_.Front();
+  odom_initialized_ = odometry.initialized;
+  odom_loc_ = odometry.loc;
+  odom_angle_ = odometry.angle;
+  robot_vel_ = odometry.vel;
+  robot_omega_ = odometry.omega;
+  const LocalizationState& localization = localization_.Front();
+  localization_initialized_ = localization.initialized;
+  robot_loc_ = localization.loc;
+  robot_angle_ = localization.angle;
+  const ScanState& scan = scan_.Front();
+  // Every scan is inserted into the costmap once, at the pose localized when it is picked up
+  if (!costmap_.Empty() && localization_initialized_) {
+    costmap_.Recenter(robot_loc_);
+    if (new_scan) {
+      costmap_.InsertScan(scan.cloud.Cloud(), robot_loc_, robot_angle_);
+      scan_loc_ = robot_loc_;
+      scan_angle_ = robot_angle_;
+      scan_inserted_ = true;
+    }
+  }
+
+  bool new_goal = false;
+  Vector2f goal_loc;
+  float goal_angle = 0;
+  {
+    std::lock_guard<std::mutex> lock(goal_mutex_);
+    if (goal_pending_) {
+      new_goal = true;
+      goal_loc = pending_goal_loc_;
+      goal_angle = pending_goal_angle_;
+      goal_pending_ = false;
+    }
+  }
+  if (new_goal) {
+    StartNavigation(goal_loc, goal_angle);
+  }
+  // Without the planner's thread the search of this tick, or a replan
+  // requested by the last one, is run before the path is picked up
+  if (synchronous_planning_) {
+    global_planner_->ServeRequest(MAX_SAMPLING_ITERATIONS, REFINEMENT_ITERATIONS);
+  }
+
   // Clear previous visualizations.
   visualization::ClearVisualizationMsg(local_viz_msg_);
   visualization::ClearVisualizationMsg(global_viz_msg_);
@@ -193,13 +310,26 @@ void Navigation::Run() {
 
   // If odometry has not been initialized, we can't do anything.
   if (!odom_initialized_) return;
+
+  // Pick up the planner's latest solution, which improves while the search keeps refining it
+  if (global_planner_->GetLatestPath(&testing_path, &global_path_version_)) {
+    if (!global_path_found_) {
+      std::cout << "[Navigation] Global path ready!" << std::endl;
+    }
+    global_path_found_ = true;
+    // carrot_planner_->populatePath(testing_path);
+    smoothed_planner_->populatePath(testing_path);
+  }
+  if (path_requested_ && !global_planner_->Planning()) {
+    path_requested_ = false;
+    if (!global_path_found_) {
+      std::cout << "[Navigation] Global path not found!" << std::endl;
+    }
+  }
   if (!global_path_found_) return;
 
   // . regular TOC
   // controllers::time_optimal_1D::Command command {controller_->generateCommand(point_cloud_, robot_vel_(0))};
-  testing_path = global_planner_->GetPath();
-  // carrot_planner_->populatePath(testing_path);
-  smoothed_planner_->populatePath(testing_path);
 
   //Temp visualization of path
   for (std::size_t i=0; i<=testing_path.size()-2; i++){
@@ -215,14 +345,14 @@ void Navigation::Run() {
   Vector2f goal {smoothed_planner_->interpolatePath(robot_loc_, robot_angle_, 0.1, l1, l2)};
   if (smoothed_planner_->reachedGoal(robot_loc_, nav_goal_loc_)) {
     global_path_found_ = false;
+    global_planner_->CancelPath();   // No refinement should restart the robot
+    path_requested_ = false;
     std::cout << "[Navigation] Robot stopped " << (robot_loc_-nav_goal_loc_).norm() << "m from goal." << std::endl;
   }
-  if (!smoothed_planner_->planStillValid(robot_loc_)) {
-    global_path_found_ = false;
-    global_planner_->ClearPath();
-    global_planner_->SetRobotLocation(robot_loc_);
-    global_planner_->SetGoalLocation(nav_goal_loc_);
-    global_path_found_ = global_planner_->CalculatePath(MAX_SAMPLING_ITERATIONS);
+  if (!smoothed_planner_->planStillValid(robot_loc_) && !path_requested_) {
+    // Keep driving the old path while the replacement is searched
+    global_planner_->RequestPath(robot_loc_, nav_goal_loc_);
+    path_requested_ = true;
   }
 
   visualization::DrawLine(l1.p0, l1.p1, 0x47FA00, global_viz_msg_);
@@ -240,7 +370,11 @@ void Navigation::Run() {
   path_generation::Path best_path;
   std::vector<path_generation::Path> path_options;
   Eigen::Vector2f global_goal {testing_path[testing_path.size() - 1] - robot_loc_};
-  controllers::time_optimal_1D::Command command {latency_controller_->generateCommand(point_cloud_, robot_vel_(0), last_msg_timestamp_, path_options, best_path, goal, global_goal)};
+  // The costmap only holds scans inserted at a localized pose, see above
+  const bool use_costmap {!costmap_.Empty() && localization_initialized_ && scan_inserted_};
+  controllers::time_optimal_1D::Command command {use_costmap ?
+      latency_controller_->generateCommand(costmap_, scan_loc_, scan_angle_, robot_vel_(0), scan.timestamp, path_options, best_path, goal, global_goal) :
+      latency_controller_->generateCommand(scan.cloud.Cloud(), robot_vel_(0), scan.timestamp, path_options, best_path, goal, global_goal)};
 
   // // . Draw possible paths
   // std::vector<float> regimes {0.03, 0.1, 0.25, 0.5}; // clearance
@@ -282,10 +416,17 @@ void Navigation::Run() {
   global_viz_msg_.header.stamp = ros::Time::now();
   drive_msg_.header.stamp = ros::Time::now();
 
-  // Publish messages.
-  viz_pub_.publish(local_viz_msg_);
-  viz_pub_.publish(global_viz_msg_);
-  drive_pub_.publish(drive_msg_);
+  // Publish messages. Visualization goes out from the thread calling
+  // PublishVisualization, so the loop only pays for the copy.
+  if (drive_pub_) {
+    drive_pub_.publish(drive_msg_);
+  }
+  if (visualization_.Due(local_viz_msg_.ns)) {
+    VisualizationFrame& frame = viz_frame_.Back();
+    frame.local = local_viz_msg_;
+    frame.global = global_viz_msg_;
+    viz_frame_.Publish();
+  }
 
   // std::cout << "End of loop" << std::endl;
 }
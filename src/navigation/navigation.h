@@ -19,14 +19,17 @@
 */
 //========================================================================
 
+#include <mutex>
 #include <vector>
 #include "eigen3/Eigen/Dense"
 #include "vector_map/vector_map.h"
+#include "laser_scan/scan_cloud.h"
 
 #include "vehicles.hpp"
 #include "controllers.h"
 #include "global_planner.h"
 #include "local_planner.h"
+#include "snapshot.h"
 
 #ifndef NAVIGATION_H
 #define NAVIGATION_H
@@ -49,7 +52,8 @@ struct PathOption {
 class Navigation {
  public:
 
-   // Constructor
+   // Constructor. Without a node handle nothing is published, as when
+   // replaying a bag offline.
   explicit Navigation(const std::string& map_file, ros::NodeHandle* n);
 
   // +
@@ -58,9 +62,13 @@ class Navigation {
     delete car_;
     delete controller_;
     delete latency_controller_;
+    delete global_planner_;
   }
   // +
 
+  // The sensor updates below may be called from a thread of their own, their
+  // state reaches the control loop through snapshots.
+
   // Used in callback from localization to update position.
   void UpdateLocation(const Eigen::Vector2f& loc, float angle);
 
@@ -74,12 +82,53 @@ class Navigation {
   void ObservePointCloud(const std::vector<Eigen::Vector2f>& cloud,
                          double time);
 
-  // Main function called continously from main
+  // Updates based on an observed laser scan, converted straight into the
+  // navigation's own cloud buffer instead of being copied in. Both are
+  // downsampled to SCAN_MIN_SPACING and SCAN_MAX_RANGE.
+  void ObserveLaser(const std::vector<float>& ranges,
+                    float range_max,
+                    float angle_min,
+                    float angle_increment,
+                    const Eigen::Vector2f& laser_loc,
+                    double time);
+
+  // Main function called continously from main, the fixed rate control loop.
   void Run();
-  // Used to set the next target pose.
+  // Used to set the next target pose. Safe to call from any thread, the goal
+  // is picked up by the next Run.
   void SetNavGoal(const Eigen::Vector2f& loc, float angle);
+  // Publish the visualization of the last Run, from a lower priority thread
+  // than the control loop.
+  void PublishVisualization();
+  // Search global paths inside Run, on the control loop's clock, instead of
+  // on the planner's thread, so that a replayed bag plans the same paths on
+  // every run.
+  void PlanSynchronously();
 
  private:
+  // Sensor state handed from the callbacks to the control loop.
+  struct OdometryState {
+    bool initialized = false;
+    Eigen::Vector2f loc = Eigen::Vector2f::Zero();
+    float angle = 0;
+    Eigen::Vector2f vel = Eigen::Vector2f::Zero();
+    float omega = 0;
+  };
+  struct LocalizationState {
+    bool initialized = false;
+    Eigen::Vector2f loc = Eigen::Vector2f::Zero();
+    float angle = 0;
+  };
+  struct ScanState {
+    laser_scan::ScanCloud cloud;
+    double timestamp = 0;
+  };
+
+  // Start planning to the goal, on the control loop.
+  void StartNavigation(const Eigen::Vector2f& loc, float angle);
+
+  // The members below up to the snapshots are the control loop's copy of the
+  // sensor state, refreshed at the start of every Run.
 
   // Whether odometry has been initialized.
   bool odom_initialized_;
@@ -101,8 +150,13 @@ class Navigation {
   Eigen::Vector2f odom_start_loc_;
   // Odometry-reported robot starting angle.
   float odom_start_angle_;
-  // Latest observed point cloud.
-  std::vector<Eigen::Vector2f> point_cloud_;
+  // Whether the starting odometry was recorded, on the sensor side.
+  bool odom_started_;
+  // Latest sensor state, written by the callbacks.
+  Snapshot<OdometryState> odometry_;
+  Snapshot<LocalizationState> localization_;
+  // Latest observed point cloud, downsampled for the local planner.
+  Snapshot<ScanState> scan_;
 
   // Whether navigation is complete.
   bool nav_complete_;
@@ -110,15 +164,26 @@ class Navigation {
   Eigen::Vector2f nav_goal_loc_;
   // Navigation goal angle.
   float nav_goal_angle_;
+  // Goal set by SetNavGoal and not yet picked up by Run.
+  std::mutex goal_mutex_;
+  bool goal_pending_;
+  Eigen::Vector2f pending_goal_loc_;
+  float pending_goal_angle_;
   // Map of the environment.
   vector_map::VectorMap map_;
+  // Map and latest scan around the robot, only used by Run.
+  local_planners::LocalCostmap costmap_;
+  // Pose the latest scan was inserted at, which the latency compensation projects from.
+  Eigen::Vector2f scan_loc_;
+  float scan_angle_;
+  // Whether a scan was inserted at all; until then the live cloud is scored instead.
+  bool scan_inserted_;
 
   // +
   // Car object
   vehicles::UT_Automata *car_;
   // Controller object
   controllers::time_optimal_1D::Controller *controller_;
-  double last_msg_timestamp_;
   controllers::latency_compensation::Controller *latency_controller_;
   // Local Planner
   std::vector<Vector2f> testing_path;
@@ -131,6 +196,12 @@ class Navigation {
   // Global planner object
   global_planner::GlobalPlanner *global_planner_;
   bool global_path_found_;
+  // Version of the planner solution being followed.
+  unsigned int global_path_version_;
+  // Whether a search was requested and has not finished yet.
+  bool path_requested_;
+  // Whether Run searches the requested paths itself.
+  bool synchronous_planning_;
 };
 
 }  // namespace navigation
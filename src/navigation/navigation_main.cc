@@ -19,12 +19,16 @@
 */
 //========================================================================
 
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <atomic>
+#include <thread>
 #include <vector>
 
 #include "glog/logging.h"
@@ -42,13 +46,16 @@
 #include "visualization_msgs/MarkerArray.h"
 #include "nav_msgs/Odometry.h"
 #include "ros/ros.h"
+#include "ros/callback_queue.h"
 #include "shared/math/math_util.h"
 #include "shared/util/timer.h"
 #include "shared/ros/ros_helpers.h"
 
 #include "std_msgs/String.h"
 
+#include "bag_replay/bag_replay.h"
 #include "navigation.h"
+#include "profiler/profiler.h"
 
 using amrl_msgs::Localization2DMsg;
 using math_util::DegToRad;
@@ -71,8 +78,13 @@ DEFINE_string(init_topic,
               "initialpose",
               "Name of ROS topic for initialization");
 DEFINE_string(map, "GDC1", "Name of vector map file");
+DEFINE_string(bag, "",
+              "Replay this bag as fast as possible instead of subscribing "
+              "to the topics, and print the time every callback took");
 
-bool run_ = true;
+DECLARE_bool(visualization);
+
+std::atomic_bool run_(true);
 sensor_msgs::LaserScan last_laser_msg_;
 Navigation* navigation_ = nullptr;
 
@@ -92,20 +104,9 @@ void LaserCallback(const sensor_msgs::LaserScan& msg) {
   // msg.range_max // Maximum observable range
   // msg.range_min // Minimum observable range
   // msg.ranges[i] // The range of the i'th ray
-  static vector<Vector2f> point_cloud_;   // vector of (x,y) coordinates
-
-  // Convert the LaserScan to a point cloud
-  int i {};
-  point_cloud_.clear();
-  for (float theta = msg.angle_min; theta <= msg.angle_max; theta += msg.angle_increment) {
-    if (msg.ranges[i] < msg.range_max){
-      point_cloud_.push_back(Eigen::Vector2f {msg.ranges[i] * cos(theta) + kLaserLoc.x(), msg.ranges[i] * sin(theta) + kLaserLoc.y()});
-    }
-    i++;
-  }
-  // +
 
-  navigation_->ObservePointCloud(point_cloud_, msg.header.stamp.toSec());
+  // Convert the LaserScan to a point cloud, directly into the navigation's buffer
+  navigation_->ObserveLaser(msg.ranges, msg.range_max, msg.angle_min, msg.angle_increment, kLaserLoc, msg.header.stamp.toSec());
   last_laser_msg_ = msg;
 }
 
@@ -148,33 +149,94 @@ void StringCallback(const std_msgs::String& msg) {
   std::cout << msg.data << "\n";
 }
 
+// Give the calling thread a real-time priority above the default scheduler,
+// when the process is allowed to.
+void RaiseThreadPriority(int priority) {
+  sched_param param;
+  param.sched_priority = priority;
+  const int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (error != 0) {
+    printf("Control loop keeps the default priority: %s\n", strerror(error));
+  }
+}
+
+// Fixed rate control loop, on a thread of its own so the callbacks and the
+// visualization never delay a command.
+void ControlLoop() {
+  RaiseThreadPriority(CONTROL_PRIORITY);
+  RateLoop loop(CONTROL_RATE);
+  while (run_ && ros::ok()) {
+    navigation_->Run();
+    loop.Sleep();
+  }
+}
+
+// The control loop runs at its rate in bag time, between the messages, and
+// plans its global paths itself so no search depends on the wall clock.
+bool ProcessBag(const string& file) {
+  bag_replay::BagReplay replay;
+  replay.Subscribe<Localization2DMsg>(FLAGS_loc_topic, LocalizationCallback);
+  replay.Subscribe<nav_msgs::Odometry>(FLAGS_odom_topic, OdometryCallback);
+  replay.Subscribe<sensor_msgs::LaserScan>(FLAGS_laser_topic, LaserCallback);
+  replay.Subscribe<geometry_msgs::PoseStamped>("/move_base_simple/goal",
+                                               GoToCallback);
+  replay.AddTimer("Navigation::Run", 1.0 / CONTROL_RATE,
+                  []() { navigation_->Run(); });
+  if (!replay.Run(file)) return false;
+  replay.PrintStatistics();
+  printf("%s", profiler::Report().c_str());
+  return true;
+}
+
 int main(int argc, char** argv) {
   google::ParseCommandLineFlags(&argc, &argv, false);
   signal(SIGINT, SignalHandler);
   // Initialize ROS.
   ros::init(argc, argv, "navigation", ros::init_options::NoSigintHandler);
+  if (!FLAGS_bag.empty()) {
+    // Offline nothing is advertised or drawn, so no ROS master is needed.
+    FLAGS_visualization = false;
+    navigation_ = new Navigation(FLAGS_map, nullptr);
+    navigation_->PlanSynchronously();
+    const bool replayed = ProcessBag(FLAGS_bag);
+    delete navigation_;
+    return replayed ? 0 : 1;
+  }
   ros::NodeHandle n;
   navigation_ = new Navigation(FLAGS_map, &n);
 
   ros::Subscriber string_sub = 
       n.subscribe("string_topic", 1, &StringCallback);
 
+  // Sensor callbacks get a queue and a thread of their own, so scans are
+  // converted as soon as they arrive instead of at the next control tick.
+  ros::CallbackQueue sensor_queue;
+  ros::NodeHandle sensor_n;
+  sensor_n.setCallbackQueue(&sensor_queue);
   ros::Subscriber velocity_sub =
-      n.subscribe(FLAGS_odom_topic, 1, &OdometryCallback);
+      sensor_n.subscribe(FLAGS_odom_topic, 1, &OdometryCallback);
   ros::Subscriber localization_sub =
-      n.subscribe(FLAGS_loc_topic, 1, &LocalizationCallback);
+      sensor_n.subscribe(FLAGS_loc_topic, 1, &LocalizationCallback);
   ros::Subscriber laser_sub =
-      n.subscribe(FLAGS_laser_topic, 1, &LaserCallback);
+      sensor_n.subscribe(FLAGS_laser_topic, 1, &LaserCallback);
   ros::Subscriber goto_sub =
       n.subscribe("/move_base_simple/goal", 1, &GoToCallback);
+  ros::AsyncSpinner sensor_spinner(1, &sensor_queue);
+  sensor_spinner.start();
 
-  RateLoop loop(20.0);
-  // RateLoop loop(5.0);
+  profiler::StartReporting(&n);
+  std::thread control_thread(ControlLoop);
+
+  // Goals and visualization are handled here, at the lowest priority.
+  RateLoop loop(NAVIGATION_VISUALIZATION_RATE);
   while (run_ && ros::ok()) {
     ros::spinOnce();
-    navigation_->Run();
+    navigation_->PublishVisualization();
     loop.Sleep();
   }
+  control_thread.join();
+  sensor_spinner.stop();
+  profiler::StopReporting();
   delete navigation_;
   return 0;
 }
@@ -0,0 +1,105 @@
+//========================================================================
+/*!
+\file    node_index.h
+\brief   Uniform grid over the locations of the RRT* nodes, for nearest
+         neighbor and radius queries that only visit nearby cells.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+namespace global_planner {
+
+class NodeIndex {
+  public:
+    explicit NodeIndex(const float cell_size) : cell_size_(cell_size) {}
+
+    void Clear(void) {
+      cells_.clear();
+      min_cell_ = {std::numeric_limits<int>::max(), std::numeric_limits<int>::max()};
+      max_cell_ = {std::numeric_limits<int>::min(), std::numeric_limits<int>::min()};
+    }
+
+    void Insert(const unsigned int id, const Eigen::Vector2f& loc) {
+      const std::pair<int, int> cell = CellOf(loc);
+      cells_[Key(cell.first, cell.second)].push_back({id, loc});
+      min_cell_ = {std::min(min_cell_.first, cell.first), std::min(min_cell_.second, cell.second)};
+      max_cell_ = {std::max(max_cell_.first, cell.first), std::max(max_cell_.second, cell.second)};
+    }
+
+    // Closest inserted node to loc, searching rings of cells outwards until no closer node can remain. Returns false
+    // when the index is empty.
+    bool Nearest(const Eigen::Vector2f& loc, unsigned int* id) const {
+      if (cells_.empty()) return false;
+      const std::pair<int, int> center = CellOf(loc);
+      const int max_ring = std::max(std::max(std::abs(center.first - min_cell_.first), std::abs(max_cell_.first - center.first)),
+                                    std::max(std::abs(center.second - min_cell_.second), std::abs(max_cell_.second - center.second)));
+      float best_dist_sq = std::numeric_limits<float>::max();
+      for (int ring = 0; ring <= max_ring; ring++) {
+        for (int i = center.first - ring; i <= center.first + ring; i++) {
+          // only the border of the ring, the inside was searched already
+          const int step = (i == center.first - ring || i == center.first + ring) ? 1 : 2 * ring;
+          for (int j = center.second - ring; j <= center.second + ring; j += std::max(step, 1)) {
+            const auto cell = cells_.find(Key(i, j));
+            if (cell == cells_.end()) continue;
+            for (const auto& entry : cell->second) {
+              const float dist_sq = (entry.second - loc).squaredNorm();
+              if (dist_sq < best_dist_sq) {
+                best_dist_sq = dist_sq;
+                *id = entry.first;
+              }
+            }
+          }
+        }
+        // anything in the next ring is at least ring cells away
+        const float ring_dist = ring * cell_size_;
+        if (best_dist_sq <= ring_dist * ring_dist) break;
+      }
+      return true;
+    }
+
+    // Ids of the nodes strictly within radius of loc, in no particular order.
+    void Radius(const Eigen::Vector2f& loc, const float radius, std::vector<unsigned int>* ids) const {
+      ids->clear();
+      const std::pair<int, int> low = CellOf(loc - Eigen::Vector2f(radius, radius));
+      const std::pair<int, int> high = CellOf(loc + Eigen::Vector2f(radius, radius));
+      for (int i = std::max(low.first, min_cell_.first); i <= std::min(high.first, max_cell_.first); i++) {
+        for (int j = std::max(low.second, min_cell_.second); j <= std::min(high.second, max_cell_.second); j++) {
+          const auto cell = cells_.find(Key(i, j));
+          if (cell == cells_.end()) continue;
+          for (const auto& entry : cell->second) {
+            if ((entry.second - loc).squaredNorm() < radius * radius) {
+              ids->push_back(entry.first);
+            }
+          }
+        }
+      }
+    }
+
+  private:
+    std::pair<int, int> CellOf(const Eigen::Vector2f& loc) const {
+      return {static_cast<int>(std::floor(loc.x() / cell_size_)), static_cast<int>(std::floor(loc.y() / cell_size_))};
+    }
+
+    static int64_t Key(const int i, const int j) {
+      // Shifted unsigned, a negative i would make the signed shift undefined
+      return static_cast<int64_t>((static_cast<uint64_t>(static_cast<uint32_t>(i)) << 32) ^ static_cast<uint32_t>(j));
+    }
+
+    float cell_size_;
+    std::unordered_map<int64_t, std::vector<std::pair<unsigned int, Eigen::Vector2f>>> cells_;
+    std::pair<int, int> min_cell_ {std::numeric_limits<int>::max(), std::numeric_limits<int>::max()};
+    std::pair<int, int> max_cell_ {std::numeric_limits<int>::min(), std::numeric_limits<int>::min()};
+};
+
+} // namespace global_planner
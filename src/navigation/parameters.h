@@ -1,13 +1,24 @@
 #pragma once
 
+// Executor values
+#define CONTROL_RATE                    20.0    // Hz
+#define CONTROL_PRIORITY                50      // SCHED_FIFO priority of the control loop, needs the privilege
+#define NAVIGATION_VISUALIZATION_RATE   10.0    // Hz, also the rate goals are picked up at
 // Obstacle avoidance values
-#define LATENCY                         0.0 //0.10    // s
+#define LATENCY                         0.10    // s
+#define COMMAND_HISTORY_SIZE            64      // commands kept for latency compensation
 #define TIME_STEP                       0.05    // s
 #define MAX_SPEED                       1.0     // m/s
 #define MAX_ACCELERATION                4.0     // m/s^2
 #define MAX_CURVATURE                   1.0     // m^(-1)
 #define CURVATURE_SAMPLING_INTERVAL     0.05   // m
 #define N_PATHS                         31
+#define PATH_SAMPLING_THREADS           4       // workers sharing the path options of a cycle
+#define SWEPT_FOOTPRINT_RESOLUTION      0.05    // m, cells of the precomputed swept areas of the arcs
+#define DYNAMIC_WINDOW                  0       // search speed and curvature jointly instead of curvature first
+#define DYNAMIC_WINDOW_VELOCITIES       7       // reachable speeds sampled per cycle
+#define DYNAMIC_WINDOW_CURVATURES       101     // arcs sampled per cycle
+#define DYNAMIC_WINDOW_SPEED_WEIGHT     1.0     // score of driving at max speed
 // Hardware values
 #define CAR_WIDTH                       0.281   // m
 #define CAR_LENGTH                      0.535   // m
@@ -15,6 +26,13 @@
 #define CAR_TRACK_WIDTH                 0.227   // m
 #define CAR_MARGIN                      0.05 //0.1    // m
 #define MAX_CLEARANCE                   0.5 //0.5     // m
+// Scan downsampling values
+#define SCAN_MIN_SPACING                0.02    // m, closer consecutive points are dropped, 0 keeps all
+#define SCAN_MAX_RANGE                  10.0    // m, farther points are dropped, 0 for the sensor range
+// Local costmap values
+#define LOCAL_COSTMAP                   1       // plan on a rolling grid of the map and scan instead of the raw scan
+#define COSTMAP_SIZE                    12.0    // m, side of the window around the robot
+#define COSTMAP_RESOLUTION              0.05    // m
 // Carrot planner values
 #define STICK_LENGTH                    3.0 // 5m
 #define GOAL_TOL                        0.3 // 1m
@@ -26,3 +44,16 @@
 #define SAMPLE_BUFFER                   5.0
 #define OPTIMIZATION_RADIUS             5.0
 #define MAX_SAMPLING_ITERATIONS         500000
+#define REFINEMENT_ITERATIONS           10000   // samples spent improving a found path
+#define REFINEMENT_TIME                 1.0     // s, cap on the refinement, 0 for none
+#define GOAL_BIAS                       0.05    // fraction of samples drawn at the goal
+#define PLANNER_VISUALIZATION_RATE      10.0    // Hz, 0 disables planner visualization
+#define TREE_CACHE_SIZE                 4       // trees kept for replans and repeated goals
+#define PLANNER_THREADS                 1       // independent RRT* trees grown in parallel, needs OpenMP
+// Grid A* Global Planner values
+#define GRID_SEARCH                     0       // plan with A* on a grid instead of RRT*
+#define GRID_SEARCH_RESOLUTION          0.1     // m
+// Roadmap Global Planner values
+#define ROADMAP                         0       // answer requests on <map>.roadmap when roadmap_builder wrote one, then fall back to the grid or RRT*
+#define ROADMAP_SPACING                 0.5     // m, lattice of the roadmap nodes
+#define ROADMAP_CONNECTION_RADIUS       1.5     // m, nodes and query ends are joined within it
@@ -1,7 +1,9 @@
 #include "path_generation.h"
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <iostream>
-// #include <cmath>
+#include <limits>
 // 1d time optimal control
 // given distance to go, max decel, max vel
 // out vel
@@ -10,6 +12,282 @@
 
 namespace path_generation {
 
+namespace {
+
+// Arcs are never followed for longer than this (m)
+const float kMaxFreePathLength = 5.0;
+
+// How much closer to the goal the car gets by driving along the arc for a while
+float goalProgress(float curvature, const Vector2f goal, const vehicles::Car& robot_config) {
+    Vector2f projected_pos(0.0, 0.0);
+    if (std::abs(curvature) <= std::abs(0.01)) {
+        projected_pos.x() = robot_config.limits_.max_speed_ * TIME_STEP;
+    } else {
+        float radius {1.0f / curvature};
+        float phi_g = (robot_config.limits_.max_speed_ * TIME_STEP * 20) / radius;
+        projected_pos.x() = radius * sin(phi_g);
+        projected_pos.y() = radius - (radius * cos(phi_g));
+    }
+    float new_goal_dist = (goal-projected_pos).norm();
+    return goal.norm() - new_goal_dist;
+}
+
+// Smallest distance from a circle center of the footprint to an obstacle, with base link s along the arc. center is
+// set to the closest center, in the frame of the car.
+float footprintDistance(float curvature, float s, const local_planners::LocalCostmap& costmap, const Footprint& footprint,
+                        const Vector2f& loc, const Eigen::Rotation2Df& rotation, Vector2f& center) {
+    const bool straight {std::abs(curvature) <= std::abs(0.01)};
+    const float theta {straight ? 0.f : curvature * s};
+    const Vector2f heading {std::cos(theta), std::sin(theta)};
+    const Vector2f base {straight ? Vector2f(s, 0) : Vector2f(heading.y() / curvature, (1 - heading.x()) / curvature)};
+    float min_distance {std::numeric_limits<float>::max()};
+    for (const float offset : footprint.offsets) {
+        const Vector2f p {base + offset * heading};
+        const float distance {costmap.Distance(loc + rotation * p)};
+        if (distance < min_distance) {
+            min_distance = distance;
+            center = p;
+        }
+    }
+    return min_distance;
+}
+
+// Radii of the sides and corners of the padded car about the center of an arc
+struct ArcGeometry {
+    float radius;
+    float r_inner;
+    float r_tl;
+    float r_tr;
+    float r_br;
+    float r_reach;
+    float theta_br;
+    float h;
+    float outer_side;
+};
+
+ArcGeometry arcGeometry(float curvature, const vehicles::Car& robot_config) {
+    ArcGeometry arc;
+    Vector2f c = Vector2f(0, 1 / curvature);
+    arc.h = (robot_config.dimensions_.length_ + robot_config.dimensions_.wheelbase_) / 2; // distance from base link to front bumper
+    arc.radius = c.norm();
+    arc.r_inner = c.norm() - robot_config.dimensions_.width_ / 2 - CAR_MARGIN;
+    float r_outer = c.norm() + robot_config.dimensions_.width_ / 2 + CAR_MARGIN;
+    arc.r_tl = (Vector2f(0, arc.r_inner) - Vector2f(arc.h + CAR_MARGIN, 0)).norm();
+    arc.r_tr = (Vector2f(0, r_outer) - Vector2f(arc.h + CAR_MARGIN, 0)).norm();
+    arc.r_br = (Vector2f(0, r_outer) - Vector2f((robot_config.dimensions_.length_ - robot_config.dimensions_.wheelbase_) / 2 + CAR_MARGIN, 0)).norm();
+    arc.theta_br = asin((robot_config.dimensions_.length_ + robot_config.dimensions_.wheelbase_) / 2 + CAR_MARGIN / arc.r_br); // angle where back right would hit
+    //. Points outside of the swept annulus cannot hit any side, so the trig is only paid for the ones inside
+    arc.r_reach = std::max(arc.r_tl, std::max(arc.r_br, arc.r_tr));
+    arc.outer_side = c.norm() + robot_config.dimensions_.width_ / 2;
+    return arc;
+}
+
+// Distance along the arc at which the car hits an obstacle dx ahead of the center of the arc and dy from the center
+// towards the car. The caller only takes positive lengths shorter than the free path so far.
+float arcHitLength(const ArcGeometry& arc, float dx, float dy) {
+    float r_p = std::sqrt(dx * dx + dy * dy);
+    if (r_p < arc.r_inner || r_p > arc.r_reach) {
+        return std::numeric_limits<float>::max();
+    }
+    float theta = atan2(dx, dy); // angle between p and c
+    float phi = 0;
+    float length = 5.0;
+    if (arc.r_inner <= r_p && r_p <= arc.r_tl) {    // inner side hit
+        phi = acos(arc.r_inner / r_p);
+        length = (theta - phi) * arc.radius;
+    }
+    if ((arc.r_inner <= r_p && r_p <= arc.r_br) && (-arc.theta_br <= theta && theta <= arc.theta_br)) {    // outer side hit
+        phi = acos(r_p / arc.outer_side);
+        length = (theta - phi) * arc.radius;
+    }
+    if (arc.r_tl <= r_p && r_p <= arc.r_tr) {    // front side hit
+        phi = asin(arc.h / r_p);
+        length = (theta - phi) * arc.radius;
+    }
+    return length;
+}
+
+// Gap the car leaves to an obstacle at r_p from the center of the arc
+float arcClearance(const ArcGeometry& arc, float r_p) {
+    float inner = std::abs(r_p - arc.r_inner);
+    float outer = std::abs(r_p - arc.r_tr);
+    return std::min(inner, outer);
+}
+
+// m, every bound of a cell is widened by it, past the float error of the exact evaluation and the difference between
+// an arc and the stored arc of the same radius it is looked up in
+const float kCellSlack = 1e-3;
+
+// Range of the distance to the center of the arc and of the angle atan2(dx, dy) over the box [x0, x1] x [y0, y1] of
+// (dx, dy)
+struct PolarRange {
+    float r0;
+    float r1;
+    float theta0;
+    float theta1;
+};
+
+PolarRange polarRange(float x0, float x1, float y0, float y1) {
+    PolarRange range;
+    const float near_x {std::min(std::max(0.f, x0), x1)};
+    const float near_y {std::min(std::max(0.f, y0), y1)};
+    range.r0 = std::sqrt(near_x * near_x + near_y * near_y);
+    range.r1 = std::sqrt(std::max(x0 * x0, x1 * x1) + std::max(y0 * y0, y1 * y1));
+    //. Boxes around the center, or across the cut of atan2 behind it, take every angle
+    if (x0 <= 0 && x1 >= 0 && y0 <= 0) {
+        range.theta0 = -M_PI;
+        range.theta1 = M_PI;
+        return range;
+    }
+    //. Otherwise the angle is continuous over the box and extreme at its corners
+    const float corners[4] {std::atan2(x0, y0), std::atan2(x0, y1), std::atan2(x1, y0), std::atan2(x1, y1)};
+    range.theta0 = *std::min_element(corners, corners + 4);
+    range.theta1 = *std::max_element(corners, corners + 4);
+    return range;
+}
+
+// Bounds of arcHitLength over every point in range, enclosing all the lengths the points can take
+struct HitBounds {
+    float low {std::numeric_limits<float>::max()};
+    float high {-std::numeric_limits<float>::max()};
+};
+
+HitBounds arcHitBounds(const ArcGeometry& arc, const PolarRange& range) {
+    HitBounds bounds;
+    if (range.r1 < arc.r_inner || range.r0 > arc.r_reach) {
+        return bounds;
+    }
+    //. Each branch is (theta - phi) * radius with phi monotonic in r_p, over the part of the range it covers. Points that
+    //. take no branch keep a length no free path reaches, and arguments out of the domain of phi give no hit.
+    HitBounds branches[3];
+    float r0 {std::max(range.r0, arc.r_inner)};
+    float r1 {std::min(range.r1, arc.r_tl)};
+    if (r0 <= r1) {    // inner side
+        branches[0].low = (range.theta0 - std::acos(arc.r_inner / r1)) * arc.radius;
+        branches[0].high = (range.theta1 - std::acos(arc.r_inner / r0)) * arc.radius;
+    }
+    const float theta0 {std::max(range.theta0, -arc.theta_br)};
+    const float theta1 {std::min(range.theta1, arc.theta_br)};
+    r1 = std::min(std::min(range.r1, arc.r_br), arc.outer_side);
+    if (r0 <= r1 && theta0 <= theta1) {    // outer side
+        branches[1].low = (theta0 - std::acos(r0 / arc.outer_side)) * arc.radius;
+        branches[1].high = (theta1 - std::acos(r1 / arc.outer_side)) * arc.radius;
+    }
+    r0 = std::max(std::max(range.r0, arc.r_tl), arc.h);
+    r1 = std::min(range.r1, arc.r_tr);
+    if (r0 <= r1) {    // front side
+        branches[2].low = (range.theta0 - std::asin(arc.h / r0)) * arc.radius;
+        branches[2].high = (range.theta1 - std::asin(arc.h / r1)) * arc.radius;
+    }
+    for (const HitBounds& branch : branches) {
+        bounds.low = std::min(bounds.low, branch.low);
+        bounds.high = std::max(bounds.high, branch.high);
+    }
+    return bounds;
+}
+
+// Lower bound of arcClearance over the distances in range, the gap only has kinks at the sides of the car
+float arcClearanceBound(const ArcGeometry& arc, const PolarRange& range) {
+    if ((range.r0 <= arc.r_inner && arc.r_inner <= range.r1) || (range.r0 <= arc.r_tr && arc.r_tr <= range.r1)) {
+        return 0;
+    }
+    return std::min(arcClearance(arc, range.r0), arcClearance(arc, range.r1));
+}
+
+// Millimeters, rounded towards the side that keeps the car safe, below the markers of SweptFootprints
+uint16_t toMillimeters(float value) {
+    return static_cast<uint16_t>(std::min(std::max(std::floor(value * 1e3f), 0.f), SweptFootprints::kExact - 1.f));
+}
+
+uint16_t toMillimetersAbove(float value) {
+    return static_cast<uint16_t>(std::min(std::max(std::ceil(value * 1e3f), 0.f), SweptFootprints::kExact - 1.f));
+}
+
+} // namespace
+
+float optionCurvature(int i, int num_options, float max_curvature) {
+    float curvature = max_curvature * pow(2*i/float(num_options-1) - 1, 2);
+    if (i < num_options / 2) {
+        curvature = -curvature;
+    }
+    return curvature;
+}
+
+void SweptFootprints::build(int num_options, const vehicles::Car& robot_config, float resolution) {
+    //. Arcs that samplePathOptions treats as straight need no table, turns of the same radius share one
+    curvatures_.clear();
+    option_arcs_.assign(num_options, -1);
+    for (int i = 0; i < num_options; i++) {
+        const float curvature {std::abs(optionCurvature(i, num_options, robot_config.limits_.max_curvature_))};
+        if (curvature <= std::abs(0.01)) {
+            continue;
+        }
+        for (std::size_t k = 0; k < curvatures_.size() && option_arcs_[i] < 0; k++) {
+            if (std::abs(curvatures_[k] - curvature) <= 1e-6f * curvature) {
+                option_arcs_[i] = k;
+            }
+        }
+        if (option_arcs_[i] < 0) {
+            option_arcs_[i] = curvatures_.size();
+            curvatures_.push_back(curvature);
+        }
+    }
+
+    const float front = (robot_config.dimensions_.length_ + robot_config.dimensions_.wheelbase_) / 2 + CAR_MARGIN;
+    const float rear = (robot_config.dimensions_.length_ - robot_config.dimensions_.wheelbase_) / 2 + CAR_MARGIN;
+    const float side = robot_config.dimensions_.width_ / 2 + CAR_MARGIN;
+    resolution_ = resolution;
+    min_x_ = -rear - 1;
+    min_y_ = -(kMaxFreePathLength + side + 1);
+    size_x_ = static_cast<int>(std::ceil((kMaxFreePathLength + front + 1 - min_x_) / resolution));
+    size_y_ = static_cast<int>(std::ceil(-2 * min_y_ / resolution));
+    entries_.resize(static_cast<std::size_t>(size_x_) * size_y_ * curvatures_.size());
+
+    //. Every entry bounds what the exact evaluation gives for any point of its cell, so that lookups only skip points
+    //. that cannot matter and never report more room than there is
+    for (std::size_t k = 0; k < curvatures_.size(); k++) {
+        const ArcGeometry arc {arcGeometry(curvatures_[k], robot_config)};
+        const float c_y {1 / curvatures_[k]};
+        const float max_length {std::min(static_cast<float>(M_PI) * arc.radius, kMaxFreePathLength)};
+        for (int ix = 0; ix < size_x_; ix++) {
+            const float x0 {min_x_ + ix * resolution - kCellSlack};
+            const float x1 {min_x_ + (ix + 1) * resolution + kCellSlack};
+            for (int iy = 0; iy < size_y_; iy++) {
+                const float y0 {c_y - (min_y_ + (iy + 1) * resolution) - kCellSlack};
+                const float y1 {c_y - (min_y_ + iy * resolution) + kCellSlack};
+                const PolarRange range {polarRange(x0, x1, y0, y1)};
+                const HitBounds hit {arcHitBounds(arc, range)};
+                //. The path along the arc to a point is theta * r_p
+                const float near {std::min(range.theta0 * range.r0, range.theta0 * range.r1) - kCellSlack};
+                const float far {std::max(range.theta1 * range.r0, range.theta1 * range.r1) + kCellSlack};
+                Entry& entry {entries_[(static_cast<std::size_t>(ix) * size_y_ + iy) * curvatures_.size() + k]};
+                entry.hit = hit.high <= 0 || hit.low >= max_length ? kNone : toMillimeters(hit.low - kCellSlack);
+                entry.clearance = toMillimeters(arcClearanceBound(arc, range) - kCellSlack);
+                entry.near = near >= 0 ? toMillimeters(near) : kExact;
+                entry.far = far >= 0 ? toMillimetersAbove(far) : kNone;
+            }
+        }
+    }
+}
+
+void SweptFootprints::locate(const ObstacleCloud& cloud, std::vector<int>& cells, std::vector<int>& mirrored_cells) const {
+    cells.resize(cloud.size());
+    mirrored_cells.resize(cloud.size());
+    for (std::size_t i = 0; i < cloud.size(); i++) {
+        cells[i] = cellOf(cloud.x[i], cloud.y[i]);
+        mirrored_cells[i] = cellOf(cloud.x[i], -cloud.y[i]);
+    }
+}
+
+int SweptFootprints::cellOf(float x, float y) const {
+    const int ix {static_cast<int>(std::floor((x - min_x_) / resolution_))};
+    const int iy {static_cast<int>(std::floor((y - min_y_) / resolution_))};
+    if (ix < 0 || iy < 0 || ix >= size_x_ || iy >= size_y_) {
+        return -1;
+    }
+    return ix * size_y_ + iy;
+}
+
 // float run1DTimeOptimalControl(float dist_to_go, float current_speed, const NavigationParams& robot_config) {
 //     float max_accel = robot_config.max_accel;
 //     float max_decel = robot_config.max_decel;
@@ -38,135 +316,125 @@ namespace path_generation {
 
 
 
+void Footprint::set(const vehicles::Car& robot_config) {
+    //. Padded rectangle from the rear to the front bumper, cut into pieces no longer than half its width. A circle
+    //. around the middle of each piece reaches the corners of the piece.
+    const float half_width = robot_config.dimensions_.width_ / 2 + CAR_MARGIN;
+    const float rear = -(robot_config.dimensions_.length_ - robot_config.dimensions_.wheelbase_) / 2 - CAR_MARGIN;
+    const float front = (robot_config.dimensions_.length_ + robot_config.dimensions_.wheelbase_) / 2 + CAR_MARGIN;
+    const int pieces {std::max(1, static_cast<int>(std::ceil((front - rear) / half_width)))};
+    const float piece {(front - rear) / pieces};
+    offsets.resize(pieces);
+    for (int i = 0; i < pieces; i++) {
+        offsets[i] = rear + (i + 0.5f) * piece;
+    }
+    radius = std::sqrt(half_width * half_width + piece * piece / 4);
+}
+
+void ObstacleCloud::set(const std::vector<Eigen::Vector2f>& point_cloud) {
+    x.resize(point_cloud.size());
+    y.resize(point_cloud.size());
+    for (std::size_t i = 0; i < point_cloud.size(); i++) {
+        x[i] = point_cloud[i][0];
+        y[i] = point_cloud[i][1];
+    }
+}
+
 // set curvature, free path length, obstruction for a path option
 void setPathOption(Path& path_option,
                         float curvature, const std::vector<Eigen::Vector2f>& point_cloud,
                         const vehicles::Car& robot_config,
                         const Vector2f goal,
                         const Vector2f global_goal) {
+    ObstacleCloud cloud;
+    cloud.set(point_cloud);
+    setPathOption(path_option, curvature, cloud, robot_config, goal, global_goal);
+}
+
+void setPathOption(Path& path_option,
+                        float curvature, const ObstacleCloud& cloud,
+                        const vehicles::Car& robot_config,
+                        const Vector2f goal,
+                        const Vector2f global_goal) {
     path_option.curvature = curvature;
     float h {(robot_config.dimensions_.length_ + robot_config.dimensions_.wheelbase_) / 2}; // distance from base link to front bumper
-    Vector2f projected_pos(0.0, 0.0);
-    float goal_distance = goal.norm();
     float global_goal_distance = global_goal.norm();
+    const std::size_t n {cloud.size()};
+    const float *xs {cloud.x.data()};
+    const float *ys {cloud.y.data()};
+    int obstruction {-1};
+    int closest {-1};
 
     if (std::abs(curvature) <= std::abs(0.01)) {
         // fpl
-        for (auto p: point_cloud) {
-            if (robot_config.dimensions_.width_ / 2 + CAR_MARGIN >= std::abs(p[1])
-                && p[0] < path_option.free_path_length) {
-                path_option.free_path_length = p[0] - h - CAR_MARGIN;
-                path_option.obstruction = p;
+        for (std::size_t i = 0; i < n; i++) {
+            if (robot_config.dimensions_.width_ / 2 + CAR_MARGIN >= std::abs(ys[i]) && xs[i] < path_option.free_path_length) {
+                path_option.free_path_length = xs[i] - h - CAR_MARGIN;
+                obstruction = i;
             }
         }
         // goal distance
-        projected_pos.x() = robot_config.limits_.max_speed_ * TIME_STEP;
-        float new_goal_dist = (goal-projected_pos).norm();
-        // goal_distance = (goal-projected_pos).norm();
-        path_option.dist_to_goal = goal_distance-new_goal_dist;
+        path_option.dist_to_goal = goalProgress(curvature, goal, robot_config);
         // Cap free path length when approaching the goal
         if (global_goal_distance < path_option.free_path_length) {
             path_option.free_path_length = global_goal_distance;
         }
         // clearance
-        for (const auto &p: point_cloud) {
-            if (p[0] >=0 and p[0] < path_option.free_path_length) {
-                float clearance_p = std::abs(p[1]) - robot_config.dimensions_.width_ / 2 - CAR_MARGIN;
+        for (std::size_t i = 0; i < n; i++) {
+            if (xs[i] >= 0 and xs[i] < path_option.free_path_length) {
+                float clearance_p = std::abs(ys[i]) - robot_config.dimensions_.width_ / 2 - CAR_MARGIN;
                 if (clearance_p < path_option.clearance) {
                     path_option.clearance = clearance_p;
-                    path_option.closest_point = p;
+                    closest = i;
                 }
             }
         }
+        if (obstruction >= 0) path_option.obstruction = cloud.point(obstruction);
+        if (closest >= 0) path_option.closest_point = cloud.point(closest);
         return;
     }
 
-    Vector2f c = Vector2f(0, 1 / curvature);
-    float r_inner = c.norm() - robot_config.dimensions_.width_ / 2 - CAR_MARGIN;
-    float r_outer = c.norm() + robot_config.dimensions_.width_ / 2 + CAR_MARGIN;
-    float r_tl = (Vector2f(0, r_inner) - Vector2f(h + CAR_MARGIN, 0)).norm();
-    float r_tr = (Vector2f(0, r_outer) - Vector2f(h + CAR_MARGIN, 0)).norm();
-    float r_br = (Vector2f(0, r_outer) - Vector2f((robot_config.dimensions_.length_ - robot_config.dimensions_.wheelbase_) / 2 + CAR_MARGIN, 0)).norm();
-    path_option.free_path_length = std::min(M_PI * c.norm(), 5.0); // some large number
-    // float omega = atan2(h, r_inner);
-
-
-
-    float theta_br = asin((robot_config.dimensions_.length_ + robot_config.dimensions_.wheelbase_) / 2 + CAR_MARGIN / r_br); // angle where back right would hit
-    float phi = 0;
-//	cout << "curvature " << curvature << endl;
-//	bool front_side = false, outer_side = false, inner_side = false;
-    for (unsigned int i = 0; i < point_cloud.size(); i++) {
-        Vector2f p = point_cloud[i];
-        float r_p = (c-p).norm();
-        float theta = curvature < 0 ? atan2(p[0], p[1]- c[1]) : atan2(p[0], c[1] - p[1]); // angle between p and c
-        float length = 5.0; //5.0;
-        // cout << "curvature " << curvature << endl;
-        if (r_inner <= r_p && r_p <= r_tl) {    // inner side hit
-                phi = acos(r_inner / r_p);
-                length = (theta - phi) * c.norm();
-            // inner_side = true;
-                // cout << "inner side hit" << endl;
-        }
-        if ((r_inner <= r_p && r_p <= r_br) && (-theta_br <= theta && theta <= theta_br)) {    // outer side hit
-            phi = acos(r_p / (c.norm() + robot_config.dimensions_.width_ / 2));
-            length = (theta - phi) * c.norm();
-	    // outer_side = true;
-	    // cout << "outer side hit" << endl;
-        }
-
-        if (r_tl <= r_p && r_p <= r_tr) {    // front side hit
-            phi = asin(h / r_p);
-            length = (theta - phi) * c.norm();
-	    // front_side = true;
-	    // cout << "front side hit" << endl;
-        }
+    const ArcGeometry arc {arcGeometry(curvature, robot_config)};
+    path_option.free_path_length = std::min(M_PI * arc.radius, 5.0); // some large number
+    const float c_y {1 / curvature};
+    const bool right_turn {curvature < 0};
+    for (std::size_t i = 0; i < n; i++) {
+        const float dx {xs[i]};
+        const float dy {right_turn ? ys[i] - c_y : c_y - ys[i]};
+        const float length {arcHitLength(arc, dx, dy)};
         if (length < path_option.free_path_length && length > 0) {
             path_option.free_path_length = length;
-            path_option.obstruction = p;
+            obstruction = i;
         }
     }
-	// if (inner_side)
-	//  	cout << "intersecting particle found with inner side" << endl;
-	// if (outer_side)
-	//	cout << "intersecting particle found with outer side" << endl;
-	//if (front_side)
-	//	cout << "intersecting particle found with front side" << endl;
 
-    // float theta = M_PI / 2;
-    // if (path_option.obstruction != Eigen::Vector2f::Zero()) {
-    //     theta = curvature < 0 ? atan2(path_option.obstruction[0], path_option.obstruction[1]- c[1]) :
-    //         atan2(path_option.obstruction[0], c[1] - path_option.obstruction[1]);
-    // }
     //. Distance to goal
-    float radius {1.0f / curvature};
-    float phi_g = (robot_config.limits_.max_speed_ * TIME_STEP * 20) / radius;
-    projected_pos.x() = radius * sin(phi_g);
-    projected_pos.y() = radius - (radius * cos(phi_g));
-    float new_goal_dist = (goal-projected_pos).norm();
-    // goal_distance = (goal-projected_pos).norm();
-    path_option.dist_to_goal = goal_distance-new_goal_dist;
+    path_option.dist_to_goal = goalProgress(curvature, goal, robot_config);
     // Cap free path length when approaching the goal
     if (global_goal_distance < path_option.free_path_length) {
         path_option.free_path_length = global_goal_distance;
     }
     // clearance
-    // path_option.clearance = 100; // some large number
-    for (auto p: point_cloud) {
-        float theta_p =  curvature < 0 ? atan2(p[0], p[1]- c[1]) :
-            atan2(p[0], c[1] - p[1]);
-        float path_len_p = theta_p * (p-c).norm();
+    //. The angle is only needed for points that would improve the clearance, and points behind the robot never count
+    for (std::size_t i = 0; i < n; i++) {
+        const float dx {xs[i]};
+        if (dx < 0) {
+            continue;
+        }
+        const float dy {right_turn ? ys[i] - c_y : c_y - ys[i]};
+        const float r_p {std::sqrt(dx * dx + dy * dy)};
+        float clearance_p = arcClearance(arc, r_p);
+        if (!(clearance_p < path_option.clearance)) {
+            continue;
+        }
+        float path_len_p = atan2(dx, dy) * r_p;
         if (path_len_p >=0 && path_len_p < path_option.free_path_length) {  // if p is within the fp length
-            float inner = std::abs((c - p).norm() - r_inner);
-            float outer = std::abs((c - p).norm() - r_tr);
-            float clearance_p = std::min(inner, outer);
-            if (clearance_p < path_option.clearance) {
-                path_option.clearance = clearance_p;
-                path_option.closest_point = p;
-            }
+            path_option.clearance = clearance_p;
+            closest = i;
         }
     }
-
+    if (obstruction >= 0) path_option.obstruction = cloud.point(obstruction);
+    if (closest >= 0) path_option.closest_point = cloud.point(closest);
 }
 
 
@@ -180,25 +448,229 @@ std::vector<Path> samplePathOptions(int num_options,
                                                     const Vector2f goal,
                                                     const Vector2f global_goal) {
     static std::vector<Path> path_options;
-    path_options.clear();
+    static ObstacleCloud cloud;
+    path_options.assign(num_options, Path());
+    cloud.set(point_cloud);
     float max_curvature = robot_config.limits_.max_curvature_;
 
-    // loop through curvature from max to -max
+    // loop through curvature from max to -max, every option only reads the shared cloud
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(PATH_SAMPLING_THREADS) schedule(static)
+#endif
     for (int i = 0; i < num_options; i++) { 
-        float curvature = max_curvature * pow(2*i/float(num_options-1) - 1, 2);
-        if (i < num_options / 2) {
-            curvature = -curvature;
+        const float curvature {optionCurvature(i, num_options, max_curvature)};
+        setPathOption(path_options[i], curvature, cloud, robot_config, goal, global_goal);
+    }
+    return path_options;
+}
+
+namespace {
+
+// setPathOption with the arc of option looked up in swept, for the points located in cells and mirrored_cells
+void setSweptPathOption(Path& path_option, int option,
+                        float curvature, const ObstacleCloud& cloud,
+                        const SweptFootprints& swept,
+                        const std::vector<int>& cells,
+                        const std::vector<int>& mirrored_cells,
+                        const vehicles::Car& robot_config,
+                        const Vector2f goal,
+                        const Vector2f global_goal) {
+    const int a {swept.arc(option)};
+    if (a < 0) {
+        setPathOption(path_option, curvature, cloud, robot_config, goal, global_goal);
+        return;
+    }
+    path_option.curvature = curvature;
+    float global_goal_distance = global_goal.norm();
+    const std::size_t n {cloud.size()};
+    const float *xs {cloud.x.data()};
+    const float *ys {cloud.y.data()};
+    const int *point_cells {curvature < 0 ? mirrored_cells.data() : cells.data()};
+    int obstruction {-1};
+    int closest {-1};
+
+    const ArcGeometry arc {arcGeometry(curvature, robot_config)};
+    path_option.free_path_length = std::min(M_PI * arc.radius, 5.0); // some large number
+    const float c_y {1 / curvature};
+    const bool right_turn {curvature < 0};
+    //. Only the points that may be hit before the free path so far are evaluated, exactly
+    for (std::size_t i = 0; i < n; i++) {
+        if (xs[i] < 0) {
+            continue;   // behind base link, any hit length is negative
+        }
+        if (point_cells[i] >= 0) {
+            const uint16_t hit {swept.entry(point_cells[i], a).hit};
+            if (hit == SweptFootprints::kNone || hit * 1e-3f >= path_option.free_path_length) {
+                continue;
+            }
+        }
+        const float length {arcHitLength(arc, xs[i], right_turn ? ys[i] - c_y : c_y - ys[i])};
+        if (length < path_option.free_path_length && length > 0) {
+            path_option.free_path_length = length;
+            obstruction = i;
         }
-        
-        Path path_option;
-        setPathOption(path_option, curvature, point_cloud, robot_config, goal, global_goal);
-        path_options.push_back(path_option);
     }
-    // exit(0);
+
+    //. Distance to goal
+    path_option.dist_to_goal = goalProgress(curvature, goal, robot_config);
+    // Cap free path length when approaching the goal
+    if (global_goal_distance < path_option.free_path_length) {
+        path_option.free_path_length = global_goal_distance;
+    }
+    // clearance
+    for (std::size_t i = 0; i < n; i++) {
+        const float dx {xs[i]};
+        if (dx < 0) {
+            continue;
+        }
+        //. Cells wholly behind the car or past the free path never count, cells wholly within it count with the
+        //. smallest gap of the cell
+        const SweptFootprints::Entry* entry {point_cells[i] >= 0 ? &swept.entry(point_cells[i], a) : nullptr};
+        if (entry && entry->far == SweptFootprints::kNone) {
+            continue;
+        }
+        if (entry && entry->near != SweptFootprints::kExact) {
+            if (entry->near * 1e-3f >= path_option.free_path_length) {
+                continue;
+            }
+            if (entry->far * 1e-3f < path_option.free_path_length) {
+                const float clearance_p {entry->clearance * 1e-3f};
+                if (clearance_p < path_option.clearance) {
+                    path_option.clearance = clearance_p;
+                    closest = i;
+                }
+                continue;
+            }
+        }
+        const float dy {right_turn ? ys[i] - c_y : c_y - ys[i]};
+        const float r_p {std::sqrt(dx * dx + dy * dy)};
+        float clearance_p = arcClearance(arc, r_p);
+        if (!(clearance_p < path_option.clearance)) {
+            continue;
+        }
+        float path_len_p = atan2(dx, dy) * r_p;
+        if (path_len_p >=0 && path_len_p < path_option.free_path_length) {  // if p is within the fp length
+            path_option.clearance = clearance_p;
+            closest = i;
+        }
+    }
+    if (obstruction >= 0) path_option.obstruction = cloud.point(obstruction);
+    if (closest >= 0) path_option.closest_point = cloud.point(closest);
+}
+
+} // namespace
+
+std::vector<Path> samplePathOptions(int num_options,
+                                    const std::vector<Eigen::Vector2f>& point_cloud,
+                                    const SweptFootprints& swept,
+                                    const vehicles::Car& robot_config,
+                                    const Vector2f goal,
+                                    const Vector2f global_goal) {
+    if (swept.numOptions() != num_options) {
+        return samplePathOptions(num_options, point_cloud, robot_config, goal, global_goal);
+    }
+    static std::vector<Path> path_options;
+    static ObstacleCloud cloud;
+    static std::vector<int> cells;
+    static std::vector<int> mirrored_cells;
+    path_options.assign(num_options, Path());
+    cloud.set(point_cloud);
+    swept.locate(cloud, cells, mirrored_cells);
+    float max_curvature = robot_config.limits_.max_curvature_;
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(PATH_SAMPLING_THREADS) schedule(static)
+#endif
+    for (int i = 0; i < num_options; i++) {
+        const float curvature {optionCurvature(i, num_options, max_curvature)};
+        setSweptPathOption(path_options[i], i, curvature, cloud, swept, cells, mirrored_cells, robot_config, goal, global_goal);
+    }
     return path_options;
 }
 
 
+void setPathOption(Path& path_option,
+                        float curvature,
+                        const local_planners::LocalCostmap& costmap,
+                        const Footprint& footprint,
+                        const Vector2f& loc,
+                        const float angle,
+                        const vehicles::Car& robot_config,
+                        const float max_clearance,
+                        const Vector2f goal,
+                        const Vector2f global_goal) {
+    path_option.curvature = curvature;
+    const bool straight {std::abs(curvature) <= std::abs(0.01)};
+    const float max_length {straight ? kMaxFreePathLength : std::min(float(M_PI) / std::abs(curvature), kMaxFreePathLength)};
+    const float step {costmap.Resolution()};
+    const Eigen::Rotation2Df rotation(angle);
+    Vector2f center;
+
+    //. Every lookup is a single cell, the first pose that does not fit ends the free path
+    path_option.free_path_length = max_length;
+    bool blocked {false};
+    for (int j = 0; ; j++) {
+        const float s {std::min(j * step, max_length)};
+        if (footprintDistance(curvature, s, costmap, footprint, loc, rotation, center) < footprint.radius) {
+            path_option.free_path_length = std::max(s - step, 0.f);
+            path_option.obstruction = center;
+            blocked = true;
+            break;
+        }
+        if (s >= max_length) {
+            break;
+        }
+    }
+
+    //. Clearance is the gap left on the sides, so the stretch where the obstruction itself is within max_clearance
+    //. ahead does not count
+    const float clearance_length {blocked ? std::max(path_option.free_path_length - max_clearance, 0.f) : path_option.free_path_length};
+    float min_distance {costmap.MaxDistance()};
+    for (int j = 0; ; j++) {
+        const float s {std::min(j * step, clearance_length)};
+        const float distance {footprintDistance(curvature, s, costmap, footprint, loc, rotation, center)};
+        if (distance < min_distance) {
+            min_distance = distance;
+            path_option.closest_point = center;
+        }
+        if (s >= clearance_length) {
+            break;
+        }
+    }
+    path_option.clearance = std::min(min_distance - footprint.radius, max_clearance);
+
+    path_option.dist_to_goal = goalProgress(curvature, goal, robot_config);
+    // Cap free path length when approaching the goal
+    float global_goal_distance = global_goal.norm();
+    if (global_goal_distance < path_option.free_path_length) {
+        path_option.free_path_length = global_goal_distance;
+    }
+}
+
+std::vector<Path> samplePathOptions(int num_options,
+                                    const local_planners::LocalCostmap& costmap,
+                                    const Vector2f& loc,
+                                    const float angle,
+                                    const vehicles::Car& robot_config,
+                                    const float max_clearance,
+                                    const Vector2f goal,
+                                    const Vector2f global_goal) {
+    static std::vector<Path> path_options;
+    static Footprint footprint;
+    path_options.assign(num_options, Path());
+    footprint.set(robot_config);
+    float max_curvature = robot_config.limits_.max_curvature_;
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(PATH_SAMPLING_THREADS) schedule(static)
+#endif
+    for (int i = 0; i < num_options; i++) {
+        const float curvature {optionCurvature(i, num_options, max_curvature)};
+        setPathOption(path_options[i], curvature, costmap, footprint, loc, angle, robot_config, max_clearance, goal, global_goal);
+    }
+    return path_options;
+}
+
 float score(float free_path_length, float curvature, float clearance, float goal_dist) {
     const float w1 = 0.75; //1.0;
     const float w2 = 0;
@@ -2,10 +2,13 @@
 #ifndef PATH_GENERATION_H
 #define PATH_GENERATION_H
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 #include "eigen3/Eigen/Dense"
 // #include "parameters.h"
 #include "vehicles.hpp"
+#include "local_costmap.h"
 
 using std::vector;
 using Eigen::Vector2f;
@@ -22,6 +25,75 @@ struct Path {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
 };
 
+// Point cloud split into separate x and y arrays, converted once per scan and shared by every path option
+struct ObstacleCloud {
+  std::vector<float> x;
+  std::vector<float> y;
+
+  void set(const std::vector<Eigen::Vector2f>& point_cloud);
+  std::size_t size() const {return x.size();}
+  Eigen::Vector2f point(const std::size_t i) const {return Eigen::Vector2f(x[i], y[i]);}
+};
+
+// Footprint of the car padded by the margin, covered by circles of one radius centered along its axis, so that a
+// pose collides when any center is closer than the radius to an obstacle
+struct Footprint {
+  std::vector<float> offsets;   // circle centers, ahead of base link
+  float radius = 0;
+
+  void set(const vehicles::Car& robot_config);
+};
+
+// Swept areas of the arcs samplePathOptions draws, computed once since the curvatures and the car never change. Every
+// cell of a grid in the frame of the car keeps, for each arc, bounds of the distance along it at which the padded car
+// hits any point of the cell, of the gap the car leaves to it and of how far along the arc it passes it. Evaluating an
+// arc then looks its obstacles up and only evaluates exactly the points that may end the free path, so the free path
+// is the exact one and the clearance never exceeds it. Obstacles off the grid are evaluated exactly. Right turns mirror
+// left ones and straight arcs need no trigonometry, so only left turns are stored.
+class SweptFootprints {
+  public:
+    struct Entry {
+      uint16_t hit;         // mm, below any hit in the cell, kNone when the car never hits it
+      uint16_t clearance;   // mm, below the gap to any point of the cell
+      uint16_t near;        // mm along the arc, below any point of the cell, kExact when part of it is behind the car
+      uint16_t far;         // mm along the arc, above any point of the cell, kNone when all of it is behind the car
+    };
+    static const uint16_t kNone = 0xffff;
+    static const uint16_t kExact = 0xfffe;
+
+    // The grid reaches a meter past the longest free path in front of and to the sides of the car. Building takes
+    // about 0.04 s for 31 options at 5 cm and 0.1 s for 101, so it belongs in setup.
+    void build(int num_options, const vehicles::Car& robot_config, float resolution);
+
+    // Options the arcs were built for, 0 until built
+    int numOptions() const {return static_cast<int>(option_arcs_.size());}
+
+    // Cells of every point, and of every point mirrored across the heading for right turns; -1 off the grid
+    void locate(const ObstacleCloud& cloud, std::vector<int>& cells, std::vector<int>& mirrored_cells) const;
+
+    // Stored arc of an option, -1 for straight ones
+    int arc(int option) const {return option_arcs_[option];}
+
+    float curvature(int arc) const {return curvatures_[arc];}
+
+    const Entry& entry(int cell, int arc) const {return entries_[static_cast<std::size_t>(cell) * curvatures_.size() + arc];}
+
+  private:
+    int cellOf(float x, float y) const;
+
+    float resolution_ = 1;
+    float min_x_ = 0;
+    float min_y_ = 0;
+    int size_x_ = 0;
+    int size_y_ = 0;
+    std::vector<float> curvatures_;   // of the stored left turns
+    std::vector<int> option_arcs_;
+    std::vector<Entry> entries_;      // cell major, the arcs of a cell side by side
+};
+
+// Curvature of option i of num_options, from -max_curvature to max_curvature, denser around straight
+float optionCurvature(int i, int num_options, float max_curvature);
+
 // float run1DTimeOptimalControl(float dist_to_go, float current_speed, const NavigationParams& nav_params);
 
 void setPathOption(Path& path_option,
@@ -31,12 +103,55 @@ void setPathOption(Path& path_option,
     const Vector2f goal,
     const Vector2f global_goal);
 
+// Same as above, on a cloud that has already been converted
+void setPathOption(Path& path_option,
+    float curvature,
+    const ObstacleCloud& cloud,
+    const vehicles::Car& robot_config,
+    const Vector2f goal,
+    const Vector2f global_goal);
+
+// Converts the point cloud once and evaluates all num_options curvatures in parallel
 std::vector<Path> samplePathOptions(int num_options,
                                                     const std::vector<Eigen::Vector2f>& point_cloud,
                                                     const vehicles::Car& robot_config,
                                                     const Vector2f goal,
                                                     const Vector2f global_goal);
 
+// Same as above, with the arcs looked up in swept, which must have been built for num_options
+std::vector<Path> samplePathOptions(int num_options,
+                                    const std::vector<Eigen::Vector2f>& point_cloud,
+                                    const SweptFootprints& swept,
+                                    const vehicles::Car& robot_config,
+                                    const Vector2f goal,
+                                    const Vector2f global_goal);
+
+// Same as above on the costmap, with the car at (loc, angle) in its frame. The footprint is marched along the arc
+// one cell at a time, and the clearance is the smallest gap left around it, up to max_clearance.
+void setPathOption(Path& path_option,
+    float curvature,
+    const local_planners::LocalCostmap& costmap,
+    const Footprint& footprint,
+    const Vector2f& loc,
+    const float angle,
+    const vehicles::Car& robot_config,
+    const float max_clearance,
+    const Vector2f goal,
+    const Vector2f global_goal);
+
+// Evaluates all num_options curvatures on the costmap in parallel
+std::vector<Path> samplePathOptions(int num_options,
+                                    const local_planners::LocalCostmap& costmap,
+                                    const Vector2f& loc,
+                                    const float angle,
+                                    const vehicles::Car& robot_config,
+                                    const float max_clearance,
+                                    const Vector2f goal,
+                                    const Vector2f global_goal);
+
+// Weighted sum of free path length, clearance and progress towards the goal, higher is better
+float score(float free_path_length, float curvature, float clearance, float goal_dist);
+
 int selectPath(const std::vector<Path>& path_options);
 
 } // namespace path_generation
@@ -0,0 +1,396 @@
+//========================================================================
+/*!
+\file    roadmap.cc
+\brief   Probabilistic roadmap of the free space of a map, built offline
+         and stored next to it, for global plans that only run a graph
+         search instead of growing an RRT* tree.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "vector_map/distance_field.h"
+#include "roadmap.h"
+
+namespace global_planner {
+
+namespace {
+
+const char kMagic[8] = {'R', 'O', 'A', 'D', 'M', 'A', 'P', '\0'};
+const uint32_t kVersion = 1;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_nodes;
+  uint64_t fingerprint;   // Of the map lines the roadmap was built for
+  uint32_t num_edges;     // Counting both directions
+  float clearance;
+  float spacing;
+  float connection_radius;
+};
+
+// Offset of the corner nodes from the line ends, along each axis of the line. Past the end and to the side by more
+// than the clearance, the node stays clear of the inflated rectangle of its own line.
+const float kCornerOffset = 1.1;
+
+} // namespace
+
+Roadmap::Roadmap() :
+  clearance_(0),
+  spacing_(0),
+  connection_radius_(0),
+  index_(1),
+  search_(0),
+  expanded_(0) {}
+
+void Roadmap::Build(const vector_map::VectorMap& map, const vector_map::VectorMap& cspace, const float clearance,
+                    const float spacing, const float connection_radius) {
+  clearance_ = clearance;
+  spacing_ = spacing;
+  connection_radius_ = connection_radius;
+  nodes_.clear();
+  edge_start_.assign(1, 0);
+  edge_target_.clear();
+  edge_cost_.clear();
+  if (map.lines.empty()) {
+    Prepare();
+    return;
+  }
+
+  // Distances are looked up from the cell a node falls in, which may be up to a cell diagonal closer to the lines
+  const float resolution = std::min(0.05f, spacing / 4);
+  const float min_distance = clearance + M_SQRT2 * resolution;
+  vector_map::DistanceField distances;
+  map.GetDistanceField(resolution, 2 * min_distance, &distances);
+
+  // Candidates closer than half the spacing to a node already taken are dropped, corners go first
+  NodeIndex taken(spacing);
+  auto add = [&](const Eigen::Vector2f& loc) {
+    unsigned int closest;
+    if (distances.Distance(loc) < min_distance ||
+        (taken.Nearest(loc, &closest) && (nodes_[closest] - loc).norm() < spacing / 2)) {
+      return;
+    }
+    taken.Insert(nodes_.size(), loc);
+    nodes_.push_back(loc);
+  };
+  Eigen::Vector2f low = map.lines[0].p0;
+  Eigen::Vector2f high = low;
+  for (const geometry::line2f& line : map.lines) {
+    low = low.cwiseMin(line.p0).cwiseMin(line.p1);
+    high = high.cwiseMax(line.p0).cwiseMax(line.p1);
+    const float length = line.Length();
+    if (length <= 0) continue;
+    const Eigen::Vector2f dir = line.Dir();
+    const Eigen::Vector2f normal(-dir.y(), dir.x());
+    const float offset = kCornerOffset * min_distance;
+    for (const float side : {-1.f, 1.f}) {
+      add(line.p0 + offset * (side * normal - dir));
+      add(line.p1 + offset * (side * normal + dir));
+    }
+  }
+  for (float y = low.y() + spacing / 2; y < high.y(); y += spacing) {
+    for (float x = low.x() + spacing / 2; x < high.x(); x += spacing) {
+      add(Eigen::Vector2f(x, y));
+    }
+  }
+
+  // Edges in both directions, grouped by their first node
+  Prepare();
+  std::vector<std::vector<std::pair<uint32_t, float>>> adjacency(nodes_.size());
+  for (unsigned int id = 0; id < nodes_.size(); id++) {
+    index_.Radius(nodes_[id], connection_radius, &neighbors_);
+    for (const unsigned int neighbor : neighbors_) {
+      if (neighbor <= id || cspace.Intersects(nodes_[id], nodes_[neighbor])) {
+        continue;
+      }
+      const float cost = (nodes_[id] - nodes_[neighbor]).norm();
+      adjacency[id].push_back({neighbor, cost});
+      adjacency[neighbor].push_back({id, cost});
+    }
+  }
+  for (const auto& edges : adjacency) {
+    for (const auto& edge : edges) {
+      edge_target_.push_back(edge.first);
+      edge_cost_.push_back(edge.second);
+    }
+    edge_start_.push_back(edge_target_.size());
+  }
+}
+
+bool Roadmap::Empty(void) const {
+  return nodes_.empty();
+}
+
+bool Roadmap::Save(const std::string& file, const vector_map::VectorMap& map) const {
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.num_nodes = nodes_.size();
+  header.fingerprint = Fingerprint(map);
+  header.num_edges = edge_target_.size();
+  header.clearance = clearance_;
+  header.spacing = spacing_;
+  header.connection_radius = connection_radius_;
+
+  const std::string temp_file = file + ".tmp";
+  FILE* fid = fopen(temp_file.c_str(), "wb");
+  if (fid == NULL) {
+    std::cout << "[Roadmap] Unable to write " << temp_file << std::endl;
+    return false;
+  }
+  std::vector<float> locs;
+  locs.reserve(2 * nodes_.size());
+  for (const Eigen::Vector2f& loc : nodes_) {
+    locs.push_back(loc.x());
+    locs.push_back(loc.y());
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, fid) == 1;
+  ok = ok && fwrite(locs.data(), sizeof(float), locs.size(), fid) == locs.size();
+  ok = ok && fwrite(edge_start_.data(), sizeof(uint32_t), edge_start_.size(), fid) == edge_start_.size();
+  ok = ok && fwrite(edge_target_.data(), sizeof(uint32_t), edge_target_.size(), fid) == edge_target_.size();
+  ok = ok && fwrite(edge_cost_.data(), sizeof(float), edge_cost_.size(), fid) == edge_cost_.size();
+  ok = (fclose(fid) == 0) && ok;
+  if (!ok || rename(temp_file.c_str(), file.c_str()) != 0) {
+    std::cout << "[Roadmap] Unable to write " << file << std::endl;
+    remove(temp_file.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool Roadmap::Load(const std::string& file, const vector_map::VectorMap& map) {
+  FILE* fid = fopen(file.c_str(), "rb");
+  if (fid == NULL) {
+    return false;
+  }
+  Header header;
+  bool ok = fread(&header, sizeof(header), 1, fid) == 1 && memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+            header.version == kVersion;
+  if (ok && header.fingerprint != Fingerprint(map)) {
+    std::cout << "[Roadmap] " << file << " was built for another version of the map, ignoring it" << std::endl;
+    fclose(fid);
+    return false;
+  }
+  // The counts must account for the rest of the file exactly before anything is allocated for them
+  if (ok) {
+    const long data_start = ftell(fid);
+    ok = data_start >= 0 && fseek(fid, 0, SEEK_END) == 0;
+    const long file_size = ok ? ftell(fid) : -1;
+    const uint64_t expected = sizeof(header) + (2 * sizeof(float) + sizeof(uint32_t)) * static_cast<uint64_t>(header.num_nodes) +
+                              sizeof(uint32_t) + (sizeof(uint32_t) + sizeof(float)) * static_cast<uint64_t>(header.num_edges);
+    ok = ok && file_size >= 0 && static_cast<uint64_t>(file_size) == expected && fseek(fid, data_start, SEEK_SET) == 0;
+    if (!ok) {
+      std::cout << "[Roadmap] " << file << " does not hold the nodes and edges its header counts" << std::endl;
+      fclose(fid);
+      return false;
+    }
+  }
+  std::vector<float> locs(ok ? 2 * static_cast<size_t>(header.num_nodes) : 0);
+  std::vector<uint32_t> edge_start(ok ? static_cast<size_t>(header.num_nodes) + 1 : 0);
+  std::vector<uint32_t> edge_target(ok ? header.num_edges : 0);
+  std::vector<float> edge_cost(ok ? header.num_edges : 0);
+  ok = ok && fread(locs.data(), sizeof(float), locs.size(), fid) == locs.size();
+  ok = ok && fread(edge_start.data(), sizeof(uint32_t), edge_start.size(), fid) == edge_start.size();
+  ok = ok && fread(edge_target.data(), sizeof(uint32_t), edge_target.size(), fid) == edge_target.size();
+  ok = ok && fread(edge_cost.data(), sizeof(float), edge_cost.size(), fid) == edge_cost.size();
+  fclose(fid);
+
+  // Edge ranges must be ordered and stay within the edges, targets within the nodes
+  ok = ok && edge_start[0] == 0 && edge_start.back() == header.num_edges;
+  for (uint32_t id = 0; ok && id < header.num_nodes; id++) {
+    ok = edge_start[id] <= edge_start[id + 1];
+  }
+  for (uint32_t edge = 0; ok && edge < header.num_edges; edge++) {
+    ok = edge_target[edge] < header.num_nodes;
+  }
+  if (!ok) {
+    std::cout << "[Roadmap] Invalid roadmap " << file << std::endl;
+    return false;
+  }
+
+  clearance_ = header.clearance;
+  spacing_ = header.spacing;
+  connection_radius_ = header.connection_radius;
+  nodes_.resize(header.num_nodes);
+  for (uint32_t id = 0; id < header.num_nodes; id++) {
+    nodes_[id] = Eigen::Vector2f(locs[2 * id], locs[2 * id + 1]);
+  }
+  edge_start_.swap(edge_start);
+  edge_target_.swap(edge_target);
+  edge_cost_.swap(edge_cost);
+  Prepare();
+  return true;
+}
+
+bool Roadmap::Plan(const Eigen::Vector2f& start, const Eigen::Vector2f& goal, const vector_map::VectorMap& cspace,
+                   std::vector<Eigen::Vector2f>* path) {
+  path->clear();
+  expanded_ = 0;
+  if (Empty()) {
+    return false;
+  }
+  if (!cspace.Intersects(start, goal)) {
+    path->push_back(start);
+    path->push_back(goal);
+    return true;
+  }
+
+  // New stamp, wrapping around only after four billion searches
+  if (++search_ == 0) {
+    std::fill(visited_.begin(), visited_.end(), 0);
+    std::fill(goal_visible_.begin(), goal_visible_.end(), 0);
+    search_ = 1;
+  }
+  const unsigned int start_id = nodes_.size();
+  const unsigned int goal_id = start_id + 1;
+  Connect(goal, cspace, &connected_, &connected_cost_);
+  if (connected_.empty()) {
+    std::cout << "[Roadmap] Goal has no free connection to the roadmap" << std::endl;
+    return false;
+  }
+  for (unsigned int i = 0; i < connected_.size(); i++) {
+    goal_visible_[connected_[i]] = search_;
+    goal_cost_[connected_[i]] = connected_cost_[i];
+  }
+  Connect(start, cspace, &connected_, &connected_cost_);
+  if (connected_.empty()) {
+    std::cout << "[Roadmap] Start has no free connection to the roadmap" << std::endl;
+    return false;
+  }
+
+  // A* with the straight line distance to the goal, which is consistent, so popped nodes are final
+  auto location = [&](const unsigned int id) { return id < start_id ? nodes_[id] : (id == start_id ? start : goal); };
+  auto relax = [&](const unsigned int id, const unsigned int parent, const float cost) {
+    if (visited_[id] != search_ || cost < cost_[id]) {
+      visited_[id] = search_;
+      cost_[id] = cost;
+      parent_[id] = parent;
+      open_.Push(id, cost + (location(id) - goal).norm());
+    }
+  };
+  open_.Clear();
+  visited_[start_id] = search_;
+  cost_[start_id] = 0;
+  parent_[start_id] = start_id;
+  for (unsigned int i = 0; i < connected_.size(); i++) {
+    relax(connected_[i], start_id, connected_cost_[i]);
+  }
+  bool found = false;
+  while (!open_.Empty()) {
+    const unsigned int id = open_.Pop();
+    if (id == goal_id) {
+      found = true;
+      break;
+    }
+    expanded_++;
+    if (goal_visible_[id] == search_) {
+      relax(goal_id, id, cost_[id] + goal_cost_[id]);
+    }
+    for (uint32_t edge = edge_start_[id]; edge < edge_start_[id + 1]; edge++) {
+      relax(edge_target_[edge], id, cost_[id] + edge_cost_[edge]);
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  std::vector<Eigen::Vector2f> nodes;
+  for (unsigned int id = goal_id; id != start_id; id = parent_[id]) {
+    nodes.push_back(location(id));
+  }
+  nodes.push_back(start);
+  std::reverse(nodes.begin(), nodes.end());
+
+  // Lattice paths zigzag, every node is joined to the farthest one after it that it sees
+  path->push_back(nodes[0]);
+  for (std::size_t i = 0; i + 1 < nodes.size();) {
+    std::size_t j = i + 1;
+    while (j + 1 < nodes.size() && !cspace.Intersects(nodes[i], nodes[j + 1])) {
+      j++;
+    }
+    path->push_back(nodes[j]);
+    i = j;
+  }
+  return true;
+}
+
+float Roadmap::Clearance(void) const {
+  return clearance_;
+}
+
+unsigned int Roadmap::NumNodes(void) const {
+  return nodes_.size();
+}
+
+unsigned int Roadmap::NumEdges(void) const {
+  return edge_target_.size() / 2;
+}
+
+const Eigen::Vector2f& Roadmap::Location(const unsigned int id) const {
+  return nodes_[id];
+}
+
+unsigned int Roadmap::Expanded(void) const {
+  return expanded_;
+}
+
+void Roadmap::Connect(const Eigen::Vector2f& loc, const vector_map::VectorMap& cspace, std::vector<unsigned int>* ids,
+                      std::vector<float>* costs) {
+  ids->clear();
+  costs->clear();
+  index_.Radius(loc, connection_radius_, &neighbors_);
+  for (const unsigned int id : neighbors_) {
+    if (!cspace.Intersects(loc, nodes_[id])) {
+      ids->push_back(id);
+      costs->push_back((loc - nodes_[id]).norm());
+    }
+  }
+}
+
+void Roadmap::Prepare(void) {
+  index_ = NodeIndex(connection_radius_ / 2);
+  index_.Clear();
+  for (unsigned int id = 0; id < nodes_.size(); id++) {
+    index_.Insert(id, nodes_[id]);
+  }
+
+  // Start and goal are searched as the two ids after the nodes
+  const unsigned int size = nodes_.size() + 2;
+  cost_.assign(size, 0);
+  parent_.assign(size, 0);
+  visited_.assign(size, 0);
+  goal_cost_.assign(size, 0);
+  goal_visible_.assign(size, 0);
+  search_ = 0;
+  open_.Reset(size);
+}
+
+uint64_t Roadmap::Fingerprint(const vector_map::VectorMap& map) {
+  // FNV-1a over the endpoints of the lines
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&hash](const float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 4; i++) {
+      hash = (hash ^ ((bits >> (8 * i)) & 0xff)) * 1099511628211ull;
+    }
+  };
+  for (const geometry::line2f& line : map.lines) {
+    mix(line.p0.x());
+    mix(line.p0.y());
+    mix(line.p1.x());
+    mix(line.p1.y());
+  }
+  return hash;
+}
+
+} // namespace global_planner
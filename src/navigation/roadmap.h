@@ -0,0 +1,93 @@
+//========================================================================
+/*!
+\file    roadmap.h
+\brief   Probabilistic roadmap of the free space of a map, built offline
+         and stored next to it, for global plans that only run a graph
+         search instead of growing an RRT* tree.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include "vector_map/vector_map.h"
+#include "indexed_heap.h"
+#include "node_index.h"
+
+namespace global_planner {
+
+class Roadmap {
+  public:
+    Roadmap();
+
+    // Nodes sit just past the corners of the map lines, as in a visibility graph, and on a lattice of the given
+    // spacing over the rest of the free space; all of them keep clearance from the lines. Nodes closer than
+    // connection_radius are joined when the segment between them is free in the configuration space cspace, the
+    // map inflated by clearance.
+    void Build(const vector_map::VectorMap& map, const vector_map::VectorMap& cspace, const float clearance,
+               const float spacing, const float connection_radius);
+
+    bool Empty(void) const;
+
+    // Written next to the target and renamed over it, as compiled maps are
+    bool Save(const std::string& file, const vector_map::VectorMap& map) const;
+
+    // Returns false, leaving the roadmap untouched, when file is missing or invalid, or was built for other lines
+    bool Load(const std::string& file, const vector_map::VectorMap& map);
+
+    // Shortest path from start to goal over the roadmap, with start and goal joined to the free nodes within the
+    // connection radius, then shortcut wherever cspace allows. Returns false when either end cannot be joined or no
+    // path connects them.
+    bool Plan(const Eigen::Vector2f& start, const Eigen::Vector2f& goal, const vector_map::VectorMap& cspace,
+              std::vector<Eigen::Vector2f>* path);
+
+    float Clearance(void) const;
+
+    unsigned int NumNodes(void) const;
+
+    unsigned int NumEdges(void) const;
+
+    const Eigen::Vector2f& Location(const unsigned int id) const;
+
+    // Nodes expanded by the last Plan
+    unsigned int Expanded(void) const;
+
+  private:
+    // Free nodes within the connection radius of loc, with their distances
+    void Connect(const Eigen::Vector2f& loc, const vector_map::VectorMap& cspace, std::vector<unsigned int>* ids,
+                 std::vector<float>* costs);
+
+    // Index the nodes and size the search state for them
+    void Prepare(void);
+
+    static uint64_t Fingerprint(const vector_map::VectorMap& map);
+
+    float clearance_;
+    float spacing_;
+    float connection_radius_;
+    std::vector<Eigen::Vector2f> nodes_;
+    std::vector<uint32_t> edge_start_;   // First edge of each node, one entry per node and a last one
+    std::vector<uint32_t> edge_target_;  // Both directions of every edge
+    std::vector<float> edge_cost_;
+    NodeIndex index_;
+
+    // Search state over the nodes, then start and goal. Entries only count when their stamp matches search_
+    std::vector<float> cost_;
+    std::vector<unsigned int> parent_;
+    std::vector<uint32_t> visited_;
+    std::vector<float> goal_cost_;       // Edge cost to the goal, of the nodes stamped in goal_visible_
+    std::vector<uint32_t> goal_visible_;
+    uint32_t search_;
+    IndexedHeap<float> open_;
+    unsigned int expanded_;
+    std::vector<unsigned int> connected_;   // Scratch buffers for Connect
+    std::vector<float> connected_cost_;
+    std::vector<unsigned int> neighbors_;
+};
+
+} // namespace global_planner
@@ -0,0 +1,79 @@
+//========================================================================
+/*!
+\file    roadmap_builder.cc
+\brief   Build the roadmap of a map offline and store it next to the map,
+         where the navigation node loads it for its global planner.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdio.h>
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+#include "shared/util/timer.h"
+#include "vector_map/vector_map.h"
+#include "parameters.h"
+#include "roadmap.h"
+
+DEFINE_string(map, "", "Vector map file to build the roadmap for, as the navigation node loads it");
+DEFINE_string(output, "", "Roadmap to write, <map>.roadmap when unset so that the navigation node picks it up");
+DEFINE_double(clearance, COLLISION_PROXIMITY, "Distance (m) the roadmap keeps from the map, at least the collision "
+              "proximity of the global planner");
+DEFINE_double(spacing, ROADMAP_SPACING, "Spacing (m) of the lattice of nodes in the free space");
+DEFINE_double(connection_radius, ROADMAP_CONNECTION_RADIUS, "Nodes closer than this (m) are joined when the segment "
+              "between them is free");
+DEFINE_int32(queries, 1000, "Random queries between nodes to time the roadmap with after it is written");
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  if (FLAGS_map.empty()) {
+    std::cerr << "Usage: roadmap_builder --map <vector map file> [--output <file>] [--clearance m] [--spacing m] "
+              << "[--connection_radius m] [--queries n]" << std::endl;
+    return 1;
+  }
+
+  vector_map::VectorMap map;
+  map.Load(FLAGS_map);
+  const vector_map::VectorMap cspace = map.Inflate(FLAGS_clearance);
+  const double t_start = GetMonotonicTime();
+  global_planner::Roadmap roadmap;
+  roadmap.Build(map, cspace, FLAGS_clearance, FLAGS_spacing, FLAGS_connection_radius);
+  const double t_built = GetMonotonicTime();
+
+  const std::string output = FLAGS_output.empty() ? FLAGS_map + ".roadmap" : FLAGS_output;
+  global_planner::Roadmap loaded;
+  if (!roadmap.Save(output, map) || !loaded.Load(output, map) || loaded.NumNodes() != roadmap.NumNodes()) {
+    std::cerr << "Unable to write " << output << std::endl;
+    return 1;
+  }
+  printf("%u nodes, %u edges built in %.0f ms, written to %s\n", roadmap.NumNodes(), roadmap.NumEdges(),
+         1e3 * (t_built - t_start), output.c_str());
+  if (FLAGS_queries <= 0 || loaded.Empty()) {
+    return 0;
+  }
+
+  // Nodes of disconnected pockets fail their queries, the count tells how much of the map the roadmap covers
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<unsigned int> node(0, loaded.NumNodes() - 1);
+  std::vector<double> times;
+  std::vector<Eigen::Vector2f> path;
+  int failures = 0;
+  for (int i = 0; i < FLAGS_queries; i++) {
+    const unsigned int start = node(rng);
+    const unsigned int goal = node(rng);
+    const double t_query = GetMonotonicTime();
+    const bool found = loaded.Plan(loaded.Location(start), loaded.Location(goal), cspace, &path);
+    times.push_back(GetMonotonicTime() - t_query);
+    failures += !found;
+  }
+  std::sort(times.begin(), times.end());
+  printf("%d queries: median %.3f ms, 99%% %.3f ms, max %.3f ms, %d without a path\n", FLAGS_queries,
+         1e3 * times[times.size() / 2], 1e3 * times[times.size() * 99 / 100], 1e3 * times.back(), failures);
+  return 0;
+}
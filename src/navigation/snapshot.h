@@ -0,0 +1,65 @@
+//========================================================================
+/*!
+\file    snapshot.h
+\brief   Latest-value hand-off between one writer thread and one reader
+         thread, so neither works on state the other is changing.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#pragma once
+
+#include <mutex>
+#include <utility>
+
+namespace navigation {
+
+// Three buffers: the writer fills its own, the reader holds its own, and the
+// third is the latest published value. Publishing and acquiring only swap
+// buffer indices under the lock, so neither side ever waits on a copy and a
+// slow reader simply skips the values it missed.
+template <class T>
+class Snapshot {
+  public:
+    Snapshot() : back_(0), middle_(1), front_(2), fresh_(false) {}
+
+    // Buffer the writer fills before Publish. It holds whatever was last
+    // written into it, which is not necessarily the latest value.
+    T& Back() {
+      return buffers_[back_];
+    }
+
+    // Make the back buffer the latest value.
+    void Publish() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::swap(back_, middle_);
+      fresh_ = true;
+    }
+
+    // Move the latest value to the front if one was published since the last
+    // call, returns whether it did.
+    bool Acquire() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!fresh_) {
+        return false;
+      }
+      std::swap(front_, middle_);
+      fresh_ = false;
+      return true;
+    }
+
+    // Value of the last Acquire, owned by the reader until the next one.
+    const T& Front() const {
+      return buffers_[front_];
+    }
+
+  private:
+    T buffers_[3];
+    int back_;
+    int middle_;
+    int front_;
+    bool fresh_;    // Whether middle_ was published after the last Acquire
+    std::mutex mutex_;
+};
+
+} // namespace navigation
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "path_generation.h"
+
+// Checks the path options looked up in the swept footprints against their exact evaluation on random clouds: the free
+// path must be the exact one and the clearance may only be smaller, by less than the diagonal of a cell.
+int main() {
+  const int kClouds = 300;
+  const float kMaxClearanceError = SWEPT_FOOTPRINT_RESOLUTION * std::sqrt(2.f) + 0.003f;
+  vehicles::UT_Automata car;
+  path_generation::SweptFootprints swept;
+  swept.build(N_PATHS, car, SWEPT_FOOTPRINT_RESOLUTION);
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> unit(0, 1);
+
+  int errors = 0;
+  int options = 0;
+  for (int trial = 0; trial < kClouds; ++trial) {
+    // Walls of a scan at a random range, and clutter around the car, some of it off the grid
+    std::vector<Eigen::Vector2f> cloud;
+    const float wall = 0.5 + 5 * unit(rng);
+    for (int i = 0; i < 1081; ++i) {
+      const float angle = -0.75 * M_PI + 1.5 * M_PI * i / 1080;
+      const float range = wall * (0.7 + 0.6 * unit(rng));
+      cloud.emplace_back(range * std::cos(angle), range * std::sin(angle));
+    }
+    for (int i = 0; i < 200; ++i) {
+      cloud.emplace_back(-2 + 10 * unit(rng), -8 + 16 * unit(rng));
+    }
+    const Eigen::Vector2f goal(6 * unit(rng) - 3, 6 * unit(rng) - 3);
+    const Eigen::Vector2f global_goal(20 * unit(rng) - 10, 20 * unit(rng) - 10);
+
+    const std::vector<path_generation::Path> exact =
+        path_generation::samplePathOptions(N_PATHS, cloud, car, goal, global_goal);
+    const std::vector<path_generation::Path> lookup =
+        path_generation::samplePathOptions(N_PATHS, cloud, swept, car, goal, global_goal);
+    for (int i = 0; i < N_PATHS; ++i) {
+      options++;
+      if (lookup[i].free_path_length != exact[i].free_path_length) {
+        printf("Cloud %d option %d: free path %f, exact %f\n", trial, i, lookup[i].free_path_length, exact[i].free_path_length);
+        errors++;
+      }
+      if (lookup[i].clearance > exact[i].clearance || lookup[i].clearance < exact[i].clearance - kMaxClearanceError) {
+        printf("Cloud %d option %d: clearance %f, exact %f\n", trial, i, lookup[i].clearance, exact[i].clearance);
+        errors++;
+      }
+    }
+  }
+
+  printf("%d options, %d errors\n", options, errors);
+  return errors == 0 ? 0 : 1;
+}
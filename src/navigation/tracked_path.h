@@ -0,0 +1,99 @@
+//========================================================================
+/*!
+\file    tracked_path.h
+\brief   Global path with precomputed arc lengths and a progress cursor,
+         so local planner queries only look at the stretch of path around
+         the robot.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include "eigen3/Eigen/Dense"
+
+namespace local_planners {
+
+class TrackedPath {
+    public:
+        TrackedPath() : cursor_(0), progress_(0) {}
+
+        void set(const std::vector<Eigen::Vector2f> &points) {
+            points_ = points;
+            arc_.resize(points_.size());
+            for (std::size_t i = 0; i < points_.size(); i++) {
+                arc_[i] = (i == 0) ? 0 : arc_[i - 1] + (points_[i] - points_[i - 1]).norm();
+            }
+            cursor_ = 0;
+            progress_ = 0;
+        }
+
+        bool empty() const {return points_.empty();}
+        std::size_t size() const {return points_.size();}
+        const Eigen::Vector2f &point(const std::size_t &i) const {return points_[i];}
+        const Eigen::Vector2f &back() const {return points_.back();}
+
+        // Arc length from the start of the path to point i
+        float arc(const std::size_t &i) const {return arc_[i];}
+        float length() const {return arc_.empty() ? 0 : arc_.back();}
+
+        // Segment (from point cursor to point cursor + 1) the robot was last projected onto. It only moves forward.
+        std::size_t cursor() const {return cursor_;}
+        // Arc length of the last projection
+        float progress() const {return progress_;}
+
+        // Project loc onto the segments from the cursor up to window past the current progress, and move the cursor to
+        // the closest one. Returns the distance from loc to that segment.
+        float track(const Eigen::Vector2f &loc, const float &window) {
+            if (points_.size() < 2) {
+                return points_.empty() ? std::numeric_limits<float>::max() : (points_[0] - loc).norm();
+            }
+            const float limit {progress_ + window};
+            float best_distance {std::numeric_limits<float>::max()};
+            for (std::size_t i = cursor_; i + 1 < points_.size() && arc_[i] <= limit; i++) {
+                float t;
+                const float distance {segmentDistance(loc, i, t)};
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    cursor_ = i;
+                    progress_ = arc_[i] + t * (arc_[i + 1] - arc_[i]);
+                }
+            }
+            return best_distance;
+        }
+
+        // Point at arc length s along the path, clamped to its ends, found by binary search over the arc lengths.
+        // segment is set to the segment the point lies on.
+        Eigen::Vector2f pointAt(const float &s, std::size_t &segment) const {
+            if (points_.size() < 2) {
+                segment = 0;
+                return points_.empty() ? Eigen::Vector2f(0, 0) : points_[0];
+            }
+            const std::size_t upper = std::upper_bound(arc_.begin(), arc_.end(), s) - arc_.begin();
+            segment = std::min(std::max<std::size_t>(upper, 1), points_.size() - 1) - 1;
+            const float segment_length {arc_[segment + 1] - arc_[segment]};
+            const float t {segment_length > 0 ? std::min(std::max((s - arc_[segment]) / segment_length, 0.f), 1.f) : 0.f};
+            return points_[segment] + t * (points_[segment + 1] - points_[segment]);
+        }
+
+    private:
+        // Exact distance from loc to segment i, with t the parameter of the closest point along it
+        float segmentDistance(const Eigen::Vector2f &loc, const std::size_t &i, float &t) const {
+            const Eigen::Vector2f d {points_[i + 1] - points_[i]};
+            const float sq_length {d.squaredNorm()};
+            t = sq_length > 0 ? std::min(std::max((loc - points_[i]).dot(d) / sq_length, 0.f), 1.f) : 0.f;
+            return (points_[i] + t * d - loc).norm();
+        }
+
+        std::vector<Eigen::Vector2f> points_;
+        std::vector<float> arc_;    // cumulative arc length at every point
+        std::size_t cursor_;
+        float progress_;
+
+}; // class TrackedPath
+
+} // namespace local_planners
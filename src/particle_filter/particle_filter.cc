@@ -22,6 +22,10 @@
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <limits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
 #include "gflags/gflags.h"
@@ -32,12 +36,12 @@
 #include "shared/util/timer.h"
 
 #include "config_reader/config_reader.h"
+#include "profiler/profiler.h"
 #include "particle_filter.h"
 
+#include "vector_map/distance_field.h"
 #include "vector_map/vector_map.h"
 
-#include <queue>
-
 using geometry::line2f;
 using std::cout;
 using std::endl;
@@ -77,17 +81,6 @@ using math_util::AngleDiff;
     might be reaching limit of numerical precision, indicates obervation likelihod function is overconfident
 */
 
-// . efficiency~accuracy tradeoff parameters
-#define n_particles 35 // number of particles instantiated and resampled by filter
-#define laser_downsampling_factor 10 // downsampled laser scan will be 1/N its original size; used to improve computational efficiency
-#define resampling_iteration_threshold 15// resampling only occurs every n iterations of particle weight updates
-
-// . observation model parameters
-#define d_long 1.0d // 
-#define d_short 0.5d // 
-#define sigma_s 0.75d // std deviation of the LiDAR sensor measurements
-#define gamma 0.75d // scalar on the weight updates for each point in the scan
-
 // . motion model noise parameters
 DEFINE_double(k1, 0.5, "Error in translation from translation motion");
 DEFINE_double(k2, 0.5, "Error in rotation from translation motion");
@@ -101,16 +94,220 @@ DEFINE_double(pi, 3.1415926, "Pi");
 
 namespace particle_filter {
 
+// . beam observation model; the downsampled laser scan is 1/N its original size, ranges more than d_short before or
+// d_long after the predicted one are treated as uniform, sigma_s is the std deviation of the LiDAR sensor
+// measurements and gamma scales the weight updates for each point in the scan
+CONFIG_INT(laser_downsampling_, "laser_downsampling");
+CONFIG_DOUBLE(d_short_, "d_short");
+CONFIG_DOUBLE(d_long_, "d_long");
+CONFIG_DOUBLE(sigma_s_, "sigma_s");
+CONFIG_DOUBLE(gamma_, "gamma");
+
+// . likelihood field observation model
+CONFIG_BOOL(use_likelihood_field_, "use_likelihood_field");
+CONFIG_FLOAT(likelihood_field_resolution_, "likelihood_field_resolution");
+CONFIG_FLOAT(likelihood_field_max_distance_, "likelihood_field_max_distance");
+CONFIG_INT(likelihood_field_downsampling_, "likelihood_field_downsampling");
+CONFIG_BOOL(lazy_beams_, "lazy_beams");
+CONFIG_INT(lazy_beam_stride_, "lazy_beam_stride");
+CONFIG_DOUBLE(lazy_beam_margin_, "lazy_beam_margin");
+
+// . parallelism
+CONFIG_INT(num_threads_, "num_threads");
+
+// . particle count; the KLD bounds adapt it between min_particles and max_particles at every resample
+CONFIG_INT(num_particles_, "num_particles");
+CONFIG_BOOL(kld_sampling_, "kld_sampling");
+CONFIG_INT(min_particles_, "min_particles");
+CONFIG_INT(max_particles_, "max_particles");
+CONFIG_DOUBLE(kld_epsilon_, "kld_epsilon");
+CONFIG_DOUBLE(kld_z_, "kld_z");
+CONFIG_FLOAT(kld_bin_size_xy_, "kld_bin_size_xy");
+CONFIG_FLOAT(kld_bin_size_theta_, "kld_bin_size_theta");
+
+// . resampling policy: "ess" resamples when the effective sample size drops below resampling_ess_threshold times the
+// particle count, "interval" resamples every resampling_interval updates
+CONFIG_STRING(resampling_policy_, "resampling_policy");
+CONFIG_INT(resampling_interval_, "resampling_interval");
+CONFIG_DOUBLE(resampling_ess_threshold_, "resampling_ess_threshold");
+
+// . global localization; hypotheses are spread over the free space of the map and pruned with a coarse pass
+CONFIG_INT(global_particles_, "global_particles");
+CONFIG_FLOAT(global_min_clearance_, "global_min_clearance");
+CONFIG_INT(global_coarse_downsampling_, "global_coarse_downsampling");
+CONFIG_INT(global_keep_particles_, "global_keep_particles");
+
 config_reader::ConfigReader config_reader_({"config/particle_filter.lua"});
 
+// . the filter reads the variables above through this snapshot, which is rebuilt after every reload of the file
+config_reader::Snapshot<Parameters> parameters_([](Parameters* p) {
+  p->use_likelihood_field = CONFIG_use_likelihood_field_;
+  p->likelihood_field_resolution = CONFIG_likelihood_field_resolution_;
+  p->likelihood_field_max_distance = CONFIG_likelihood_field_max_distance_;
+  p->likelihood_field_downsampling = CONFIG_likelihood_field_downsampling_;
+  p->lazy_beams = CONFIG_lazy_beams_;
+  p->lazy_beam_stride = std::max(1, CONFIG_lazy_beam_stride_);
+  p->lazy_beam_margin = CONFIG_lazy_beam_margin_;
+  p->laser_downsampling = std::max(1, CONFIG_laser_downsampling_);
+  p->d_short = CONFIG_d_short_;
+  p->d_long = CONFIG_d_long_;
+  p->sigma_s = CONFIG_sigma_s_;
+  p->gamma = CONFIG_gamma_;
+  p->num_threads = std::max(1, CONFIG_num_threads_);
+  p->num_particles = std::max(1, CONFIG_num_particles_);
+  p->kld_sampling = CONFIG_kld_sampling_;
+  p->min_particles = std::max(1, CONFIG_min_particles_);
+  p->max_particles = std::max(p->min_particles, CONFIG_max_particles_);
+  p->kld_epsilon = CONFIG_kld_epsilon_;
+  p->kld_z = CONFIG_kld_z_;
+  p->kld_bin_size_xy = CONFIG_kld_bin_size_xy_;
+  p->kld_bin_size_theta = CONFIG_kld_bin_size_theta_;
+  p->resample_at_interval = CONFIG_resampling_policy_ == "interval";
+  p->resampling_interval = CONFIG_resampling_interval_;
+  p->resampling_ess_threshold = CONFIG_resampling_ess_threshold_;
+  p->global_particles = std::max(1, CONFIG_global_particles_);
+  p->global_min_clearance = CONFIG_global_min_clearance_;
+  p->global_coarse_downsampling = CONFIG_global_coarse_downsampling_;
+  p->global_keep_particles = std::max(1, CONFIG_global_keep_particles_);
+});
+
+namespace {
+// index of the calling worker inside a parallel region, 0 outside of one
+int WorkerIndex() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+}  // namespace
+
+double CumulativeWeights(const ParticleSet& particles,
+                         int num_workers,
+                         vector<double>* cumulative_ptr,
+                         vector<double>* block_weights_ptr) {
+  vector<double>& cumulative_weights = *cumulative_ptr;
+  vector<double>& block_weights = *block_weights_ptr;
+  // the weights are summed in fixed blocks, each block on its own and then the block totals in order, so the
+  // distribution comes out the same whatever the number of workers
+  const int num_particles {static_cast<int>(particles.size())};
+  const int num_blocks {(num_particles + kResampleBlock - 1) / kResampleBlock};
+  cumulative_weights.resize(num_particles);
+  block_weights.resize(num_blocks);
+  const int block_workers {std::max(1, std::min(num_workers, num_blocks))};
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(block_workers) schedule(static)
+#endif
+  for (int b = 0; b < num_blocks; b++) {
+    const int end {std::min(num_particles, (b + 1) * kResampleBlock)};
+    double sum {0.d};
+    for (int i = b * kResampleBlock; i < end; i++) {
+      sum += exp(particles.logw[i]); // converting this out of log space to get the range for resampling
+      cumulative_weights[i] = sum;
+    }
+    block_weights[b] = sum;
+  }
+
+  // . every block after the first is shifted by the total of the ones before it
+  double weights_sum {0.d};
+  for (int b = 0; b < num_blocks; b++) {
+    const double offset {weights_sum};
+    weights_sum += block_weights[b];
+    block_weights[b] = offset;
+  }
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(block_workers) schedule(static)
+#endif
+  for (int b = 1; b < num_blocks; b++) {
+    const int end {std::min(num_particles, (b + 1) * kResampleBlock)};
+    for (int i = b * kResampleBlock; i < end; i++) {
+      cumulative_weights[i] += block_weights[b];
+    }
+  }
+  (void)block_workers;
+  return weights_sum;
+}
+
+void LowVarianceComb(const ParticleSet& particles,
+                     const vector<double>& cumulative_weights,
+                     double first_sampling_location,
+                     double low_variance_sampling_step,
+                     int n_particles,
+                     int num_workers,
+                     ParticleSet* resampled_ptr) {
+  ParticleSet& resampled_particles = *resampled_ptr;
+  resampled_particles.resize(n_particles);
+
+  // resampling: the comb's teeth are cut into fixed contiguous runs, one per worker, shared out over whatever team
+  // OpenMP forms. Each run finds the bin of its first tooth by binary search and walks the distribution from there,
+  // so the draw is the same as one walk over all of them
+  const std::size_t last_particle {particles.size() - 1};
+  const int comb_runs {std::max(1, std::min(num_workers, n_particles / kResampleBlock))};
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(comb_runs) schedule(static)
+#endif
+  for (int run = 0; run < comb_runs; run++) {
+    const int begin {static_cast<int>(static_cast<long>(n_particles) * run / comb_runs)};
+    const int end {static_cast<int>(static_cast<long>(n_particles) * (run + 1) / comb_runs)};
+    std::size_t original_particle_counter {static_cast<std::size_t>(
+        std::lower_bound(cumulative_weights.begin(), cumulative_weights.end(), first_sampling_location + begin * low_variance_sampling_step) -
+        cumulative_weights.begin())}; // to track which particle from the original vector to add to the resampled vector
+    original_particle_counter = std::min(original_particle_counter, last_particle);
+    for (int i = begin; i < end; i++) {
+      // move to the bin that contains the current sampling location
+      const double current_sampling_location {first_sampling_location + i * low_variance_sampling_step};
+      while (original_particle_counter < last_particle && cumulative_weights[original_particle_counter] < current_sampling_location) {
+        original_particle_counter++;
+      }
+      resampled_particles.x[i] = particles.x[original_particle_counter];
+      resampled_particles.y[i] = particles.y[original_particle_counter];
+      resampled_particles.theta[i] = particles.theta[original_particle_counter];
+      resampled_particles.logw[i] = particles.logw[original_particle_counter];
+    }
+  }
+  (void)comb_runs;
+}
+
 ParticleFilter::ParticleFilter() :
     prev_odom_loc_(0, 0),
     prev_odom_angle_(0),
     odom_initialized_(false),
-    resampling_iteration_counter_(0) {}
+    new_odometry_flag_(false),
+    global_localization_pending_(false),
+    resampling_iteration_counter_(0),
+    scratch_(1) {}
+
+void ParticleFilter::RefreshParameters() {
+  parameters_.Refresh(&params_);
+}
+
+int ParticleFilter::NumWorkers() {
+  const int num_workers {params_->num_threads};
+  // each worker draws from its own stream of the filter seed, so results only depend on the worker count
+  if (static_cast<int>(worker_rngs_.size()) != num_workers) {
+    worker_rngs_.clear();
+    for (int i = 0; i < num_workers; i++) {
+      worker_rngs_.push_back(rng_.Stream(i + 1));
+    }
+  }
+  // and its own scratch buffers, which keep their capacity from scan to scan
+  if (static_cast<int>(scratch_.size()) < num_workers) {
+    scratch_.resize(num_workers);
+  }
+  return num_workers;
+}
+
+constexpr uint64_t ParticleFilter::kEmptyBin;
+
+const ParticleSet& ParticleFilter::GetParticleSet() const {
+  return particles_;
+}
 
 void ParticleFilter::GetParticles(vector<Particle>* particles) const {
-  *particles = particles_;
+  particles->resize(particles_.size());
+  for (std::size_t i = 0; i < particles_.size(); i++) {
+    (*particles)[i] = particles_.Get(i);
+  }
 }
 
 void ParticleFilter::GetPredictedPointCloud(const Vector2f& loc,
@@ -121,19 +318,27 @@ void ParticleFilter::GetPredictedPointCloud(const Vector2f& loc,
                                             float angle_min,
                                             float angle_max,
                                             vector<Vector2f>* scan_ptr) {
+  RefreshParameters();
   vector<Vector2f>& scan = *scan_ptr;
   // The returned values must be set using the 'scan' variable:
-  scan.resize(num_ranges / laser_downsampling_factor);
+  scan.resize(num_ranges / params_->laser_downsampling);
 
   // Calculate lidar location (0.2m in front of base_link)
   Eigen::Vector2f lidar_loc = loc + 0.2 * Vector2f(cos(angle), sin(angle));
 
   // Loop through laser scans creating a line for each ray
-  float angle_increment = (angle_max - angle_min) / num_ranges * laser_downsampling_factor;
+  float angle_increment = (angle_max - angle_min) / num_ranges * params_->laser_downsampling;
   for (size_t i = 0; i < scan.size(); i++) {
     // Calculate angle of the ray
     float ray_angle = angle + angle_min + i * angle_increment;
 
+    // A range table attached to the map answers the ray with one lookup; without one the ray is cast against the lines
+    if (map_.range_table != nullptr) {
+      const float range {map_.range_table->Range(lidar_loc, ray_angle, range_min, range_max)};
+      scan[i] = lidar_loc + range * Vector2f(cos(ray_angle), sin(ray_angle));
+      continue;
+    }
+
     // Create a line for the ray
     line2f ray(
       lidar_loc.x() + range_min * cos(ray_angle),
@@ -144,21 +349,11 @@ void ParticleFilter::GetPredictedPointCloud(const Vector2f& loc,
 
     // Laserscan maximum value is default ray intersection with the map
     Eigen::Vector2f ray_intersection = lidar_loc + range_max * Vector2f(cos(ray_angle), sin(ray_angle));
-    float obstacle_dist = range_max;
-
-    // Loop through map lines checking for intersections with the predicted ray
-    for (size_t j = 0; j < map_.lines.size(); ++j) {
-      const line2f map_line = map_.lines[j];
 
-      // Check for intersection between ray and map line
-      Eigen::Vector2f intersection_point;
-      bool intersects = map_line.Intersection(ray, &intersection_point);
-
-      // Update if the intersection is closer (deal with multiple collisions, take first obstacle seen)
-      if (intersects && (intersection_point - lidar_loc).norm() < obstacle_dist) {
-        obstacle_dist = (intersection_point - lidar_loc).norm();    // Update distance
-        ray_intersection = intersection_point;    // Update location
-      }
+    // Find the first obstacle seen along the ray; the map's grid index only tests lines near the ray
+    Eigen::Vector2f intersection_point;
+    if (map_.Intersection(ray.p0, ray.p1, &intersection_point)) {
+      ray_intersection = intersection_point;
     }
 
     // Lastly, add obstacle to generated scan
@@ -166,118 +361,295 @@ void ParticleFilter::GetPredictedPointCloud(const Vector2f& loc,
   }
 }
 
+void ParticleFilter::PrepareScan(const vector<float>& ranges,
+                                 float range_min,
+                                 float range_max,
+                                 float angle_min,
+                                 float angle_max,
+                                 int downsampling,
+                                 PreparedScan* scan_ptr) const {
+  PreparedScan& scan = *scan_ptr;
+  const int stride {std::max(1, downsampling)};
+  const int num_ranges {static_cast<int>(ranges.size())};
+
+  // the beam directions only depend on the scan geometry, so they are recomputed only when it changes
+  const vector<Vector2f>& all_directions {scan.beams.Get(angle_min, (angle_max - angle_min) / num_ranges, num_ranges)};
+  scan.range_min = range_min;
+  scan.range_max = range_max;
+
+  // downsample once for all particles, keeping only the beams the observation model uses;
+  // ranges less than the minimum range or greater than the maximum range are excluded; adding some tolerance so 9.999 and 0.201 don't ruin us
+  const float tolerance {0.05};
+  const float angle_increment {(angle_max - angle_min) / num_ranges};
+  scan.ranges.clear();
+  scan.directions.clear();
+  scan.angles.clear();
+  for (int i = 0; i < num_ranges; i += stride) {
+    if (ranges[i] < (1 + tolerance) * range_min || ranges[i] > (1 - tolerance) * range_max) {continue;}
+    scan.ranges.push_back(ranges[i]);
+    scan.directions.push_back(all_directions[i]);
+    scan.angles.push_back(angle_min + i * angle_increment);
+  }
+}
+
 void ParticleFilter::Update(const vector<float>& ranges,
                             float range_min,
                             float range_max,
                             float angle_min,
                             float angle_max,
                             Particle* p_ptr) {
-  // Lecture 08 slide 44, Lecture 7 slide 32, log likelihoods and infitesimally small numbers
+  RefreshParameters();
+  // single-particle entry point; ObserveLaser prepares the scan once and shares it across all particles instead
+  WorkerScratch& scratch {scratch_[std::min<std::size_t>(WorkerIndex(), scratch_.size() - 1)]};
+  PrepareScan(ranges, range_min, range_max, angle_min, angle_max, SensorModelDownsampling(), &scratch.scan);
+  p_ptr->weight = ScanLogWeight(scratch.scan, *p_ptr);
+}
+
+int ParticleFilter::SensorModelDownsampling() const {
+  return UseLikelihoodField() ? params_->likelihood_field_downsampling : params_->laser_downsampling;
+}
+
+bool ParticleFilter::UseLikelihoodField() const {
+  return params_->use_likelihood_field && !distance_field_.Empty();
+}
 
-  // getting the expected cloud at the particle pose
-  std::vector<Eigen::Vector2f> predicted_scan; // This scan will be altered by GetPredictedPointCloud to be compared to ranges
-  Particle particle = *p_ptr;
-  GetPredictedPointCloud(particle.loc, particle.angle, ranges.size(), range_min, range_max, angle_min, angle_max, &predicted_scan);
+double ParticleFilter::ScanLogWeight(const PreparedScan& scan, const Particle& particle) const {
+  // scoring beam endpoints against the precomputed distance field is much cheaper than ray casting
+  if (UseLikelihoodField()) {
+    return LikelihoodFieldLogWeight(scan, particle);
+  }
+  return BeamModelLogWeight(scan, particle);
+}
 
-  // downsampling the raw scan to make its size match the predicted scan
-  int downsampling_factor {static_cast<int>(ranges.size() / predicted_scan.size())};
-  std::vector<float> downsampled_ranges(predicted_scan.size());
-  for (std::size_t i = 0; i < predicted_scan.size(); i++) {
-    downsampled_ranges[i] = ranges[i * downsampling_factor];
+double ParticleFilter::BeamModelLogWeight(const PreparedScan& scan, const Particle& particle) const {
+  // one sin/cos per particle: it places the LiDAR sensor and rotates the sensor-frame beams into the map frame
+  const float c {std::cos(particle.angle)};
+  const float s {std::sin(particle.angle)};
+  const Eigen::Vector2f kLaserLoc(0.2, 0); // pulled from navigation_main.cc
+  const Eigen::Vector2f lidar_location {particle.loc + kLaserLoc(0) * Eigen::Vector2f(c, s)};
+
+  // iterating over the beams of the prepared scan
+  vector<float> predicted_ranges(scan.ranges.size());
+  for (std::size_t i = 0; i < scan.ranges.size(); i++) {
+    const Eigen::Vector2f& u {scan.directions[i]};
+    const Eigen::Vector2f direction(c * u.x() - s * u.y(), s * u.x() + c * u.y());
+
+    // laserscan maximum value is the default when the ray does not hit the map; otherwise take the first obstacle seen along the ray
+    predicted_ranges[i] = scan.range_max;
+    Eigen::Vector2f intersection_point;
+    if (map_.Intersection(lidar_location + scan.range_min * direction, lidar_location + scan.range_max * direction, &intersection_point)) {
+      predicted_ranges[i] = (intersection_point - lidar_location).norm();
+    }
   }
+  return BeamModelLogWeight(scan, predicted_ranges.data());
+}
+
+double ParticleFilter::BeamModelLogWeight(const PreparedScan& scan, const float* predicted_ranges) const {
+  // Lecture 08 slide 44, Lecture 7 slide 32, log likelihoods and infitesimally small numbers
 
   // the particle's weight
   double default_particle_weight {1e-06d}; // setting initial weight in probability space to be small value (nonzero so log is not indeterminant)
   double log_weight {log(default_particle_weight)}; // working with weights in log space because we'll want them there for resampling anyway
 
-  // getting location of LiDAR sensor given the particle's pose
-  const Eigen::Vector2f kLaserLoc(0.2, 0); // pulled from navigation_main.cc
-  Eigen::Vector2f lidar_location = particle.loc + kLaserLoc(0) * Eigen::Vector2f(cos(particle.angle), sin(particle.angle));
-
-  // iterating over the points in the predicted scan
-  for (std::size_t i = 0; i < predicted_scan.size(); i++) {
-    
-    // getting the range (magnitude of distance) between the point and the LiDAR sensor's location
-    double predicted_scan_range {(predicted_scan[i] - lidar_location).norm()}; 
+  for (std::size_t i = 0; i < scan.ranges.size(); i++) {
+    const double predicted_scan_range {predicted_ranges[i]};
+    const double range {scan.ranges[i]};
 
     // // . this is the simple observation likelihood function
-    // log_weight += (-1 * pow((downsampled_ranges[i] - predicted_scan_range), 2) / (pow(sigma_s, 2)));
+    // log_weight += (-1 * pow((range - predicted_scan_range), 2) / (pow(sigma_s, 2)));
 
     // . this is a more complete observation likelihood function
-    // ranges less than the minimum range or greater than the maximum range are excluded; adding some tolerance so 9.999 and 0.201 don't ruin us
-    // if (downsampled_ranges[i] < range_min || downsampled_ranges[i] > range_max){
-    float tolerance {0.05};
-    if (downsampled_ranges[i] < (1 + tolerance) * range_min || downsampled_ranges[i] > (1 - tolerance) * range_max) {continue;}
-
     // if the predicted scan range is less than some value (pred - d_s), treat it as uniform instead of Gaussian
-    if (downsampled_ranges[i] < predicted_scan_range - d_short) {
-      log_weight += (-1 * pow(d_short, 2) / pow(sigma_s, 2));
+    if (range < predicted_scan_range - params_->d_short) {
+      log_weight += (-1 * pow(params_->d_short, 2) / pow(params_->sigma_s, 2));
     }
     // if the predicted scan range is greater than some value (pred + d_l), treat it as uniform instead of Gaussian
-    else if (downsampled_ranges[i] > predicted_scan_range+d_long) {
-      log_weight += (-1 * pow(d_long, 2) / pow(sigma_s, 2));
+    else if (range > predicted_scan_range+params_->d_long) {
+      log_weight += (-1 * pow(params_->d_long, 2) / pow(params_->sigma_s, 2));
     }
     // simplest case, assumes purely Gaussian distribution between expected and actual ranges
     else {
-      log_weight += (-1 * pow((downsampled_ranges[i] - predicted_scan_range), 2) / (pow(sigma_s, 2)));
+      log_weight += (-1 * pow((range - predicted_scan_range), 2) / (pow(params_->sigma_s, 2)));
     }
   }
   // assigning weight with some scalar gamma
-  p_ptr->weight = gamma * log_weight;
+  return params_->gamma * log_weight;
+}
+
+double ParticleFilter::LikelihoodFieldLogWeight(const PreparedScan& scan, const Particle& particle) const {
+  double default_particle_weight {1e-06d};
+  return params_->gamma * (log(default_particle_weight) + LikelihoodFieldSum(scan, particle, 1, false));
+}
+
+double ParticleFilter::LikelihoodFieldSum(const PreparedScan& scan, const Particle& particle, int stride, bool skip) const {
+  // one sin/cos per particle: it places the LiDAR sensor and rotates the sensor-frame beams into the map frame
+  const float c {std::cos(particle.angle)};
+  const float s {std::sin(particle.angle)};
+  const Eigen::Vector2f kLaserLoc(0.2, 0); // pulled from navigation_main.cc
+  const Eigen::Vector2f lidar_location {particle.loc + kLaserLoc(0) * Eigen::Vector2f(c, s)};
+
+  const double max_distance {distance_field_.MaxDistance()};
+  const double sigma_s {params_->sigma_s};
+  const auto term = [&](std::size_t i) {
+    // project the beam endpoint into the map frame and look up its distance to the closest wall
+    const Eigen::Vector2f& u {scan.directions[i]};
+    const Eigen::Vector2f endpoint {lidar_location + scan.ranges[i] * Eigen::Vector2f(c * u.x() - s * u.y(), s * u.x() + c * u.y())};
+    // the field is truncated at max_distance, which plays the role of d_short/d_long in the beam model
+    const double distance {std::min<double>(distance_field_.Distance(endpoint), max_distance)};
+    return -1 * pow(distance, 2) / pow(sigma_s, 2);
+  };
+
+  const std::size_t num_beams {scan.ranges.size()};
+  double sum {0.d};
+  if (!skip) {
+    // beams first, first + stride, ...
+    for (std::size_t i = 0; i < num_beams; i += stride) {
+      sum += term(i);
+    }
+    return sum;
+  }
+  // the ones in between them
+  for (std::size_t first = 0; first < num_beams; first += stride) {
+    const std::size_t end {std::min(first + stride, num_beams)};
+    for (std::size_t i = first + 1; i < end; i++) {
+      sum += term(i);
+    }
+  }
+  return sum;
+}
+
+double ParticleFilter::LazyLikelihoodFieldWeights(bool accumulate_weights, int num_workers) {
+  const int num_particles {static_cast<int>(particles_.size())};
+  const int stride {params_->lazy_beam_stride};
+  const double gamma {params_->gamma};
+  const double default_log_weight {log(1e-06d)};
+  if (num_particles == 0) {return -std::numeric_limits<double>::infinity();}
+
+  // . every term of the field is at most 0, so with gamma >= 0 the weight from the strided beams bounds the full one
+  weight_bounds_.resize(num_particles);
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(num_workers) schedule(static)
+#endif
+  for (int i = 0; i < num_particles; i++) {
+    const double prior {accumulate_weights ? particles_.logw[i] : 0.d};
+    weight_bounds_[i] = prior + gamma * (default_log_weight + LikelihoodFieldSum(scan_, particles_.Get(i), stride, false));
+  }
+
+  // . the particle with the highest bound is refined first, and the others are measured against its full weight
+  const int best {static_cast<int>(std::max_element(weight_bounds_.begin(), weight_bounds_.end()) - weight_bounds_.begin())};
+  const double best_weight {weight_bounds_[best] + gamma * LikelihoodFieldSum(scan_, particles_.Get(best), stride, true)};
+  const double threshold {best_weight - params_->lazy_beam_margin};
+
+  // . a particle whose bound falls more than the margin below it is left at its bound; it is hopeless either way
+  double max_particle_weight {best_weight};
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(num_workers) schedule(dynamic, 64) reduction(max: max_particle_weight)
+#endif
+  for (int i = 0; i < num_particles; i++) {
+    if (i == best) {
+      particles_.logw[i] = best_weight;
+    } else if (weight_bounds_[i] < threshold) {
+      particles_.logw[i] = weight_bounds_[i];
+    } else {
+      particles_.logw[i] = weight_bounds_[i] + gamma * LikelihoodFieldSum(scan_, particles_.Get(i), stride, true);
+    }
+    max_particle_weight = std::max(max_particle_weight, particles_.logw[i]);
+  }
+  (void)num_workers;
+  return max_particle_weight;
 }
 
 void ParticleFilter::Resample() {
+  PROFILE_SCOPE("Resample");
   // checking to see if we have anything to resample
   if (particles_.empty()) {
       std::cerr << "NO EXISTING PARTICLES! Nothing to resample..." << std::endl;
       return;
   }
 
-  // create vector for new particles
-  std::vector<particle_filter::Particle> resampled_particles;
-  resampled_particles.reserve(n_particles);
+  // draw the new particles into the back buffer
+  ParticleSet& resampled_particles {resampled_particles_};
+  resampled_particles.clear();
+  if (params_->kld_sampling) {
+    KLDResample(&resampled_particles);
+  } else {
+    LowVarianceResample(params_->num_particles, &resampled_particles);
+  }
 
+  // reset particle weights after resampling
+  double resampled_weight {log(1.d / resampled_particles.size())};
+  std::fill(resampled_particles.logw.begin(), resampled_particles.logw.end(), resampled_weight);
+
+  // swap the buffers instead of copying the resampled particles
+  swap(particles_, resampled_particles_);
+}
+
+void ParticleFilter::LowVarianceResample(int n_particles, ParticleSet* resampled_ptr) {
   // build discrete distribution for resampling
-  double weights_sum {0.d};
-  std::queue<double> relative_positions;
-  for (std::size_t i = 0; i < particles_.size(); i++) {
-    weights_sum += exp(particles_[i].weight); // converting this out of log space to get the range for low-variance resampling
-    relative_positions.push(weights_sum); // keeping track of where the particles fall in the distribution we are going to resample for convenince
-  }
+  const int num_workers {NumWorkers()};
+  const double weights_sum {CumulativeWeights(particles_, num_workers, &cumulative_weights_, &block_weights_)};
 
   // create starting point and step size for low-variance resampling
-  double low_variance_sampling_step {weights_sum / n_particles}; // size of constant step for low variance resampling
-  double current_sampling_location {rng_.UniformRandom(0, low_variance_sampling_step)}; // starting point for low-variance resampling; constraining it to be within the first step so we don't have to worry about wrapping around
-
-  // resampling
-  int original_particle_counter {0}; // to track which particle from the original vector to add to the resampled vector
-  // iterate for the total number of particles
-  for (std::size_t i = 0; i < n_particles; i++) {
-    while (!relative_positions.empty()) {
-      if (relative_positions.front() < current_sampling_location) { // checking to see if the front of the discrete probability distribution queue is less than the current sampling location; if it is, we need to move to the next bin to sample
-        relative_positions.pop();
-        original_particle_counter++;
-      } else { // otherwise, we are in the correct bin and should draw a particle for the resampled distribution
-        resampled_particles.push_back(particles_[original_particle_counter]);
-        break; // to make sure we only add once particle for each iteration
-      }
-    }
-    current_sampling_location += low_variance_sampling_step;
-  }
+  const double low_variance_sampling_step {weights_sum / n_particles}; // size of constant step for low variance resampling
+  const double first_sampling_location {rng_.UniformRandom(0, low_variance_sampling_step)}; // starting point for low-variance resampling; constraining it to be within the first step so we don't have to worry about wrapping around
+
+  LowVarianceComb(particles_, cumulative_weights_, first_sampling_location, low_variance_sampling_step, n_particles, num_workers, resampled_ptr);
 
   // make sure we resampled how many particles we wanted
-  if (static_cast<int>(resampled_particles.size()) != n_particles) {
-    std::cerr << resampled_particles.size() << " particles were resampled instead of " << n_particles << "! Investigate this." << std::endl;
+  if (static_cast<int>(resampled_ptr->size()) != n_particles) {
+    std::cerr << resampled_ptr->size() << " particles were resampled instead of " << n_particles << "! Investigate this." << std::endl;
   }
+}
 
-  // reset particle weights after resampling
-  double resampled_weight {log(1.d / n_particles)};
-  for (auto &particle : resampled_particles) {
-    particle.weight = resampled_weight;
+void ParticleFilter::KLDResample(ParticleSet* resampled_ptr) {
+  // Fox, "Adapting the Sample Size in Particle Filters Through KLD-Sampling": keep drawing until the number of
+  // samples bounds the KL divergence between the sampled and the true posterior by kld_epsilon with probability
+  // given by the kld_z quantile, counting the histogram bins of (x, y, theta) that the samples fall into
+  ParticleSet& resampled_particles = *resampled_ptr;
+  const int min_particles {params_->min_particles};
+  const int max_particles {params_->max_particles};
+  resampled_particles.reserve(max_particles);
+
+  // cumulative weights for drawing from the current particles
+  const double weights_sum {CumulativeWeights(particles_, NumWorkers(), &cumulative_weights_, &block_weights_)};
+
+  const float inv_bin_xy {1.f / params_->kld_bin_size_xy};
+  const float inv_bin_theta {static_cast<float>(1.f / (params_->kld_bin_size_theta * M_PI / 180.f))};
+  // open-addressing hash set of occupied bins, sized to stay at most half full
+  std::size_t table_size {16};
+  while (table_size < 2 * static_cast<std::size_t>(max_particles)) {
+    table_size *= 2;
+  }
+  kld_bins_.assign(table_size, kEmptyBin);
+  int k {0};
+  double required_particles {static_cast<double>(min_particles)};
+  while (static_cast<int>(resampled_particles.size()) < max_particles &&
+         static_cast<double>(resampled_particles.size()) < required_particles) {
+    // draw a particle in proportion to its weight
+    const double sample {rng_.UniformRandom(0, weights_sum)};
+    std::size_t index = std::lower_bound(cumulative_weights_.begin(), cumulative_weights_.end(), sample) - cumulative_weights_.begin();
+    index = std::min(index, particles_.size() - 1);
+    resampled_particles.push_back(particles_.Get(index));
+
+    // a sample in a new bin raises the number of samples needed
+    const uint64_t bin_x {static_cast<uint64_t>(static_cast<int64_t>(std::floor(particles_.x[index] * inv_bin_xy)))};
+    const uint64_t bin_y {static_cast<uint64_t>(static_cast<int64_t>(std::floor(particles_.y[index] * inv_bin_xy)))};
+    const uint64_t bin_theta {static_cast<uint64_t>(static_cast<int64_t>(std::floor(math_util::AngleMod(particles_.theta[index]) * inv_bin_theta)))};
+    const uint64_t bin {((bin_x & 0xFFFFFF) << 40) | ((bin_y & 0xFFFFFF) << 16) | (bin_theta & 0xFFFF)};
+    std::size_t slot {static_cast<std::size_t>((bin * 0x9E3779B97F4A7C15ull) >> 32) & (table_size - 1)};
+    while (kld_bins_[slot] != kEmptyBin && kld_bins_[slot] != bin) {
+      slot = (slot + 1) & (table_size - 1);
+    }
+    if (kld_bins_[slot] == bin) {continue;}
+    kld_bins_[slot] = bin;
+    k++;
+    if (k < 2) {continue;}
+
+    // Wilson-Hilferty approximation of the chi-square quantile with k - 1 degrees of freedom
+    const double a {2.0 / (9.0 * (k - 1))};
+    const double b {1.0 - a + sqrt(a) * params_->kld_z};
+    required_particles = std::max<double>(min_particles, (k - 1) / (2.0 * params_->kld_epsilon) * b * b * b);
   }
-
-  // assign the resampled particles
-  particles_ = resampled_particles;
 }
 
 void ParticleFilter::ObserveLaser(const vector<float>& ranges,
@@ -285,37 +657,159 @@ void ParticleFilter::ObserveLaser(const vector<float>& ranges,
                                   float range_max,
                                   float angle_min,
                                   float angle_max) {
+  PROFILE_SCOPE("ObserveLaser");
+  RefreshParameters();
+  // The first scan after global initialization prunes the map-wide hypotheses before the regular update
+  if (global_localization_pending_) {
+    PruneGlobalHypotheses(ranges, range_min, range_max, angle_min, angle_max);
+    global_localization_pending_ = false;
+  }
   // Ignore callback when odometry has not changed (car has not moved more than some threshold; refer to Predict() function for more information)
-  if (!new_odometry_flag_) {
+  else if (!new_odometry_flag_) {
     return;
   }
 
-  // update the weights of each particle
-  Particle *top_particle = new Particle;
-  double max_particle_weight {-100000};
-  for (auto &particle : particles_) {
-    Update(ranges, range_min, range_max, angle_min, angle_max, &particle);
-    if (particle.weight > max_particle_weight) {
-      max_particle_weight = particle.weight;
-      top_particle = &particle;
+  // downsample the scan and look up the beam directions once, shared by every particle
+  PrepareScan(ranges, range_min, range_max, angle_min, angle_max, SensorModelDownsampling(), &scan_);
+
+  // update the weights of each particle; every particle is independent so they are split across the workers
+  const int num_workers {NumWorkers()};
+  const int num_particles {static_cast<int>(particles_.size())};
+  // the ESS policy needs the weights accumulated since the last resample; the interval policy only keeps the latest scan
+  const bool accumulate_weights {!params_->resample_at_interval};
+  // the beam model ray casts every beam of every particle, all at once so that particles close to each other share the map
+  // lines gathered around them
+  const bool batch_beams {!UseLikelihoodField()};
+  const std::size_t num_beams {scan_.ranges.size()};
+  if (batch_beams) {
+    const Eigen::Vector2f kLaserLoc(0.2, 0); // pulled from navigation_main.cc
+    lidar_locs_.resize(num_particles);
+    for (int i = 0; i < num_particles; i++) {
+      lidar_locs_[i] = Eigen::Vector2f(particles_.x[i], particles_.y[i]) + kLaserLoc(0) * Eigen::Vector2f(std::cos(particles_.theta[i]), std::sin(particles_.theta[i]));
+    }
+    map_.GetPredictedScans(lidar_locs_, particles_.theta, scan_.angles, scan_.range_min, scan_.range_max, &predicted_ranges_);
+  }
+  // the likelihood field may skip most beams of hopeless particles; the beam model has already cast them all above
+  const bool lazy {params_->lazy_beams && !batch_beams && params_->lazy_beam_stride > 1 && params_->gamma >= 0};
+  double max_particle_weight {-std::numeric_limits<double>::infinity()};
+  if (lazy) {
+    max_particle_weight = LazyLikelihoodFieldWeights(accumulate_weights, num_workers);
+  } else {
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(num_workers) schedule(static) reduction(max: max_particle_weight)
+#endif
+    for (int i = 0; i < num_particles; i++) {
+      const double scan_log_weight {batch_beams ? BeamModelLogWeight(scan_, predicted_ranges_.data() + i * num_beams) : ScanLogWeight(scan_, particles_.Get(i))};
+      particles_.logw[i] = (accumulate_weights ? particles_.logw[i] : 0.d) + scan_log_weight;
+      max_particle_weight = std::max(max_particle_weight, particles_.logw[i]);
+    }
+  }
+  (void)num_workers;
+
+  int top_particle_index {0};
+  for (int i = 0; i < num_particles; i++) {
+    if (particles_.logw[i] == max_particle_weight) {
+      top_particle_index = i;
+      break;
     }
   }
-  for (auto &particle : particles_) {
-    particle.weight -= max_particle_weight;
+  double weights_sum {0.d};
+  double squared_weights_sum {0.d};
+  for (auto &weight : particles_.logw) {
+    weight -= max_particle_weight;
+    const double w {exp(weight)};
+    weights_sum += w;
+    squared_weights_sum += w * w;
+  }
+  const double effective_sample_size {squared_weights_sum > 0 ? weights_sum * weights_sum / squared_weights_sum : 0.d};
+  if (num_particles > 0) {
+    top_particle_ = particles_.Get(top_particle_index);   // Only copy the contents to avoid changes in between particle
   }
-  *top_particle_ = *top_particle;   // Only copy the contents to avoid changes in between particle
 
-  // check how many iterations we have had since resampling, resample if it's time to do so
+  // decide whether the weights have degenerated enough to resample
   resampling_iteration_counter_++;
-  if (resampling_iteration_counter_ == resampling_iteration_threshold) {
+  bool resample {false};
+  if (params_->resample_at_interval) {
+    // check how many iterations we have had since resampling, resample if it's time to do so
+    resample = resampling_iteration_counter_ >= params_->resampling_interval;
+  } else {
+    // effective sample size (sum w)^2 / sum w^2 ranges from 1 (one particle holds all the weight) to the particle count (uniform weights)
+    resample = effective_sample_size < params_->resampling_ess_threshold * num_particles;
+  }
+  if (resample) {
     resampling_iteration_counter_ = 0;
     Resample();
   }
 }
 
+void ParticleFilter::PredictKernel(const Vector2f& translation_diff,
+                                   float rotation_diff,
+                                   float major_axis_sigma,
+                                   float minor_axis_sigma,
+                                   float rotation_sigma) {
+  const int num_workers {NumWorkers()};
+  const int num_particles {static_cast<int>(particles_.size())};
+  noise_major_.resize(num_particles);
+  noise_minor_.resize(num_particles);
+  noise_rotation_.resize(num_particles);
+  cos_theta_.resize(num_particles);
+  sin_theta_.resize(num_particles);
+
+  float* x {particles_.x.data()};
+  float* y {particles_.y.data()};
+  float* theta {particles_.theta.data()};
+  float* major {noise_major_.data()};
+  float* minor {noise_minor_.data()};
+  float* rotation {noise_rotation_.data()};
+  float* c {cos_theta_.data()};
+  float* s {sin_theta_.data()};
+  // rotating the odometry translation into a particle's frame only needs the sin/cos of the particle angle
+  const float cos_prev {std::cos(prev_odom_angle_)};
+  const float sin_prev {std::sin(prev_odom_angle_)};
+  const float tx {translation_diff.x()};
+  const float ty {translation_diff.y()};
+
+  // the particles are cut into one fixed contiguous block per worker, each with its own random stream; the blocks are
+  // shared out over whatever team OpenMP forms, so every particle moves, and the same way, with fewer threads
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(num_workers) schedule(static)
+#endif
+  for (int block = 0; block < num_workers; block++) {
+    const int begin {static_cast<int>(static_cast<long>(num_particles) * block / num_workers)};
+    const int end {static_cast<int>(static_cast<long>(num_particles) * (block + 1) / num_workers)};
+    fast_random::FastRandom &rng {worker_rngs_[block]};
+
+    // batch-generate the noise for the whole block
+    rng.FillGaussian(major + begin, end - begin, 0, major_axis_sigma);
+    rng.FillGaussian(minor + begin, end - begin, 0, minor_axis_sigma);
+    rng.FillGaussian(rotation + begin, end - begin, 0, rotation_sigma);
+
+    for (int i = begin; i < end; i++) {
+      c[i] = std::cos(theta[i]);
+      s[i] = std::sin(theta[i]);
+    }
+
+    // straight-line arithmetic over contiguous arrays, so the compiler can vectorize it
+#ifdef _OPENMP
+    #pragma omp simd
+#endif
+    for (int i = begin; i < end; i++) {
+      // rotation by particle angle minus previous odometry angle
+      const float cos_delta {c[i] * cos_prev + s[i] * sin_prev};
+      const float sin_delta {s[i] * cos_prev - c[i] * sin_prev};
+      x[i] += cos_delta * tx - sin_delta * ty + major[i] * c[i] + minor[i] * s[i];
+      y[i] += sin_delta * tx + cos_delta * ty + major[i] * s[i] + minor[i] * c[i];
+      theta[i] += rotation_diff + rotation[i];
+    }
+  }
+  (void)num_workers;
+}
+
 // A new odometry value is available. Propagate the particles forward using the motion model.
 void ParticleFilter::Predict(const Vector2f& odom_loc,
                              const float odom_angle) {
+  PROFILE_SCOPE("Predict");
+  RefreshParameters();
   // Ignore new pose set
   if (odom_initialized_) {
     // Calculate pose change from odometry reading
@@ -333,31 +827,17 @@ void ParticleFilter::Predict(const Vector2f& odom_loc,
 
     // Ignore unrealistic jumps in odometry
     if (translation_diff.norm() < 1.0 && abs(rotation_diff) < FLAGS_pi / 4) {
-      // Loop through particles
-      for (auto &particle : particles_) {
-        // Transform odometry pose change to map frame (for particle)
-        Eigen::Rotation2Df rotation_vector(AngleDiff(particle.angle, prev_odom_angle_));
-        Eigen::Vector2f particle_translation = rotation_vector * translation_diff;
-
-        // // Sample noise from a Gaussian distribution
-        // float x_noise = rng_.Gaussian(0.0,  FLAGS_k1 * translation_diff.norm() + FLAGS_k4 * rotation_diff);
-        // float y_noise = rng_.Gaussian(0.0,  FLAGS_k1 * translation_diff.norm() + FLAGS_k4 * rotation_diff);
-        // float rotation_noise = rng_.Gaussian(0.0, FLAGS_k2 * translation_diff.norm() + FLAGS_k3 * rotation_diff);
-
-        // Sample noise from a Gaussian distribution for a more complete ellipsoid model
-        auto translation_norm {translation_diff.norm()};
-        auto major_axis_noise {rng_.Gaussian(0.0, FLAGS_k5 * translation_norm + FLAGS_k4 * rotation_diff)};
-        auto minor_axis_noise {rng_.Gaussian(0.0, FLAGS_k6 * translation_norm + FLAGS_k4 * rotation_diff)};
-
-        auto x_noise {major_axis_noise * cos(particle.angle) + minor_axis_noise * sin(particle.angle)};
-        auto y_noise {major_axis_noise * sin(particle.angle) + minor_axis_noise * cos(particle.angle)};
-        auto rotation_noise {rng_.Gaussian(0.0, FLAGS_k2 * translation_diff.norm() + FLAGS_k3 * rotation_diff)};
-
-        // Update particle location from motion model
-        particle.loc[0] += particle_translation[0] + x_noise;
-        particle.loc[1] += particle_translation[1] + y_noise;
-        particle.angle += rotation_diff + rotation_noise;
-      }
+      // // Sample noise from a Gaussian distribution
+      // float x_noise = rng_.Gaussian(0.0,  FLAGS_k1 * translation_diff.norm() + FLAGS_k4 * rotation_diff);
+      // float y_noise = rng_.Gaussian(0.0,  FLAGS_k1 * translation_diff.norm() + FLAGS_k4 * rotation_diff);
+      // float rotation_noise = rng_.Gaussian(0.0, FLAGS_k2 * translation_diff.norm() + FLAGS_k3 * rotation_diff);
+
+      // standard deviations of the ellipsoid noise model, shared by every particle
+      const float translation_norm {translation_diff.norm()};
+      const float major_axis_sigma {static_cast<float>(FLAGS_k5 * translation_norm + FLAGS_k4 * rotation_diff)};
+      const float minor_axis_sigma {static_cast<float>(FLAGS_k6 * translation_norm + FLAGS_k4 * rotation_diff)};
+      const float rotation_sigma {static_cast<float>(FLAGS_k2 * translation_norm + FLAGS_k3 * rotation_diff)};
+      PredictKernel(translation_diff, rotation_diff, major_axis_sigma, minor_axis_sigma, rotation_sigma);
     }
   }
   else {
@@ -371,10 +851,23 @@ void ParticleFilter::Predict(const Vector2f& odom_loc,
   prev_odom_angle_ = odom_angle;
 }
 
+void ParticleFilter::LoadMap(const string& map_file) {
+  const bool map_changed {map_file != map_.file_name};
+  map_.Load(map_file);
+
+  // the distance field only depends on the map, so it is rebuilt only when the map changes
+  if (map_changed || distance_field_.Empty()) {
+    map_.GetDistanceField(params_->likelihood_field_resolution, params_->likelihood_field_max_distance, &distance_field_);
+    std::cout << "Likelihood field built: " << distance_field_.Width() << " x " << distance_field_.Height() << " cells" << std::endl;
+  }
+}
+
 void ParticleFilter::Initialize(const string& map_file,
                                 const Vector2f& loc,
                                 const float angle) {
-  map_.Load(map_file);
+  RefreshParameters();
+  LoadMap(map_file);
+  global_localization_pending_ = false;
 
   // Initialize odometry
   prev_odom_loc_ = loc;
@@ -383,17 +876,20 @@ void ParticleFilter::Initialize(const string& map_file,
 
   // Clear and Initialize particles
   particles_.clear();
+  const int n_particles {params_->num_particles};
+  // Generate random numbers for error, all particles at once
+  std::vector<float> error_x(n_particles);
+  std::vector<float> error_y(n_particles);
+  std::vector<float> error_theta(n_particles);
+  rng_.FillUniform(error_x.data(), n_particles, -0.25, 0.25);
+  rng_.FillUniform(error_y.data(), n_particles, -0.25, 0.25);
+  rng_.FillUniform(error_theta.data(), n_particles, -FLAGS_pi / 4, FLAGS_pi / 4);
   for (int i = 0; i < n_particles; i++) {
-    // Generate random number for error
-    float error_x = rng_.UniformRandom(-0.25, 0.25);  
-    float error_y = rng_.UniformRandom(-0.25, 0.25);
-    float error_theta = rng_.UniformRandom(-FLAGS_pi / 4, FLAGS_pi / 4);
-
     // Create particle using error weights
     Particle p = {
-      Eigen::Vector2f(loc[0] + error_x, loc[1] + error_y),
-      (float)(angle + error_theta),
-      1 / n_particles};
+      Eigen::Vector2f(loc[0] + error_x[i], loc[1] + error_y[i]),
+      (float)(angle + error_theta[i]),
+      log(1.d / n_particles)};
 
     // Add particle
     particles_.push_back(p);
@@ -402,39 +898,109 @@ void ParticleFilter::Initialize(const string& map_file,
   std::cout << particles_.size() << " particles initialized" << std::endl;
 }
 
+void ParticleFilter::InitializeGlobal(const string& map_file) {
+  RefreshParameters();
+  LoadMap(map_file);
+  odom_initialized_ = false;
+  particles_.clear();
+  if (map_.lines.empty()) {
+    std::cerr << "Map " << map_file << " has no lines, cannot localize globally" << std::endl;
+    return;
+  }
+
+  // bounding box of the map to draw candidate locations from
+  Vector2f map_min {map_.lines[0].p0};
+  Vector2f map_max {map_.lines[0].p0};
+  for (const line2f& line : map_.lines) {
+    map_min = map_min.cwiseMin(line.p0).cwiseMin(line.p1);
+    map_max = map_max.cwiseMax(line.p0).cwiseMax(line.p1);
+  }
+
+  // rejection-sample locations that are at least the minimum clearance away from any wall, with uniform headings
+  const int n_particles {params_->global_particles};
+  const double weight {log(1.d / n_particles)};
+  const long max_attempts {100L * n_particles};
+  for (long attempt = 0; attempt < max_attempts && static_cast<int>(particles_.size()) < n_particles; attempt++) {
+    Vector2f loc(rng_.UniformRandom(map_min.x(), map_max.x()), rng_.UniformRandom(map_min.y(), map_max.y()));
+    if (distance_field_.Distance(loc) < params_->global_min_clearance) {continue;}
+    particles_.push_back({loc, static_cast<float>(rng_.UniformRandom(-M_PI, M_PI)), weight});
+  }
+
+  global_localization_pending_ = !particles_.empty();
+  std::cout << particles_.size() << " particles initialized over the whole map" << std::endl;
+}
+
+void ParticleFilter::PruneGlobalHypotheses(const vector<float>& ranges,
+                                           float range_min,
+                                           float range_max,
+                                           float angle_min,
+                                           float angle_max) {
+  // coarse pass: score every hypothesis against the likelihood field with few beams
+  PrepareScan(ranges, range_min, range_max, angle_min, angle_max, params_->global_coarse_downsampling, &coarse_scan_);
+  const int num_workers {NumWorkers()};
+  const int num_particles {static_cast<int>(particles_.size())};
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(num_workers) schedule(static)
+#endif
+  for (int i = 0; i < num_particles; i++) {
+    particles_.logw[i] = LikelihoodFieldLogWeight(coarse_scan_, particles_.Get(i));
+  }
+  (void)num_workers;
+
+  // keep the best hypotheses; the fine pass is the regular full-resolution update
+  const int keep {std::min(num_particles, params_->global_keep_particles)};
+  vector<int> order(num_particles);
+  for (int i = 0; i < num_particles; i++) {
+    order[i] = i;
+  }
+  std::nth_element(order.begin(), order.begin() + (keep - 1), order.end(), [this](int a, int b) {
+    return particles_.logw[a] > particles_.logw[b];
+  });
+  ParticleSet kept;
+  kept.reserve(keep);
+  for (int i = 0; i < keep; i++) {
+    kept.push_back(particles_.Get(order[i]));
+  }
+  // the coarse scores only select; the fine pass accumulates onto the weights, so it starts them uniform and the
+  // scan is scored once
+  std::fill(kept.logw.begin(), kept.logw.end(), log(1.d / keep));
+  particles_ = kept;
+  std::cout << "Global localization kept " << keep << " of " << num_particles << " hypotheses" << std::endl;
+}
+
 void ParticleFilter::GetLocation(Eigen::Vector2f* loc_ptr, 
                                  float* angle_ptr) const {
   Vector2f& loc = *loc_ptr;
   float& angle = *angle_ptr;
 
   // - for just returning the most likely particle
-  // loc = top_particle_->loc;
-  // angle = top_particle_->angle;
+  // loc = top_particle_.loc;
+  // angle = top_particle_.angle;
 
   // - taking weighted average around most likely particle
   double radial_inclusion_distance {5.0}; // m
-  auto most_likely_location {top_particle_->loc};
+  auto most_likely_location {top_particle_.loc};
 
-  auto location_estimate {top_particle_->loc};
-  auto angle_estimate {top_particle_->angle};
+  auto location_estimate {top_particle_.loc};
+  auto angle_estimate {top_particle_.angle};
   int total_considered_particles {1};
-  auto sum_of_weights {exp(top_particle_->weight)};
+  auto sum_of_weights {exp(top_particle_.weight)};
 
   double radial_inclusion_distance_sqrd {pow(radial_inclusion_distance, 2)};
   for (std::size_t i = 0; i < particles_.size(); i++) {
     
     // calculate the distance from the most likely location to the particle
-    double radial_distance_sqrd {pow(particles_[i].loc.x() - most_likely_location.x(), 2) + pow(particles_[i].loc.y() - most_likely_location.y(), 2)};
+    double radial_distance_sqrd {pow(particles_.x[i] - most_likely_location.x(), 2) + pow(particles_.y[i] - most_likely_location.y(), 2)};
 
     // don't consider points farther from the most likely particle than the set distance
     if (radial_distance_sqrd > radial_inclusion_distance_sqrd) {continue;}
 
     // accumulate the point for calculations (probably start with a simple average, then maybe can consider a probability- or distance-weighted average depending on the results)
     total_considered_particles++;
-    auto weight {exp(particles_[i].weight)};
-    location_estimate.x() += weight * particles_[i].loc.x();
-    location_estimate.y() += weight * particles_[i].loc.y();
-    angle_estimate += weight * particles_[i].angle;
+    auto weight {exp(particles_.logw[i])};
+    location_estimate.x() += weight * particles_.x[i];
+    location_estimate.y() += weight * particles_.y[i];
+    angle_estimate += weight * particles_.theta[i];
     sum_of_weights += weight;
   }
 
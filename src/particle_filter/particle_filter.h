@@ -20,12 +20,16 @@
 //========================================================================
 
 #include <algorithm>
+#include <cstdint>
 #include <vector>
 
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
+#include "fast_random/fast_random.h"
 #include "shared/math/line2d.h"
-#include "shared/util/random.h"
+#include "config_reader/snapshot.h"
+#include "laser_scan/scan_cloud.h"
+#include "vector_map/distance_field.h"
 #include "vector_map/vector_map.h"
 
 #ifndef SRC_PARTICLE_FILTER_H_
@@ -39,6 +43,109 @@ struct Particle {
   double weight;
 };
 
+// Structure-of-arrays storage for the particles tracked by the filter; entry i
+// of every array belongs to particle i.
+struct ParticleSet {
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> theta;
+  std::vector<double> logw;
+
+  size_t size() const { return x.size(); }
+  bool empty() const { return x.empty(); }
+
+  void clear() {
+    x.clear();
+    y.clear();
+    theta.clear();
+    logw.clear();
+  }
+
+  void reserve(size_t n) {
+    x.reserve(n);
+    y.reserve(n);
+    theta.reserve(n);
+    logw.reserve(n);
+  }
+
+  void resize(size_t n) {
+    x.resize(n);
+    y.resize(n);
+    theta.resize(n);
+    logw.resize(n);
+  }
+
+  void push_back(const Particle& p) {
+    x.push_back(p.loc.x());
+    y.push_back(p.loc.y());
+    theta.push_back(p.angle);
+    logw.push_back(p.weight);
+  }
+
+  Particle Get(size_t i) const {
+    return {Eigen::Vector2f(x[i], y[i]), theta[i], logw[i]};
+  }
+};
+
+// Particles summed on their own before the block totals are added up, and the fewest comb teeth given to a worker.
+const int kResampleBlock = 1024;
+
+// Fill cumulative with the running sum of the particle weights, out of log space, in parallel blocks of
+// kResampleBlock particles; the sums do not depend on the number of workers. Returns the total weight.
+double CumulativeWeights(const ParticleSet& particles,
+                         int num_workers,
+                         std::vector<double>* cumulative,
+                         std::vector<double>* block_weights);
+
+// Draw n_particles of particles with the low-variance comb whose i'th tooth sits at first + i * step along
+// cumulative, kResampleBlock or more teeth per worker; the draw does not depend on the number of workers.
+void LowVarianceComb(const ParticleSet& particles,
+                     const std::vector<double>& cumulative,
+                     double first,
+                     double step,
+                     int n_particles,
+                     int num_workers,
+                     ParticleSet* resampled);
+
+// Tunables of the filter, read from config/particle_filter.lua after every load of it.
+struct Parameters {
+  // likelihood field observation model
+  bool use_likelihood_field;
+  float likelihood_field_resolution;
+  float likelihood_field_max_distance;
+  int likelihood_field_downsampling;
+  // lazy likelihood field evaluation
+  bool lazy_beams;
+  int lazy_beam_stride;
+  double lazy_beam_margin;
+  // beam observation model
+  int laser_downsampling;
+  double d_short;
+  double d_long;
+  double sigma_s;
+  double gamma;
+  // parallelism
+  int num_threads;
+  // particle count and KLD sampling
+  int num_particles;
+  bool kld_sampling;
+  int min_particles;
+  int max_particles;
+  double kld_epsilon;
+  double kld_z;
+  float kld_bin_size_xy;
+  float kld_bin_size_theta;
+  // resampling policy
+  bool resample_at_interval;
+  int resampling_interval;
+  double resampling_ess_threshold;
+  // global localization
+  int global_particles;
+  float global_min_clearance;
+  int global_coarse_downsampling;
+  int global_keep_particles;
+};
+
 class ParticleFilter {
  public:
   // Default Constructor.
@@ -60,9 +167,16 @@ class ParticleFilter {
                   const Eigen::Vector2f& loc,
                   const float angle);
 
-  // Return the list of particles.
+  // Spread particles over the free space of the whole map, for when the robot location is unknown. The next laser
+  // scan prunes them down to the most likely hypotheses.
+  void InitializeGlobal(const std::string& map_file);
+
+  // Return a copy of the list of particles.
   void GetParticles(std::vector<Particle>* particles) const;
 
+  // Read-only view of the particles, valid until the next call that modifies the filter.
+  const ParticleSet& GetParticleSet() const;
+
   // Get robot's current location.
   void GetLocation(Eigen::Vector2f* loc, float* angle) const;
 
@@ -89,14 +203,119 @@ class ParticleFilter {
 
  private:
 
+  // A laser scan downsampled and prepared once, then shared by every particle it is compared against.
+  struct PreparedScan {
+    // Sensor-frame unit vector of every beam, cached for the scan geometry.
+    laser_scan::BeamDirections beams;
+
+    float range_min = 0;
+    float range_max = 0;
+    // Downsampled beams within the valid range, with their sensor-frame unit vectors.
+    std::vector<float> ranges;
+    std::vector<Eigen::Vector2f> directions;
+    // Sensor-frame angles of the same beams, for casting them in batches.
+    std::vector<float> angles;
+  };
+
+  // Keep every downsampling-th beam of the scan, dropping beams outside the valid range.
+  void PrepareScan(const std::vector<float>& ranges,
+                   float range_min,
+                   float range_max,
+                   float angle_min,
+                   float angle_max,
+                   int downsampling,
+                   PreparedScan* scan) const;
+
+  // Whether particles are scored with the likelihood field rather than by ray casting.
+  bool UseLikelihoodField() const;
+
+  // Beam downsampling factor of the active observation model.
+  int SensorModelDownsampling() const;
+
+  // Log weight of a particle from the active observation model.
+  double ScanLogWeight(const PreparedScan& scan, const Particle& particle) const;
+
+  // Log weight of a particle from the beam model: each beam is ray cast against the map.
+  double BeamModelLogWeight(const PreparedScan& scan, const Particle& particle) const;
+
+  // Same as above, from the ranges predicted for each beam of the scan.
+  double BeamModelLogWeight(const PreparedScan& scan, const float* predicted_ranges) const;
+
+  // Log weight of a particle from the likelihood field model: each beam endpoint is scored by its distance to the closest map line.
+  double LikelihoodFieldLogWeight(const PreparedScan& scan, const Particle& particle) const;
+
+  // Sum of the likelihood field terms of the beams first, first + stride, ... of the scan, all of them when stride is 1;
+  // with skip, of every other beam instead.
+  double LikelihoodFieldSum(const PreparedScan& scan, const Particle& particle, int stride, bool skip) const;
+
+  // Set the log weight of every particle from scan_ with the likelihood field, scoring every lazy_beam_stride-th beam
+  // first and the other beams only for particles that may come within lazy_beam_margin of the best. Returns the
+  // largest log weight.
+  double LazyLikelihoodFieldWeights(bool accumulate_weights, int num_workers);
+
+  // Load the map and its distance field, unless that map is already loaded.
+  void LoadMap(const std::string& map_file);
+
+  // Coarse scoring pass over the map-wide hypotheses that keeps only the best ones.
+  void PruneGlobalHypotheses(const std::vector<float>& ranges,
+                             float range_min,
+                             float range_max,
+                             float angle_min,
+                             float angle_max);
+
+  // Pick up the parameters of the latest config load. Called once at the start of every update, so that a reload
+  // never changes them halfway through one.
+  void RefreshParameters();
+
+  // Number of workers used for the per-particle loops; also makes sure there is one random stream per worker.
+  int NumWorkers();
+
+  // Propagate every particle through the motion model, given the odometry change and the noise standard deviations.
+  void PredictKernel(const Eigen::Vector2f& translation_diff,
+                     float rotation_diff,
+                     float major_axis_sigma,
+                     float minor_axis_sigma,
+                     float rotation_sigma);
+
+  // Draw a fixed number of particles with low-variance resampling, kResampleBlock or more teeth of the comb per worker.
+  void LowVarianceResample(int n_particles, ParticleSet* resampled);
+
+  // Draw as many particles as the KLD bound requires, between the configured minimum and maximum.
+  void KLDResample(ParticleSet* resampled);
+
+  // Parameters of the current update.
+  config_reader::Snapshot<Parameters>::Handle params_;
+
   // List of particles being tracked.
-  std::vector<Particle> particles_;
+  ParticleSet particles_;
+
+  // Back buffer that Resample draws into before swapping it with particles_.
+  ParticleSet resampled_particles_;
+
+  // Scratch space for resampling, reused across calls.
+  std::vector<double> cumulative_weights_;
+  std::vector<double> block_weights_;
+  static constexpr uint64_t kEmptyBin = ~0ull;
+  std::vector<uint64_t> kld_bins_;
+
+  // Per-particle scratch arrays for PredictKernel, reused across calls.
+  std::vector<float> noise_major_;
+  std::vector<float> noise_minor_;
+  std::vector<float> noise_rotation_;
+  std::vector<float> cos_theta_;
+  std::vector<float> sin_theta_;
 
   // Map of the environment.
   vector_map::VectorMap map_;
 
+  // Distance to the closest map line, precomputed when the map is loaded.
+  vector_map::DistanceField distance_field_;
+
   // Random number generator.
-  util_random::Random rng_;
+  fast_random::FastRandom rng_;
+
+  // One stream of rng_ per worker, so parallel sampling is reproducible for a given worker count.
+  std::vector<fast_random::FastRandom> worker_rngs_;
 
   // Previous odometry-reported locations.
   Eigen::Vector2f prev_odom_loc_;
@@ -104,8 +323,26 @@ class ParticleFilter {
   bool odom_initialized_;
 
   bool new_odometry_flag_;    // Flag to indicate odmometry change (robot movement)
+  bool global_localization_pending_;    // Set until the first scan after InitializeGlobal prunes the hypotheses
   int resampling_iteration_counter_;    // count the number of times Resample() has been called
-  Particle *top_particle_ = new Particle;  // Particle with max weight
+  Particle top_particle_ {Eigen::Vector2f(0, 0), 0, 0};  // Particle with max weight
+
+  // Buffers used by a single worker outside of ObserveLaser.
+  struct WorkerScratch {
+    PreparedScan scan;
+  };
+  std::vector<WorkerScratch> scratch_;
+
+  // The latest scan prepared for the observation model, and for the coarse global localization pass.
+  PreparedScan scan_;
+  PreparedScan coarse_scan_;
+
+  // LiDAR location of every particle, and the ranges predicted for each of its beams, for the batch beam model.
+  std::vector<Eigen::Vector2f> lidar_locs_;
+  std::vector<float> predicted_ranges_;
+
+  // Upper bounds of the particle log weights from the strided beams, for the lazy likelihood field.
+  std::vector<double> weight_bounds_;
 };
 }  // namespace slam
 
@@ -0,0 +1,222 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    particle_filter_bench.cc
+\brief   Offline benchmark of the particle filter on synthetic scans
+         rendered from a vector map
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdio.h>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "eigen3/Eigen/Geometry"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "config_reader/config_reader.h"
+#include "shared/math/math_util.h"
+#include "shared/math/statistics.h"
+#include "shared/util/timer.h"
+
+#include "particle_filter.h"
+#include "vector_map/vector_map.h"
+
+using Eigen::Vector2f;
+using math_util::AngleDiff;
+using std::string;
+using std::vector;
+
+DEFINE_string(map, "", "Vector map file to localize in");
+DEFINE_string(config, "config/particle_filter.lua", "Particle filter configuration the runs start from");
+DEFINE_string(particles, "100,500,1000,2000,5000", "Comma separated particle counts to benchmark");
+DEFINE_string(downsampling, "1,2,5,10", "Comma separated likelihood field downsampling factors to benchmark");
+DEFINE_int32(num_scans, 500, "Number of synthetic scans per run");
+DEFINE_double(start_x, 0, "Start x of the simulated robot; the config init_x is used when unset");
+DEFINE_double(start_y, 0, "Start y of the simulated robot; the config init_y is used when unset");
+DEFINE_double(start_angle, 0, "Start heading of the simulated robot, in degrees");
+DEFINE_double(speed, 0.1, "Distance travelled between scans, in meters");
+DEFINE_int32(num_ranges, 1081, "Number of beams in a synthetic scan");
+DEFINE_double(angle_min, -2.25, "Angle of the first beam, relative to the robot heading");
+DEFINE_double(angle_max, 2.25, "Angle of the last beam, relative to the robot heading");
+DEFINE_double(range_min, 0.02, "Minimum laser range");
+DEFINE_double(range_max, 10.0, "Maximum laser range");
+
+CONFIG_FLOAT(init_x_, "init_x");
+CONFIG_FLOAT(init_y_, "init_y");
+
+namespace {
+
+// Settings of the benchmark override file, written after the base config so they take precedence.
+const char kOverrideFile[] = "/tmp/particle_filter_bench.lua";
+
+// Lidar offset from base_link, matching the particle filter observation model.
+const float kLaserOffset = 0.2;
+
+vector<int> ParseList(const string& list) {
+  vector<int> values;
+  std::stringstream ss(list);
+  string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) values.push_back(std::stoi(item));
+  }
+  return values;
+}
+
+// Reload the configuration with a fixed particle count and the given downsampling. KLD sampling is disabled so
+// the particle count stays where the run puts it, and the ESS threshold is zeroed so the filter only resamples when
+// the benchmark asks it to.
+bool ApplyOverrides(int num_particles, int downsampling) {
+  std::ofstream file(kOverrideFile);
+  if (!file.is_open()) {
+    std::cerr << "Unable to write " << kOverrideFile << std::endl;
+    return false;
+  }
+  file << "num_particles = " << num_particles << ";\n"
+       << "kld_sampling = false;\n"
+       << "resampling_policy = \"ess\";\n"
+       << "resampling_ess_threshold = 0;\n"
+       << "likelihood_field_downsampling = " << downsampling << ";\n";
+  file.close();
+  config_reader::LuaRead({FLAGS_config, kOverrideFile});
+  return true;
+}
+
+// Simulated robot: drives straight ahead and turns in place when a wall is within a meter.
+struct Robot {
+  Vector2f loc;
+  float angle;
+
+  void Step(const vector_map::VectorMap& map) {
+    const Vector2f heading(std::cos(angle), std::sin(angle));
+    if (map.Intersects(loc, loc + 1.0 * heading)) {
+      angle = math_util::AngleMod(angle + 0.3f);
+    } else {
+      loc += FLAGS_speed * heading;
+    }
+  }
+};
+
+void RenderScan(vector_map::VectorMap* map, const Robot& robot, vector<float>* ranges) {
+  const Vector2f lidar_loc {robot.loc + kLaserOffset * Vector2f(std::cos(robot.angle), std::sin(robot.angle))};
+  map->GetPredictedScan(lidar_loc,
+                        FLAGS_range_min,
+                        FLAGS_range_max,
+                        robot.angle + FLAGS_angle_min,
+                        robot.angle + FLAGS_angle_max,
+                        FLAGS_num_ranges,
+                        ranges);
+}
+
+struct Latency {
+  vector<double> samples;
+
+  void Print(const char* name) const {
+    if (samples.empty()) return;
+    double total {0};
+    for (const double t : samples) total += t;
+    printf("  %-8s mean %8.3f  p50 %8.3f  p90 %8.3f  p99 %8.3f ms\n",
+           name,
+           1e3 * total / samples.size(),
+           1e3 * statistics::GetPercentile<vector<double>, double, double>(samples, 0.5),
+           1e3 * statistics::GetPercentile<vector<double>, double, double>(samples, 0.9),
+           1e3 * statistics::GetPercentile<vector<double>, double, double>(samples, 0.99));
+  }
+};
+
+void RunBenchmark(vector_map::VectorMap* map, int num_particles, int downsampling) {
+  if (!ApplyOverrides(num_particles, downsampling)) return;
+
+  Robot robot {Vector2f(FLAGS_start_x, FLAGS_start_y), static_cast<float>(math_util::DegToRad(FLAGS_start_angle))};
+  if (FLAGS_start_x == 0 && FLAGS_start_y == 0) {
+    robot.loc = Vector2f(CONFIG_init_x_, CONFIG_init_y_);
+  }
+
+  particle_filter::ParticleFilter pf;
+  pf.Initialize(FLAGS_map, robot.loc, robot.angle);
+
+  Latency predict, observe, resample;
+  vector<float> ranges;
+  double translation_error {0};
+  double rotation_error {0};
+  double filter_time {0};
+  for (int i = 0; i < FLAGS_num_scans; ++i) {
+    robot.Step(*map);
+    RenderScan(map, robot, &ranges);
+
+    // odometry is reported without drift, the filter adds its own motion noise
+    double t_start {GetMonotonicTime()};
+    pf.Predict(robot.loc, robot.angle);
+    predict.samples.push_back(GetMonotonicTime() - t_start);
+
+    t_start = GetMonotonicTime();
+    pf.ObserveLaser(ranges, FLAGS_range_min, FLAGS_range_max, FLAGS_angle_min, FLAGS_angle_max);
+    observe.samples.push_back(GetMonotonicTime() - t_start);
+
+    // resample after every scan so the stage is measured on each iteration
+    t_start = GetMonotonicTime();
+    pf.Resample();
+    resample.samples.push_back(GetMonotonicTime() - t_start);
+    filter_time += predict.samples.back() + observe.samples.back() + resample.samples.back();
+
+    Vector2f loc;
+    float angle;
+    pf.GetLocation(&loc, &angle);
+    translation_error += (loc - robot.loc).norm();
+    rotation_error += std::fabs(AngleDiff(angle, robot.angle));
+  }
+
+  printf("particles %d, downsampling %d: %.1f scans/s, error %.3f m %.2f deg\n",
+         num_particles,
+         downsampling,
+         FLAGS_num_scans / filter_time,
+         translation_error / FLAGS_num_scans,
+         math_util::RadToDeg(rotation_error / FLAGS_num_scans));
+  predict.Print("predict");
+  observe.Print("observe");
+  resample.Print("resample");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  if (FLAGS_map.empty()) {
+    std::cerr << "Usage: particle_filter_bench --map <vector map file>" << std::endl;
+    return 1;
+  }
+  config_reader::LuaRead({FLAGS_config});
+
+  vector_map::VectorMap map(FLAGS_map);
+  if (map.lines.empty()) {
+    std::cerr << "Map " << FLAGS_map << " has no lines" << std::endl;
+    return 1;
+  }
+
+  for (const int num_particles : ParseList(FLAGS_particles)) {
+    for (const int downsampling : ParseList(FLAGS_downsampling)) {
+      RunBenchmark(&map, num_particles, downsampling);
+    }
+  }
+  return 0;
+}
@@ -27,6 +27,8 @@
 #include <string.h>
 #include <inttypes.h>
 #include <termios.h>
+#include <atomic>
+#include <thread>
 #include <vector>
 
 #include "eigen3/Eigen/Dense"
@@ -42,13 +44,17 @@
 #include "rosbag/view.h"
 #include "ros/package.h"
 
+#include "bag_replay/bag_replay.h"
 #include "config_reader/config_reader.h"
+#include "laser_scan/mailbox.h"
 #include "shared/math/math_util.h"
 #include "shared/math/line2d.h"
 #include "shared/util/timer.h"
 
 #include "particle_filter.h"
+#include "profiler/profiler.h"
 #include "visualization/visualization.h"
+#include "visualization/visualization_manager.h"
 
 using amrl_msgs::VisualizationMsg;
 using geometry::line2f;
@@ -71,19 +77,28 @@ DEFINE_string(odom_topic, "/odom", "Name of ROS topic for odometry data");
 DEFINE_string(init_topic,
               "/set_pose",
               "Name of ROS topic for initialization");
+DEFINE_string(bag, "",
+              "Replay this bag as fast as possible instead of subscribing "
+              "to the topics, and print the time every callback took");
+DEFINE_bool(latest_scan_only, false,
+              "Live, only stash the newest messages in the callbacks and "
+              "filter on a worker thread, which skips the scans that arrive "
+              "while it is busy instead of falling behind them");
 
 DECLARE_int32(v);
+DECLARE_bool(visualization);
 
 // Create config reader entries
 CONFIG_STRING(map_name_, "map");
 CONFIG_FLOAT(init_x_, "init_x");
 CONFIG_FLOAT(init_y_, "init_y");
 CONFIG_FLOAT(init_r_, "init_r");
+CONFIG_BOOL(global_localization_, "global_localization");
 config_reader::ConfigReader config_reader_({"config/particle_filter.lua"});
 
-bool run_ = true;
+std::atomic_bool run_(true);
 particle_filter::ParticleFilter particle_filter_;
-ros::Publisher visualization_publisher_;
+visualization::VisualizationManager visualization_;
 ros::Publisher localization_publisher_;
 ros::Publisher laser_publisher_;
 VisualizationMsg vis_msg_;
@@ -93,6 +108,11 @@ sensor_msgs::LaserScan last_laser_msg_;
 vector<Vector2f> trajectory_points_;
 string current_map_;
 
+// With --latest_scan_only the callbacks only post here, for ProcessLatest.
+laser_scan::Mailbox<sensor_msgs::LaserScan> laser_mailbox_;
+laser_scan::Mailbox<nav_msgs::Odometry> odom_mailbox_;
+laser_scan::Mailbox<amrl_msgs::Localization2DMsg> init_mailbox_;
+
 void InitializeMsgs() {
   std_msgs::Header header;
   header.frame_id = "map";
@@ -102,11 +122,13 @@ void InitializeMsgs() {
 }
 
 void PublishParticles() {
-  vector<particle_filter::Particle> particles;
-  particle_filter_.GetParticles(&particles);
+  const particle_filter::ParticleSet& particles =
+      particle_filter_.GetParticleSet();
   // std::cout << "Particles: " << particles.size() << std::endl;
-  for (const particle_filter::Particle& p : particles) {
-    DrawParticle(p.loc, p.angle, vis_msg_);
+  for (size_t i = 0; i < particles.size(); ++i) {
+    DrawParticle(Vector2f(particles.x[i], particles.y[i]),
+                 particles.theta[i],
+                 vis_msg_);
   }
 }
 
@@ -154,19 +176,17 @@ void PublishTrajectory() {
 }
 
 void PublishVisualization() {
-  static double t_last = 0;
-  if (GetMonotonicTime() - t_last < 0.05) {
-    // Rate-limit visualization.
+  // Nothing is drawn unless the message goes out.
+  if (!visualization_.Due(vis_msg_.ns)) {
     return;
   }
-  t_last = GetMonotonicTime();
   vis_msg_.header.stamp = ros::Time::now();
   ClearVisualizationMsg(vis_msg_);
 
   PublishParticles();
   PublishPredictedScan();
   PublishTrajectory();
-  visualization_publisher_.publish(vis_msg_);
+  visualization_.Publish(vis_msg_);
 }
 
 void LaserCallback(const sensor_msgs::LaserScan& msg) {
@@ -193,7 +213,9 @@ void PublishLocation() {
   localization_msg_.pose.x = robot_loc.x();
   localization_msg_.pose.y = robot_loc.y();
   localization_msg_.pose.theta = robot_angle;
-  localization_publisher_.publish(localization_msg_);
+  if (localization_publisher_) {
+    localization_publisher_.publish(localization_msg_);
+  }
 }
 
 void OdometryCallback(const nav_msgs::Odometry& msg) {
@@ -228,28 +250,104 @@ void InitCallback(const amrl_msgs::Localization2DMsg& msg) {
   trajectory_points_.clear();
 }
 
+void InitializeFilter() {
+  if (CONFIG_global_localization_) {
+    // No need for an initial pose, localize over the whole map.
+    particle_filter_.InitializeGlobal(GetMapFileFromName(current_map_));
+  } else {
+    particle_filter_.Initialize(
+        GetMapFileFromName(current_map_),
+        Vector2f(CONFIG_init_x_, CONFIG_init_x_),
+        DegToRad(CONFIG_init_r_));
+  }
+}
+
+// Worker of --latest_scan_only, the only thread that touches the filter.
+// Odometry poses are absolute, so the newest one carries all the motion since
+// the last one taken, and it is applied before the scan that follows it.
+void ProcessLatest() {
+  InitializeFilter();
+  while (ros::ok() && run_) {
+    const amrl_msgs::Localization2DMsg* init = init_mailbox_.Take();
+    if (init != nullptr) InitCallback(*init);
+    const nav_msgs::Odometry* odom = odom_mailbox_.Take();
+    if (odom != nullptr) OdometryCallback(*odom);
+    const sensor_msgs::LaserScan* laser = laser_mailbox_.Take();
+    if (laser != nullptr) {
+      LaserCallback(*laser);
+      if (FLAGS_v > 0) {
+        printf("Scans dropped: %lu of %lu\n",
+               static_cast<unsigned long>(laser_mailbox_.Dropped()),
+               static_cast<unsigned long>(laser_mailbox_.Posted()));
+      }
+    }
+    if (init == nullptr && odom == nullptr && laser == nullptr) {
+      PublishVisualization();
+      Sleep(0.001);
+    }
+  }
+}
+
+void PostLaser(const sensor_msgs::LaserScan& msg) {
+  laser_mailbox_.Post(msg);
+}
+
+void PostOdometry(const nav_msgs::Odometry& msg) {
+  odom_mailbox_.Post(msg);
+}
+
+void PostInit(const amrl_msgs::Localization2DMsg& msg) {
+  init_mailbox_.Post(msg);
+}
+
 void ProcessLive(ros::NodeHandle* n) {
+  const bool latest_only = FLAGS_latest_scan_only;
   ros::Subscriber initial_pose_sub = n->subscribe(
       FLAGS_init_topic.c_str(),
       1,
-      InitCallback);
+      latest_only ? PostInit : InitCallback);
   ros::Subscriber laser_sub = n->subscribe(
       FLAGS_laser_topic.c_str(),
       1,
-      LaserCallback);
+      latest_only ? PostLaser : LaserCallback);
   ros::Subscriber odom_sub = n->subscribe(
       FLAGS_odom_topic.c_str(),
       1,
-      OdometryCallback);
-  particle_filter_.Initialize(
-      GetMapFileFromName(current_map_),
-      Vector2f(CONFIG_init_x_, CONFIG_init_x_),
-      DegToRad(CONFIG_init_r_));
+      latest_only ? PostOdometry : OdometryCallback);
+  std::thread worker;
+  if (latest_only) {
+    worker = std::thread(ProcessLatest);
+  } else {
+    InitializeFilter();
+  }
   while (ros::ok() && run_) {
     ros::spinOnce();
-    PublishVisualization();
+    if (!latest_only) PublishVisualization();
     Sleep(0.01);
   }
+  if (latest_only) {
+    run_ = false;
+    worker.join();
+    printf("Scans: %lu received, %lu dropped; odometry: %lu received, "
+           "%lu dropped\n",
+           static_cast<unsigned long>(laser_mailbox_.Posted()),
+           static_cast<unsigned long>(laser_mailbox_.Dropped()),
+           static_cast<unsigned long>(odom_mailbox_.Posted()),
+           static_cast<unsigned long>(odom_mailbox_.Dropped()));
+  }
+}
+
+bool ProcessBag(const string& file) {
+  bag_replay::BagReplay replay;
+  replay.Subscribe<amrl_msgs::Localization2DMsg>(FLAGS_init_topic,
+                                                 InitCallback);
+  replay.Subscribe<sensor_msgs::LaserScan>(FLAGS_laser_topic, LaserCallback);
+  replay.Subscribe<nav_msgs::Odometry>(FLAGS_odom_topic, OdometryCallback);
+  InitializeFilter();
+  if (!replay.Run(file)) return false;
+  replay.PrintStatistics();
+  printf("%s", profiler::Report().c_str());
+  return true;
 }
 
 void SignalHandler(int) {
@@ -266,18 +364,27 @@ int main(int argc, char** argv) {
   signal(SIGINT, SignalHandler);
   // Initialize ROS.
   ros::init(argc, argv, "particle_filter", ros::init_options::NoSigintHandler);
+  if (!FLAGS_bag.empty()) {
+    // Offline nothing is advertised or drawn, so no ROS master is needed.
+    FLAGS_visualization = false;
+    InitializeMsgs();
+    current_map_ = CONFIG_map_name_;
+    return ProcessBag(FLAGS_bag) ? 0 : 1;
+  }
   ros::NodeHandle n;
   InitializeMsgs();
   current_map_ = CONFIG_map_name_;
 
-  visualization_publisher_ =
-      n.advertise<VisualizationMsg>("visualization", 1);
+  visualization_.Init(&n);
+  visualization_.SetRate(vis_msg_.ns, 20);
   localization_publisher_ =
       n.advertise<amrl_msgs::Localization2DMsg>("localization", 1);
   laser_publisher_ =
       n.advertise<sensor_msgs::LaserScan>("scan", 1);
 
+  profiler::StartReporting(&n);
   ProcessLive(&n);
+  profiler::StopReporting();
 
   return 0;
 }
@@ -9,6 +9,7 @@
 #include "shared/math/geometry.h"
 #include "shared/math/line2d.h"
 #include "shared/math/math_util.h"
+#include "shared/util/random.h"
 #include "shared/util/timer.h"
 
 #include "config_reader/config_reader.h"
@@ -20,6 +21,7 @@
 
 void resample (std::vector<particle_filter::Particle> &particles_);
 void printParticles(const std::vector<particle_filter::Particle> &particles);
+int checkParallelResampling();
 
 int main(int argc, char** argv)
 {
@@ -56,7 +58,65 @@ int main(int argc, char** argv)
         printParticles(particles);
     }
 
-    return 0;
+    return checkParallelResampling() == 0 ? 0 : 1;
+}
+
+// The filter's distribution and comb walk, with fixed seeds, must give the same particles for any number of workers
+int checkParallelResampling()
+{
+    const int worker_counts[] {2, 3, 8};
+    const int particle_counts[] {35, 1024, 5000, 100000};
+    int errors {0};
+    for (const int n_particles : particle_counts) {
+        fast_random::FastRandom rng(n_particles);
+        particle_filter::ParticleSet particles;
+        particles.resize(n_particles);
+        for (int i = 0; i < n_particles; i++) {
+            particles.x[i] = rng.UniformRandom(-10, 10);
+            particles.y[i] = rng.UniformRandom(-10, 10);
+            particles.theta[i] = rng.UniformRandom(-M_PI, M_PI);
+            particles.logw[i] = rng.UniformRandom(-30, 0);
+        }
+        // draw as many particles, and fewer and more of them as KLD sampling does
+        for (const int n_resampled : {n_particles, n_particles / 2 + 1, 2 * n_particles}) {
+            std::vector<double> serial_cumulative, serial_blocks;
+            const double serial_sum {particle_filter::CumulativeWeights(particles, 1, &serial_cumulative, &serial_blocks)};
+            const double step {serial_sum / n_resampled};
+            const double first {rng.UniformRandom(0, step)};
+            particle_filter::ParticleSet serial;
+            particle_filter::LowVarianceComb(particles, serial_cumulative, first, step, n_resampled, 1, &serial);
+
+            for (const int workers : worker_counts) {
+                std::vector<double> cumulative, blocks;
+                const double sum {particle_filter::CumulativeWeights(particles, workers, &cumulative, &blocks)};
+                particle_filter::ParticleSet parallel;
+                particle_filter::LowVarianceComb(particles, cumulative, first, step, n_resampled, workers, &parallel);
+                if (sum != serial_sum || cumulative != serial_cumulative) {
+                    std::cout << "FAIL: " << n_particles << " particles, " << workers << " workers: distribution differs from the serial one" << std::endl;
+                    errors++;
+                }
+                if (parallel.x != serial.x || parallel.y != serial.y || parallel.theta != serial.theta || parallel.logw != serial.logw) {
+                    std::cout << "FAIL: " << n_particles << " particles resampled to " << n_resampled << ", " << workers << " workers: draw differs from the serial one" << std::endl;
+                    errors++;
+                }
+
+                // nested in another parallel region OpenMP forms a smaller team than asked for, every tooth must still
+                // be drawn
+                particle_filter::ParticleSet nested;
+#ifdef _OPENMP
+                #pragma omp parallel num_threads(2)
+                #pragma omp single
+#endif
+                particle_filter::LowVarianceComb(particles, cumulative, first, step, n_resampled, workers, &nested);
+                if (nested.x != serial.x || nested.y != serial.y || nested.theta != serial.theta || nested.logw != serial.logw) {
+                    std::cout << "FAIL: " << n_particles << " particles resampled to " << n_resampled << ", " << workers << " workers in a nested region: draw differs from the serial one" << std::endl;
+                    errors++;
+                }
+            }
+        }
+    }
+    std::cout << "Parallel resampling: " << errors << " errors" << std::endl;
+    return errors;
 }
 
 void resample (std::vector<particle_filter::Particle> &particles_)
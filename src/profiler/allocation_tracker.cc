@@ -0,0 +1,85 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    allocation_tracker.cc
+\brief   Replacement of the global operator new that counts the allocations
+         of every thread for the profiler zones.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <new>
+
+#include "profiler.h"
+
+#ifdef ENABLE_ALLOCATION_TRACKER
+
+namespace profiler {
+
+// Zero initialized, so counting takes no allocation of its own.
+thread_local AllocationCounters allocation_counters;
+
+}  // namespace profiler
+
+namespace {
+
+void Count(size_t size) {
+  ++profiler::allocation_counters.allocations;
+  profiler::allocation_counters.bytes += size;
+}
+
+}  // namespace
+
+// Over-aligned allocations keep the default functions and are not counted.
+void* operator new(size_t size) {
+  Count(size);
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  Count(size);
+  return malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+#endif  // ENABLE_ALLOCATION_TRACKER
@@ -0,0 +1,371 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    profiler.cc
+\brief   Hierarchical scoped-zone profiler with per-thread counters and
+         latency histograms, and optionally the heap allocations of every
+         zone.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "ros/ros.h"
+#include "std_msgs/String.h"
+
+#include "profiler.h"
+
+using std::string;
+using std::vector;
+
+DEFINE_double(profile_period, 10,
+              "Seconds between profile reports, 0 for none");
+
+namespace {
+
+// Nodes of the zone tree of one thread, calls beyond are not counted.
+const int kMaxNodes = 128;
+// Latency histogram, four buckets per power of two of nanoseconds up to
+// 2^41 ns (about half an hour), which bounds the percentile error to 12%.
+const int kSubBuckets = 4;
+const int kBuckets = kSubBuckets * 40;
+
+// One zone at one path of the tree.
+struct Node {
+  int zone;
+  int parent;
+  std::atomic<int> first_child;
+  std::atomic<int> next_sibling;
+  std::atomic<uint64_t> calls;
+  std::atomic<uint64_t> total;
+  std::atomic<uint64_t> max;
+  std::atomic<uint32_t> histogram[kBuckets];
+#ifdef ENABLE_ALLOCATION_TRACKER
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint64_t> max_allocations;
+  // Calls that allocated nothing.
+  std::atomic<uint64_t> clean_calls;
+#endif
+};
+
+// Zones run by one thread. Node 0 is the root that the outermost zones hang
+// off. Only the owner adds nodes and writes counters, the report reads
+// nodes below size.
+struct ThreadTree {
+  ThreadTree() : size(1), current(0) {
+    for (Node& node : nodes) {
+      node.zone = -1;
+      node.parent = -1;
+      node.first_child.store(-1, std::memory_order_relaxed);
+      node.next_sibling.store(-1, std::memory_order_relaxed);
+      node.calls.store(0, std::memory_order_relaxed);
+      node.total.store(0, std::memory_order_relaxed);
+      node.max.store(0, std::memory_order_relaxed);
+      for (std::atomic<uint32_t>& count : node.histogram) {
+        count.store(0, std::memory_order_relaxed);
+      }
+#ifdef ENABLE_ALLOCATION_TRACKER
+      node.allocations.store(0, std::memory_order_relaxed);
+      node.bytes.store(0, std::memory_order_relaxed);
+      node.max_allocations.store(0, std::memory_order_relaxed);
+      node.clean_calls.store(0, std::memory_order_relaxed);
+#endif
+    }
+  }
+
+  Node nodes[kMaxNodes];
+  std::atomic<int> size;
+  // Node of the innermost running zone, -1 below a zone that did not fit.
+  int current;
+};
+
+// Zone names and the trees of all threads that ran a zone. Trees outlive
+// their threads so that the report keeps what they did.
+std::mutex registry_mutex_;
+vector<string> zone_names_;
+vector<ThreadTree*> threads_;
+
+ThreadTree* Tree() {
+  static thread_local ThreadTree* tree = nullptr;
+  if (tree == nullptr) {
+    tree = new ThreadTree();
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    threads_.push_back(tree);
+  }
+  return tree;
+}
+
+uint64_t Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Counters have a single writer, a plain load and store is enough for the
+// report to never see a torn value.
+template <typename T>
+void Add(std::atomic<T>* counter, T value) {
+  counter->store(counter->load(std::memory_order_relaxed) + value,
+                 std::memory_order_relaxed);
+}
+
+int Bucket(uint64_t ns) {
+  if (ns < kSubBuckets) return ns;
+  const int exponent = 63 - __builtin_clzll(ns);
+  const int bucket = kSubBuckets * (exponent - 1) +
+      ((ns >> (exponent - 2)) & (kSubBuckets - 1));
+  return std::min(bucket, kBuckets - 1);
+}
+
+// Middle of the range of a bucket.
+uint64_t BucketValue(int bucket) {
+  if (bucket < kSubBuckets) return bucket;
+  const int shift = bucket / kSubBuckets - 1;
+  const uint64_t lower =
+      static_cast<uint64_t>(kSubBuckets + bucket % kSubBuckets) << shift;
+  return lower + ((1ull << shift) >> 1);
+}
+
+// Child of parent for zone, added if the zone did not run there before.
+int Child(ThreadTree* tree, int parent, int zone) {
+  Node& p = tree->nodes[parent];
+  for (int i = p.first_child.load(std::memory_order_relaxed); i >= 0;
+       i = tree->nodes[i].next_sibling.load(std::memory_order_relaxed)) {
+    if (tree->nodes[i].zone == zone) return i;
+  }
+  const int index = tree->size.load(std::memory_order_relaxed);
+  if (index == kMaxNodes) return -1;
+  Node& node = tree->nodes[index];
+  node.zone = zone;
+  node.parent = parent;
+  node.next_sibling.store(p.first_child.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+  tree->size.store(index + 1, std::memory_order_release);
+  p.first_child.store(index, std::memory_order_release);
+  return index;
+}
+
+struct ZoneStats {
+  int depth = 0;
+  string name;
+  uint64_t calls = 0;
+  uint64_t total = 0;
+  uint64_t max = 0;
+  vector<uint64_t> histogram = vector<uint64_t>(kBuckets, 0);
+  uint64_t allocations = 0;
+  uint64_t bytes = 0;
+  uint64_t max_allocations = 0;
+  uint64_t clean_calls = 0;
+};
+
+double Percentile(const ZoneStats& stats, double q) {
+  const uint64_t rank = std::max<uint64_t>(1, q * stats.calls + 0.5);
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    seen += stats.histogram[i];
+    if (seen >= rank) return std::min(BucketValue(i), stats.max);
+  }
+  return stats.max;
+}
+
+// Reporting thread, woken up early to stop.
+std::mutex reporter_mutex_;
+std::condition_variable reporter_stop_;
+std::thread reporter_;
+bool reporting_ = false;
+ros::Publisher publisher_;
+
+void PublishReport() {
+  const string report = profiler::Report();
+  printf("%s", report.c_str());
+  fflush(stdout);
+  std_msgs::String msg;
+  msg.data = report;
+  publisher_.publish(msg);
+}
+
+}  // namespace
+
+namespace profiler {
+
+int RegisterZone(const char* name) {
+  std::lock_guard<std::mutex> lock(registry_mutex_);
+  zone_names_.push_back(name);
+  return zone_names_.size() - 1;
+}
+
+ScopedZone::ScopedZone(int zone) {
+  ThreadTree* tree = Tree();
+  parent_ = tree->current;
+  node_ = (parent_ < 0) ? -1 : Child(tree, parent_, zone);
+  tree->current = node_;
+#ifdef ENABLE_ALLOCATION_TRACKER
+  allocations_start_ = allocation_counters.allocations;
+  bytes_start_ = allocation_counters.bytes;
+#endif
+  start_ = Now();
+}
+
+ScopedZone::~ScopedZone() {
+  const uint64_t duration = Now() - start_;
+  ThreadTree* tree = Tree();
+  tree->current = parent_;
+  if (node_ < 0) return;
+  Node& node = tree->nodes[node_];
+  Add<uint64_t>(&node.calls, 1);
+  Add<uint64_t>(&node.total, duration);
+  if (duration > node.max.load(std::memory_order_relaxed)) {
+    node.max.store(duration, std::memory_order_relaxed);
+  }
+  Add<uint32_t>(&node.histogram[Bucket(duration)], 1);
+#ifdef ENABLE_ALLOCATION_TRACKER
+  const uint64_t allocations =
+      allocation_counters.allocations - allocations_start_;
+  Add<uint64_t>(&node.allocations, allocations);
+  Add<uint64_t>(&node.bytes, allocation_counters.bytes - bytes_start_);
+  if (allocations > node.max_allocations.load(std::memory_order_relaxed)) {
+    node.max_allocations.store(allocations, std::memory_order_relaxed);
+  }
+  if (allocations == 0) Add<uint64_t>(&node.clean_calls, 1);
+#endif
+}
+
+string Report() {
+  vector<string> names;
+  vector<ThreadTree*> threads;
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    names = zone_names_;
+    threads = threads_;
+  }
+
+  // Zones are merged by the names along their path. Joined with a character
+  // below any printable one, the paths sort parents before their children.
+  std::map<string, ZoneStats> zones;
+  for (const ThreadTree* tree : threads) {
+    const int size = tree->size.load(std::memory_order_acquire);
+    for (int i = 1; i < size; ++i) {
+      const Node& node = tree->nodes[i];
+      string path;
+      int depth = 0;
+      for (int n = i; n > 0; n = tree->nodes[n].parent, ++depth) {
+        path = names[tree->nodes[n].zone] + (path.empty() ? "" : "\x01") +
+            path;
+      }
+      ZoneStats& stats = zones[path];
+      stats.depth = depth - 1;
+      stats.name = names[node.zone];
+      stats.calls += node.calls.load(std::memory_order_relaxed);
+      stats.total += node.total.load(std::memory_order_relaxed);
+      stats.max = std::max(stats.max, node.max.load(std::memory_order_relaxed));
+      for (int b = 0; b < kBuckets; ++b) {
+        stats.histogram[b] += node.histogram[b].load(std::memory_order_relaxed);
+      }
+#ifdef ENABLE_ALLOCATION_TRACKER
+      stats.allocations += node.allocations.load(std::memory_order_relaxed);
+      stats.bytes += node.bytes.load(std::memory_order_relaxed);
+      stats.max_allocations =
+          std::max(stats.max_allocations,
+                   node.max_allocations.load(std::memory_order_relaxed));
+      stats.clean_calls += node.clean_calls.load(std::memory_order_relaxed);
+#endif
+    }
+  }
+
+  string report;
+  char line[256];
+  snprintf(line, sizeof(line), "%-40s %8s %10s %9s %9s %9s %9s %9s\n",
+           "zone", "calls", "total ms", "mean ms", "p50 ms", "p90 ms",
+           "p99 ms", "max ms");
+  report += line;
+  for (const auto& zone : zones) {
+    const ZoneStats& stats = zone.second;
+    if (stats.calls == 0) continue;
+    const string name = string(2 * stats.depth, ' ') + stats.name;
+    snprintf(line, sizeof(line),
+             "%-40s %8lu %10.1f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+             name.c_str(), static_cast<unsigned long>(stats.calls),
+             1e-6 * stats.total, 1e-6 * stats.total / stats.calls,
+             1e-6 * Percentile(stats, 0.5), 1e-6 * Percentile(stats, 0.9),
+             1e-6 * Percentile(stats, 0.99), 1e-6 * stats.max);
+    report += line;
+  }
+
+#ifdef ENABLE_ALLOCATION_TRACKER
+  snprintf(line, sizeof(line), "%-40s %8s %10s %10s %10s %9s\n",
+           "zone", "calls", "allocs", "KB", "max allocs", "no alloc");
+  report += line;
+  for (const auto& zone : zones) {
+    const ZoneStats& stats = zone.second;
+    if (stats.calls == 0) continue;
+    const string name = string(2 * stats.depth, ' ') + stats.name;
+    snprintf(line, sizeof(line), "%-40s %8lu %10.1f %10.2f %10lu %8.1f%%\n",
+             name.c_str(), static_cast<unsigned long>(stats.calls),
+             static_cast<double>(stats.allocations) / stats.calls,
+             1e-3 * stats.bytes / stats.calls,
+             static_cast<unsigned long>(stats.max_allocations),
+             100.0 * stats.clean_calls / stats.calls);
+    report += line;
+  }
+#endif
+  return report;
+}
+
+void StartReporting(ros::NodeHandle* n) {
+#ifdef ENABLE_PROFILER
+  std::lock_guard<std::mutex> lock(reporter_mutex_);
+  if (FLAGS_profile_period <= 0 || reporting_) return;
+  // Every node has a topic of its own, the reports are latched for
+  // late subscribers.
+  publisher_ = n->advertise<std_msgs::String>(
+      ros::this_node::getName() + "/profile", 1, true);
+  reporting_ = true;
+  reporter_ = std::thread([]() {
+    const std::chrono::duration<double> period(FLAGS_profile_period);
+    std::unique_lock<std::mutex> lock(reporter_mutex_);
+    while (!reporter_stop_.wait_for(lock, period, []() {
+      return !reporting_;
+    })) {
+      PublishReport();
+    }
+  });
+#endif
+}
+
+void StopReporting() {
+  {
+    std::lock_guard<std::mutex> lock(reporter_mutex_);
+    if (!reporting_) return;
+    reporting_ = false;
+  }
+  reporter_stop_.notify_all();
+  reporter_.join();
+  PublishReport();
+}
+
+}  // namespace profiler
@@ -0,0 +1,115 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    profiler.h
+\brief   Hierarchical scoped-zone profiler with per-thread counters and
+         latency histograms, and optionally the heap allocations of every
+         zone.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <string>
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+namespace ros {
+class NodeHandle;
+}  // namespace ros
+
+// PROFILE_SCOPE("name") times the rest of the enclosing scope as a zone.
+// Zones opened while another one is running on the same thread are counted
+// as its children, so the same zone reached from two callers shows up twice.
+// Built without ENABLE_PROFILER the macro expands to nothing.
+//
+// Built with ENABLE_ALLOCATION_TRACKER as well, the global operator new is
+// replaced by one that counts the calls and bytes of each thread, and every
+// zone also reports what it allocated, children included, so a cycle such as
+// a scan or a control tick can be checked to allocate nothing once warmed up.
+// Memory taken with malloc directly, as Eigen does, and over-aligned
+// allocations are not counted.
+#ifdef ENABLE_PROFILER
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name)                                                  \
+  static const int PROFILE_CONCAT(profile_zone_, __LINE__) =                 \
+      profiler::RegisterZone(name);                                          \
+  profiler::ScopedZone PROFILE_CONCAT(profile_scope_, __LINE__)(             \
+      PROFILE_CONCAT(profile_zone_, __LINE__))
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#endif
+
+namespace profiler {
+
+// Id of the zone called name. Ids are handed out once per PROFILE_SCOPE site,
+// sites that share a name are merged in the report.
+int RegisterZone(const char* name);
+
+// Times one call of a zone, from construction to destruction. Only the
+// thread that runs the zone writes its counters, the report reads them
+// without stopping it.
+class ScopedZone {
+ public:
+  explicit ScopedZone(int zone);
+  ~ScopedZone();
+
+ private:
+  ScopedZone(const ScopedZone&);
+  ScopedZone& operator=(const ScopedZone&);
+
+  // Node of this call in the tree of the thread, -1 if the tree is full.
+  int node_;
+  // Node that was running before, restored on destruction.
+  int parent_;
+  uint64_t start_;
+#ifdef ENABLE_ALLOCATION_TRACKER
+  // Allocation counters of the thread on construction.
+  uint64_t allocations_start_;
+  uint64_t bytes_start_;
+#endif
+};
+
+// Table of the calls, total and mean time, median, 90th and 99th percentile
+// and maximum of every zone, merged over all threads, children indented
+// under their parent. With ENABLE_ALLOCATION_TRACKER, followed by a table of
+// the allocations and bytes per call of every zone, the most allocations of
+// one call and the share of calls that allocated nothing.
+std::string Report();
+
+// Print the report every --profile_period seconds, and publish it as a
+// std_msgs/String on the "<node name>/profile" topic. Does nothing when the
+// period is 0 or the profiler is compiled out.
+void StartReporting(ros::NodeHandle* n);
+
+// Stop reporting, with a last report of everything so far.
+void StopReporting();
+
+#ifdef ENABLE_ALLOCATION_TRACKER
+// Calls to operator new and bytes asked for by the calling thread so far,
+// counted by the replacement in allocation_tracker.cc.
+struct AllocationCounters {
+  uint64_t allocations;
+  uint64_t bytes;
+};
+extern thread_local AllocationCounters allocation_counters;
+#endif
+
+}  // namespace profiler
+
+#endif  // PROFILER_H
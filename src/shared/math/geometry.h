@@ -496,8 +496,10 @@ T MinDistanceLineArc(const Eigen::Matrix<T, 2, 1>& l0,
       }
     }
     // Vector of the center projected onto line segment is not in arc.
-    const auto a_angle_min_v = Heading(a_angle_start) * a_radius;
-    const auto a_angle_max_v = Heading(a_angle_end) * a_radius;
+    const Eigen::Matrix<T, 2, 1> a_angle_min_v =
+        Heading(a_angle_start) * a_radius;
+    const Eigen::Matrix<T, 2, 1> a_angle_max_v =
+        Heading(a_angle_end) * a_radius;
     return std::sqrt(
         std::min((proj_dir_segment - a_angle_min_v).squaredNorm(),
                  (proj_dir_segment - a_angle_max_v).squaredNorm()));
@@ -532,8 +534,10 @@ T MinDistanceLineArc(const Eigen::Matrix<T, 2, 1>& l0,
          const T& a_radius,
          const Eigen::Matrix<T, 2, 1>& l0,
          const Eigen::Matrix<T, 2, 1>& l1) -> float {
-    const auto a_angle_min_v = Heading(a_angle_start) * a_radius + a_center;
-    const auto a_angle_max_v = Heading(a_angle_end) * a_radius + a_center;
+    const Eigen::Matrix<T, 2, 1> a_angle_min_v =
+        Heading(a_angle_start) * a_radius + a_center;
+    const Eigen::Matrix<T, 2, 1> a_angle_max_v =
+        Heading(a_angle_end) * a_radius + a_center;
     const auto proj_a_angle_min_v =
         ProjectPointOntoLineSegment<T>(a_angle_min_v, l0, l1);
     const auto proj_a_angle_max_v =
@@ -19,6 +19,10 @@
 */
 //========================================================================
 
+#include <float.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include <algorithm>
 #include <vector>
 
@@ -30,9 +34,204 @@
 #ifndef LINE2D_H
 #define LINE2D_H
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LINE2D_BATCH_SIMD
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LINE2D_BATCH_SIMD
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define LINE2D_BATCH_SIMD
+#endif
 
 namespace geometry {
 
+template <typename T>
+struct Line;
+
+// Line segments stored coordinate by coordinate, for the batch queries of
+// Line to test one segment against several of them per instruction.
+template <typename T>
+struct LineBatch {
+  std::vector<T> x0;
+  std::vector<T> y0;
+  std::vector<T> x1;
+  std::vector<T> y1;
+
+  void Clear() {
+    x0.clear();
+    y0.clear();
+    x1.clear();
+    y1.clear();
+  }
+
+  void Reserve(size_t size) {
+    x0.reserve(size);
+    y0.reserve(size);
+    x1.reserve(size);
+    y1.reserve(size);
+  }
+
+  void Append(const Line<T>& l) {
+    x0.push_back(l.p0.x());
+    y0.push_back(l.p0.y());
+    x1.push_back(l.p1.x());
+    y1.push_back(l.p1.y());
+  }
+
+  size_t Size() const { return x0.size(); }
+
+  Line<T> Get(size_t i) const { return Line<T>(x0[i], y0[i], x1[i], y1[i]); }
+};
+
+namespace line2d_batch {
+
+// Without vector instructions for T, all segments are left to the scalar loop.
+template <typename T, typename Visitor>
+bool VisitCandidates(const LineBatch<T>& lines,
+                     size_t end,
+                     const Eigen::Matrix<T, 2, 1>& p2,
+                     const Eigen::Matrix<T, 2, 1>& p3,
+                     size_t* i,
+                     Visitor* visit) {
+  return true;
+}
+
+#ifdef LINE2D_BATCH_SIMD
+// Lanes of the widest float vectors the build targets, AVX2, SSE2 (any
+// x86-64) or NEON, and the few operations the broad and narrow phase need.
+#if defined(__AVX2__)
+const int kWidth = 8;
+typedef __m256 Floats;
+typedef __m256 Bits;
+inline Floats Broadcast(float v) { return _mm256_set1_ps(v); }
+inline Floats Load(const float* p) { return _mm256_loadu_ps(p); }
+inline Floats Sub(Floats a, Floats b) { return _mm256_sub_ps(a, b); }
+inline Floats Add(Floats a, Floats b) { return _mm256_add_ps(a, b); }
+inline Floats Mul(Floats a, Floats b) { return _mm256_mul_ps(a, b); }
+inline Floats Min(Floats a, Floats b) { return _mm256_min_ps(a, b); }
+inline Floats Max(Floats a, Floats b) { return _mm256_max_ps(a, b); }
+inline Floats Abs(Floats a) {
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+}
+inline Bits Greater(Floats a, Floats b) {
+  return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+}
+inline Bits And(Bits a, Bits b) { return _mm256_and_ps(a, b); }
+inline Bits Or(Bits a, Bits b) { return _mm256_or_ps(a, b); }
+inline unsigned int Mask(Bits b) { return _mm256_movemask_ps(b); }
+#elif defined(__SSE2__)
+const int kWidth = 4;
+typedef __m128 Floats;
+typedef __m128 Bits;
+inline Floats Broadcast(float v) { return _mm_set1_ps(v); }
+inline Floats Load(const float* p) { return _mm_loadu_ps(p); }
+inline Floats Sub(Floats a, Floats b) { return _mm_sub_ps(a, b); }
+inline Floats Add(Floats a, Floats b) { return _mm_add_ps(a, b); }
+inline Floats Mul(Floats a, Floats b) { return _mm_mul_ps(a, b); }
+inline Floats Min(Floats a, Floats b) { return _mm_min_ps(a, b); }
+inline Floats Max(Floats a, Floats b) { return _mm_max_ps(a, b); }
+inline Floats Abs(Floats a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+inline Bits Greater(Floats a, Floats b) { return _mm_cmpgt_ps(a, b); }
+inline Bits And(Bits a, Bits b) { return _mm_and_ps(a, b); }
+inline Bits Or(Bits a, Bits b) { return _mm_or_ps(a, b); }
+inline unsigned int Mask(Bits b) { return _mm_movemask_ps(b); }
+#else
+const int kWidth = 4;
+typedef float32x4_t Floats;
+typedef uint32x4_t Bits;
+inline Floats Broadcast(float v) { return vdupq_n_f32(v); }
+inline Floats Load(const float* p) { return vld1q_f32(p); }
+inline Floats Sub(Floats a, Floats b) { return vsubq_f32(a, b); }
+inline Floats Add(Floats a, Floats b) { return vaddq_f32(a, b); }
+inline Floats Mul(Floats a, Floats b) { return vmulq_f32(a, b); }
+inline Floats Min(Floats a, Floats b) { return vminq_f32(a, b); }
+inline Floats Max(Floats a, Floats b) { return vmaxq_f32(a, b); }
+inline Floats Abs(Floats a) { return vabsq_f32(a); }
+inline Bits Greater(Floats a, Floats b) { return vcgtq_f32(a, b); }
+inline Bits And(Bits a, Bits b) { return vandq_u32(a, b); }
+inline Bits Or(Bits a, Bits b) { return vorrq_u32(a, b); }
+inline unsigned int Mask(Bits b) {
+  static const int32_t kShifts[4] = {0, 1, 2, 3};
+  return vaddvq_u32(vshlq_u32(vshrq_n_u32(b, 31), vld1q_s32(kShifts)));
+}
+#endif
+
+// Cross product a x b, and a bound on its rounding error. Products of the
+// same sign are only trusted beyond the bound, so that no lane the scalar
+// test accepts is rejected, whatever the rounding or contraction of either.
+inline Floats Cross(Floats ax, Floats ay, Floats bx, Floats by,
+                    Floats* error) {
+  const Floats p = Mul(ax, by);
+  const Floats q = Mul(bx, ay);
+  *error = Mul(Broadcast(4 * FLT_EPSILON), Add(Abs(p), Abs(q)));
+  return Sub(p, q);
+}
+
+// Lanes where both crosses are surely on the same side of zero.
+inline Bits SameSide(Floats c1, Floats e1, Floats c2, Floats e2) {
+  const Floats zero = Broadcast(0);
+  return And(Greater(Mul(c1, c2), zero),
+             And(Greater(Abs(c1), e1), Greater(Abs(c2), e2)));
+}
+
+// Runs the broad and narrow phase of Line::Intersects over whole vectors of
+// segments from *i on, and visits the lanes no phase surely rejects. Leaves
+// *i at the first segment left for the scalar loop, returns false when visit
+// asked to stop.
+template <typename Visitor>
+bool VisitCandidates(const LineBatch<float>& lines,
+                     size_t end,
+                     const Eigen::Vector2f& p2,
+                     const Eigen::Vector2f& p3,
+                     size_t* i,
+                     Visitor* visit) {
+  if (*i + kWidth > end) return true;
+  const Floats qx0 = Broadcast(p2.x());
+  const Floats qy0 = Broadcast(p2.y());
+  const Floats qx1 = Broadcast(p3.x());
+  const Floats qy1 = Broadcast(p3.y());
+  const Floats q_min_x = Broadcast(std::min(p2.x(), p3.x()));
+  const Floats q_max_x = Broadcast(std::max(p2.x(), p3.x()));
+  const Floats q_min_y = Broadcast(std::min(p2.y(), p3.y()));
+  const Floats q_max_y = Broadcast(std::max(p2.y(), p3.y()));
+  const Floats qdx = Broadcast(p3.x() - p2.x());
+  const Floats qdy = Broadcast(p3.y() - p2.y());
+  for (; *i + kWidth <= end; *i += kWidth) {
+    const Floats x0 = Load(&lines.x0[*i]);
+    const Floats y0 = Load(&lines.y0[*i]);
+    const Floats x1 = Load(&lines.x1[*i]);
+    const Floats y1 = Load(&lines.y1[*i]);
+    // Broad phase, the bounding boxes do not overlap.
+    Bits reject = Or(Or(Greater(Min(x0, x1), q_max_x),
+                        Greater(q_min_x, Max(x0, x1))),
+                     Or(Greater(Min(y0, y1), q_max_y),
+                        Greater(q_min_y, Max(y0, y1))));
+    // Narrow phase, the query lies on one side of the segment or the
+    // segment on one side of the query.
+    const Floats dx = Sub(x1, x0);
+    const Floats dy = Sub(y1, y0);
+    Floats e1, e2, e3, e4;
+    const Floats c1 = Cross(dx, dy, Sub(qx1, x0), Sub(qy1, y0), &e1);
+    const Floats c2 = Cross(dx, dy, Sub(qx0, x0), Sub(qy0, y0), &e2);
+    const Floats c3 = Cross(qdx, qdy, Sub(x1, qx0), Sub(y1, qy0), &e3);
+    const Floats c4 = Cross(qdx, qdy, Sub(x0, qx0), Sub(y0, qy0), &e4);
+    reject = Or(reject, Or(SameSide(c1, e1, c2, e2),
+                           SameSide(c3, e3, c4, e4)));
+    unsigned int lanes = ~Mask(reject) & ((1u << kWidth) - 1);
+    while (lanes != 0) {
+      const int lane = __builtin_ctz(lanes);
+      lanes &= lanes - 1;
+      if (!(*visit)(*i + lane)) return false;
+    }
+  }
+  return true;
+}
+#endif  // LINE2D_BATCH_SIMD
+
+}  // namespace line2d_batch
+
 template <typename T>
 struct Line {
   typedef Eigen::Matrix<T, 2, 1> Vector2T;
@@ -194,6 +393,82 @@ struct Line {
     return (p + alpha * dir);
   }
 
+  // Calls visit(i), in ascending order until it returns false, for every
+  // segment i of lines[begin ... end - 1] that may intersect p2 -> p3: all
+  // that may pass Intersects(). With AVX2, SSE2 or NEON, float segments are
+  // sorted out 8 or 4 at a time, otherwise one at a time by their bounding
+  // box.
+  template <typename Visitor>
+  static void ForEachCandidate(const LineBatch<T>& lines,
+                               size_t begin,
+                               size_t end,
+                               const Vector2T& p2,
+                               const Vector2T& p3,
+                               Visitor visit) {
+    size_t i = begin;
+    if (!line2d_batch::VisitCandidates(lines, end, p2, p3, &i, &visit)) {
+      return;
+    }
+    // The rest only skip the segments the broad phase of Intersects() rejects.
+    const T min_x = std::min(p2.x(), p3.x());
+    const T max_x = std::max(p2.x(), p3.x());
+    const T min_y = std::min(p2.y(), p3.y());
+    const T max_y = std::max(p2.y(), p3.y());
+    for (; i < end; ++i) {
+      if (std::min(lines.x0[i], lines.x1[i]) > max_x ||
+          std::max(lines.x0[i], lines.x1[i]) < min_x ||
+          std::min(lines.y0[i], lines.y1[i]) > max_y ||
+          std::max(lines.y0[i], lines.y1[i]) < min_y) {
+        continue;
+      }
+      if (!visit(i)) return;
+    }
+  }
+
+  // Whether p2 -> p3 intersects any of lines[begin ... end - 1], exactly as
+  // Intersects() of each.
+  static bool AnyIntersects(const LineBatch<T>& lines,
+                            size_t begin,
+                            size_t end,
+                            const Vector2T& p2,
+                            const Vector2T& p3) {
+    bool intersects = false;
+    ForEachCandidate(lines, begin, end, p2, p3, [&](size_t i) {
+      intersects = lines.Get(i).Intersects(p2, p3);
+      return !intersects;
+    });
+    return intersects;
+  }
+
+  // Nearest intersection of p2 -> p3 with lines[begin ... end - 1], exactly
+  // as Intersection() of each. Only hits at a parameter (0 at p2, 1 at p3)
+  // below *t count, of equally near ones the first. Returns the index of the
+  // segment hit and updates *t and *intersection, or returns -1.
+  static int ClosestIntersection(const LineBatch<T>& lines,
+                                 size_t begin,
+                                 size_t end,
+                                 const Vector2T& p2,
+                                 const Vector2T& p3,
+                                 T* t,
+                                 Vector2T* intersection) {
+    const Vector2T d = p3 - p2;
+    const T sq_length = d.squaredNorm();
+    int closest = -1;
+    Vector2T p(0, 0);
+    ForEachCandidate(lines, begin, end, p2, p3, [&](size_t i) {
+      if (lines.Get(i).Intersection(p2, p3, &p)) {
+        const T hit_t = (p - p2).dot(d) / sq_length;
+        if (hit_t < *t) {
+          *t = hit_t;
+          *intersection = p;
+          closest = i;
+        }
+      }
+      return true;
+    });
+    return closest;
+  }
+
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
 
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "eigen3/Eigen/Dense"
+
+namespace keyframe_map {
+
+// A keyframe of a saved SLAM session: its optimized pose in the map frame, the covariance of the constraint that placed
+// it, and its scan in its own frame.
+struct Keyframe {
+    double x {};
+    double y {};
+    double theta {};
+    Eigen::Matrix3d covariance {Eigen::Matrix3d::Zero()};
+    std::vector<Eigen::Vector2f> points;
+}; // struct Keyframe
+
+// One point per cell of the given size, the first one seen in it.
+inline std::vector<Eigen::Vector2f> decimate(const std::vector<Eigen::Vector2f> &points, const float &cell_size)
+{
+    std::unordered_set<std::int64_t> cells;
+    std::vector<Eigen::Vector2f> decimated;
+    for (const auto &point : points) {
+        const std::int64_t i {static_cast<std::int64_t>(std::floor(point.x() / cell_size))};
+        const std::int64_t j {static_cast<std::int64_t>(std::floor(point.y() / cell_size))};
+        // shifted unsigned, a negative index would make the signed shift undefined
+        if (cells.insert(static_cast<std::int64_t>((static_cast<std::uint64_t>(i) << 32) ^ (static_cast<std::uint64_t>(j) & 0xFFFFFFFF))).second) {
+            decimated.push_back(point);
+        }
+    }
+    return decimated;
+}
+
+// File layout, in the byte order of the machine that saved it: the magic and version, the keyframe count and the
+// resolution the points are quantized to, then for every keyframe its pose (x, y, theta) and row-major covariance as
+// doubles, its point count and the points as pairs of int16 multiples of the resolution.
+constexpr char _magic[8] {'S', 'L', 'A', 'M', 'K', 'F', 'M', '\0'};
+constexpr std::uint32_t _version {1};
+
+template <typename T>
+inline void write(std::ofstream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+inline bool read(std::ifstream &in, T &value)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+// Bytes left after the read position, so counts read from the file are checked before anything is allocated for them.
+inline std::uint64_t remaining(std::ifstream &in, const std::uint64_t &size)
+{
+    const std::streamoff position {in.tellg()};
+    return position < 0 || static_cast<std::uint64_t>(position) > size ? 0 : size - static_cast<std::uint64_t>(position);
+}
+
+// Pose, covariance and point count of a keyframe.
+constexpr std::uint64_t _keyframe_header_bytes {12 * sizeof(double) + sizeof(std::uint32_t)};
+
+// Points beyond the int16 range of the resolution, 65 m at 2 mm, are dropped.
+inline bool save(const std::string &file, const std::vector<Keyframe> &keyframes, const float &resolution)
+{
+    std::ofstream out(file, std::ios::binary);
+    if (!out) {
+        std::cerr << "ERROR: cannot write the keyframe map " << file << std::endl;
+        return false;
+    }
+    out.write(_magic, sizeof(_magic));
+    write(out, _version);
+    write(out, static_cast<std::uint32_t>(keyframes.size()));
+    write(out, resolution);
+
+    const float limit {static_cast<float>(std::numeric_limits<std::int16_t>::max())};
+    std::vector<std::int16_t> values;
+    for (const auto &keyframe : keyframes) {
+        write(out, keyframe.x);
+        write(out, keyframe.y);
+        write(out, keyframe.theta);
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                write(out, keyframe.covariance(r, c));
+            }
+        }
+        values.clear();
+        for (const auto &point : keyframe.points) {
+            const float x {std::round(point.x() / resolution)};
+            const float y {std::round(point.y() / resolution)};
+            if (std::abs(x) > limit || std::abs(y) > limit) {continue;}
+            values.push_back(static_cast<std::int16_t>(x));
+            values.push_back(static_cast<std::int16_t>(y));
+        }
+        write(out, static_cast<std::uint32_t>(values.size() / 2));
+        out.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(std::int16_t));
+    }
+    if (!out) {
+        std::cerr << "ERROR: failed writing the keyframe map " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+inline bool load(const std::string &file, std::vector<Keyframe> &keyframes)
+{
+    keyframes.clear();
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        std::cerr << "ERROR: cannot open the keyframe map " << file << std::endl;
+        return false;
+    }
+    in.seekg(0, std::ios::end);
+    const std::uint64_t size {static_cast<std::uint64_t>(std::max<std::streamoff>(in.tellg(), 0))};
+    in.seekg(0, std::ios::beg);
+    char magic[sizeof(_magic)];
+    std::uint32_t version {};
+    std::uint32_t count {};
+    float resolution {};
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, _magic, sizeof(_magic)) != 0 || !read(in, version) || version != _version) {
+        std::cerr << "ERROR: " << file << " is not a version " << _version << " keyframe map" << std::endl;
+        return false;
+    }
+    if (!read(in, count) || !read(in, resolution) || count > remaining(in, size) / _keyframe_header_bytes) {
+        std::cerr << "ERROR: keyframe map " << file << " is truncated" << std::endl;
+        return false;
+    }
+
+    keyframes.resize(count);
+    std::vector<std::int16_t> values;
+    for (auto &keyframe : keyframes) {
+        bool ok {read(in, keyframe.x) && read(in, keyframe.y) && read(in, keyframe.theta)};
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                ok = ok && read(in, keyframe.covariance(r, c));
+            }
+        }
+        std::uint32_t points {};
+        ok = ok && read(in, points) && points <= remaining(in, size) / (2 * sizeof(std::int16_t));
+        if (ok) {
+            values.resize(2 * static_cast<std::size_t>(points));
+            ok = static_cast<bool>(in.read(reinterpret_cast<char *>(values.data()), values.size() * sizeof(std::int16_t)));
+        }
+        if (!ok) {
+            std::cerr << "ERROR: keyframe map " << file << " is truncated" << std::endl;
+            keyframes.clear();
+            return false;
+        }
+        keyframe.points.resize(points);
+        for (std::size_t k = 0; k < points; k++) {
+            keyframe.points[k] = Eigen::Vector2f(static_cast<float>(values[2 * k]), static_cast<float>(values[2 * k + 1])) * resolution;
+        }
+    }
+    return true;
+}
+
+} // namespace keyframe_map
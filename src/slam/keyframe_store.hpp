@@ -0,0 +1,198 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "eigen3/Eigen/Dense"
+
+#include "node_arena.hpp"
+#include "span.hpp"
+
+namespace keyframe_store {
+
+// Scans by id, in three tiers by age so that memory stays bounded over long sessions: the newest hot_scans keep their
+// float points, older ones are quantized to 16 bit multiples of resolution, and past warm_scans they are spilled to a
+// memory mapped file in spill_dir that the kernel pages out as needed. An empty spill_dir keeps them in memory. Scans
+// are added by one thread, which may also read hot ones in place; points() may be called from any thread.
+class KeyframeStore {
+public:
+    KeyframeStore(const float &resolution, const std::size_t &hot_scans, const std::size_t &warm_scans, const std::string &spill_dir)
+    : _resolution(resolution), _hot_scans(std::max<std::size_t>(hot_scans, 1)),
+      _warm_scans(std::max(warm_scans, _hot_scans)), _fd(-1), _mapped(nullptr),
+      _spill_capacity(0), _spill_size(0)
+    {
+        if (spill_dir.empty()) {return;}
+        std::string path {spill_dir + "/keyframes_XXXXXX"};
+        _fd = mkstemp(&path[0]);
+        if (_fd < 0) {
+            std::cerr << "ERROR: cannot create a keyframe spill file in " << spill_dir << "; keeping old scans in memory" << std::endl;
+            return;
+        }
+        // the file goes away with the descriptor
+        unlink(path.c_str());
+    }
+
+    ~KeyframeStore()
+    {
+        if (_mapped != nullptr) {
+            munmap(_mapped, _spill_capacity * sizeof(std::int16_t));
+        }
+        if (_fd >= 0) {
+            close(_fd);
+        }
+    }
+
+    KeyframeStore(const KeyframeStore &) = delete;
+    KeyframeStore &operator=(const KeyframeStore &) = delete;
+
+    // Store a scan under the next id, returned, and move the scans that aged out of their tier down a tier.
+    int add(const span::Span<Eigen::Vector2f> &points)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Entry entry;
+        entry.tier = Tier::HOT;
+        entry.hot = _pool.append(points);
+        _entries.push_back(std::move(entry));
+
+        const std::size_t newest {_entries.size() - 1};
+        if (newest >= _hot_scans) {
+            quantize(_entries[newest - _hot_scans]);
+            _pool.releaseBefore(_entries[newest - _hot_scans + 1].hot);
+        }
+        if (newest >= _warm_scans && _fd >= 0) {
+            spill(_entries[newest - _warm_scans]);
+        }
+        return static_cast<int>(newest);
+    }
+
+    int size() const
+    {
+        return static_cast<int>(_entries.size());
+    }
+
+    // Whether the scan still has its float points; only on the thread that adds scans.
+    bool hot(const int &id) const
+    {
+        return _entries[id].tier == Tier::HOT;
+    }
+
+    // The float points of a hot scan, valid until it ages out; only on the thread that adds scans.
+    span::Span<Eigen::Vector2f> hotPoints(const int &id) const
+    {
+        return _entries[id].hot;
+    }
+
+    // A copy of the points of any scan, decoded from its tier.
+    std::vector<Eigen::Vector2f> points(const int &id) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const auto &entry {_entries[id]};
+        switch (entry.tier) {
+            case Tier::HOT:
+                return entry.hot.copy();
+            case Tier::WARM:
+                return decode(entry.warm.data(), entry.size);
+            default:
+                return decode(_mapped + entry.offset, entry.size);
+        }
+    }
+
+private:
+    enum class Tier {HOT, WARM, COLD};
+
+    struct Entry {
+        Tier tier;
+        span::Span<Eigen::Vector2f> hot;
+        std::vector<std::int16_t> warm;  // x and y of each point, interleaved
+        std::size_t offset {};          // of the cold points in the spill file, in int16 values
+        std::size_t size {};            // points in the warm or cold tier
+    };
+
+    const float _resolution;
+    const std::size_t _hot_scans;
+    const std::size_t _warm_scans;
+
+    mutable std::mutex _mutex;
+    node_arena::Pool<Eigen::Vector2f> _pool;
+    std::vector<Entry> _entries;
+
+    int _fd;
+    std::int16_t *_mapped;
+    std::size_t _spill_capacity;    // int16 values the file and mapping hold
+    std::size_t _spill_size;        // int16 values written
+
+    // points farther than the largest int16 multiple of the resolution from the scan origin, 65 m at 2 mm, are dropped
+    void quantize(Entry &entry)
+    {
+        const float limit {static_cast<float>(std::numeric_limits<std::int16_t>::max())};
+        entry.warm.reserve(2 * entry.hot.size());
+        for (const auto &point : entry.hot) {
+            const float x {std::round(point.x() / _resolution)};
+            const float y {std::round(point.y() / _resolution)};
+            if (std::abs(x) > limit || std::abs(y) > limit) {continue;}
+            entry.warm.push_back(static_cast<std::int16_t>(x));
+            entry.warm.push_back(static_cast<std::int16_t>(y));
+        }
+        entry.size = entry.warm.size() / 2;
+        entry.hot = span::Span<Eigen::Vector2f>();
+        entry.tier = Tier::WARM;
+    }
+
+    void spill(Entry &entry)
+    {
+        if (entry.tier != Tier::WARM || !reserveSpill(_spill_size + entry.warm.size())) {return;}
+        std::memcpy(_mapped + _spill_size, entry.warm.data(), entry.warm.size() * sizeof(std::int16_t));
+        entry.offset = _spill_size;
+        _spill_size += entry.warm.size();
+        std::vector<std::int16_t>().swap(entry.warm);
+        entry.tier = Tier::COLD;
+    }
+
+    // Grow the file and its mapping to at least values int16 values, doubling them. On failure the scans spilled so
+    // far stay mapped and later ones stay warm.
+    bool reserveSpill(const std::size_t &values)
+    {
+        if (values <= _spill_capacity) {return true;}
+        std::size_t capacity {std::max<std::size_t>(_spill_capacity, 1 << 20)};
+        while (capacity < values) {capacity *= 2;}
+        void *mapped {MAP_FAILED};
+        if (ftruncate(_fd, capacity * sizeof(std::int16_t)) == 0) {
+            mapped = mmap(nullptr, capacity * sizeof(std::int16_t), PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        }
+        if (mapped == MAP_FAILED) {
+            std::cerr << "ERROR: cannot grow the keyframe spill file; keeping newer old scans in memory" << std::endl;
+            close(_fd);
+            _fd = -1;
+            return false;
+        }
+        if (_mapped != nullptr) {
+            munmap(_mapped, _spill_capacity * sizeof(std::int16_t));
+        }
+        _mapped = static_cast<std::int16_t *>(mapped);
+        _spill_capacity = capacity;
+        return true;
+    }
+
+    std::vector<Eigen::Vector2f> decode(const std::int16_t *values, const std::size_t &size) const
+    {
+        std::vector<Eigen::Vector2f> points(size);
+        for (std::size_t k = 0; k < size; k++) {
+            points[k] = Eigen::Vector2f(static_cast<float>(values[2 * k]), static_cast<float>(values[2 * k + 1])) * _resolution;
+        }
+        return points;
+    }
+
+}; // class KeyframeStore
+
+} // namespace keyframe_store
@@ -13,10 +13,9 @@ class MultivariateMotionModel
 {
 public:
     MultivariateMotionModel(const Eigen::Vector3d &mu, const Eigen::Vector3d &odom_mag)
+    : _mu(mu), _invertible(false)
     {
         // storing values and precomputing ones needed for computation
-        _mu = std::make_unique<const Eigen::Vector3d>(mu);
-        
         Eigen::Vector2d translation_vector;
         double translation;
         double rotation;
@@ -25,55 +24,116 @@ public:
         translation = translation_vector.norm();
         rotation = std::abs(odom_mag.z());
 
-        Eigen::Matrix3d cov;
-        cov << std::max(pow(K5 * translation + K4 * rotation, 2), 0.1), 0.d, 0.d,
+        _covariance << std::max(pow(K5 * translation + K4 * rotation, 2), 0.1), 0.d, 0.d,
                 0.d, std::max(pow(K6 * translation + K4 * rotation, 2), 0.1), 0.d,
                 0.d, 0.d, std::max(pow(K2 * translation + K3 * rotation, 2), 0.1);
 
-        _covariance = std::make_unique<const Eigen::Matrix3d>(cov);
-
         // use LU decomposition to get the inverse and determinant (precomputing so we don't have to do it for each evaluation)
-        Eigen::FullPivLU<Eigen::Matrix3d> lu_decomp(cov);
+        Eigen::FullPivLU<Eigen::Matrix3d> lu_decomp(_covariance);
 
         if (lu_decomp.rank() == 3) {
-            _inv_covariance = std::make_unique<const Eigen::Matrix3d>(lu_decomp.inverse());
+            _inv_covariance = lu_decomp.inverse();
+            _invertible = true;
 
-            // _det_covariance = std::make_unique<const double>(lu_decomp.determinant());
-            // _normalization_constant = std::make_unique<const double>(
-            //     1 / (sqrt(pow(2 * M_PI, 3) * (*_det_covariance)))
-            // );
+            // _det_covariance = lu_decomp.determinant();
+            // _normalization_constant = 1 / (sqrt(pow(2 * M_PI, 3) * _det_covariance));
         }
 
-        // std::cout << *_covariance << ",\n" << *_inv_covariance << ",\n" << *_det_covariance << ",\n" << *_normalization_constant << std::endl;
+        // std::cout << _covariance << ",\n" << _inv_covariance << ",\n" << _det_covariance << ",\n" << _normalization_constant << std::endl;
     }
 
-    double evaluate(const Eigen::Vector3d &X)
+    double evaluate(const Eigen::Vector3d &X) const
     {
-        if (_inv_covariance == nullptr) {
+        if (!_invertible) {
             std::cerr << "Inverse covariance or determinant could not be set! Covariance was probably not positive definite. Returning a small non-zero probability to allow computation to continue." << std::endl;
             return 0.1;
         }
 
-        // return (*_normalization_constant) * exp(-0.5 * (X - (*_mu)).transpose() * (*_inv_covariance) * (X - (*_mu)));
+        // return _normalization_constant * exp(-0.5 * (X - _mu).transpose() * _inv_covariance * (X - _mu));
         
+        // headings are compared on the circle, relative rotations against a submap can sit near +-pi
+        Eigen::Vector3d diff {X - _mu};
+        diff.z() = atan2(sin(diff.z()), cos(diff.z()));
+
         // just returning unnormalized probability because we only care about proportionality
-        return exp(-0.5 * (X - (*_mu)).transpose() * (*_inv_covariance) * (X - (*_mu)));
+        return exp(-0.5 * diff.transpose() * _inv_covariance * diff);
     }
 
-    Eigen::Matrix3d get_covariance(){
-        //! I don't believe a check that _covariance is populated is necessary since it should populate with the motion models instantiation
-        return *_covariance;
+    // Upper bound of evaluate() over the axis-aligned box [lower, upper]. The covariance is diagonal, so the peak of
+    // the box sits at the mean clamped into it.
+    double upper_bound(const Eigen::Vector3d &lower, const Eigen::Vector3d &upper) const
+    {
+        if (!_invertible) {
+            return 0.1;
+        }
+        return evaluate(_mu.cwiseMax(lower).cwiseMin(upper));
+    }
+
+    // the mean and inverse covariance, for evaluating the model over a lattice; false when there is no inverse
+    bool get_parameters(Eigen::Vector3d &mean, Eigen::Matrix3d &inverse_covariance) const
+    {
+        if (!_invertible) {
+            return false;
+        }
+        mean = _mu;
+        inverse_covariance = _inv_covariance;
+        return true;
+    }
+
+    Eigen::Matrix3d get_covariance() const
+    {
+        return _covariance;
     }
 
 private:
-    std::unique_ptr<const Eigen::Vector3d> _mu;
-    std::unique_ptr<const Eigen::Matrix3d> _covariance;
-    std::unique_ptr<const Eigen::Matrix3d> _inv_covariance;
-    // std::unique_ptr<const double> _det_covariance;
-    // std::unique_ptr<const double> _normalization_constant; 
+    // fixed size and held inline, so a model per comparison costs no allocation
+    Eigen::Vector3d _mu;
+    Eigen::Matrix3d _covariance;
+    Eigen::Matrix3d _inv_covariance;
+    bool _invertible;
+    // double _det_covariance;
+    // double _normalization_constant;
 
 }; // class MultivariateMotionModel
 
+// evaluate() of a model over the candidates of one search, which share their positions across headings: the quadratic
+// form splits into a position and a heading term, since the covariance does not correlate heading with position, so
+// the prior of each position and of each heading is computed once and a candidate only multiplies the two.
+class MotionLattice
+{
+public:
+    MotionLattice(const MultivariateMotionModel &model, const std::vector<Eigen::Vector2f> &positions, const std::vector<float> &headings)
+    : _position(positions.size(), 0.1), _heading(headings.size(), 1.d)
+    {
+        Eigen::Vector3d mean;
+        Eigen::Matrix3d inverse_covariance;
+        if (!model.get_parameters(mean, inverse_covariance)) {
+            std::cerr << "Inverse covariance or determinant could not be set! Covariance was probably not positive definite. Returning a small non-zero probability to allow computation to continue." << std::endl;
+            return;
+        }
+
+        const Eigen::Matrix2d position_inverse {inverse_covariance.topLeftCorner<2, 2>()};
+        for (std::size_t k = 0; k < positions.size(); k++) {
+            const Eigen::Vector2d diff {positions[k].cast<double>() - mean.head<2>()};
+            _position[k] = exp(-0.5 * diff.transpose() * position_inverse * diff);
+        }
+        for (std::size_t k = 0; k < headings.size(); k++) {
+            const double diff {atan2(sin(headings[k] - mean.z()), cos(headings[k] - mean.z()))};
+            _heading[k] = exp(-0.5 * diff * inverse_covariance(2, 2) * diff);
+        }
+    }
+
+    double evaluate(const std::size_t &position, const std::size_t &heading) const
+    {
+        return _position[position] * _heading[heading];
+    }
+
+private:
+    std::vector<double> _position;
+    std::vector<double> _heading;
+
+}; // class MotionLattice
+
 class IndependentMotionModel
 {
 public:
@@ -1,6 +1,9 @@
 #include "motion_model.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <vector>
 #include <eigen3/Eigen/Dense>
 
 int main (int argc, char **argv)
@@ -13,6 +16,31 @@ int main (int argc, char **argv)
     
     auto model {motion_model::MultivariateMotionModel(odom, odom)};
     std::cout << model.evaluate(eval) << std::endl;
+
+    // the lattice prior matches evaluate() over a grid of candidates
+    std::vector<Eigen::Vector2f> positions;
+    for (int j = -5; j <= 5; j++) {
+        for (int i = -5; i <= 5; i++) {
+            positions.push_back(Eigen::Vector2f(odom.x() + 0.03 * i, odom.y() + 0.03 * j));
+        }
+    }
+    std::vector<float> headings;
+    for (int k = -13; k <= 13; k++) {
+        headings.push_back(odom.z() + 0.03 * k);
+    }
+    const motion_model::MotionLattice lattice(model, positions, headings);
+    double max_error {};
+    for (std::size_t p = 0; p < positions.size(); p++) {
+        for (std::size_t h = 0; h < headings.size(); h++) {
+            const double expected {model.evaluate(Eigen::Vector3d(positions[p].x(), positions[p].y(), headings[h]))};
+            max_error = std::max(max_error, std::abs(lattice.evaluate(p, h) - expected));
+        }
+    }
+    std::cout << "lattice max error " << max_error << std::endl;
+    if (max_error > 1e-12) {
+        std::cout << "FAILED" << std::endl;
+        return 1;
+    }
     
     return 0;
 }
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "span.hpp"
+
+namespace node_arena {
+
+// Append-only store of T with stable integer handles: elements are constructed in place in blocks of kBlockSize
+// that never move, and handles are consecutive from 0. The block directory is allocated up front, so while one
+// thread appends, others may use the elements handed to them (through a queue, say) without any locking.
+template <typename T, std::size_t kBlockSize = 256, std::size_t kMaxBlocks = 4096>
+class Arena {
+public:
+    Arena()
+    : _blocks(new Block *[kMaxBlocks]()), _size(0) {}
+
+    ~Arena()
+    {
+        clear();
+    }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // Construct a new element from args; its handle is the size before the call.
+    template <typename... Args>
+    T &emplace(Args &&...args)
+    {
+        const std::size_t block {_size / kBlockSize};
+        if (block >= kMaxBlocks) {
+            std::cerr << "ERROR: arena full at " << _size << " elements" << std::endl;
+            std::abort();
+        }
+        if (_blocks[block] == nullptr) {
+            _blocks[block] = new Block();
+        }
+        T *element {new (slot(_size)) T(std::forward<Args>(args)...)};
+        _size++;
+        return *element;
+    }
+
+    T &operator[](const std::size_t &handle) {return *slot(handle);}
+    const T &operator[](const std::size_t &handle) const {return *slot(handle);}
+
+    std::size_t size() const {return _size;}
+    bool empty() const {return _size == 0;}
+
+    // Destroy every element; handles start from 0 again.
+    void clear()
+    {
+        for (std::size_t i = 0; i < _size; i++) {
+            slot(i)->~T();
+        }
+        _size = 0;
+        for (std::size_t b = 0; b < kMaxBlocks && _blocks[b] != nullptr; b++) {
+            delete _blocks[b];
+            _blocks[b] = nullptr;
+        }
+    }
+
+private:
+    struct Block {
+        alignas(T) unsigned char bytes[kBlockSize * sizeof(T)];
+    };
+
+    std::unique_ptr<Block *[]> _blocks;
+    std::size_t _size;
+
+    T *slot(const std::size_t &handle) const
+    {
+        return reinterpret_cast<T *>(_blocks[handle / kBlockSize]->bytes) + handle % kBlockSize;
+    }
+
+}; // class Arena
+
+// Contiguous storage for many small arrays, such as the scans of every node: each array is copied into the current
+// block of kBlockSize elements, or a block of its own when it does not fit in one, and is handed back as a span
+// that stays valid until the pool is destroyed or its block released.
+template <typename T, std::size_t kBlockSize = (1 << 16)>
+class Pool {
+public:
+    Pool()
+    : _used(kBlockSize) {}
+
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    span::Span<T> append(const span::Span<T> &values)
+    {
+        if (_blocks.empty() || values.size() > _blocks.back().second - _used) {
+            const std::size_t capacity {std::max(kBlockSize, values.size())};
+            _blocks.emplace_back(std::unique_ptr<T[]>(new T[capacity]), capacity);
+            _used = 0;
+        }
+        T *destination {_blocks.back().first.get() + _used};
+        std::copy(values.begin(), values.end(), destination);
+        _used += values.size();
+        return span::Span<T>(destination, values.size());
+    }
+
+    // Free the blocks that only hold arrays appended before values, which came from this pool. Arrays are released
+    // in the order they were appended; spans into freed blocks are invalid.
+    void releaseBefore(const span::Span<T> &values)
+    {
+        while (_blocks.size() > 1) {
+            const T *first {_blocks.front().first.get()};
+            if (values.data() >= first && values.data() < first + _blocks.front().second) {break;}
+            _blocks.pop_front();
+        }
+    }
+
+private:
+    std::deque<std::pair<std::unique_ptr<T[]>, std::size_t>> _blocks;   // with their capacities
+    std::size_t _used;      // elements taken in the last block
+
+}; // class Pool
+
+} // namespace node_arena
@@ -1,8 +1,16 @@
 #pragma once
 
 // Correlative Scan Match values
-#define ODOM_TRANSLATION_THRESHOLD          1.0     // m
+#define ODOM_TRANSLATION_THRESHOLD          1.5     // m, 1.0 without SLAM_SUBMAPS
 #define ODOM_ROTATION_THRESHOLD             0.52    // rad
+#define SLAM_ADAPTIVE_KEYFRAMES             1       // 1: take a keyframe once the scan overlaps the last one too little, 0: at the thresholds above
+#define KEYFRAME_MIN_TRANSLATION            0.5     // m, with SLAM_ADAPTIVE_KEYFRAMES scans are considered from here...
+#define KEYFRAME_MIN_ROTATION               0.2     // rad
+#define KEYFRAME_MAX_TRANSLATION            2.5     // m, ...and always taken past here
+#define KEYFRAME_MAX_ROTATION               0.8     // rad
+#define KEYFRAME_OVERLAP_THRESHOLD          0.8     // share of the scan the last keyframe must explain for it to be skipped
+#define KEYFRAME_OVERLAP_STRIDE             8       // every this many-th point of the scan is scored for the overlap
+#define KEYFRAME_OVERLAP_LEVEL              2       // max-pooled table level the overlap is scored on, 2^level cells wide
 
 // Generate Candidate values
 #define POSE_SAMPLING_X_RESOLUTION           0.03    // m
@@ -11,12 +19,56 @@
 #define POSE_SAMPLING_Y_LIMIT                0.15    // m
 #define POSE_SAMPLING_THETA_RESOLUTION       0.03    // ~1.71 deg
 #define POSE_SAMPLING_THETA_LIMIT            0.4     // ~17.19 deg
+#define CSM_BRANCH_AND_BOUND                 1       // 1: coarse-to-fine search on max-pooled tables, 0: score the whole cube
+#define CSM_COVARIANCE_WINDOW                2       // samples on each side of the best match scored for the covariance
 
 #define LOOKUP_TABLE_RESOLUTION             0.03 // m
 #define LOOKUP_TABLE_SIGMA                  0.03 // 0.05 // 0.01 // 0.1 // m
+#define LOOKUP_TABLE_QUANTIZED              1 // 1: store cells as 8 bit likelihoods, 0: as floats
+#define LOOKUP_TABLE_POOL_SIZE              16 // freed table buffers kept for reuse
 
 #define GTSAM_FREQUENCY                     1 // gtsam will run every this many CSM updates
+#define SLAM_ASYNC_BACKEND                  1 // 1: optimize and assemble the map on a back end thread, 0: inline in the laser callback
+#define SLAM_BACKEND_QUEUE_SIZE             64 // nodes the front end may get ahead of the back end
+#define GTSAM_INCREMENTAL                   1 // 1: update an iSAM2 solver with each node's factors, 0: rebuild and batch optimize the graph
 #define POSE_GRAPH_CONNECTION_DEPTH         2 // 5 // number of previous non-sequential poses to connect to new
+#define POSE_GRAPH_PRUNING                  1 // 1: merge nodes whose scans repeat a kept neighbour's into the constraints around them, 0: keep every node
+#define POSE_GRAPH_PRUNING_DELAY            20 // newer nodes a node waits for before it is kept or pruned
+#define POSE_GRAPH_PRUNING_BATCH            10 // nodes decided at a time, with one solver update for the ones pruned
+#define POSE_GRAPH_PRUNING_RADIUS           0.5 // m, a node is redundant with a kept node this close...
+#define POSE_GRAPH_PRUNING_ROTATION         0.3 // rad, ...facing this close to the same way...
+#define POSE_GRAPH_PRUNING_DISTANCE         0.3 // ...whose descriptor is this close to its own
+#define SLAM_NUM_THREADS                    4 // worker threads for the scan comparisons of each update; needs OpenMP
+#define SLAM_SUBMAPS                        1 // 1: match scans against submaps of consecutive scans, 0: against single scans
+#define SUBMAP_SIZE                         10 // scans merged into each submap
+#define LOOP_CLOSURE_RADIUS                 1.0 // m, earlier poses this close to a new one are loop closure candidates
+#define LOOP_CLOSURE_MAX_CONSTRAINTS        4 // loop closures kept per new state, from distinct earlier visits
+#define LOOP_CLOSURE_DESCRIPTORS            1 // 1: only match the earlier visits whose scans look most alike, 0: every visit, closest first
+#define LOOP_CLOSURE_DESCRIPTOR_RADIUS      2.0 // m, earlier poses this close are ranked by descriptor with LOOP_CLOSURE_DESCRIPTORS
+#define LOOP_CLOSURE_DESCRIPTOR_CANDIDATES  3 // best ranked visits matched per new state
+#define LOOP_CLOSURE_DESCRIPTOR_DISTANCE    0.7 // visits whose descriptors are farther apart are never matched
+#define LOOP_CLOSURE_AGE_SCALE              100 // keyframes since a visit that halve its ranking distance, older visits close more drift
+#define SCAN_DESCRIPTOR_MAX_RANGE           8.0 // m, reach of the outermost ring of the scan descriptors
+#define SLAM_SCAN_MIN_SPACING               0.02 // m, closer consecutive scan points are dropped, 0 keeps all
+#define SLAM_SCAN_MAX_RANGE                 0 // m, farther scan points are dropped, 0 for the sensor range
+
+// Keyframe storage values
+#define SLAM_KEYFRAME_HOT_SCANS             100 // newest scans kept as floats, with their lookup tables without SLAM_SUBMAPS
+#define SLAM_KEYFRAME_HOT_SUBMAPS           4 // newest submaps kept as floats with their lookup tables
+#define SLAM_KEYFRAME_WARM_SCANS            1000 // newest scans and submaps kept quantized in memory, older ones are spilled
+#define SLAM_KEYFRAME_RESOLUTION            0.002 // m, of quantized scans
+#define SLAM_KEYFRAME_SPILL_DIR             "/tmp" // of the file old scans are spilled to, "" keeps them in memory
+#define SLAM_KEYFRAME_TABLE_CACHE           8 // lookup tables rebuilt for loop closures that are kept for later ones
+
+// Localization values, against a loaded keyframe map
+#define LOCALIZATION_KEYFRAME_RADIUS        3.0 // m, keyframes this close to the predicted pose are matched against
+#define LOCALIZATION_KEYFRAMES              2 // nearest keyframes matched against, side by side
+
+// Global map values
+#define MAP_RESOLUTION                      0.05 // m, the map keeps one point per cell
+#define MAP_UPDATE_TRANSLATION              0.02 // m, a node's scan is re-transformed once its pose moved this far
+#define MAP_UPDATE_ROTATION                 0.01 // rad
+#define SLAM_VISUALIZATION_RATE             2 // Hz, most pose graph visualizations sent a second
 
 #define K2              0.5
 #define K3              0.5
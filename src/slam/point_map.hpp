@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "eigen3/Eigen/Dense"
+
+#include "span.hpp"
+
+namespace point_map {
+
+// Every stride-th point, with the stride chosen to leave at most max_points; all of them when max_points is zero.
+inline std::vector<Eigen::Vector2f> subsample(const std::vector<Eigen::Vector2f> &points, const std::size_t &max_points)
+{
+    if (max_points == 0 || points.size() <= max_points) {return points;}
+    const std::size_t stride {(points.size() + max_points - 1) / max_points};
+    std::vector<Eigen::Vector2f> subsampled;
+    subsampled.reserve(max_points);
+    for (std::size_t k = 0; k < points.size(); k += stride) {
+        subsampled.push_back(points[k]);
+    }
+    return subsampled;
+}
+
+// Global map of the scans of every node, decimated to one point (the centroid) per grid cell. Nodes are only
+// re-transformed when their pose moved beyond the thresholds since they were last inserted.
+class PointMap {
+public:
+    PointMap(const float &resolution, const float &translation_threshold, const float &rotation_threshold)
+    : _resolution(resolution), _translation_threshold(translation_threshold), _rotation_threshold(rotation_threshold) {}
+
+    // Whether update() would insert or move the scan of node id, so callers can skip fetching its points.
+    bool moved(const int &id, const float &x, const float &y, const float &theta) const
+    {
+        if (id >= static_cast<int>(_nodes.size()) || !_nodes[id].inserted) {return true;}
+        const auto &node {_nodes[id]};
+        const float d_theta {std::abs(std::atan2(std::sin(theta - node.theta), std::cos(theta - node.theta)))};
+        return std::hypot(x - node.x, y - node.y) >= _translation_threshold || d_theta >= _rotation_threshold;
+    }
+
+    // Inserts or moves the scan of node id, given in the node frame. Returns whether the map changed.
+    bool update(const int &id, const span::Span<Eigen::Vector2f> &points, const float &x, const float &y, const float &theta)
+    {
+        if (!moved(id, x, y, theta)) {return false;}
+        if (id >= static_cast<int>(_nodes.size())) {
+            _nodes.resize(id + 1);
+        }
+        auto &node {_nodes[id]};
+        if (node.inserted) {
+            remove(node);
+        }
+
+        // the scan is decimated to the same cells before it is added, so every node counts once per cell
+        const Eigen::Rotation2Df rotation(theta);
+        const Eigen::Vector2f translation(x, y);
+        std::unordered_map<std::int64_t, std::size_t> node_cells;
+        for (const auto &point : points) {
+            const Eigen::Vector2f p {rotation * point + translation};
+            const auto key {cellKey(p)};
+            if (node_cells.emplace(key, node.contributions.size()).second) {
+                node.contributions.emplace_back(key, p);
+            }
+        }
+        for (const auto &contribution : node.contributions) {
+            auto &cell {_cells[contribution.first]};
+            cell.count++;
+            cell.sum += contribution.second;
+        }
+        node.x = x;
+        node.y = y;
+        node.theta = theta;
+        node.inserted = true;
+        return true;
+    }
+
+    // Takes the scan of node id out of the map. Returns whether the map changed.
+    bool erase(const int &id)
+    {
+        if (id >= static_cast<int>(_nodes.size()) || !_nodes[id].inserted) {return false;}
+        remove(_nodes[id]);
+        return true;
+    }
+
+    // Centroids of the occupied cells.
+    std::vector<Eigen::Vector2f> points() const
+    {
+        std::vector<Eigen::Vector2f> points;
+        points.reserve(_cells.size());
+        for (const auto &cell : _cells) {
+            points.push_back(cell.second.sum / cell.second.count);
+        }
+        return points;
+    }
+
+    std::size_t size() const
+    {
+        return _cells.size();
+    }
+
+private:
+    struct Cell {
+        int count {};
+        Eigen::Vector2f sum {Eigen::Vector2f::Zero()};
+    };
+
+    struct Node {
+        bool inserted {false};
+        float x {};
+        float y {};
+        float theta {};
+        std::vector<std::pair<std::int64_t, Eigen::Vector2f>> contributions;
+    };
+
+    const float _resolution;
+    const float _translation_threshold;
+    const float _rotation_threshold;
+    std::unordered_map<std::int64_t, Cell> _cells;
+    std::vector<Node> _nodes;
+
+    std::int64_t cellKey(const Eigen::Vector2f &p) const
+    {
+        const std::int64_t i {static_cast<std::int64_t>(std::floor(p.x() / _resolution))};
+        const std::int64_t j {static_cast<std::int64_t>(std::floor(p.y() / _resolution))};
+        // shifted unsigned, a negative index would make the signed shift undefined
+        return static_cast<std::int64_t>((static_cast<std::uint64_t>(i) << 32) ^ (static_cast<std::uint64_t>(j) & 0xFFFFFFFF));
+    }
+
+    void remove(Node &node)
+    {
+        for (const auto &contribution : node.contributions) {
+            auto cell {_cells.find(contribution.first)};
+            cell->second.count--;
+            cell->second.sum -= contribution.second;
+            if (cell->second.count == 0) {
+                _cells.erase(cell);
+            }
+        }
+        node.contributions.clear();
+        node.inserted = false;
+    }
+
+}; // class PointMap
+
+} // namespace point_map
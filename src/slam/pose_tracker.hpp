@@ -0,0 +1,74 @@
+#pragma once
+
+#include "eigen3/Eigen/Dense"
+#include "eigen3/Eigen/Geometry"
+
+namespace pose_tracker {
+
+// Robot pose at odometry rate: the map pose of the newest keyframe composed with the odometry since its scan was
+// taken, so the pose moves smoothly between keyframes and follows the keyframe as optimization moves it.
+class PoseTracker {
+public:
+    PoseTracker()
+    : _keyframe(Eigen::Affine2f::Identity()), _keyframe_odom(Eigen::Affine2f::Identity()),
+      _odom(Eigen::Affine2f::Identity()), _anchored(false) {}
+
+    // Start from a map pose; the next odometry reading is taken as the one at that pose.
+    void reset(const Eigen::Vector2f &loc, const float &angle)
+    {
+        _keyframe = transform(loc, angle);
+        _anchored = false;
+    }
+
+    // A new keyframe at a map pose, whose scan was taken at the latest odometry reading.
+    void setKeyframe(const Eigen::Vector2f &loc, const float &angle)
+    {
+        _keyframe = transform(loc, angle);
+        _keyframe_odom = _odom;
+    }
+
+    // The newest keyframe moved, as optimization shifted it.
+    void moveKeyframe(const Eigen::Vector2f &loc, const float &angle)
+    {
+        _keyframe = transform(loc, angle);
+    }
+
+    void observeOdometry(const Eigen::Vector2f &loc, const float &angle)
+    {
+        _odom = transform(loc, angle);
+        if (!_anchored) {
+            _keyframe_odom = _odom;
+            _anchored = true;
+        }
+    }
+
+    // Odometry jumped to a reading that does not follow from the last one: carry on from the current pose.
+    void rebase(const Eigen::Vector2f &loc, const float &angle)
+    {
+        _keyframe = _keyframe * _keyframe_odom.inverse() * _odom;
+        _odom = transform(loc, angle);
+        _keyframe_odom = _odom;
+        _anchored = true;
+    }
+
+    void pose(Eigen::Vector2f *loc, float *angle) const
+    {
+        const Eigen::Affine2f current {_keyframe * _keyframe_odom.inverse() * _odom};
+        *loc = current.translation();
+        *angle = Eigen::Rotation2Df(current.rotation()).angle();
+    }
+
+private:
+    Eigen::Affine2f _keyframe;      // map pose of the newest keyframe
+    Eigen::Affine2f _keyframe_odom; // odometry pose when its scan was taken
+    Eigen::Affine2f _odom;          // latest odometry pose
+    bool _anchored;                 // whether _keyframe_odom has been read since reset()
+
+    static Eigen::Affine2f transform(const Eigen::Vector2f &loc, const float &angle)
+    {
+        return Eigen::Translation2f(loc) * Eigen::Rotation2Df(angle);
+    }
+
+}; // class PoseTracker
+
+} // namespace pose_tracker
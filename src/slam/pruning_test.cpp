@@ -0,0 +1,250 @@
+#include <gtsam/geometry/Pose2.h>
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/linear/linearExceptions.h>
+#include <gtsam/nonlinear/ISAM2.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// pruning a node out of the incremental solver (SLAM::removePrunedFactors), and dropping an unstable constraint for a
+// prior (SLAM::optimizeIncremental), have to leave the same estimates as building the resulting graph from scratch
+
+static const int kChain {6};
+
+struct Constraint {
+    int node;
+    int parent;
+    int id;
+    gtsam::Pose2 rel_pose;
+    gtsam::Matrix rel_cov;
+    // set once the constraint is dropped for instability and a prior holds its variable instead
+    bool held;
+    gtsam::Pose2 held_pose;
+};
+
+// same composition as SLAM::pruneChain
+static gtsam::Matrix composedCovariance(const gtsam::Matrix &a_cov, const gtsam::Pose2 &b, const gtsam::Matrix &b_cov)
+{
+    const gtsam::Matrix adjoint {b.inverse().AdjointMap()};
+    return adjoint * a_cov * adjoint.transpose() + b_cov;
+}
+
+static gtsam::Matrix covariance(double xy, double theta)
+{
+    gtsam::Matrix cov {gtsam::Matrix::Zero(3, 3)};
+    cov(0, 0) = xy * xy;
+    cov(1, 1) = xy * xy;
+    cov(2, 2) = theta * theta;
+    return cov;
+}
+
+static void addPrior(gtsam::NonlinearFactorGraph &graph)
+{
+    graph.addPrior(gtsam::Symbol('x', 0), gtsam::Pose2(0, 0, 0), gtsam::noiseModel::Diagonal::Sigmas(gtsam::Vector3(0.1, 0.1, 0.03)));
+}
+
+static void addSequential(gtsam::NonlinearFactorGraph &graph, int previous, int index, const gtsam::Pose2 &rel_pose, const gtsam::Matrix &rel_cov)
+{
+    graph.add(gtsam::BetweenFactor<gtsam::Pose2>(
+        gtsam::Symbol('x', previous),
+        gtsam::Symbol('x', index),
+        rel_pose,
+        gtsam::noiseModel::Gaussian::Covariance(rel_cov)
+    ));
+}
+
+static void addNonsequential(gtsam::NonlinearFactorGraph &graph, int parent, int id, const gtsam::Pose2 &rel_pose, const gtsam::Matrix &rel_cov)
+{
+    graph.add(gtsam::BetweenFactor<gtsam::Pose2>(
+        gtsam::Symbol('x', parent),
+        gtsam::Symbol('n', id),
+        rel_pose,
+        gtsam::noiseModel::Gaussian::Covariance(rel_cov)
+    ));
+}
+
+// the pruned graph built from scratch, solved in batch from the same initial estimates
+static gtsam::Values batchEstimate(
+    const std::vector<gtsam::Pose2> &truth,
+    const std::vector<gtsam::Pose2> &rel_poses,
+    const std::vector<gtsam::Matrix> &rel_covs,
+    const std::vector<Constraint> &constraints,
+    int pruned,
+    std::vector<gtsam::Key> &keys)
+{
+    gtsam::NonlinearFactorGraph graph;
+    gtsam::Values initial_estimate;
+    keys.clear();
+    int previous {};
+    for (int i = 0; i < kChain; i++) {
+        if (i == pruned) {continue;}
+        if (i == 0) {
+            addPrior(graph);
+        } else {
+            addSequential(graph, previous, i, rel_poses[i], rel_covs[i]);
+        }
+        previous = i;
+        keys.push_back(gtsam::Symbol('x', i));
+        initial_estimate.insert(gtsam::Symbol('x', i), truth[i]);
+    }
+    for (const auto &c : constraints) {
+        if (c.held) {
+            graph.addPrior(gtsam::Symbol('n', c.id), c.held_pose, gtsam::noiseModel::Gaussian::Covariance(c.rel_cov));
+        } else {
+            addNonsequential(graph, c.parent, c.id, c.rel_pose, c.rel_cov);
+        }
+        keys.push_back(gtsam::Symbol('n', c.id));
+        initial_estimate.insert(gtsam::Symbol('n', c.id), truth[c.node]);
+    }
+    return gtsam::LevenbergMarquardtOptimizer(graph, initial_estimate).optimize();
+}
+
+static bool matches(const gtsam::Values &estimate, const gtsam::Values &expected, const std::vector<gtsam::Key> &keys, const char *name)
+{
+    double max_error {};
+    for (const auto &key : keys) {
+        if (!estimate.exists(key)) {
+            std::cout << name << ": variable missing from the incremental estimate" << std::endl;
+            return false;
+        }
+        const auto error {expected.at<gtsam::Pose2>(key).between(estimate.at<gtsam::Pose2>(key))};
+        max_error = std::max({max_error, std::abs(error.x()), std::abs(error.y()), std::abs(error.theta())});
+    }
+    std::cout << name << " max error " << max_error << std::endl;
+    return max_error < 1e-4;
+}
+
+int main (int argc, char **argv)
+{
+    // a chain bending to the left with slightly inconsistent odometry, and constraints of newer nodes matched
+    // against older ones; node 2 is the one pruned
+    std::vector<gtsam::Pose2> truth {gtsam::Pose2(0, 0, 0)};
+    std::vector<gtsam::Pose2> rel_poses {gtsam::Pose2()};
+    std::vector<gtsam::Matrix> rel_covs {gtsam::Matrix()};
+    for (int i = 1; i < kChain; i++) {
+        const gtsam::Pose2 step {1.0, 0.1 * i, 0.2};
+        truth.push_back(truth.back() * step);
+        rel_poses.push_back(step * gtsam::Pose2(0.02 * std::sin(i), -0.015 * std::cos(i), 0.01 * std::sin(2 * i)));
+        rel_covs.push_back(covariance(0.05 + 0.01 * i, 0.02));
+    }
+    std::vector<Constraint> constraints;
+    const int matched[][2] {{3, 1}, {5, 2}, {5, 4}};
+    for (const auto &m : matched) {
+        const int id {static_cast<int>(constraints.size())};
+        const auto rel_pose {truth[m[1]].between(truth[m[0]]) * gtsam::Pose2(-0.01 * id, 0.02, -0.005)};
+        constraints.push_back(Constraint{m[0], m[1], id, rel_pose, covariance(0.08, 0.03), false, gtsam::Pose2()});
+    }
+    const int pruned {2};
+
+    gtsam::ISAM2Params parameters;
+    parameters.relinearizeThreshold = 0.01;
+    parameters.relinearizeSkip = 1;
+    gtsam::ISAM2 isam(parameters);
+
+    try {
+        // . the chain goes in over two updates like SLAM::optimizeIncremental adds it, the factor indices are kept
+        std::vector<gtsam::FactorIndex> node_factor(kChain);
+        std::vector<gtsam::FactorIndex> constraint_factor(constraints.size());
+        const int updates[][2] {{0, 4}, {4, kChain}};
+        for (const auto &update : updates) {
+            gtsam::NonlinearFactorGraph graph;
+            gtsam::Values initial_estimate;
+            std::vector<gtsam::FactorIndex *> indices;
+            for (int i = update[0]; i < update[1]; i++) {
+                if (i == 0) {
+                    addPrior(graph);
+                } else {
+                    addSequential(graph, i - 1, i, rel_poses[i], rel_covs[i]);
+                }
+                indices.push_back(&node_factor[i]);
+                initial_estimate.insert(gtsam::Symbol('x', i), truth[i]);
+                for (const auto &c : constraints) {
+                    if (c.node != i) {continue;}
+                    addNonsequential(graph, c.parent, c.id, c.rel_pose, c.rel_cov);
+                    indices.push_back(&constraint_factor[c.id]);
+                    initial_estimate.insert(gtsam::Symbol('n', c.id), truth[c.node]);
+                }
+            }
+            const auto result {isam.update(graph, initial_estimate)};
+            for (std::size_t k = 0; k < indices.size(); k++) {
+                *indices[k] = result.newFactorsIndices[k];
+            }
+        }
+
+        // . prune node 2: the node after it composes onto the kept node before, and so does the constraint matched
+        // against it; the removed factors and their replacements go in with one update as in removePrunedFactors
+        rel_covs[pruned + 1] = composedCovariance(rel_covs[pruned], rel_poses[pruned + 1], rel_covs[pruned + 1]);
+        rel_poses[pruned + 1] = rel_poses[pruned] * rel_poses[pruned + 1];
+        gtsam::FactorIndices removed {node_factor[pruned], node_factor[pruned + 1]};
+        gtsam::NonlinearFactorGraph replacement;
+        std::vector<gtsam::FactorIndex *> replaced;
+        addSequential(replacement, pruned - 1, pruned + 1, rel_poses[pruned + 1], rel_covs[pruned + 1]);
+        replaced.push_back(&node_factor[pruned + 1]);
+        for (auto &c : constraints) {
+            if (c.parent != pruned) {continue;}
+            removed.push_back(constraint_factor[c.id]);
+            c.rel_cov = composedCovariance(rel_covs[pruned], c.rel_pose, c.rel_cov);
+            c.rel_pose = rel_poses[pruned] * c.rel_pose;
+            c.parent = pruned - 1;
+            addNonsequential(replacement, c.parent, c.id, c.rel_pose, c.rel_cov);
+            replaced.push_back(&constraint_factor[c.id]);
+        }
+        const auto result {isam.update(replacement, gtsam::Values(), removed)};
+        for (std::size_t k = 0; k < replaced.size(); k++) {
+            *replaced[k] = result.newFactorsIndices[k];
+        }
+
+        std::vector<gtsam::Key> keys;
+        const auto batch {batchEstimate(truth, rel_poses, rel_covs, constraints, pruned, keys)};
+
+        // . a few more updates relinearize the incremental solution until it settles
+        for (int k = 0; k < 5; k++) {
+            isam.update();
+        }
+        const auto estimate {isam.calculateEstimate()};
+        if (estimate.exists(gtsam::Symbol('x', pruned))) {
+            std::cout << "pruned variable left in the incremental estimate" << std::endl;
+            std::cout << "FAILED" << std::endl;
+            return 1;
+        }
+        if (!matches(estimate, batch, keys, "pruning")) {
+            std::cout << "FAILED" << std::endl;
+            return 1;
+        }
+
+        // . the instability path of SLAM::optimizeIncremental: the newest constraint's factor is removed and a prior
+        // from its covariance holds the variable where it is, with the same update
+        auto &dropped {constraints.back()};
+        dropped.held = true;
+        dropped.held_pose = estimate.at<gtsam::Pose2>(gtsam::Symbol('n', dropped.id));
+        gtsam::NonlinearFactorGraph held;
+        held.addPrior(gtsam::Symbol('n', dropped.id), dropped.held_pose, gtsam::noiseModel::Gaussian::Covariance(dropped.rel_cov));
+        isam.update(held, gtsam::Values(), gtsam::FactorIndices{constraint_factor[dropped.id]});
+        if (isam.getFactorsUnsafe().at(constraint_factor[dropped.id])) {
+            std::cout << "removed constraint left in the solver" << std::endl;
+            std::cout << "FAILED" << std::endl;
+            return 1;
+        }
+        for (int k = 0; k < 5; k++) {
+            isam.update();
+        }
+        const auto held_batch {batchEstimate(truth, rel_poses, rel_covs, constraints, pruned, keys)};
+        if (!matches(isam.calculateEstimate(), held_batch, keys, "instability")) {
+            std::cout << "FAILED" << std::endl;
+            return 1;
+        }
+    } catch (const gtsam::IndeterminantLinearSystemException &e) {
+        std::cout << e.what() << std::endl;
+        std::cout << "FAILED" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <vector>
 #include <memory>
+#include <mutex>
 #include <limits>
 #include <cmath>
 #include <iostream>
@@ -10,29 +14,149 @@
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
 
+#include "parameters.h"
+#include "span.hpp"
+
 namespace rasterization {
 
+// Freed table buffers, kept so tables built later reuse their memory instead of going back to the allocator.
+template <typename T>
+class BufferPool {
+public:
+    static BufferPool &instance()
+    {
+        static BufferPool pool;
+        return pool;
+    }
+
+    // a zeroed buffer of the given size
+    std::vector<T> acquire(const std::size_t &size)
+    {
+        std::vector<T> buffer;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_free.empty()) {
+                buffer = std::move(_free.back());
+                _free.pop_back();
+            }
+        }
+        buffer.assign(size, T());
+        return buffer;
+    }
+
+    void release(std::vector<T> &&buffer)
+    {
+        if (buffer.capacity() == 0) {return;}
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_free.size() < LOOKUP_TABLE_POOL_SIZE) {
+            _free.push_back(std::move(buffer));
+        }
+    }
+
+private:
+    std::mutex _mutex;
+    std::vector<std::vector<T>> _free;
+
+}; // class BufferPool
+
 class LookupTable {
 public:
-    LookupTable(const std::vector<Eigen::Vector2f> &points, const float &resolution, const float &sigma)
-    : _resolution(resolution), _sigma(sigma)
+    // Cells are stored row-major (x major), either as floats or as likelihoods quantized to 8 bits.
+#if LOOKUP_TABLE_QUANTIZED
+    typedef std::uint8_t Cell;
+    static constexpr double _cell_scale {1.d / 255.d};
+#else
+    typedef float Cell;
+    static constexpr double _cell_scale {1.d};
+#endif
+
+    // precomputed_kernel stamps one precomputed Gaussian patch per point; false evaluates the Gaussian for every
+    // pixel of every point instead, which gives the same cells and is kept as the reference
+    LookupTable(const span::Span<Eigen::Vector2f> &points, const float &resolution, const float &sigma, const bool &precomputed_kernel = true)
+    : _resolution(resolution), _sigma(sigma), _size_x(0), _size_y(0)
     {
         // create the lookup table based on the data
-        generateLookupTable(points);
+        generateLookupTable(points, precomputed_kernel);
+    }
+
+    ~LookupTable()
+    {
+        BufferPool<Cell>::instance().release(std::move(_table));
+        for (auto &level : _pooled) {
+            BufferPool<Cell>::instance().release(std::move(level.values));
+        }
     }
 
     double evaluate(const Eigen::Vector2f &point)
     {
-        if (_table == nullptr) {
+        if (_table.empty()) {
             // std::cout << "Table has not been created." << std::endl;
             return 0.d;
         }
         // calculate indices of point in image
         const auto indices {computeIndices(point)};
-        if (indices[0] == -1 || indices[1] == -1) {return 0.d;}
+        if (indices[0] == -1) {return 0.d;}
 
         // if here, the point is within the canvas
-        return (*_table)[indices[0]][indices[1]];
+        return decode(_table[indices[0] * _size_y + indices[1]]);
+    }
+
+    // Continuous cell coordinates of a point, so clouds can be shifted across the table with index arithmetic only.
+    Eigen::Vector2f gridCoordinates(const Eigen::Vector2f &point)
+    {
+        if (_lower_left_corner == nullptr) {return Eigen::Vector2f::Zero();}
+        return (point - *_lower_left_corner) / _resolution;
+    }
+
+    // Sum of evaluate() over a cloud given in grid coordinates, shifted by the given number of cells.
+    double sumShifted(const std::vector<float> &x, const std::vector<float> &y, const Eigen::Vector2f &shift)
+    {
+        if (_table.empty()) {return 0.d;}
+        const float shift_x {shift.x()};
+        const float shift_y {shift.y()};
+
+        // cells are summed as stored and scaled once at the end
+        double sum {};
+        for (std::size_t k = 0; k < x.size(); k++) {
+            const int i {static_cast<int>(std::floor(x[k] + shift_x))};
+            const int j {static_cast<int>(std::floor(y[k] + shift_y))};
+            if (inBounds(i, j)) {
+                sum += _table[i * _size_y + j];
+            }
+        }
+        return sum * _cell_scale;
+    }
+
+    // Upper bound of sumShifted() over every shift in the square window of 2^level cells starting at shift. Used by
+    // the branch-and-bound scan matcher; levels start at 1 and go up to maxPooledLevel().
+    double sumUpperBound(const std::vector<float> &x, const std::vector<float> &y, const Eigen::Vector2f &shift, const int &level)
+    {
+        buildMaxPooledTables();
+        if (_table.empty() || level < 1 || level > static_cast<int>(_pooled.size())) {return 0.d;}
+        const auto &pooled {_pooled[level - 1]};
+
+        // a window hanging off the low edge is covered by the first coarse cell, one starting past the high edge holds
+        // no data at all
+        double sum {};
+        for (std::size_t k = 0; k < x.size(); k++) {
+            const int x_index {static_cast<int>(std::floor(x[k] + shift.x()))};
+            const int y_index {static_cast<int>(std::floor(y[k] + shift.y()))};
+            if (x_index < _size_x && y_index < _size_y) {
+                sum += pooled.values[(std::max(x_index, 0) >> level) * pooled.size_y + (std::max(y_index, 0) >> level)];
+            }
+        }
+        return sum * _cell_scale;
+    }
+
+    int maxPooledLevel()
+    {
+        buildMaxPooledTables();
+        return static_cast<int>(_pooled.size());
+    }
+
+    float getResolution()
+    {
+        return _resolution;
     }
 
     double getPeak()
@@ -42,29 +166,27 @@ public:
 
     void exportAsPPM(const std::string &path)
     {
-        if (_table == nullptr) {
+        if (_table.empty()) {
             std::cout << "Table has not been created." << std::endl;
             return;
         }
-        const auto pixels = *_table;
         std::ofstream outFile(path);
 
         // Write PPM header
         outFile << "P3\n"; // P3 indicates the type of PPM file (ASCII format)
-        outFile << pixels[0].size() << " " << pixels.size() << "\n"; // Width and height
+        outFile << _size_y << " " << _size_x << "\n"; // Width and height
         outFile << "255\n"; // Maximum color value (for 8-bit grayscale)
 
         // find highest magnitude pixel
         float max_value {};
-        for (const auto &row : pixels) {
-            for (const auto &value : row) {
-                if (value > max_value) {max_value = value;}
-            }
+        for (const auto &cell : _table) {
+            if (decode(cell) > max_value) {max_value = decode(cell);}
         }
 
         // Write pixel data
-        for (auto row : pixels) {
-            for (auto value : row) {
+        for (int i = 0; i < _size_x; i++) {
+            for (int j = 0; j < _size_y; j++) {
+                const double value {decode(_table[i * _size_y + j])};
                 int int_value = static_cast<int>(255 * value / max_value);
                 if (int_value > 255) {
                     int_value = 255;
@@ -78,16 +200,15 @@ public:
 
     void exportAsPPMRandom(const std::string &path)
     {
-        if (_table == nullptr) {
+        if (_table.empty()) {
             std::cout << "Table has not been created." << std::endl;
             return;
         }
-        const auto pixels = *_table;
         std::ofstream outFile(path);
 
         // Write PPM header
         outFile << "P3\n"; // P3 indicates the type of PPM file (ASCII format)
-        outFile << pixels[0].size() << " " << pixels.size() << "\n"; // Width and height
+        outFile << _size_y << " " << _size_x << "\n"; // Width and height
         outFile << "255\n"; // Maximum color value (for 8-bit grayscale)
 
         std::random_device rd;
@@ -95,9 +216,8 @@ public:
         std::uniform_int_distribution<int> dis(0, 255);
 
         // Write pixel data
-        for (auto row : pixels) {
-            for (auto value : row) {
-                if (value){}
+        for (int i = 0; i < _size_x; i++) {
+            for (int j = 0; j < _size_y; j++) {
                 outFile << dis(gen) << " " << dis(gen) << " " << dis(gen) << "\n"; // Write grayscale pixel (R, G, B)
             }
         }
@@ -105,6 +225,12 @@ public:
         std::cout << "Saved image to " << path << std::endl;
     }
 
+    // raw cells, row-major over [size_x][size_y]
+    const std::vector<Cell> &cells() const
+    {
+        return _table;
+    }
+
     std::vector<Eigen::Vector2f> corners()
     {
         std::vector<Eigen::Vector2f> corners;
@@ -116,36 +242,115 @@ public:
 private:
     const float _resolution;
     const float _sigma;
-    std::unique_ptr<std::vector<std::vector<double>>> _table;
+    int _size_x;
+    int _size_y;
+    std::vector<Cell> _table;    // _size_x * _size_y cells from the pool, empty until built
     std::unique_ptr<const Eigen::Vector2f> _lower_left_corner;
     std::unique_ptr<const Eigen::Vector2f> _upper_right_corner;
 
+    // Max-pooled copies of the table, built on first use. Level k has a stride of 2^k cells and each cell holds the max
+    // over the 2^(k+1) cells that follow it, so any window of up to 2^k cells falls inside a single coarse cell.
+    struct PooledTable {
+        int size_x;
+        int size_y;
+        std::vector<Cell> values;
+    };
+    std::vector<PooledTable> _pooled;
+    std::once_flag _pooled_flag;
+
+    void buildMaxPooledTables()
+    {
+        std::call_once(_pooled_flag, [this]() {
+            if (_table.empty()) {return;}
+            auto &pool {BufferPool<Cell>::instance()};
+
+            // level 0 (stride 1, window 2) seeds the recursion and is dropped once level 1 exists
+            PooledTable previous;
+            previous.size_x = _size_x;
+            previous.size_y = _size_y;
+            previous.values = pool.acquire(previous.size_x * previous.size_y);
+            for (int i = 0; i < previous.size_x; i++) {
+                for (int j = 0; j < previous.size_y; j++) {
+                    Cell value {_table[i * _size_y + j]};
+                    for (int di = 0; di <= 1 && i + di < previous.size_x; di++) {
+                        for (int dj = 0; dj <= 1 && j + dj < previous.size_y; dj++) {
+                            value = std::max(value, _table[(i + di) * _size_y + j + dj]);
+                        }
+                    }
+                    previous.values[i * previous.size_y + j] = value;
+                }
+            }
+
+            // each level takes the max of cells 0 and 2 strides apart in the one below, halving the size until it
+            // covers the whole table
+            while (previous.size_x > 1 || previous.size_y > 1) {
+                PooledTable level;
+                level.size_x = (previous.size_x + 1) / 2;
+                level.size_y = (previous.size_y + 1) / 2;
+                level.values = pool.acquire(level.size_x * level.size_y);
+                for (int i = 0; i < level.size_x; i++) {
+                    for (int j = 0; j < level.size_y; j++) {
+                        Cell value {previous.values[2 * i * previous.size_y + 2 * j]};
+                        if (2 * i + 2 < previous.size_x) {
+                            value = std::max(value, previous.values[(2 * i + 2) * previous.size_y + 2 * j]);
+                        }
+                        if (2 * j + 2 < previous.size_y) {
+                            value = std::max(value, previous.values[2 * i * previous.size_y + 2 * j + 2]);
+                        }
+                        if (2 * i + 2 < previous.size_x && 2 * j + 2 < previous.size_y) {
+                            value = std::max(value, previous.values[(2 * i + 2) * previous.size_y + 2 * j + 2]);
+                        }
+                        level.values[i * level.size_y + j] = value;
+                    }
+                }
+                // level 0 goes back to the pool, the others are kept
+                if (_pooled.empty()) {
+                    pool.release(std::move(previous.values));
+                }
+                _pooled.push_back(level);
+                previous = std::move(level);
+            }
+            if (_pooled.empty()) {
+                pool.release(std::move(previous.values));
+            }
+        });
+    }
+
+    static double decode(const Cell &cell)
+    {
+        return cell * _cell_scale;
+    }
+
+    static Cell encode(const double &value)
+    {
+        return static_cast<Cell>(LOOKUP_TABLE_QUANTIZED ? std::round(value / _cell_scale) : value);
+    }
+
+    // one unsigned comparison per axis covers both ends of the canvas
+    bool inBounds(const int &i, const int &j) const
+    {
+        return static_cast<unsigned>(i) < static_cast<unsigned>(_size_x) && static_cast<unsigned>(j) < static_cast<unsigned>(_size_y);
+    }
+
     std::array<int, 2> computeIndices(const Eigen::Vector2f &point)
     {
         // check if image not yet created (should never get here but just n case)
-        if (_table == nullptr || _lower_left_corner == nullptr || _upper_right_corner == nullptr) {
+        if (_table.empty() || _lower_left_corner == nullptr) {
             std::cout << "Image is not initialized! Nothing to look up." << std::endl;
             return {-1, -1};
         }
 
-        // make sure the point falls within the bounds of the input data
-        if (point.x() < _lower_left_corner->x() || point.x() > _upper_right_corner->x() || point.y() < _lower_left_corner->y() || point.y() > _upper_right_corner->y()) {
-            return {-1, -1};
-        }
-
-        // calculate the indices where the data should be
-        int x_index {static_cast<int>((point.x() - _lower_left_corner->x()) / _resolution)};
-        int y_index {static_cast<int>((point.y() - _lower_left_corner->y()) / _resolution)};
-
-        // make sure these indices fall within the canvas
-        if (!((x_index < static_cast<int>(_table->size())) && (x_index >= 0)) || !((y_index < static_cast<int>(_table->at(0).size())) && (y_index >= 0))) {
+        // calculate the indices where the data should be; anything outside the canvas, on either side, is rejected
+        const int x_index {static_cast<int>(std::floor((point.x() - _lower_left_corner->x()) / _resolution))};
+        const int y_index {static_cast<int>(std::floor((point.y() - _lower_left_corner->y()) / _resolution))};
+        if (!inBounds(x_index, y_index)) {
             return {-1, -1};
         }
 
         return {x_index, y_index};
     }
 
-    void generateLookupTable(const std::vector<Eigen::Vector2f> &points)
+    void generateLookupTable(const span::Span<Eigen::Vector2f> &points, const bool &precomputed_kernel)
     {
         if (points.empty()) {
             std::cout << "Table cannot be created, no points provided." << std::endl;
@@ -169,31 +374,84 @@ private:
         _upper_right_corner = std::make_unique<const Eigen::Vector2f>(max_x + buffer, max_y + buffer);
 
         // - now build an "image" sized for these limits
-        std::size_t size_x {static_cast<std::size_t>((_upper_right_corner->x() - _lower_left_corner->x()) / _resolution)};
-        std::size_t size_y {static_cast<std::size_t>((_upper_right_corner->y() - _lower_left_corner->y()) / _resolution)};
-        
-        _table = std::make_unique<std::vector<std::vector<double>>>(size_x, std::vector<double>(size_y, 0.d));
+        _size_x = static_cast<int>((_upper_right_corner->x() - _lower_left_corner->x()) / _resolution);
+        _size_y = static_cast<int>((_upper_right_corner->y() - _lower_left_corner->y()) / _resolution);
+
+        _table = BufferPool<Cell>::instance().acquire(static_cast<std::size_t>(_size_x) * _size_y);
+
+        // std::cout << "Created an lookup table of size [" << _size_x << ", " << _size_y << "] with lower left corner [" << _lower_left_corner->transpose() << "] and upper right corner [" << _upper_right_corner->transpose() << "]." << std::endl;
 
-        // std::cout << "Created an lookup table of size [" << _table->size() << ", " << _table->at(0).size() << "] with lower left corner [" << _lower_left_corner->transpose() << "] and upper right corner [" << _upper_right_corner->transpose() << "]." << std::endl;
+        if (!precomputed_kernel) {
+            for (const auto &point : points) {
+                seedGaussianKernel(point);
+            }
+            return;
+        }
 
+        const int d_pixels {kernelRadius()};
+        const auto kernel {buildKernel(d_pixels)};
         for (const auto &point : points) {
-            seedGaussianKernel(point);
+            stampKernel(point, kernel, d_pixels);
+        }
+    }
+
+    int kernelRadius() const
+    {
+        float d_three_sigma {3 * _sigma};
+        return static_cast<int>(d_three_sigma / _resolution);
+    }
+
+    // Encoded Gaussian over the (2 * d_pixels + 1)^2 offsets around a point, computed exactly as seedGaussianKernel
+    // does; offsets outside the disc are zero, which leaves cells untouched under max-blending.
+    std::vector<Cell> buildKernel(const int &d_pixels) const
+    {
+        const int width {2 * d_pixels + 1};
+        std::vector<Cell> kernel(width * width, Cell());
+        for (int di = -d_pixels; di <= d_pixels; di++) {
+            for (int dj = -d_pixels; dj <= d_pixels; dj++) {
+                double l2_pixels {sqrt(pow(di, 2) + pow(dj, 2))};
+                if (l2_pixels <= d_pixels) {
+                    float l2_m {static_cast<float>(l2_pixels * _resolution)};
+                    auto prob {exp(-0.5 * pow(l2_m / _sigma, 2))};
+                    kernel[(di + d_pixels) * width + dj + d_pixels] = encode(prob);
+                }
+            }
+        }
+        return kernel;
+    }
+
+    void stampKernel(const Eigen::Vector2f &point, const std::vector<Cell> &kernel, const int &d_pixels)
+    {
+        const auto indices {computeIndices(point)};
+        if (indices[0] == -1) {return;}
+
+        // clip the patch to the canvas once, then max-blend it a row at a time
+        const int width {2 * d_pixels + 1};
+        const int i_begin {std::max(indices[0] - d_pixels, 0)};
+        const int i_end {std::min(indices[0] + d_pixels, _size_x - 1)};
+        const int j_begin {std::max(indices[1] - d_pixels, 0)};
+        const int j_end {std::min(indices[1] + d_pixels, _size_y - 1)};
+        for (int i = i_begin; i <= i_end; i++) {
+            Cell *row {&_table[i * _size_y]};
+            const Cell *kernel_row {&kernel[(i - indices[0] + d_pixels) * width + d_pixels]};
+            for (int j = j_begin; j <= j_end; j++) {
+                row[j] = std::max(row[j], kernel_row[j - indices[1]]);
+            }
         }
     }
 
     void seedGaussianKernel(const Eigen::Vector2f &point)
     {
         const auto indices {computeIndices(point)};
-        if (indices[0] == -1 || indices[1] == -1) {return;}
+        if (indices[0] == -1) {return;}
 
         // get all points that should have values
-        float d_three_sigma {3 * _sigma};
-        int d_pixels {static_cast<int>(d_three_sigma / _resolution)};
+        int d_pixels {kernelRadius()};
 
         // evaluate the Gaussian at these points (in the center) based on distance from point
-        for (int i = std::max(indices[0] - d_pixels, 0); i <= std::min(indices[0] + d_pixels, static_cast<int>(_table->size()) - 1); i++) {
+        for (int i = std::max(indices[0] - d_pixels, 0); i <= std::min(indices[0] + d_pixels, _size_x - 1); i++) {
             
-            for (int j = std::max(indices[1] - d_pixels, 0); j <= std::min(indices[1] + d_pixels, static_cast<int>((*_table)[0].size()) - 1); j++) {
+            for (int j = std::max(indices[1] - d_pixels, 0); j <= std::min(indices[1] + d_pixels, _size_y - 1); j++) {
 
                 // calculate the distance from the center to the pixel in pixels
                 double l2_pixels {sqrt(pow(i - indices[0], 2) + pow(j - indices[1], 2))};
@@ -209,7 +467,8 @@ private:
 
                     // paper suggest this should be a max of all the possible probability values, is this right?
                     // (*_table)[i][j] += prob;
-                    (*_table)[i][j] = std::max(prob, (*_table)[i][j]);
+                    auto &cell {_table[i * _size_y + j]};
+                    cell = std::max(encode(prob), cell);
                 }
             }
         }
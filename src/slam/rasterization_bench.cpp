@@ -0,0 +1,49 @@
+#include "rasterization.hpp"
+#include <iostream>
+#include <chrono>
+
+// Compares the precomputed-kernel table builder against the per-pixel reference builder for speed and for
+// bit-exact agreement of the cells.
+int main(int argc, char** argv)
+{
+    // generating 1081 random points (size of one scan)
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<float> dis(-10, 10);
+
+    std::vector<Eigen::Vector2f> points;
+    for (int i = 0; i <= 1081; i++) {
+        points.push_back(Eigen::Vector2f(dis(gen), dis(gen)));
+    }
+
+    const int n_tables {argc > 1 ? std::atoi(argv[1]) : 20};
+    bool identical {true};
+
+    for (const float sigma : {LOOKUP_TABLE_SIGMA, 0.1}) {
+        std::chrono::microseconds reference_duration {};
+        std::chrono::microseconds kernel_duration {};
+
+        for (int i = 0; i < n_tables; i++) {
+            auto reference_start {std::chrono::high_resolution_clock::now()};
+            const auto reference {std::make_unique<rasterization::LookupTable>(points, LOOKUP_TABLE_RESOLUTION, sigma, false)};
+            auto reference_end {std::chrono::high_resolution_clock::now()};
+            reference_duration += std::chrono::duration_cast<std::chrono::microseconds>(reference_end - reference_start);
+
+            auto kernel_start {std::chrono::high_resolution_clock::now()};
+            const auto kernel {std::make_unique<rasterization::LookupTable>(points, LOOKUP_TABLE_RESOLUTION, sigma, true)};
+            auto kernel_end {std::chrono::high_resolution_clock::now()};
+            kernel_duration += std::chrono::duration_cast<std::chrono::microseconds>(kernel_end - kernel_start);
+
+            if (reference->cells() != kernel->cells()) {
+                identical = false;
+            }
+        }
+
+        std::cout << "\t>> sigma " << sigma << " m: reference builder " << reference_duration.count() / n_tables << " us, "
+                  << "precomputed kernel " << kernel_duration.count() / n_tables << " us per table ("
+                  << static_cast<double>(reference_duration.count()) / kernel_duration.count() << "x)" << std::endl;
+    }
+
+    std::cout << (identical ? "Tables are identical." : "Tables DIFFER.") << std::endl;
+    return identical ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+#include "eigen3/Eigen/Dense"
+
+#include "span.hpp"
+
+namespace scan_descriptor {
+
+// Polar occupancy signature of a scan, in the spirit of Scan Context: the plane around the sensor is cut into rings and
+// sectors, and each cell records whether any point of the scan falls in it. A sector is a column of ring bits, so two
+// scans are compared under every relative heading by only shifting whole columns.
+class ScanDescriptor {
+public:
+    static constexpr int RINGS {20};
+    static constexpr int SECTORS {60};
+
+    // points in the frame of the robot, those beyond max_range are left out
+    ScanDescriptor(const span::Span<Eigen::Vector2f> &points, const float &max_range)
+    : _sectors {}
+    {
+        const float ring_scale {RINGS / max_range};
+        const float sector_scale {static_cast<float>(SECTORS / (2 * M_PI))};
+        for (const auto &point : points) {
+            const int ring {static_cast<int>(point.norm() * ring_scale)};
+            if (ring >= RINGS) {continue;}
+            int sector {static_cast<int>((std::atan2(point.y(), point.x()) + M_PI) * sector_scale)};
+            sector = std::min(sector, SECTORS - 1);
+            _sectors[sector] |= std::uint32_t {1} << ring;
+        }
+        _cells = 0;
+        for (const auto &column : _sectors) {_cells += __builtin_popcount(column);}
+    }
+
+    // Jaccard distance of the occupied cells under the relative heading that overlaps them best, from 0 for the same
+    // view to 1 for views that share nothing
+    float distance(const ScanDescriptor &other) const
+    {
+        if (_cells == 0 || other._cells == 0) {return 1;}
+        int best {0};
+        for (int shift = 0; shift < SECTORS; shift++) {
+            int shared {0};
+            for (int sector = 0; sector < SECTORS; sector++) {
+                const int shifted {sector + shift < SECTORS ? sector + shift : sector + shift - SECTORS};
+                shared += __builtin_popcount(_sectors[sector] & other._sectors[shifted]);
+            }
+            best = std::max(best, shared);
+        }
+        return 1 - static_cast<float>(best) / (_cells + other._cells - best);
+    }
+
+private:
+    std::array<std::uint32_t, SECTORS> _sectors;    // bit r of a sector is set when ring r holds a point
+    int _cells;
+
+}; // class ScanDescriptor
+
+} // namespace scan_descriptor
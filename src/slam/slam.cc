@@ -30,6 +30,7 @@
 #include "shared/math/geometry.h"
 #include "shared/math/math_util.h"
 #include "shared/util/timer.h"
+#include "profiler/profiler.h"
 
 #include "slam.h"
 #include "parameters.h"
@@ -54,22 +55,48 @@ namespace slam {
 SLAM::SLAM() :
     odom_initialized_(false),
     ready_for_slam_update_(false),
+    odom_translation_change_(0),
+    odom_rotation_change_(0),
     depth_(POSE_GRAPH_CONNECTION_DEPTH),
     gtsam_timer_(0),
-    iteration_counter_(0) {}
+    keyframes_(SLAM_KEYFRAME_RESOLUTION, SLAM_KEYFRAME_HOT_SCANS, SLAM_KEYFRAME_WARM_SCANS, SLAM_KEYFRAME_SPILL_DIR),
+    submap_clouds_(SLAM_KEYFRAME_RESOLUTION, SLAM_KEYFRAME_HOT_SUBMAPS, SLAM_KEYFRAME_WARM_SCANS, SLAM_KEYFRAME_SPILL_DIR),
+    pose_index_(LOOP_CLOSURE_RADIUS),
+    synced_size_(0),
+    map_(MAP_RESOLUTION, MAP_UPDATE_TRANSLATION, MAP_UPDATE_ROTATION),
+    backend_running_(false),
+    async_backend_(SLAM_ASYNC_BACKEND),
+    localization_only_(false),
+    keyframe_index_(LOCALIZATION_KEYFRAME_RADIUS),
+    isam_nodes_(0),
+    isam_nonsequential_keys_(0),
+    pruning_decided_(0),
+    kept_index_(POSE_GRAPH_PRUNING_RADIUS),
+    kept_index_stale_(false) {
+    scan_cloud_.SetDownsampling(SLAM_SCAN_MIN_SPACING, SLAM_SCAN_MAX_RANGE);
+}
+
+SLAM::~SLAM() {
+    stopBackend();
+}
 
 void SLAM::CreateVisPublisher(ros::NodeHandle* n) {
-    vis_pub_ = n->advertise<amrl_msgs::VisualizationMsg>("visualization", 1);
+    visualization_.Init(n);
     vis_msg_ = visualization::NewVisualizationMessage("map", "slam");
+    visualization_.SetRate(vis_msg_.ns, SLAM_VISUALIZATION_RATE);
 }
 
 void SLAM::InitializePose(const Eigen::Vector2f& loc, const float angle) {
     current_pose_.loc = loc;
     current_pose_.angle = angle;
     starting_pose_ = std::make_shared<gtsam::Pose2>(loc.x(), loc.y(), angle);
-    visualization::ClearVisualizationMsg(vis_msg_);
-    vis_msg_.header.stamp = ros::Time::now();
-    vis_pub_.publish(vis_msg_);
+    localized_pose_ = *starting_pose_;
+    tracker_.reset(loc, angle);
+
+    // vis_msg_ belongs to the back end, so the cleared graph goes out in a message of its own
+    auto clear_msg {visualization::NewVisualizationMessage("map", "slam")};
+    clear_msg.header.stamp = ros::Time::now();
+    visualization_.Publish(clear_msg);
     odom_initialized_ = false;
 
     // start the pose graph
@@ -79,17 +106,13 @@ void SLAM::InitializePose(const Eigen::Vector2f& loc, const float angle) {
 
 void SLAM::GetPose(Eigen::Vector2f* loc, float* angle) {
     // Return the latest pose estimate of the robot.
-    if (!(chain_.size() > 0)) {
-        const auto pose {transformPoseCopy(odom_change_, current_pose_)};
-        *loc = pose.loc;
-        *angle = pose.angle;
-        return;
+    if (!localization_only_) {
+        syncOptimizedPoses();
+        if (!poses_.empty()) {
+            tracker_.moveKeyframe(Eigen::Vector2f(poses_.back().x(), poses_.back().y()), poses_.back().theta());
+        }
     }
-
-    const auto last_chain_pose {Pose(chain_[chain_.size() - 1]->est_pose.x(), chain_[chain_.size() - 1]->est_pose.y(), chain_[chain_.size() - 1]->est_pose.theta())};
-    Pose current {transformPoseCopy(odom_change_, last_chain_pose)};
-    *loc = current.loc;
-    *angle = current.angle;
+    tracker_.pose(loc, angle);
 }
 
 void SLAM::ObserveLaser(const vector<float>& ranges,
@@ -106,54 +129,48 @@ void SLAM::ObserveLaser(const vector<float>& ranges,
         return;
     }
 
-    std::vector<Eigen::Vector2f> point_cloud;
-
-    // Convert laser scan to point cloud centered around base_link
+    // Convert laser scan to point cloud centered around base_link, ignoring points that are not obstacles
+    const Eigen::Vector2f lidar_loc(0.2, 0);    // LiDAR is 20cm in front of base link
     float angle_inc = (angle_max - angle_min) / ranges.size();
-    for (std::size_t i = 0; i < ranges.size(); i++) {
-        // Ignore points that are not obstacles
-        if (ranges[i] >= range_max) {
-        continue;
-        }
-
-        // Create point coordinates in robot frame
-        const Eigen::Vector2f lidar_loc(0.2, 0);    // LiDAR is 20cm in front of base link
-        float theta = angle_inc * i + angle_min;    // angle_min is -2.35619
-        Eigen::Vector2f point(
-        ranges[i] * cos(theta) + lidar_loc.x(),
-        ranges[i] * sin(theta) + lidar_loc.y()
-        );
+    const auto &point_cloud {scan_cloud_.Convert(ranges, range_max, angle_min, angle_inc, lidar_loc)};
 
-        // Push into point cloud vector
-        point_cloud.push_back(point);
+    // With SLAM_ADAPTIVE_KEYFRAMES, a scan the last keyframe already explains is skipped until the robot has moved
+    // KEYFRAME_MAX_TRANSLATION or KEYFRAME_MAX_ROTATION, so only new parts of the scene cost a scan match
+    if (SLAM_ADAPTIVE_KEYFRAMES && !localization_only_ && !chain_.empty()
+        && odom_translation_change_ <= KEYFRAME_MAX_TRANSLATION && odom_rotation_change_ <= KEYFRAME_MAX_ROTATION
+        && keyframeOverlap(odom_change_, point_cloud) >= KEYFRAME_OVERLAP_THRESHOLD) {
+        return;
     }
 
-    // Publish point cloud visualization
-    vis_msg_.header.stamp = ros::Time::now();
-    vis_pub_.publish(vis_msg_);
-
-    // update SLAM
-    iterateSLAM(odom_change_, point_cloud);
+    // update SLAM, or only the pose against a loaded map, and carry on from the new keyframe at odometry rate
+    if (localization_only_) {
+        localize(odom_change_, point_cloud);
+        tracker_.setKeyframe(Eigen::Vector2f(localized_pose_.x(), localized_pose_.y()), localized_pose_.theta());
+    } else {
+        iterateSLAM(odom_change_, point_cloud);
+        tracker_.setKeyframe(Eigen::Vector2f(poses_.back().x(), poses_.back().y()), poses_.back().theta());
+    }
 
-    // Clear motion model flag
+    // Clear motion model flag, the motion to the next keyframe is measured from the latest odometry reading
     ready_for_slam_update_ = false;
+    reference_odom_pose_ = prev_odom_pose_;
+    odom_translation_change_ = 0;
+    odom_rotation_change_ = 0;
 }
 
 void SLAM::ObserveOdometry(const Vector2f& odom_loc, const float odom_angle) {
-    static float odom_translation_change;
-    static float odom_rotation_change;
-
     if (starting_pose_ == nullptr) {
         return;
     }
 
     // Disregard first odometry reading, set pose variables
     if (!odom_initialized_) {
-        odom_translation_change = 0;
-        odom_rotation_change = 0;
+        odom_translation_change_ = 0;
+        odom_rotation_change_ = 0;
 
         reference_odom_pose_.loc = odom_loc;
         reference_odom_pose_.angle = odom_angle;
+        tracker_.observeOdometry(odom_loc, odom_angle);
 
         odom_initialized_ = true;
         return;
@@ -165,9 +182,11 @@ void SLAM::ObserveOdometry(const Vector2f& odom_loc, const float odom_angle) {
 
         // Ignore unrealistic jumps in odometry
         if (odom_translation < 1.0 && odom_rotation < M_PI_4) {
+            tracker_.observeOdometry(odom_loc, odom_angle);
+
             // Keep track of movement from odometry readings to estimate how far the robot has moved
-            odom_translation_change += odom_translation;
-            odom_rotation_change += odom_rotation;
+            odom_translation_change_ += odom_translation;
+            odom_rotation_change_ += odom_rotation;
 
             // updating odometry change in odom frame for use in later algorithm
             Eigen::Matrix3f transform;
@@ -176,18 +195,16 @@ void SLAM::ObserveOdometry(const Vector2f& odom_loc, const float odom_angle) {
                             0, 0, 1;
             odom_change_ = transformPoseCopy(Pose(odom_loc.x(), odom_loc.y(), odom_angle), transform.inverse());
 
-            // Proceed with preparing a motion model when meeting threshold
-            if ((odom_translation_change > ODOM_TRANSLATION_THRESHOLD || odom_rotation_change > ODOM_ROTATION_THRESHOLD) && !ready_for_slam_update_) {
+            // Proceed with preparing a motion model when meeting threshold; with adaptive keyframes, scans are
+            // only considered from the lower thresholds on. The reference pose moves once a keyframe is taken.
+            const bool adaptive {SLAM_ADAPTIVE_KEYFRAMES && !localization_only_};
+            const float translation_threshold {static_cast<float>(adaptive ? KEYFRAME_MIN_TRANSLATION : ODOM_TRANSLATION_THRESHOLD)};
+            const float rotation_threshold {static_cast<float>(adaptive ? KEYFRAME_MIN_ROTATION : ODOM_ROTATION_THRESHOLD)};
+            if (odom_translation_change_ > translation_threshold || odom_rotation_change_ > rotation_threshold) {
                 ready_for_slam_update_ = true;
-
-                // Update reference pose
-                reference_odom_pose_.loc = odom_loc;
-                reference_odom_pose_.angle = odom_angle;
-
-                // Reset odom change variables
-                odom_translation_change = 0;
-                odom_rotation_change = 0;
             }
+        } else {
+            tracker_.rebase(odom_loc, odom_angle);
         }
     }
 
@@ -196,19 +213,63 @@ void SLAM::ObserveOdometry(const Vector2f& odom_loc, const float odom_angle) {
     prev_odom_pose_.angle = odom_angle;
 }
 
-std::vector<Eigen::Vector2f> SLAM::GetMap() {
-    std::vector<Eigen::Vector2f> map;
-    // Reconstruct the map as a single aligned point cloud from all saved poses
-    // and their respective scans.
-    for (int i = 0; i < static_cast<int>(chain_.size()); i++) {
-        // transform cloud
-        auto viz_points {chain_[i]->points};
-        transformPoints(viz_points, Pose(chain_[i]->est_pose.x(), chain_[i]->est_pose.y(), chain_[i]->est_pose.theta()));
+std::vector<Eigen::Vector2f> SLAM::GetMap(const std::size_t &max_points) {
+    // The back end keeps the map aligned with the optimized poses, this only reads its latest copy.
+    const auto map {std::atomic_load(&map_points_)};
+    if (map == nullptr) {
+        return std::vector<Eigen::Vector2f>();
+    }
+    return point_map::subsample(*map, max_points);
+}
+
+bool SLAM::SaveMap(const std::string &file) {
+    if (localization_only_) {
+        std::cerr << "ERROR: only a mapping session can be saved" << std::endl;
+        return false;
+    }
 
-        // add to map
-        map.insert(map.end(), viz_points.begin(), viz_points.end());
+    // the back end drains its queue before it stops, so every queued node is optimized before the chain is read
+    stopBackend();
+    syncOptimizedPoses();
+
+    // pruned nodes only repeat the scans of the kept ones
+    std::vector<keyframe_map::Keyframe> keyframes;
+    for (std::size_t i = 0; i < chain_.size(); i++) {
+        if (chain_[i].pruned) {continue;}
+        keyframe_map::Keyframe keyframe;
+        keyframe.x = poses_[i].x();
+        keyframe.y = poses_[i].y();
+        keyframe.theta = poses_[i].theta();
+        keyframe.covariance = chain_[i].rel_cov;
+        keyframe.points = keyframe_map::decimate(keyframes_.points(i), LOOKUP_TABLE_RESOLUTION);
+        keyframes.push_back(std::move(keyframe));
+    }
+    if (!keyframe_map::save(file, keyframes, SLAM_KEYFRAME_RESOLUTION)) {
+        return false;
     }
-    return map;
+    std::cout << "Saved " << keyframes.size() << " keyframes to " << file << std::endl;
+    return true;
+}
+
+bool SLAM::LoadMap(const std::string &file) {
+    std::vector<keyframe_map::Keyframe> keyframes;
+    if (!keyframe_map::load(file, keyframes)) {
+        return false;
+    }
+    map_keyframes_ = std::move(keyframes);
+    map_tables_.clear();
+    map_tables_.resize(map_keyframes_.size());
+    rehydrated_.clear();
+    keyframe_index_.clear();
+    for (std::size_t i = 0; i < map_keyframes_.size(); i++) {
+        const auto &keyframe {map_keyframes_[i]};
+        keyframe_index_.insert(i, keyframe.x, keyframe.y);
+        map_.update(i, keyframe.points, keyframe.x, keyframe.y, keyframe.theta);
+    }
+    std::atomic_store(&map_points_, std::shared_ptr<const std::vector<Eigen::Vector2f>>(std::make_shared<std::vector<Eigen::Vector2f>>(map_.points())));
+    localization_only_ = true;
+    std::cout << "Localizing against " << map_keyframes_.size() << " keyframes from " << file << std::endl;
+    return true;
 }
 
 // -------------------------------------------
@@ -217,59 +278,300 @@ std::vector<Eigen::Vector2f> SLAM::GetMap() {
 
 void SLAM::iterateSLAM(
     Pose &odom,
-    std::vector<Eigen::Vector2f> &cloud)
+    const std::vector<Eigen::Vector2f> &cloud)
 {
-    auto start_time {std::chrono::high_resolution_clock::now()};
-
-    // . add new sequential state
-    auto new_state {std::make_shared<SequentialNode>(chain_.size(), odom, cloud)};
-
-    // compare with previous state and populate pose and covariance
-    if (!chain_.empty()) { // if data immediately before this exists
-        int index {static_cast<int>(chain_.size()) - 1};
+    PROFILE_SCOPE("iterateSLAM");
 
-        // perform the update (results same for sequenial and non-sequential scans, but the way they are stored is different)
-        auto csm_results {pairwiseComparison(new_state, chain_[index])};
+    // bring in whatever the back end has optimized since the last update
+    syncOptimizedPoses();
 
-        // convert relative pose to absolute pose using previous absolute pose
-        new_state->rel_pose = csm_results.first;
-        new_state->rel_cov = csm_results.second;
-        new_state->est_pose = transformPoseCopy(gtsam::Pose2(odom.loc.x(), odom.loc.y(), odom.angle), chain_[static_cast<int>(chain_.size()) - 1]->est_pose);
-        
-        // add to the chain
-        chain_.push_back(new_state);
+    // . add new sequential state, with its scan copied into the keyframe store
+    const bool first {chain_.empty()};
+    const int id {keyframes_.add(cloud)};
+    auto &new_state {chain_.emplace(id, odom, keyframes_.hotPoints(id), !SLAM_SUBMAPS)};
+    ageKeyframes();
 
+    // place the new state from odometry; the scan comparisons below only refine its constraints
+    if (!first) { // if data immediately before this exists
+        new_state.est_pose = transformPoseCopy(gtsam::Pose2(odom.loc.x(), odom.loc.y(), odom.angle), poses_[poses_.size() - 1]);
     } else { // if no previous data in the chain to compare to
-        new_state->rel_pose = gtsam::Pose2(0, 0, 0);
-        new_state->rel_cov = gtsam::Matrix(Eigen::Matrix3d::Zero());
-        new_state->est_pose = transformPoseCopy(gtsam::Pose2(odom.loc.x(), odom.loc.y(), odom.angle), *starting_pose_);
-
-        // add to the chain
-        chain_.push_back(new_state);
+        new_state.rel_pose = gtsam::Pose2(0, 0, 0);
+        new_state.rel_cov = gtsam::Matrix(Eigen::Matrix3d::Zero());
+        new_state.est_pose = transformPoseCopy(gtsam::Pose2(odom.loc.x(), odom.loc.y(), odom.angle), *starting_pose_);
     }
 
-    // . now create all non-sequential states
-    // for each comparison
-    for (int i = 1; i <= depth_; i++) {
-        int index {(static_cast<int>(chain_.size()) - 1) - i - 1};
-        if (index < 0) {continue;}
+    // add to the chain
+    poses_.push_back(new_state.est_pose);
+
+    // . match against the active submap, which already holds the previous state and the ones before it
+    if (SLAM_SUBMAPS) {
+        gtsam::Pose2 submap_pose(0, 0, 0);
+        if (chain_.size() > 1) {
+            // the constraint is the match itself, from where the previous state matched in the same submap
+            auto &submap {submaps_.back()};
+            const auto match {submapComparison(new_state, submap)};
+            submap_pose = match.first;
+            new_state.rel_pose = submap.member_poses.back().between(submap_pose);
+            new_state.rel_cov = match.second;
+
+            // the scan goes into the submap where it matched
+            new_state.est_pose = poses_[submap.anchor] * submap_pose;
+            poses_.back() = new_state.est_pose;
+
+            // . and against the depth_ submaps before it, whose earlier scans tie the state to the graph on their own
+            std::vector<int> indices;
+            for (int i = 1; i <= depth_; i++) {
+                const int index {static_cast<int>(submaps_.size()) - 1 - i};
+                if (index < 0) {break;}
+                indices.push_back(index);
+            }
+            std::vector<rasterization::LookupTable *> tables;
+            for (const int index : indices) {
+                tables.push_back(loopClosureTable(index));
+            }
+            std::vector<std::variant<bool, NonsequentialNode>> constraints(indices.size());
+#ifdef _OPENMP
+            #pragma omp parallel for num_threads(SLAM_NUM_THREADS) schedule(dynamic)
+#endif
+            for (std::size_t k = 0; k < indices.size(); k++) {
+                constraints[k] = submapConstraint(new_state, submaps_[indices[k]].anchor, *tables[k]);
+            }
+            for (const auto &constraint : constraints) {
+                if (std::holds_alternative<NonsequentialNode>(constraint)) {
+                    new_state.nodes.push_back(std::get<NonsequentialNode>(constraint));
+                }
+            }
+        }
+        insertIntoSubmap(new_state, submap_pose);
+    } else {
+        // . compare with the previous state and with depth_ earlier non-sequential states; the comparisons only read
+        // the immutable lookup tables, so they run side by side
+        std::vector<int> indices;
+        for (int i = 0; i <= depth_; i++) {
+            int index {(static_cast<int>(chain_.size()) - 1) - i - 1};
+            if (index < 0) {continue;}
+            indices.push_back(index);
+        }
+
+        std::vector<std::pair<gtsam::Pose2, gtsam::Matrix>> csm_results(indices.size());
+#ifdef _OPENMP
+        #pragma omp parallel for num_threads(SLAM_NUM_THREADS) schedule(dynamic)
+#endif
+        for (std::size_t k = 0; k < indices.size(); k++) {
+            csm_results[k] = pairwiseComparison(new_state, chain_[indices[k]]);
+        }
+
+        for (std::size_t k = 0; k < indices.size(); k++) {
+            const int index {indices[k]};
 
-        // get pose and covariance
-        auto csm_results {pairwiseComparison(new_state, chain_[index])};
+            // the sequential comparison gives the relative pose and covariance of the new state itself
+            if (index == static_cast<int>(chain_.size()) - 2) {
+                new_state.rel_pose = csm_results[k].first;
+                new_state.rel_cov = csm_results[k].second;
+                continue;
+            }
 
-        // store them appropriately
-        NonsequentialNode node;
-        node.parent = chain_[index]->id;
-        node.rel_odom = transformPoseCopy(odom, chain_[index]->rel_odom);
-        node.rel_pose = csm_results.first;
-        node.rel_cov = csm_results.second;
-        node.est_pose = transformPoseCopy(csm_results.first, chain_[index]->est_pose);
-        new_state->nodes.push_back(node);
+            // store them appropriately
+            NonsequentialNode node;
+            node.parent = chain_[index].id;
+            node.rel_odom = transformPoseCopy(odom, chain_[index].rel_odom);
+            node.rel_pose = csm_results[k].first;
+            node.rel_cov = csm_results[k].second;
+            node.est_pose = transformPoseCopy(csm_results[k].first, poses_[index]);
+            new_state.nodes.push_back(node);
+        }
     }
 
     // . check for loops
     detectLoops(new_state);
 
+    // . hand the node over to the back end for optimization and map assembly
+    if (async_backend_) {
+        queueNode(&new_state);
+    } else {
+        updateBackend(&new_state);
+    }
+}
+
+double SLAM::keyframeOverlap(
+    const Pose &odom,
+    const span::Span<Eigen::Vector2f> &cloud)
+{
+    PROFILE_SCOPE("keyframeOverlap");
+
+    // . the table the next scan would be matched against, and the pose odometry predicts for the scan in its frame
+    const gtsam::Pose2 odom_pose(odom.loc.x(), odom.loc.y(), odom.angle);
+    rasterization::LookupTable *table;
+    gtsam::Pose2 pose;
+    if (SLAM_SUBMAPS) {
+        table = submaps_.back().lookup_table.get();
+        pose = poses_[submaps_.back().anchor].between(poses_.back()) * odom_pose;
+    } else {
+        table = chain_[chain_.size() - 1].lookup_table.get();
+        pose = odom_pose;
+    }
+    if (table == nullptr) {return 0.d;}
+
+    // . every KEYFRAME_OVERLAP_STRIDE-th point, scored on a max-pooled level of the table so odometry drift of up to
+    // half its cells still finds the walls it saw; cells hold likelihoods up to 1
+    const int level {std::min(KEYFRAME_OVERLAP_LEVEL, table->maxPooledLevel())};
+    const Eigen::Rotation2Df rotation(pose.theta());
+    const Eigen::Vector2f translation(pose.x(), pose.y());
+    overlap_slice_.x.clear();
+    overlap_slice_.y.clear();
+    for (std::size_t k = 0; k < cloud.size(); k += KEYFRAME_OVERLAP_STRIDE) {
+        const auto grid {table->gridCoordinates(rotation * cloud[k] + translation)};
+        overlap_slice_.x.push_back(grid.x());
+        overlap_slice_.y.push_back(grid.y());
+    }
+    if (overlap_slice_.x.empty()) {return 0.d;}
+    const double sum {level > 0
+        ? table->sumUpperBound(overlap_slice_.x, overlap_slice_.y, Eigen::Vector2f::Constant(-(1 << (level - 1))), level)
+        : table->sumShifted(overlap_slice_.x, overlap_slice_.y, Eigen::Vector2f::Zero())};
+    return sum / overlap_slice_.x.size();
+}
+
+void SLAM::localize(
+    const Pose &odom,
+    const std::vector<Eigen::Vector2f> &cloud)
+{
+    PROFILE_SCOPE("localize");
+    const auto predicted {localized_pose_ * gtsam::Pose2(odom.loc.x(), odom.loc.y(), odom.angle)};
+
+    // . the nearest keyframes; away from the map the pose follows odometry
+    std::vector<std::pair<int, double>> neighbours;
+    keyframe_index_.query(predicted.x(), predicted.y(), LOCALIZATION_KEYFRAME_RADIUS, neighbours);
+    std::sort(neighbours.begin(), neighbours.end(), [](const std::pair<int, double> &a, const std::pair<int, double> &b) {
+        return a.second < b.second;
+    });
+    if (neighbours.size() > LOCALIZATION_KEYFRAMES) {
+        neighbours.resize(LOCALIZATION_KEYFRAMES);
+    }
+    localized_pose_ = predicted;
+    if (neighbours.empty()) {return;}
+
+    // . tables are built the first time a keyframe is matched against, and the oldest ones dropped
+    for (const auto &neighbour : neighbours) {
+        auto &table {map_tables_[neighbour.first]};
+        if (table == nullptr) {
+            table = std::make_unique<rasterization::LookupTable>(map_keyframes_[neighbour.first].points, LOOKUP_TABLE_RESOLUTION, LOOKUP_TABLE_SIGMA);
+            rehydrated_.push_back(neighbour.first);
+        }
+    }
+    while (rehydrated_.size() > std::max<std::size_t>(SLAM_KEYFRAME_TABLE_CACHE, LOCALIZATION_KEYFRAMES)) {
+        map_tables_[rehydrated_.front()].reset();
+        rehydrated_.pop_front();
+    }
+
+    // . match the scan against each keyframe side by side, from the pose odometry predicts in its frame
+    const std::vector<double> odom_mag{std::abs(odom.loc.x()), std::abs(odom.loc.y()), std::abs(odom.angle)};
+    std::vector<std::pair<double, gtsam::Pose2>> matches(neighbours.size(), std::make_pair(-1.d, predicted));
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(SLAM_NUM_THREADS) schedule(dynamic)
+#endif
+    for (std::size_t k = 0; k < neighbours.size(); k++) {
+        const auto &keyframe {map_keyframes_[neighbours[k].first]};
+        const gtsam::Pose2 keyframe_pose(keyframe.x, keyframe.y, keyframe.theta);
+        const auto relative {keyframe_pose.between(predicted)};
+        const Pose rel_odom(relative.x(), relative.y(), relative.theta());
+        auto motion_model {motion_model::MultivariateMotionModel(Eigen::Vector3d(rel_odom.loc.x(), rel_odom.loc.y(), rel_odom.angle), Eigen::Vector3d(odom_mag[0], odom_mag[1], odom_mag[2]))};
+        const auto candidates {searchCandidates(rel_odom, odom_mag, cloud, *map_tables_[neighbours[k].first], motion_model)};
+        if (std::holds_alternative<bool>(candidates.covariance())) {continue;}
+        const auto &best {candidates.best.relative_pose};
+        matches[k] = std::make_pair(candidates.best.p, keyframe_pose * gtsam::Pose2(best.loc.x(), best.loc.y(), best.angle));
+    }
+
+    // . the best of the matches that succeeded
+    double best {-1.d};
+    for (const auto &match : matches) {
+        if (match.first > best) {
+            best = match.first;
+            localized_pose_ = match.second;
+        }
+    }
+}
+
+void SLAM::syncOptimizedPoses()
+{
+    // GetPose syncs at odometry rate, mostly with nothing new
+    const auto optimized {std::atomic_load(&optimized_poses_)};
+    if (optimized == synced_poses_ && poses_.size() == synced_size_) {return;}
+    synced_poses_ = optimized;
+    synced_size_ = poses_.size();
+    const std::size_t n_optimized {optimized == nullptr ? 0 : std::min(optimized->size(), poses_.size())};
+    for (std::size_t i = 0; i < n_optimized; i++) {
+        poses_[i] = (*optimized)[i];
+    }
+
+    // nodes still waiting for the back end follow the newest optimized one by odometry
+    for (std::size_t i = std::max<std::size_t>(n_optimized, 1); i < poses_.size(); i++) {
+        const auto &rel_odom {chain_[i].rel_odom};
+        poses_[i] = transformPoseCopy(gtsam::Pose2(rel_odom.loc.x(), rel_odom.loc.y(), rel_odom.angle), poses_[i - 1]);
+    }
+}
+
+// -------------------------------------------
+// * Back End
+// -------------------------------------------
+
+void SLAM::OptimizeSynchronously()
+{
+    stopBackend();
+    async_backend_ = false;
+}
+
+void SLAM::startBackend()
+{
+    std::lock_guard<std::mutex> lock(backend_mutex_);
+    if (backend_running_) {return;}
+    backend_running_ = true;
+    backend_ = std::thread(&SLAM::runBackend, this);
+}
+
+void SLAM::queueNode(SequentialNode *node)
+{
+    startBackend();
+
+    // the front end waits for room when it gets too far ahead of the back end
+    std::unique_lock<std::mutex> lock(backend_mutex_);
+    backend_cv_.wait(lock, [this]() {return node_queue_.size() < SLAM_BACKEND_QUEUE_SIZE;});
+    node_queue_.push_back(node);
+    backend_cv_.notify_all();
+}
+
+void SLAM::stopBackend()
+{
+    {
+        std::lock_guard<std::mutex> lock(backend_mutex_);
+        backend_running_ = false;
+    }
+    backend_cv_.notify_all();
+    if (backend_.joinable()) {
+        backend_.join();
+    }
+}
+
+void SLAM::runBackend()
+{
+    // a stopped back end still optimizes the nodes left in its queue before it returns
+    std::unique_lock<std::mutex> lock(backend_mutex_);
+    while (true) {
+        backend_cv_.wait(lock, [this]() {return !backend_running_ || !node_queue_.empty();});
+        if (node_queue_.empty()) {break;}
+        SequentialNode *node {node_queue_.front()};
+        node_queue_.pop_front();
+        backend_cv_.notify_all();
+        lock.unlock();
+        updateBackend(node);
+        lock.lock();
+    }
+}
+
+void SLAM::updateBackend(SequentialNode *node)
+{
+    PROFILE_SCOPE("updateBackend");
+    graph_chain_.push_back(node);
+
     // . perform pose graph optimization using GTSAM
     gtsam_timer_++;
     if (gtsam_timer_ == GTSAM_FREQUENCY) {
@@ -277,50 +579,78 @@ void SLAM::iterateSLAM(
         gtsam_timer_ = 0;
     }
 
+    // . merge the nodes that only repeat what kept ones already cover, so the graph grows with the area explored
+    if (POSE_GRAPH_PRUNING) {
+        pruneChain();
+    }
+
+    // . hand the optimized poses back to the front end
+    auto poses {std::make_shared<std::vector<gtsam::Pose2>>()};
+    poses->reserve(graph_chain_.size());
+    for (const auto &n : graph_chain_) {
+        poses->push_back(n->est_pose);
+    }
+    std::atomic_store(&optimized_poses_, std::shared_ptr<const std::vector<gtsam::Pose2>>(poses));
+
+    // . move the scans of the nodes that optimization shifted, and hand the map points to GetMap if anything changed
+    bool map_changed {};
+    for (const auto &n : graph_chain_) {
+        if (n->pruned) {
+            map_changed |= map_.erase(n->id);
+            continue;
+        }
+        if (map_.moved(n->id, n->est_pose.x(), n->est_pose.y(), n->est_pose.theta())) {
+            map_changed |= map_.update(n->id, keyframes_.points(n->id), n->est_pose.x(), n->est_pose.y(), n->est_pose.theta());
+        }
+    }
+    if (map_changed) {
+        std::atomic_store(&map_points_, std::shared_ptr<const std::vector<Eigen::Vector2f>>(std::make_shared<std::vector<Eigen::Vector2f>>(map_.points())));
+    }
+
+    publishVisualization(*node);
+}
+
+void SLAM::publishVisualization(const SequentialNode &new_state)
+{
+    // the map itself is a persistent layer of the node, this only draws the graph, and not for every new state
+    if (!visualization_.Due(vis_msg_.ns)) {
+        return;
+    }
+
     // . now add visualization stuff here for debugging
     visualization::ClearVisualizationMsg(vis_msg_);
 
-    for (int i = 0; i < static_cast<int>(chain_.size()); i++) {
-        // transform cloud
-        auto viz_points {chain_[i]->points};
-        transformPoints(viz_points, Pose(chain_[i]->est_pose.x(), chain_[i]->est_pose.y(), chain_[i]->est_pose.theta()));
+    for (int i = 0; i < static_cast<int>(graph_chain_.size()); i++) {
+        if (graph_chain_[i]->pruned) {continue;}
 
-        // visualize cloud
-        for (const auto &point : viz_points) {
-            visualization::DrawPoint(point, 0xC0C0C0, vis_msg_);
-        }
-        
         // visualize pose
-        visualization::DrawParticle(Eigen::Vector2f(chain_[i]->est_pose.x(), chain_[i]->est_pose.y()), chain_[i]->est_pose.theta(), vis_msg_);
+        visualization::DrawParticle(Eigen::Vector2f(graph_chain_[i]->est_pose.x(), graph_chain_[i]->est_pose.y()), graph_chain_[i]->est_pose.theta(), vis_msg_);
 
         // and visualize all non-sequential ones to make sure they're in the right spot
-        for (const auto &node : chain_[i]->nodes) {
+        for (const auto &node : graph_chain_[i]->nodes) {
             visualization::DrawParticle(Eigen::Vector2f(node.est_pose.x(), node.est_pose.y()), node.est_pose.theta(), vis_msg_);
             
             // draw lines between non-sequential poses
-            visualization::DrawLine(Eigen::Vector2f(chain_[node.parent]->est_pose.x(), chain_[node.parent]->est_pose.y()), Eigen::Vector2f(chain_[i]->est_pose.x(), chain_[i]->est_pose.y()), 0xF633FF, vis_msg_);
+            visualization::DrawLine(Eigen::Vector2f(graph_chain_[node.parent]->est_pose.x(), graph_chain_[node.parent]->est_pose.y()), Eigen::Vector2f(graph_chain_[i]->est_pose.x(), graph_chain_[i]->est_pose.y()), 0xF633FF, vis_msg_);
         }
     }
 
     // draw lines between all sequential poses
-    for (int i = 1; i < static_cast<int>(chain_.size()); i++) {
-        visualization::DrawLine(Eigen::Vector2f(chain_[i - 1]->est_pose.x(), chain_[i - 1]->est_pose.y()), Eigen::Vector2f(chain_[i]->est_pose.x(), chain_[i]->est_pose.y()), 0xF633FF, vis_msg_);
+    for (int i = 1; i < static_cast<int>(graph_chain_.size()); i++) {
+        if (graph_chain_[i]->pruned) {continue;}
+        const auto &previous {graph_chain_[graph_chain_[i]->previous]->est_pose};
+        visualization::DrawLine(Eigen::Vector2f(previous.x(), previous.y()), Eigen::Vector2f(graph_chain_[i]->est_pose.x(), graph_chain_[i]->est_pose.y()), 0xF633FF, vis_msg_);
     }
 
     // visualize the selected cloud from CSM
-    auto viz_points {new_state->points};
-    transformPoints(viz_points, Pose(new_state->est_pose.x(), new_state->est_pose.y(), new_state->est_pose.theta()));
+    auto viz_points {keyframes_.points(new_state.id)};
+    transformPoints(viz_points, Pose(new_state.est_pose.x(), new_state.est_pose.y(), new_state.est_pose.theta()));
     for (const auto &point : viz_points) {
         visualization::DrawPoint(point, 0x33FF4A, vis_msg_);
     }
 
     vis_msg_.header.stamp = ros::Time::now();
-    vis_pub_.publish(vis_msg_);
-
-    auto end_time {std::chrono::high_resolution_clock::now()};
-    auto time_duration {std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time)};
-    std::cout << ">> Finished SLAM update " << iteration_counter_ << " in " << time_duration.count() << "ms" << std::endl;
-    iteration_counter_++;
+    visualization_.Publish(vis_msg_);
 }
 
 // -------------------------------------------
@@ -329,16 +659,23 @@ void SLAM::iterateSLAM(
 
 void SLAM::optimizeChain()
 {
+    PROFILE_SCOPE("optimizeChain");
+    kept_index_stale_ = true;
+    if (GTSAM_INCREMENTAL) {
+        optimizeIncremental();
+        return;
+    }
+
     bool updateComplete {};
     while (!updateComplete) {
         updateComplete = iterateGTSAM();
         if (!updateComplete) {
-            if (chain_[chain_.size() - 1]->nodes.size() > 0) {
+            if (graph_chain_[graph_chain_.size() - 1]->nodes.size() > 0) {
                 std::cerr << "\tGTSAM returned unstable results; removing some newly added data and rerunning..." << std::endl;
-                chain_[chain_.size() - 1]->nodes.pop_back();
+                graph_chain_[graph_chain_.size() - 1]->nodes.pop_back();
             } else {
                 std::cerr << "\tALL results added in last pose update are incompatible with GTSAM. This is a critical error with unhandled behavior that should never arise.Investigate further." << std::endl;
-                chain_.pop_back();
+                useOdometryConstraint(*graph_chain_[graph_chain_.size() - 1]);
                 updateComplete = true;
             }
         }
@@ -357,29 +694,34 @@ bool SLAM::iterateGTSAM()
 
     auto priorNoise = gtsam::noiseModel::Diagonal::Sigmas(gtsam::Vector3(0.1, 0.1, 0.03));
     graph.addPrior(0, gtsam::Pose2(0, 0, 0), priorNoise);
-    initial_estimate.insert(graph_id, chain_[0]->est_pose);
+    initial_estimate.insert(graph_id, graph_chain_[0]->est_pose);
 
-    // start by adding sequential poses to graph
-    for (std::size_t i = 1; i < chain_.size(); i++) {
+    // start by adding sequential poses to graph; keys stay the chain indices, pruned nodes are left out
+    for (std::size_t i = 1; i < graph_chain_.size(); i++) {
         graph_id++;
+        if (graph_chain_[i]->pruned) {continue;}
         graph.add(gtsam::BetweenFactor<gtsam::Pose2>(
-            graph_id - 1,
+            graph_chain_[i]->previous,
             graph_id,
-            chain_[i]->rel_pose,
-            gtsam::noiseModel::Gaussian::Covariance(chain_[i]->rel_cov)
+            graph_chain_[i]->rel_pose,
+            gtsam::noiseModel::Gaussian::Covariance(graph_chain_[i]->rel_cov)
         ));
-        initial_estimate.insert(graph_id, chain_[i]->est_pose);
+        initial_estimate.insert(graph_id, graph_chain_[i]->est_pose);
     }
 
     // now add in the non-sequential poses
-    for (const auto &node : chain_) {
+    for (const auto &node : graph_chain_) {
         for (const auto &n : node->nodes) {
             graph_id++;
+            int parent {n.parent};
+            gtsam::Pose2 rel_pose {n.rel_pose};
+            gtsam::Matrix rel_cov {n.rel_cov};
+            keptConstraint(parent, rel_pose, rel_cov);
             graph.add(gtsam::BetweenFactor<gtsam::Pose2>(
-                n.parent,
+                parent,
                 graph_id,
-                n.rel_pose,
-                gtsam::noiseModel::Gaussian::Covariance(n.rel_cov)
+                rel_pose,
+                gtsam::noiseModel::Gaussian::Covariance(rel_cov)
             ));
             initial_estimate.insert(graph_id, n.est_pose);
         }
@@ -404,10 +746,11 @@ bool SLAM::iterateGTSAM()
     };
     
     int verification_graph_id {0};
-    for (std::size_t i = 1; i < chain_.size(); i++) {
+    for (std::size_t i = 1; i < graph_chain_.size(); i++) {
         verification_graph_id++;
-        auto comp_pose = transformPoseCopy(optimized_result.at<gtsam::Pose2>(verification_graph_id), chain_[0]->est_pose);
-        if (!checkDistance(chain_[i]->est_pose, comp_pose)) {
+        if (graph_chain_[i]->pruned) {continue;}
+        auto comp_pose = transformPoseCopy(optimized_result.at<gtsam::Pose2>(verification_graph_id), graph_chain_[0]->est_pose);
+        if (!checkDistance(graph_chain_[i]->est_pose, comp_pose)) {
             // std::cout << "Distance between two poses exceeds threshold! GTSAM results will be ignored..." << std::endl;
             return false;
         }
@@ -415,163 +758,531 @@ bool SLAM::iterateGTSAM()
 
     // iterate over the data and update it
     int new_graph_id {0};
-    for (std::size_t i = 1; i < chain_.size(); i++) {
+    for (std::size_t i = 1; i < graph_chain_.size(); i++) {
         new_graph_id++;
-        chain_[i]->est_pose = transformPoseCopy(optimized_result.at<gtsam::Pose2>(new_graph_id), chain_[0]->est_pose);
+        auto &node {*graph_chain_[i]};
+        if (node.pruned) {
+            node.est_pose = graph_chain_[node.previous]->est_pose * node.rel_pose;
+        } else {
+            node.est_pose = transformPoseCopy(optimized_result.at<gtsam::Pose2>(new_graph_id), graph_chain_[0]->est_pose);
+        }
     }
 
-    for (auto &node : chain_) {
+    for (auto &node : graph_chain_) {
         for (auto &n : node->nodes) {
             new_graph_id++;
-            n.est_pose = transformPoseCopy(optimized_result.at<gtsam::Pose2>(new_graph_id), chain_[0]->est_pose);
+            n.est_pose = transformPoseCopy(optimized_result.at<gtsam::Pose2>(new_graph_id), graph_chain_[0]->est_pose);
         }
     }
 
     return true;
 }
 
-// -------------------------------------------
-// * Detect Loops
-// -------------------------------------------
+void SLAM::resetIncremental()
+{
+    gtsam::ISAM2Params parameters;
+    parameters.relinearizeThreshold = 0.01;
+    parameters.relinearizeSkip = 1;
+    isam_ = std::make_unique<gtsam::ISAM2>(parameters);
+    isam_nodes_ = 0;
+    isam_nonsequential_keys_ = 0;
+}
 
-void SLAM::detectLoops(std::shared_ptr<SequentialNode> &state)
+void SLAM::addNodeFactors(
+    std::size_t index,
+    gtsam::NonlinearFactorGraph &graph,
+    gtsam::Values &initial_estimate,
+    std::vector<int> &nonsequential_ids)
 {
-    const double loop_closure_radius {1.0};
-    const int ignore_depth {POSE_GRAPH_CONNECTION_DEPTH};
-    const int max_loop_closure_constraints {2};
-    int constraint_counter {};
+    // same graph as iterateGTSAM, anchored at the first node with estimates expressed in its frame
+    const auto &origin {graph_chain_[0]->est_pose};
+    const auto &node {graph_chain_[index]};
+    if (node->pruned) {return;}
+    if (index == 0) {
+        auto priorNoise = gtsam::noiseModel::Diagonal::Sigmas(gtsam::Vector3(0.1, 0.1, 0.03));
+        graph.addPrior(gtsam::Symbol('x', 0), gtsam::Pose2(0, 0, 0), priorNoise);
+        nonsequential_ids.push_back(-1);
+    } else {
+        graph.add(gtsam::BetweenFactor<gtsam::Pose2>(
+            gtsam::Symbol('x', node->previous),
+            gtsam::Symbol('x', index),
+            node->rel_pose,
+            gtsam::noiseModel::Gaussian::Covariance(node->rel_cov)
+        ));
+        nonsequential_ids.push_back(-1);
+    }
+    initial_estimate.insert(gtsam::Symbol('x', index), origin.between(node->est_pose));
+
+    for (auto &n : node->nodes) {
+        n.graph_id = isam_nonsequential_keys_++;
+        int parent {n.parent};
+        gtsam::Pose2 rel_pose {n.rel_pose};
+        gtsam::Matrix rel_cov {n.rel_cov};
+        keptConstraint(parent, rel_pose, rel_cov);
+        graph.add(gtsam::BetweenFactor<gtsam::Pose2>(
+            gtsam::Symbol('x', parent),
+            gtsam::Symbol('n', n.graph_id),
+            rel_pose,
+            gtsam::noiseModel::Gaussian::Covariance(rel_cov)
+        ));
+        initial_estimate.insert(gtsam::Symbol('n', n.graph_id), origin.between(n.est_pose));
+        nonsequential_ids.push_back(n.graph_id);
+    }
+}
 
-    // search around abs location for other data close to
-    if (!(chain_.size() > 1 + ignore_depth)) {return;}
+void SLAM::optimizeIncremental()
+{
+    if (isam_ == nullptr) {
+        resetIncremental();
+    }
 
-    auto computeDisplacement = [](const SequentialNode &state1, const SequentialNode &state2)
-    {
-        return sqrt(pow(state1.est_pose.x() - state2.est_pose.x(), 2) + pow(state1.est_pose.y() - state2.est_pose.y(), 2));
-    };
+    // . only the factors of nodes added since the last update go into the solver
+    gtsam::NonlinearFactorGraph graph;
+    gtsam::Values initial_estimate;
+    std::vector<int> nonsequential_ids;
+    for (std::size_t i = isam_nodes_; i < graph_chain_.size(); i++) {
+        addNodeFactors(i, graph, initial_estimate, nonsequential_ids);
+    }
+    const auto result {isam_->update(graph, initial_estimate)};
+
+    // . the factors went in as addNodeFactors added them, the indices are kept so pruning can remove them in place
+    std::size_t added {};
+    for (std::size_t i = isam_nodes_; i < graph_chain_.size(); i++) {
+        auto &node {*graph_chain_[i]};
+        if (node.pruned) {continue;}
+        node.factor = result.newFactorsIndices[added++];
+        for (auto &n : node.nodes) {
+            n.factor = result.newFactorsIndices[added++];
+        }
+    }
+    isam_nodes_ = graph_chain_.size();
+
+    // . check the results of the optimization to make sure they aren't crazy; constraints of the newest node are
+    // removed, last first, until they are
+    while (!applyEstimate(isam_->calculateEstimate())) {
+        auto &last {graph_chain_[graph_chain_.size() - 1]};
+        if (last->nodes.empty()) {
+            std::cerr << "\tALL results added in last pose update are incompatible with GTSAM. This is a critical error with unhandled behavior that should never arise.Investigate further." << std::endl;
+            useOdometryConstraint(*last);
+            resetIncremental();
+            return;
+        }
 
-    for (std::size_t i = 0; i < chain_.size() - 1 - ignore_depth; i++) {
-        // make sure we don't add too many constraints (just to make sure this doesn't decrease performance too much)
-        if (constraint_counter >= max_loop_closure_constraints) {
+        std::cerr << "\tGTSAM returned unstable results; removing some newly added data and rerunning..." << std::endl;
+        const auto &n {last->nodes.back()};
+        const auto factor {std::find(nonsequential_ids.begin(), nonsequential_ids.end(), n.graph_id)};
+        if (factor == nonsequential_ids.end()) {
+            // only the latest update's factors can be removed in place
+            last->nodes.pop_back();
+            resetIncremental();
+            optimizeIncremental();
             return;
         }
 
-        // check if the displacement is sufficiently close
-        if (!(computeDisplacement(*state, *chain_[i]) < loop_closure_radius)) {
+        // the constraint's variable is only tied to the graph by the removed factor, so a prior holds it where it is
+        gtsam::NonlinearFactorGraph replacement;
+        replacement.addPrior(gtsam::Symbol('n', n.graph_id), graph_chain_[0]->est_pose.between(n.est_pose), gtsam::noiseModel::Gaussian::Covariance(n.rel_cov));
+        isam_->update(replacement, gtsam::Values(), gtsam::FactorIndices{result.newFactorsIndices[factor - nonsequential_ids.begin()]});
+        *factor = -1;
+        last->nodes.pop_back();
+    }
+}
+
+bool SLAM::applyEstimate(const gtsam::Values &estimate)
+{
+    // check the results of the optimization to make sure they aren't crazy, don't update the estimates if so
+    auto checkDistance = [](gtsam::Pose2 p1, gtsam::Pose2 p2) {
+        float dist_sqrd_tolerance {10.0};
+        auto dist_sqrd {pow(p1.x() - p2.x(), 2) + pow(p1.y() - p2.y(), 2)};
+        return !(dist_sqrd > dist_sqrd_tolerance);
+    };
+
+    const auto origin {graph_chain_[0]->est_pose};
+    for (std::size_t i = 1; i < graph_chain_.size(); i++) {
+        if (graph_chain_[i]->pruned) {continue;}
+        if (!checkDistance(graph_chain_[i]->est_pose, origin * estimate.at<gtsam::Pose2>(gtsam::Symbol('x', i)))) {
+            return false;
+        }
+    }
+
+    // iterate over the data and update it; pruned nodes follow the kept node before them
+    for (std::size_t i = 1; i < graph_chain_.size(); i++) {
+        auto &node {*graph_chain_[i]};
+        if (node.pruned) {
+            node.est_pose = graph_chain_[node.previous]->est_pose * node.rel_pose;
+        } else {
+            node.est_pose = origin * estimate.at<gtsam::Pose2>(gtsam::Symbol('x', i));
+        }
+    }
+    for (auto &node : graph_chain_) {
+        for (auto &n : node->nodes) {
+            n.est_pose = origin * estimate.at<gtsam::Pose2>(gtsam::Symbol('n', n.graph_id));
+        }
+    }
+    return true;
+}
+
+void SLAM::useOdometryConstraint(SequentialNode &node)
+{
+    // the front end has already built on every node it queued, so a node is never dropped from the graph; its
+    // constraints fall back to odometry instead and the estimates are left as they were for this update
+    const auto &odom {node.rel_odom};
+    auto motion_model {motion_model::MultivariateMotionModel(Eigen::Vector3d(odom.loc.x(), odom.loc.y(), odom.angle), Eigen::Vector3d(std::abs(odom.loc.x()), std::abs(odom.loc.y()), std::abs(odom.angle)))};
+    node.rel_pose = gtsam::Pose2(odom.loc.x(), odom.loc.y(), odom.angle);
+    node.rel_cov = gtsam::Matrix(motion_model.get_covariance());
+    node.nodes.clear();
+}
+
+// -------------------------------------------
+// * Pose Graph Pruning
+// -------------------------------------------
+
+// first order covariance of a * b, in the tangent space of the composition, from the covariances of a and of b
+static gtsam::Matrix composedCovariance(const gtsam::Matrix &a_cov, const gtsam::Pose2 &b, const gtsam::Matrix &b_cov)
+{
+    const gtsam::Matrix adjoint {b.inverse().AdjointMap()};
+    return adjoint * a_cov * adjoint.transpose() + b_cov;
+}
+
+void SLAM::pruneChain()
+{
+    PROFILE_SCOPE("pruneChain");
+
+    // . nodes are decided a batch at a time, once POSE_GRAPH_PRUNING_DELAY newer ones follow them so the front end is
+    // done matching them in sequence. A kept node stays kept, so a pruned node always follows a kept one.
+    if (graph_chain_.size() < pruning_decided_ + POSE_GRAPH_PRUNING_DELAY + POSE_GRAPH_PRUNING_BATCH) {return;}
+    if (kept_index_stale_) {
+        kept_index_.clear();
+        for (const int &id : kept_) {
+            kept_index_.insert(id, graph_chain_[id]->est_pose.x(), graph_chain_[id]->est_pose.y());
+        }
+        kept_index_stale_ = false;
+    }
+    const std::size_t first {pruning_decided_};
+    gtsam::FactorIndices removed;
+    for (int decided = 0; decided < POSE_GRAPH_PRUNING_BATCH; decided++) {
+        auto &node {*graph_chain_[pruning_decided_++]};
+        if (node.id == 0 || !redundant(node)) {
+            kept_.push_back(node.id);
+            kept_index_.insert(node.id, node.est_pose.x(), node.est_pose.y());
             continue;
         }
 
-        // generate candidates
-        // get diff WRT to frame of comparison pose
-        Eigen::Matrix3f transform;
-        transform << cos(chain_[i]->est_pose.theta()), -sin(chain_[i]->est_pose.theta()), chain_[i]->est_pose.x(),
-                        sin(chain_[i]->est_pose.theta()), cos(chain_[i]->est_pose.theta()), chain_[i]->est_pose.y(),
-                        0, 0, 1;
-        auto rel_odom {transformPoseCopy(Pose(state->est_pose.x(), state->est_pose.y(), state->est_pose.theta()), transform.inverse())};
-
-        // compare scans
-        // check if nodes are not sequential; if not, need to compute the relative odometry
-        std::vector<double> odom_mag{std::abs(state->rel_odom.loc.x()), std::abs(state->rel_odom.loc.y()), std::abs(state->rel_odom.angle)};
-        
-        // handle cases when nodes are not immediately sequential
-        if (state->id != chain_[i]->id + 1) {
-            Pose rel_pose(0, 0, 0);
-
-            for (int i = 0; i < state->id - chain_[i]->id - 1; i++) {
-                transformPose(rel_pose, chain_[chain_[i]->id + i]->rel_odom);
-                odom_mag[0] += std::abs(chain_[chain_[i]->id + i]->rel_odom.loc.x());
-                odom_mag[1] += std::abs(chain_[chain_[i]->id + i]->rel_odom.loc.y());
-                odom_mag[2] += std::abs(chain_[chain_[i]->id + i]->rel_odom.angle);
+        // . a node already in the solver takes its factors with it
+        if (GTSAM_INCREMENTAL && static_cast<std::size_t>(node.id) < isam_nodes_) {
+            removed.push_back(node.factor);
+            for (const auto &n : node.nodes) {
+                removed.push_back(n.factor);
             }
+        }
+
+        // . the sequential constraint of the next node is composed with the node's own, so it now starts at the kept
+        // node this one follows; the node's other constraints end in variables only they are tied to, and go with it
+        auto &next {*graph_chain_[node.id + 1]};
+        next.rel_cov = composedCovariance(node.rel_cov, next.rel_pose, next.rel_cov);
+        next.rel_pose = node.rel_pose * next.rel_pose;
+        next.previous = node.previous;
+        node.nodes.clear();
+        node.pruned = true;
+    }
+
+    // . constraints from a pruned node are composed onto the kept one as the factors are added (keptConstraint); the
+    // ones the solver already holds are swapped in place
+    if (!removed.empty()) {
+        removePrunedFactors(first, removed);
+    }
+}
+
+void SLAM::removePrunedFactors(const std::size_t &first, gtsam::FactorIndices &removed)
+{
+    PROFILE_SCOPE("removePrunedFactors");
+    const auto pruned_now = [this, &first](const int &id) {
+        return static_cast<std::size_t>(id) >= first && static_cast<std::size_t>(id) < pruning_decided_ && graph_chain_[id]->pruned;
+    };
+
+    // . the factors still tied to a node of the batch are the sequential one of the kept node after it, and those of
+    // newer nodes matched against it; only nodes up to POSE_GRAPH_PRUNING_DELAY past the batch can hold them, and both
+    // go in again from the kept node before
+    gtsam::NonlinearFactorGraph replacement;
+    std::vector<gtsam::FactorIndex *> replaced;
+    for (std::size_t i = first + 1; i < isam_nodes_; i++) {
+        auto &node {*graph_chain_[i]};
+        if (node.pruned) {continue;}
+        if (pruned_now(i - 1)) {
+            removed.push_back(node.factor);
+            replacement.add(gtsam::BetweenFactor<gtsam::Pose2>(
+                gtsam::Symbol('x', node.previous),
+                gtsam::Symbol('x', i),
+                node.rel_pose,
+                gtsam::noiseModel::Gaussian::Covariance(node.rel_cov)
+            ));
+            replaced.push_back(&node.factor);
+        }
+        for (auto &n : node.nodes) {
+            if (!pruned_now(n.parent)) {continue;}
+            removed.push_back(n.factor);
+            int parent {n.parent};
+            gtsam::Pose2 rel_pose {n.rel_pose};
+            gtsam::Matrix rel_cov {n.rel_cov};
+            keptConstraint(parent, rel_pose, rel_cov);
+            replacement.add(gtsam::BetweenFactor<gtsam::Pose2>(
+                gtsam::Symbol('x', parent),
+                gtsam::Symbol('n', n.graph_id),
+                rel_pose,
+                gtsam::noiseModel::Gaussian::Covariance(rel_cov)
+            ));
+            replaced.push_back(&n.factor);
+        }
+    }
+
+    // . the pruned variables are left without factors, so the solver drops them along with the removed factors
+    const auto result {isam_->update(replacement, gtsam::Values(), removed)};
+    for (std::size_t k = 0; k < replaced.size(); k++) {
+        *replaced[k] = result.newFactorsIndices[k];
+    }
+}
 
-            // transformPose(rel_pose, state->rel_odom);
-            // rel_odom = rel_pose;
+bool SLAM::redundant(const SequentialNode &node) const
+{
+    // a kept node in about the same pose whose scan looks alike already holds what the node adds to the map and graph
+    std::vector<std::pair<int, double>> nearby;
+    kept_index_.query(node.est_pose.x(), node.est_pose.y(), POSE_GRAPH_PRUNING_RADIUS, nearby);
+    for (const auto &candidate : nearby) {
+        const auto &kept {*graph_chain_[candidate.first]};
+        if (std::abs(kept.est_pose.between(node.est_pose).theta()) > POSE_GRAPH_PRUNING_ROTATION) {continue;}
+        if (node.descriptor.distance(kept.descriptor) <= POSE_GRAPH_PRUNING_DISTANCE) {
+            return true;
         }
+    }
+    return false;
+}
 
-        odom_mag = std::vector<double>{2, 2, 1.5};
+void SLAM::keptConstraint(int &parent, gtsam::Pose2 &rel_pose, gtsam::Matrix &rel_cov) const
+{
+    // a constraint from a pruned node starts at the kept node its pose follows instead
+    const auto &node {*graph_chain_[parent]};
+    if (!node.pruned) {return;}
+    rel_cov = composedCovariance(node.rel_cov, rel_pose, rel_cov);
+    rel_pose = node.rel_pose * rel_pose;
+    parent = node.previous;
+}
 
-        // auto points {state->points};
-        // transformPoints(points, rel_odom);
+// -------------------------------------------
+// * Detect Loops
+// -------------------------------------------
 
-        // std::cout << "\tOdom: " << rel_odom.loc.x() << ", " << rel_odom.loc.y() << ", " << rel_odom.angle << std::endl;
-        // std::cout << "\tMag: " << odom_mag[0] << ", " << odom_mag[1] << ", " << odom_mag[2] << std::endl;
+void SLAM::updatePoseIndex()
+{
+    // optimization can move any pose, so a new snapshot means a new index; otherwise only new states go in
+    if (synced_poses_ != indexed_poses_ || pose_index_.size() > poses_.size()) {
+        pose_index_.clear();
+        indexed_poses_ = synced_poses_;
+    }
+    for (std::size_t i = pose_index_.size(); i < poses_.size(); i++) {
+        pose_index_.insert(i, poses_[i].x(), poses_[i].y());
+    }
+}
 
-        // generate motion model
-        auto motion_model {motion_model::MultivariateMotionModel(Eigen::Vector3d(rel_odom.loc.x(), rel_odom.loc.y(), rel_odom.angle), Eigen::Vector3d(odom_mag[0], odom_mag[1], odom_mag[2]))};
+void SLAM::detectLoops(SequentialNode &state)
+{
+    PROFILE_SCOPE("detectLoops");
+    const int ignore_depth {POSE_GRAPH_CONNECTION_DEPTH};
+    int constraint_counter {};
 
-        // generate candidates
-        auto candidates {generateCandidates(rel_odom, odom_mag, state->points, chain_[i]->lookup_table, motion_model)};
+    // . find the earlier poses within the radius, which descriptors make cheap to widen
+    updatePoseIndex();
+    std::vector<std::pair<int, double>> neighbours;
+    const double radius {LOOP_CLOSURE_DESCRIPTORS ? LOOP_CLOSURE_DESCRIPTOR_RADIUS : LOOP_CLOSURE_RADIUS};
+    pose_index_.query(poses_[state.id].x(), poses_[state.id].y(), radius, neighbours);
+    std::sort(neighbours.begin(), neighbours.end());
+
+    // . keep the best pose of each earlier visit: a submap with SLAM_SUBMAPS, otherwise a run of consecutive states.
+    // The active submap and the depth_ ones before it, or the last ignore_depth states, are already tied to the state by
+    // sequential matches. With descriptors the best pose is the one whose scan looks most like the state's, otherwise
+    // the closest one.
+    std::vector<std::pair<int, double>> visits;
+    int last_visit {-1};
+    int last_id {-2};
+    for (const auto &neighbour : neighbours) {
+        const int id {neighbour.first};
+        if (chain_[id].pruned) {continue;}
+        int visit;
+        if (SLAM_SUBMAPS) {
+            visit = node_submaps_[id];
+            if (visit + 1 + depth_ >= static_cast<int>(submaps_.size())) {continue;}
+        } else {
+            if (id >= static_cast<int>(chain_.size()) - 1 - ignore_depth) {continue;}
+            visit = id == last_id + 1 ? last_visit : id;
+            last_id = id;
+        }
 
-        // calculate covariance and get pose
-        auto covariance {calculateCovariance(candidates)};
-        if (std::holds_alternative<bool>(covariance)) {
-            continue;
+        const std::pair<int, double> ranked {id, LOOP_CLOSURE_DESCRIPTORS ? state.descriptor.distance(chain_[id].descriptor) : neighbour.second};
+        if (visit == last_visit) {
+            if (ranked.second < visits.back().second) {visits.back() = ranked;}
+        } else {
+            visits.push_back(ranked);
+            last_visit = visit;
         }
+    }
 
-        Eigen::Matrix3d cov_matrix;
-        cov_matrix = {std::get<Eigen::Matrix3d>(covariance)};
-        Pose best_pose;
-        best_pose = (*candidates)[0].relative_pose;
-        double best_prob {(*candidates)[0].p_scan};
-        for (std::size_t i = 1; i < candidates->size(); i++) {
-            if ((*candidates)[i].p_scan > best_prob) {
-                best_prob = (*candidates)[i].p_scan;
-                best_pose = (*candidates)[i].relative_pose;
+    // . best ranked visits first, the ranking distance shrinking with the keyframes since the visit; with descriptors
+    // only the few that look alike are worth a scan match
+    if (LOOP_CLOSURE_DESCRIPTORS) {
+        visits.erase(std::remove_if(visits.begin(), visits.end(), [](const std::pair<int, double> &visit) {
+            return visit.second > LOOP_CLOSURE_DESCRIPTOR_DISTANCE;
+        }), visits.end());
+    }
+    const auto rank = [&state](const std::pair<int, double> &visit) {
+        return visit.second / (1 + static_cast<double>(state.id - visit.first) / LOOP_CLOSURE_AGE_SCALE);
+    };
+    std::stable_sort(visits.begin(), visits.end(), [&rank](const std::pair<int, double> &a, const std::pair<int, double> &b) {
+        return rank(a) < rank(b);
+    });
+    if (LOOP_CLOSURE_DESCRIPTORS) {
+        if (visits.size() > LOOP_CLOSURE_DESCRIPTOR_CANDIDATES) {
+            visits.resize(LOOP_CLOSURE_DESCRIPTOR_CANDIDATES);
+        }
+    }
+    std::vector<int> candidates;
+    std::vector<int> table_indices;     // submaps with SLAM_SUBMAPS, otherwise the candidates themselves
+    for (const auto &visit : visits) {
+        if (SLAM_SUBMAPS) {
+            candidates.push_back(submaps_[node_submaps_[visit.first]].anchor);
+            table_indices.push_back(node_submaps_[visit.first]);
+        } else {
+            candidates.push_back(visit.first);
+            table_indices.push_back(visit.first);
+        }
+    }
+
+    // . match the candidates a batch at a time and keep the first successful ones in order, so the result is the
+    // same as matching them one by one; old tables are only rebuilt for the batches that are reached
+    std::vector<rasterization::LookupTable *> tables(SLAM_NUM_THREADS);
+    for (std::size_t batch = 0; batch < candidates.size(); batch += SLAM_NUM_THREADS) {
+        const std::size_t batch_end {std::min(candidates.size(), batch + SLAM_NUM_THREADS)};
+        for (std::size_t k = batch; k < batch_end; k++) {
+            tables[k - batch] = loopClosureTable(table_indices[k]);
+        }
+        std::vector<std::variant<bool, NonsequentialNode>> closures(batch_end - batch);
+#ifdef _OPENMP
+        #pragma omp parallel for num_threads(SLAM_NUM_THREADS) schedule(dynamic)
+#endif
+        for (std::size_t k = batch; k < batch_end; k++) {
+            closures[k - batch] = matchLoopClosure(state, candidates[k], *tables[k - batch]);
+        }
+
+        for (const auto &closure : closures) {
+            // make sure we don't add too many constraints (just to make sure this doesn't decrease performance too much)
+            if (constraint_counter >= LOOP_CLOSURE_MAX_CONSTRAINTS) {
+                return;
+            }
+            if (std::holds_alternative<bool>(closure)) {
+                continue;
             }
+            state.nodes.push_back(std::get<NonsequentialNode>(closure));
+            constraint_counter++;
         }
+    }
+}
+
+rasterization::LookupTable *SLAM::loopClosureTable(const int &index)
+{
+    auto &table {SLAM_SUBMAPS ? submaps_[index].lookup_table : chain_[index].lookup_table};
+    if (table == nullptr) {
+        const auto points {SLAM_SUBMAPS ? submap_clouds_.points(index) : keyframes_.points(index)};
+        table = std::make_unique<rasterization::LookupTable>(points, LOOKUP_TABLE_RESOLUTION, LOOKUP_TABLE_SIGMA);
+        rehydrated_.push_back(index);
+    }
+    return table.get();
+}
 
-        // std::cout << "\tBest pose: " << best_pose.loc.x() << ", " << best_pose.loc.y() << ", " << best_pose.angle << "; p = " << best_prob << std::endl;
-        // cov_matrix << 1e-7, 0, 0, 0, 1e-7, 0, 0, 0, 1e-7;
-        
-        NonsequentialNode loop_closure_node;
-        loop_closure_node.parent = chain_[i]->id;
-        loop_closure_node.rel_odom = transformPoseCopy(rel_odom, chain_[i]->rel_odom);
-        loop_closure_node.rel_pose = gtsam::Pose2(best_pose.loc.x(), best_pose.loc.y(), best_pose.angle);
-        loop_closure_node.rel_cov = gtsam::Matrix(cov_matrix);
-        loop_closure_node.est_pose = transformPoseCopy(gtsam::Pose2(best_pose.loc.x(), best_pose.loc.y(), best_pose.angle), chain_[i]->est_pose);
+void SLAM::ageKeyframes()
+{
+    // a node's table goes with the float points of its scan (submap tables age in insertIntoSubmap)
+    const int aged {static_cast<int>(chain_.size()) - 1 - SLAM_KEYFRAME_HOT_SCANS};
+    if (!SLAM_SUBMAPS && aged >= 0) {
+        chain_[aged].lookup_table.reset();
+    }
+
+    // tables rebuilt for loop closures are dropped oldest first
+    while (rehydrated_.size() > SLAM_KEYFRAME_TABLE_CACHE) {
+        if (SLAM_SUBMAPS) {
+            submaps_[rehydrated_.front()].lookup_table.reset();
+        } else {
+            chain_[rehydrated_.front()].lookup_table.reset();
+        }
+        rehydrated_.pop_front();
+    }
+}
 
-        state->nodes.push_back(loop_closure_node);
-        // std::cout << "\tAdding a loop closure constraint:\n" << loop_closure_node.rel_pose << ",\n" << loop_closure_node.rel_cov << ",\n" << loop_closure_node.est_pose << std::endl;
-        constraint_counter++;
+std::variant<bool, NonsequentialNode> SLAM::matchLoopClosure(
+    const SequentialNode &state,
+    const int &i,
+    rasterization::LookupTable &ref)
+{
+    // generate candidates
+    // get diff WRT to frame of comparison pose
+    Eigen::Matrix3f transform;
+    transform << cos(poses_[i].theta()), -sin(poses_[i].theta()), poses_[i].x(),
+                    sin(poses_[i].theta()), cos(poses_[i].theta()), poses_[i].y(),
+                    0, 0, 1;
+    auto rel_odom {transformPoseCopy(Pose(poses_[state.id].x(), poses_[state.id].y(), poses_[state.id].theta()), transform.inverse())};
 
-        // . visualizing for debugging
-    //     // new data
-    //     auto new_rel_viz_points {state->points};
-    //     transformPoints(new_rel_viz_points, best_pose);
-        
-    //     for (const auto &point : new_rel_viz_points) {
-    //         visualization::DrawPoint(point, 0xF0F915, vis_msg_);
-    //     }
+    // compare scans
+    // check if nodes are not sequential; if not, need to compute the relative odometry
+    std::vector<double> odom_mag{std::abs(state.rel_odom.loc.x()), std::abs(state.rel_odom.loc.y()), std::abs(state.rel_odom.angle)};
+    
+    // handle cases when nodes are not immediately sequential
+    if (state.id != chain_[i].id + 1) {
+        Pose rel_pose(0, 0, 0);
 
-    //     visualization::DrawParticle(Eigen::Vector2f(state->est_pose.x(), state->est_pose.y()), state->est_pose.theta(), vis_msg_);
+        for (int i = 0; i < state.id - chain_[i].id - 1; i++) {
+            transformPose(rel_pose, chain_[chain_[i].id + i].rel_odom);
+            odom_mag[0] += std::abs(chain_[chain_[i].id + i].rel_odom.loc.x());
+            odom_mag[1] += std::abs(chain_[chain_[i].id + i].rel_odom.loc.y());
+            odom_mag[2] += std::abs(chain_[chain_[i].id + i].rel_odom.angle);
+        }
 
-    //     // new data
-    //     auto new_viz_points {state->points};
-    //     transformPoints(new_viz_points, Pose(loop_closure_node.est_pose.x(), loop_closure_node.est_pose.y(), loop_closure_node.est_pose.theta()));
-        
-    //     for (const auto &point : new_viz_points) {
-    //         visualization::DrawPoint(point, 0xF0F915, vis_msg_);
-    //     }
+        // transformPose(rel_pose, state.rel_odom);
+        // rel_odom = rel_pose;
+    }
 
-    //     visualization::DrawParticle(Eigen::Vector2f(state->est_pose.x(), state->est_pose.y()), state->est_pose.theta(), vis_msg_);
+    odom_mag = std::vector<double>{2, 2, 1.5};
 
-    //     // comparison data
-    //     auto old_viz_points {chain_[i]->points};
+    // auto points {state.points};
+    // transformPoints(points, rel_odom);
 
-    //     for (const auto &point : old_viz_points) {
-    //         visualization::DrawPoint(point, 0x15F4F9, vis_msg_);
-    //     }
+    // std::cout << "\tOdom: " << rel_odom.loc.x() << ", " << rel_odom.loc.y() << ", " << rel_odom.angle << std::endl;
+    // std::cout << "\tMag: " << odom_mag[0] << ", " << odom_mag[1] << ", " << odom_mag[2] << std::endl;
 
-    //     transformPoints(old_viz_points, Pose(chain_[i]->est_pose.x(), chain_[i]->est_pose.y(), chain_[i]->est_pose.theta()));
+    // generate motion model
+    auto motion_model {motion_model::MultivariateMotionModel(Eigen::Vector3d(rel_odom.loc.x(), rel_odom.loc.y(), rel_odom.angle), Eigen::Vector3d(odom_mag[0], odom_mag[1], odom_mag[2]))};
 
-    //     for (const auto &point : old_viz_points) {
-    //         visualization::DrawPoint(point, 0x15F4F9, vis_msg_);
-    //     }
+    // generate candidates
+    const auto candidates {searchCandidates(rel_odom, odom_mag, keyframes_.hotPoints(state.id), ref, motion_model)};
 
-    //     visualization::DrawParticle(Eigen::Vector2f(chain_[i]->est_pose.x(), chain_[i]->est_pose.y()), chain_[i]->est_pose.theta(), vis_msg_);
-    // }
-    // vis_msg_.header.stamp = ros::Time::now();
-    // vis_pub_.publish(vis_msg_);
+    // calculate covariance and get pose
+    const auto covariance {candidates.covariance()};
+    if (std::holds_alternative<bool>(covariance)) {
+        return false;
     }
+
+    Eigen::Matrix3d cov_matrix;
+    cov_matrix = {std::get<Eigen::Matrix3d>(covariance)};
+    const Pose best_pose {candidates.best_scan.relative_pose};
+
+    // std::cout << "\tBest pose: " << best_pose.loc.x() << ", " << best_pose.loc.y() << ", " << best_pose.angle << "; p = " << best_prob << std::endl;
+    // cov_matrix << 1e-7, 0, 0, 0, 1e-7, 0, 0, 0, 1e-7;
+    
+    NonsequentialNode loop_closure_node;
+    loop_closure_node.parent = chain_[i].id;
+    loop_closure_node.rel_odom = transformPoseCopy(rel_odom, chain_[i].rel_odom);
+    loop_closure_node.rel_pose = gtsam::Pose2(best_pose.loc.x(), best_pose.loc.y(), best_pose.angle);
+    loop_closure_node.rel_cov = gtsam::Matrix(cov_matrix);
+    loop_closure_node.est_pose = transformPoseCopy(gtsam::Pose2(best_pose.loc.x(), best_pose.loc.y(), best_pose.angle), poses_[i]);
+
+    // std::cout << "\tAdding a loop closure constraint:\n" << loop_closure_node.rel_pose << ",\n" << loop_closure_node.rel_cov << ",\n" << loop_closure_node.est_pose << std::endl;
+    return loop_closure_node;
 }
 
 // -------------------------------------------
@@ -579,26 +1290,26 @@ void SLAM::detectLoops(std::shared_ptr<SequentialNode> &state)
 // -------------------------------------------
 
 std::pair<gtsam::Pose2, gtsam::Matrix> SLAM::pairwiseComparison(
-    std::shared_ptr<SequentialNode> &new_node,
-    std::shared_ptr<SequentialNode> &existing_node)
+    const SequentialNode &new_node,
+    const SequentialNode &existing_node)
 {
     // check if nodes are not sequential; if not, need to compute the relative odometry
-    auto rel_odom {new_node->rel_odom};
-    std::vector<double> odom_mag{std::abs(new_node->rel_odom.loc.x()), std::abs(new_node->rel_odom.loc.y()), std::abs(new_node->rel_odom.angle)};
+    auto rel_odom {new_node.rel_odom};
+    std::vector<double> odom_mag{std::abs(new_node.rel_odom.loc.x()), std::abs(new_node.rel_odom.loc.y()), std::abs(new_node.rel_odom.angle)};
     
     // handle cases when nodes are not immediately sequential
-    if (new_node->id != existing_node->id + 1) {
+    if (new_node.id != existing_node.id + 1) {
         Pose rel_pose(0, 0, 0);
         std::vector<double> odom_cum{0, 0, 0};
 
-        for (int i = 0; i < new_node->id - existing_node->id - 1; i++) {
-            transformPose(rel_pose, chain_[existing_node->id + i]->rel_odom);
-            odom_mag[0] += std::abs(chain_[existing_node->id + i]->rel_odom.loc.x());
-            odom_mag[1] += std::abs(chain_[existing_node->id + i]->rel_odom.loc.y());
-            odom_mag[2] += std::abs(chain_[existing_node->id + i]->rel_odom.angle);
+        for (int i = 0; i < new_node.id - existing_node.id - 1; i++) {
+            transformPose(rel_pose, chain_[existing_node.id + i].rel_odom);
+            odom_mag[0] += std::abs(chain_[existing_node.id + i].rel_odom.loc.x());
+            odom_mag[1] += std::abs(chain_[existing_node.id + i].rel_odom.loc.y());
+            odom_mag[2] += std::abs(chain_[existing_node.id + i].rel_odom.angle);
         }
 
-        transformPose(rel_pose, new_node->rel_odom);
+        transformPose(rel_pose, new_node.rel_odom);
         rel_odom = rel_pose;
     }
 
@@ -606,43 +1317,125 @@ std::pair<gtsam::Pose2, gtsam::Matrix> SLAM::pairwiseComparison(
     auto motion_model {motion_model::MultivariateMotionModel(Eigen::Vector3d(rel_odom.loc.x(), rel_odom.loc.y(), rel_odom.angle), Eigen::Vector3d(odom_mag[0], odom_mag[1], odom_mag[2]))};
 
     // generate candidates
-    auto candidates {generateCandidates(rel_odom, odom_mag, new_node->points, existing_node->lookup_table, motion_model)};
+    const auto candidates {searchCandidates(rel_odom, odom_mag, keyframes_.hotPoints(new_node.id), *existing_node.lookup_table, motion_model)};
 
     // calculate covariance and get pose
     Eigen::Matrix3d cov_matrix;
     Pose best_pose;
-    auto covariance {calculateCovariance(candidates)};
+    const auto covariance {candidates.covariance()};
     if (std::holds_alternative<bool>(covariance)) {
         cov_matrix = motion_model.get_covariance();
-        // std::cout << "\tBad covariance detected for " << new_node->id << " and " << existing_node->id << ", overriding with pure odometry covariance." << std::endl;
+        // std::cout << "\tBad covariance detected for " << new_node.id << " and " << existing_node.id << ", overriding with pure odometry covariance." << std::endl;
         best_pose = rel_odom;
     } else {
         cov_matrix = {std::get<Eigen::Matrix3d>(covariance)};
-        best_pose = (*candidates)[0].relative_pose;
-        double best_prob {(*candidates)[0].p};
-        for (std::size_t i = 1; i < candidates->size(); i++) {
-            if ((*candidates)[i].p > best_prob) {
-                best_prob = (*candidates)[i].p;
-                best_pose = (*candidates)[i].relative_pose;
-            }
-        }
+        best_pose = candidates.best.relative_pose;
     }
 
     return std::make_pair<gtsam::Pose2, gtsam::Matrix>(gtsam::Pose2(best_pose.loc.x(), best_pose.loc.y(), best_pose.angle), gtsam::Matrix(cov_matrix));
 }
 
+std::pair<gtsam::Pose2, gtsam::Matrix> SLAM::submapComparison(
+    const SequentialNode &new_node,
+    Submap &submap)
+{
+    // the previous state is already placed in the submap, so only the latest step of odometry is uncertain
+    const auto predicted {submap.member_poses.back() * gtsam::Pose2(new_node.rel_odom.loc.x(), new_node.rel_odom.loc.y(), new_node.rel_odom.angle)};
+    Pose rel_odom(predicted.x(), predicted.y(), predicted.theta());
+    std::vector<double> odom_mag{std::abs(new_node.rel_odom.loc.x()), std::abs(new_node.rel_odom.loc.y()), std::abs(new_node.rel_odom.angle)};
+
+    // generate motion model
+    auto motion_model {motion_model::MultivariateMotionModel(Eigen::Vector3d(rel_odom.loc.x(), rel_odom.loc.y(), rel_odom.angle), Eigen::Vector3d(odom_mag[0], odom_mag[1], odom_mag[2]))};
+
+    // generate candidates
+    const auto candidates {searchCandidates(rel_odom, odom_mag, keyframes_.hotPoints(new_node.id), *submap.lookup_table, motion_model)};
+
+    // calculate covariance and get pose
+    Eigen::Matrix3d cov_matrix;
+    Pose best_pose;
+    const auto covariance {candidates.covariance()};
+    if (std::holds_alternative<bool>(covariance)) {
+        cov_matrix = motion_model.get_covariance();
+        best_pose = rel_odom;
+    } else {
+        cov_matrix = {std::get<Eigen::Matrix3d>(covariance)};
+        best_pose = candidates.best.relative_pose;
+    }
+
+    return std::make_pair<gtsam::Pose2, gtsam::Matrix>(gtsam::Pose2(best_pose.loc.x(), best_pose.loc.y(), best_pose.angle), gtsam::Matrix(cov_matrix));
+}
+
+std::variant<bool, NonsequentialNode> SLAM::submapConstraint(
+    const SequentialNode &state,
+    const int &anchor,
+    rasterization::LookupTable &ref)
+{
+    // the state was just placed by the active submap, so it is searched for around that pose, as far off as one step
+    // of odometry
+    const auto predicted {poses_[anchor].between(state.est_pose)};
+    Pose rel_odom(predicted.x(), predicted.y(), predicted.theta());
+    std::vector<double> odom_mag{std::abs(state.rel_odom.loc.x()), std::abs(state.rel_odom.loc.y()), std::abs(state.rel_odom.angle)};
+    auto motion_model {motion_model::MultivariateMotionModel(Eigen::Vector3d(rel_odom.loc.x(), rel_odom.loc.y(), rel_odom.angle), Eigen::Vector3d(odom_mag[0], odom_mag[1], odom_mag[2]))};
+    const auto candidates {searchCandidates(rel_odom, odom_mag, keyframes_.hotPoints(state.id), ref, motion_model)};
+
+    // without a match there is no measurement, only the pose it was searched around
+    const auto covariance {candidates.covariance()};
+    if (std::holds_alternative<bool>(covariance)) {
+        return false;
+    }
+    const Pose best_pose {candidates.best.relative_pose};
+
+    NonsequentialNode node;
+    node.parent = anchor;
+    node.rel_odom = rel_odom;
+    node.rel_pose = gtsam::Pose2(best_pose.loc.x(), best_pose.loc.y(), best_pose.angle);
+    node.rel_cov = gtsam::Matrix(std::get<Eigen::Matrix3d>(covariance));
+    node.est_pose = poses_[anchor] * node.rel_pose;
+    return node;
+}
+
+void SLAM::insertIntoSubmap(const SequentialNode &state, const gtsam::Pose2 &submap_pose)
+{
+    // a full submap is left as it is for loop closures, with its points in the submap store, and the state starts the
+    // next one; the submap that aged out of the hot tier with it drops its table
+    if (submaps_.empty() || static_cast<int>(submaps_.back().members.size()) >= SUBMAP_SIZE) {
+        if (!submaps_.empty()) {
+            const int complete {submap_clouds_.add(submaps_.back().points)};
+            std::vector<Eigen::Vector2f>().swap(submaps_.back().points);
+            const int aged {complete - SLAM_KEYFRAME_HOT_SUBMAPS};
+            if (aged >= 0) {
+                submaps_[aged].lookup_table.reset();
+            }
+        }
+        submaps_.emplace_back(state.id);
+    }
+    auto &submap {submaps_.back()};
+
+    // an anchor is the origin of its own submap, wherever it matched in the one before
+    const gtsam::Pose2 rel_pose {submap.anchor == state.id ? gtsam::Pose2(0, 0, 0) : submap_pose};
+    auto points {keyframes_.hotPoints(state.id).copy()};
+    transformPoints(points, Pose(rel_pose.x(), rel_pose.y(), rel_pose.theta()));
+    submap.members.push_back(state.id);
+    submap.member_poses.push_back(rel_pose);
+    node_submaps_.push_back(static_cast<int>(submaps_.size()) - 1);
+    submap.points.insert(submap.points.end(), points.begin(), points.end());
+
+    // tables are immutable, so the submap's is rebuilt with the new scan in it
+    submap.lookup_table = std::make_unique<rasterization::LookupTable>(submap.points, LOOKUP_TABLE_RESOLUTION, LOOKUP_TABLE_SIGMA);
+}
+
 // -------------------------------------------
 // * Generating Candidates
 // -------------------------------------------
 
-std::shared_ptr<std::vector<Candidate>> SLAM::generateCandidates(
-    Pose odom,
-    std::vector<double> odom_mag,
-    std::vector<Eigen::Vector2f> points,
-    std::shared_ptr<rasterization::LookupTable> &ref,
+CandidateAccumulator SLAM::searchCandidates(
+    const Pose &odom,
+    const std::vector<double> &odom_mag,
+    const span::Span<Eigen::Vector2f> &points,
+    rasterization::LookupTable &ref,
     motion_model::MultivariateMotionModel &motion_model)
 {
-    auto candidates {std::make_shared<std::vector<Candidate>>()};
+    CandidateAccumulator candidates;
 
     // calculate periods of thresholds based on given odom pose.
     // used for dynamically allocation larger range of candidates for relative poses (which are further)
@@ -654,87 +1447,264 @@ std::shared_ptr<std::vector<Candidate>> SLAM::generateCandidates(
     const int x_iterations = std::ceil(POSE_SAMPLING_X_LIMIT / POSE_SAMPLING_X_RESOLUTION);
     const int y_iterations = std::ceil(POSE_SAMPLING_Y_LIMIT / POSE_SAMPLING_Y_RESOLUTION);
     const int theta_iterations = std::ceil(POSE_SAMPLING_THETA_LIMIT / POSE_SAMPLING_THETA_RESOLUTION);
+    SearchWindow window {-x_iterations, x_iterations, -y_iterations, y_iterations, -theta_iterations, theta_iterations};
+
+    // find the best match without scoring the whole cube, then only score its neighbourhood, so the covariance still
+    // sees the shape of the peak and is gathered on the fine window alone
+    if (CSM_BRANCH_AND_BOUND) {
+        const auto best {branchAndBound(odom, periods, window, points, ref, motion_model)};
+        window = SearchWindow {
+            std::max(window.x_min, best[0] - CSM_COVARIANCE_WINDOW), std::min(window.x_max, best[0] + CSM_COVARIANCE_WINDOW),
+            std::max(window.y_min, best[1] - CSM_COVARIANCE_WINDOW), std::min(window.y_max, best[1] + CSM_COVARIANCE_WINDOW),
+            std::max(window.theta_min, best[2] - CSM_COVARIANCE_WINDOW), std::min(window.theta_max, best[2] + CSM_COVARIANCE_WINDOW)
+        };
+    }
 
-    // reserving space in candidates
-    candidates->reserve(x_iterations * y_iterations * theta_iterations);
-
-    // Triple loop to populate motion model poses with variance in each dimension. This creates a cube of next state possibilities
-    for (int theta_i = -theta_iterations; theta_i <= theta_iterations; theta_i++) {
-        for (int  y_i = -y_iterations; y_i <= y_iterations; y_i++) {
-            for (int x_i = -x_iterations; x_i <= x_iterations; x_i++) {
-                Candidate candidate;
-                
-                // . generate a candidate pose WRT to the body
-                auto candidate_pose {Pose(
-                        static_cast<float>(x_i * POSE_SAMPLING_X_RESOLUTION * periods), 
-                        static_cast<float>(y_i * POSE_SAMPLING_Y_RESOLUTION * periods), 
-                        static_cast<float>(theta_i * POSE_SAMPLING_THETA_RESOLUTION * periods))
-                };
-
-                // . transform it back to the last frame (from odom)
-                transformPose(candidate_pose, odom);
-
-                // . set the relative pose
-                candidate.relative_pose = candidate_pose;
-
-                // . use motion model to fill in the p_motion
-                candidate.p_motion = motion_model.evaluate(Eigen::Vector3d(candidate_pose.loc.x(), candidate_pose.loc.y(), candidate_pose.angle));
-
-                // . transform the points to the candidate frame
-                auto cloud {points};
-                Eigen::Matrix3f transform {pose2Transform(candidate_pose)};
-                transformPoints(cloud, transform);
-
-                // . compute scan similarity
-                double p_scan {};
-                if (cloud.size() > 0) {
-                    for (const auto &point : cloud) {
-                        p_scan += ref->evaluate(point);
-                    }
-                    p_scan /= cloud.size();
-                }
-                candidate.p_scan = p_scan;
+    scoreCandidates(odom, periods, window, points, ref, motion_model, candidates);
+    return candidates;
+}
 
-                // . compute the combined probability
-                candidate.p = candidate.p_scan * candidate.p_motion;
-                
-                // . add the candidate to the output
-                candidates->push_back(candidate);
+void SLAM::scoreCandidates(
+    const Pose &odom,
+    const int &periods,
+    const SearchWindow &window,
+    const span::Span<Eigen::Vector2f> &points,
+    rasterization::LookupTable &ref,
+    motion_model::MultivariateMotionModel &motion_model,
+    CandidateAccumulator &candidates)
+{
+    // the candidates share their positions across the theta slices, so the motion prior is precomputed per position and
+    // per slice angle
+    std::vector<Eigen::Vector2f> positions;
+    for (int  y_i = window.y_min; y_i <= window.y_max; y_i++) {
+        for (int x_i = window.x_min; x_i <= window.x_max; x_i++) {
+            positions.push_back(odom.loc + candidateTranslation(odom, periods, x_i, y_i));
+        }
+    }
+    std::vector<float> angles;
+    for (int theta_i = window.theta_min; theta_i <= window.theta_max; theta_i++) {
+        angles.push_back(sliceAngle(odom, periods, theta_i));
+    }
+    const motion_model::MotionLattice prior(motion_model, positions, angles);
+
+    // Triple loop to populate motion model poses with variance in each dimension. This creates a cube of next state possibilities.
+    // The cloud is rotated once per theta slice, after which each translation only shifts its grid coordinates
+    ScanSlice slice;
+    for (int theta_i = window.theta_min; theta_i <= window.theta_max; theta_i++) {
+        rotateScan(odom, periods, theta_i, points, ref, slice);
+        std::size_t position {};
+        for (int  y_i = window.y_min; y_i <= window.y_max; y_i++) {
+            for (int x_i = window.x_min; x_i <= window.x_max; x_i++) {
+                const double p_motion {prior.evaluate(position++, theta_i - window.theta_min)};
+                candidates.add(scoreCandidate(odom, periods, {x_i, y_i, theta_i}, slice, ref, p_motion));
             }
         }
     }
-    return candidates;
+}
+
+void SLAM::rotateScan(
+    const Pose &odom,
+    const int &periods,
+    const int &theta_i,
+    const span::Span<Eigen::Vector2f> &points,
+    rasterization::LookupTable &ref,
+    ScanSlice &slice)
+{
+    slice.angle = sliceAngle(odom, periods, theta_i);
+    const Eigen::Rotation2Df rotation(slice.angle);
+
+    slice.x.resize(points.size());
+    slice.y.resize(points.size());
+    for (std::size_t k = 0; k < points.size(); k++) {
+        const Eigen::Vector2f grid_point {ref.gridCoordinates(rotation * points[k] + odom.loc)};
+        slice.x[k] = grid_point.x();
+        slice.y[k] = grid_point.y();
+    }
+}
+
+float SLAM::sliceAngle(const Pose &odom, const int &periods, const int &theta_i)
+{
+    // the slice takes the candidate angle that transformPose produces, so the motion model sees the same angle
+    return transformPoseCopy(Pose(0, 0, static_cast<float>(theta_i * POSE_SAMPLING_THETA_RESOLUTION * periods)), odom).angle;
+}
+
+Eigen::Vector2f SLAM::candidateTranslation(const Pose &odom, const int &periods, const int &x_i, const int &y_i)
+{
+    return Eigen::Rotation2Df(odom.angle) * Eigen::Vector2f(
+            static_cast<float>(x_i * POSE_SAMPLING_X_RESOLUTION * periods),
+            static_cast<float>(y_i * POSE_SAMPLING_Y_RESOLUTION * periods));
+}
+
+Candidate SLAM::scoreCandidate(
+    const Pose &odom,
+    const int &periods,
+    const std::array<int, 3> &offset,
+    const ScanSlice &slice,
+    rasterization::LookupTable &ref,
+    motion_model::MultivariateMotionModel &motion_model)
+{
+    Candidate candidate {scoreCandidate(odom, periods, offset, slice, ref, 0.d)};
+    candidate.p_motion = motion_model.evaluate(Eigen::Vector3d(candidate.relative_pose.loc.x(), candidate.relative_pose.loc.y(), candidate.relative_pose.angle));
+    candidate.p = candidate.p_scan * candidate.p_motion;
+    return candidate;
+}
+
+Candidate SLAM::scoreCandidate(
+    const Pose &odom,
+    const int &periods,
+    const std::array<int, 3> &offset,
+    const ScanSlice &slice,
+    rasterization::LookupTable &ref,
+    const double &p_motion)
+{
+    Candidate candidate;
+
+    // . generate a candidate pose WRT to the body
+    const Eigen::Vector2f translation {candidateTranslation(odom, periods, offset[0], offset[1])};
+
+    // . set the relative pose, transformed back to the last frame (from odom)
+    candidate.relative_pose.loc = odom.loc + translation;
+    candidate.relative_pose.angle = slice.angle;
+    candidate.p_motion = p_motion;
+
+    // . compute scan similarity by shifting the rotated cloud across the table
+    double p_scan {};
+    if (!slice.x.empty()) {
+        p_scan = ref.sumShifted(slice.x, slice.y, translation / ref.getResolution()) / slice.x.size();
+    }
+    candidate.p_scan = p_scan;
+
+    // . compute the combined probability
+    candidate.p = candidate.p_scan * candidate.p_motion;
+    return candidate;
 }
 
 // -------------------------------------------
-// * Covariance
+// * Branch and Bound
 // -------------------------------------------
 
-std::variant<bool, Eigen::Matrix3d> SLAM::calculateCovariance(std::shared_ptr<std::vector<Candidate>> &candidates)
+std::array<int, 3> SLAM::branchAndBound(
+    const Pose &odom,
+    const int &periods,
+    const SearchWindow &window,
+    const span::Span<Eigen::Vector2f> &points,
+    rasterization::LookupTable &ref,
+    motion_model::MultivariateMotionModel &motion_model)
 {
-    Eigen::Matrix3d K = Eigen::Matrix3d::Zero();
-    Eigen::Vector3d u = Eigen::Vector3d::Zero();
-    double s = 0;
-    for (auto &candidate : *candidates){
-        Eigen::Vector3d x_i(candidate.relative_pose.loc.x(), candidate.relative_pose.loc.y(), candidate.relative_pose.angle); // I know its ugly let me live steven
-        K += x_i*x_i.transpose()*candidate.p_motion*candidate.p_scan; //^
-        u += x_i*candidate.p_motion*candidate.p_scan;
-        s += candidate.p_motion*candidate.p_scan;
+    std::array<int, 3> best {0, 0, 0};
+    if (points.empty()) {return best;}
+
+    struct SearchNode {
+        int theta_i;
+        int x_min;
+        int x_max;
+        int y_min;
+        int y_max;
+        double bound;
+    };
+
+    const float step_x {static_cast<float>(POSE_SAMPLING_X_RESOLUTION * periods)};
+    const float step_y {static_cast<float>(POSE_SAMPLING_Y_RESOLUTION * periods)};
+    const float resolution {ref.getResolution()};
+    const int max_level {ref.maxPooledLevel()};
+    const Eigen::Rotation2Df odom_rotation(odom.angle);
+
+    // . rotate the cloud once per theta slice; translations within a slice only shift it
+    std::vector<ScanSlice> slices(window.theta_max - window.theta_min + 1);
+    for (int theta_i = window.theta_min; theta_i <= window.theta_max; theta_i++) {
+        rotateScan(odom, periods, theta_i, points, ref, slices[theta_i - window.theta_min]);
+    }
+
+    // . upper bound of a node: every point lands somewhere in the box swept by the node's translations, which a
+    // max-pooled table covers with a single lookup per point
+    auto computeBound = [&](SearchNode &node) {
+        Eigen::Vector2f t_min {Eigen::Vector2f::Constant(std::numeric_limits<float>::max())};
+        Eigen::Vector2f t_max {-t_min};
+        for (const int x_i : {node.x_min, node.x_max}) {
+            for (const int y_i : {node.y_min, node.y_max}) {
+                const Eigen::Vector2f t {odom_rotation * Eigen::Vector2f(x_i * step_x, y_i * step_y)};
+                t_min = t_min.cwiseMin(t);
+                t_max = t_max.cwiseMax(t);
+            }
+        }
+
+        // half a cell of margin on each side absorbs rounding between the corners and the exact shifts
+        const Eigen::Vector2f corner {t_min / resolution - Eigen::Vector2f::Constant(0.5f)};
+        const float extent {(t_max - t_min).maxCoeff() / resolution + 1};
+        const int window_cells {static_cast<int>(std::ceil(extent)) + 1};
+        int level {1};
+        while ((1 << level) < window_cells && level < max_level) {level++;}
+
+        const auto &slice {slices[node.theta_i - window.theta_min]};
+        const double scan_bound {ref.sumUpperBound(slice.x, slice.y, corner, level) / points.size()};
+        const double motion_bound {motion_model.upper_bound(
+            Eigen::Vector3d(odom.loc.x() + t_min.x(), odom.loc.y() + t_min.y(), slice.angle),
+            Eigen::Vector3d(odom.loc.x() + t_max.x(), odom.loc.y() + t_max.y(), slice.angle))};
+        node.bound = scan_bound * motion_bound;
+    };
+
+    // . one root per theta slice, searched depth first with the most promising branch taken first
+    std::vector<SearchNode> stack;
+    for (int theta_i = window.theta_min; theta_i <= window.theta_max; theta_i++) {
+        SearchNode root {theta_i, window.x_min, window.x_max, window.y_min, window.y_max, 0};
+        computeBound(root);
+        stack.push_back(root);
+    }
+    std::sort(stack.begin(), stack.end(), [](const SearchNode &a, const SearchNode &b) {return a.bound < b.bound;});
+
+    double best_score {};
+    while (!stack.empty()) {
+        const SearchNode node {stack.back()};
+        stack.pop_back();
+        if (node.bound <= best_score) {continue;}
+
+        // leaves are scored exactly
+        if (node.x_min == node.x_max && node.y_min == node.y_max) {
+            const std::array<int, 3> offset {node.x_min, node.y_min, node.theta_i};
+            const auto candidate {scoreCandidate(odom, periods, offset, slices[node.theta_i - window.theta_min], ref, motion_model)};
+            if (candidate.p > best_score) {
+                best_score = candidate.p;
+                best = offset;
+            }
+            continue;
+        }
+
+        // split the longer side in two
+        SearchNode low {node};
+        SearchNode high {node};
+        if (node.x_max - node.x_min >= node.y_max - node.y_min) {
+            low.x_max = node.x_min + (node.x_max - node.x_min) / 2;
+            high.x_min = low.x_max + 1;
+        } else {
+            low.y_max = node.y_min + (node.y_max - node.y_min) / 2;
+            high.y_min = low.y_max + 1;
+        }
+        computeBound(low);
+        computeBound(high);
+        if (low.bound > high.bound) {std::swap(low, high);}
+        stack.push_back(low);
+        stack.push_back(high);
     }
+    return best;
+}
 
+// -------------------------------------------
+// * Covariance
+// -------------------------------------------
+
+std::variant<bool, Eigen::Matrix3d> CandidateAccumulator::covariance() const
+{
     if (s < 1e-9) {
         return false;
     }
 
-    auto cov {1/s*K-(1/(s*s))*u*u.transpose()};
+    const Eigen::Matrix3d cov {1/s*K-(1/(s*s))*u*u.transpose()};
 
     if (cov(0,0) < 1e-9 || cov(1,1) < 1e-9 || cov(2,2) < 1e-9) {
         return false;
     }
 
     return cov;
-
-    // return 1/s*K-(1/(s*s))*u*u.transpose();
 }
 
 // -------------------------------------------
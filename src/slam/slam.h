@@ -20,8 +20,15 @@
 //========================================================================
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <variant>
 
 #include "eigen3/Eigen/Dense"
@@ -30,10 +37,20 @@
 #include "ros/ros.h"
 #include "ros/package.h"
 #include "visualization/visualization.h"
+#include "visualization/visualization_manager.h"
+#include "laser_scan/scan_cloud.h"
 #include "amrl_msgs/VisualizationMsg.h"
 
 #include "rasterization.hpp"
 #include "motion_model.hpp"
+#include "spatial_hash.hpp"
+#include "scan_descriptor.hpp"
+#include "point_map.hpp"
+#include "node_arena.hpp"
+#include "keyframe_store.hpp"
+#include "keyframe_map.hpp"
+#include "pose_tracker.hpp"
+#include "span.hpp"
 #include "parameters.h"
 
 #include <gtsam/base/Vector.h>
@@ -41,6 +58,7 @@
 #include <gtsam/geometry/Pose2.h>
 #include <gtsam/geometry/Pose3.h>
 #include <gtsam/inference/Key.h>
+#include <gtsam/inference/Symbol.h>
 #include <gtsam/slam/PriorFactor.h>
 #include <gtsam/slam/BetweenFactor.h>
 #include <gtsam/nonlinear/NonlinearFactor.h>
@@ -49,6 +67,7 @@
 #include <gtsam/nonlinear/Marginals.h>
 #include <gtsam/nonlinear/GaussNewtonOptimizer.h>
 #include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/nonlinear/ISAM2.h>
 #include <boost/optional.hpp>
 
 #ifndef SRC_SLAM_H_
@@ -71,43 +90,114 @@ struct Candidate {
     double p {};
 }; // struct Candidate
 
+// Moments of the candidates of one search weighted by p (Olson, "Real-Time Correlative Scan Matching", 2009), gathered
+// as they are scored so none of them is stored, with the first best candidates by p and by p_scan
+struct CandidateAccumulator {
+    Eigen::Matrix3d K {Eigen::Matrix3d::Zero()};
+    Eigen::Vector3d u {Eigen::Vector3d::Zero()};
+    double s {};
+    std::size_t count {};
+    Candidate best;
+    Candidate best_scan;
+
+    void add(const Candidate &candidate)
+    {
+        const Eigen::Vector3d x_i(candidate.relative_pose.loc.x(), candidate.relative_pose.loc.y(), candidate.relative_pose.angle);
+        const double p {candidate.p_motion * candidate.p_scan};
+        K += x_i * x_i.transpose() * p;
+        u += x_i * p;
+        s += p;
+        if (count == 0 || candidate.p > best.p) {best = candidate;}
+        if (count == 0 || candidate.p_scan > best_scan.p_scan) {best_scan = candidate;}
+        count++;
+    }
+
+    // the covariance of the pose, false when the candidates carry too little probability to estimate it
+    std::variant<bool, Eigen::Matrix3d> covariance() const;
+}; // struct CandidateAccumulator
+
+// Range of candidate offsets searched by the scan matcher, in samples of the POSE_SAMPLING_* resolutions
+struct SearchWindow {
+    int x_min;
+    int x_max;
+    int y_min;
+    int y_max;
+    int theta_min;
+    int theta_max;
+}; // struct SearchWindow
+
+// Cloud rotated into one theta slice of the search and expressed in the grid coordinates of the reference table
+struct ScanSlice {
+    float angle;
+    std::vector<float> x;
+    std::vector<float> y;
+}; // struct ScanSlice
+
 struct NonsequentialNode {
     int parent;
     Pose rel_odom;
     
     int graph_id;
+    gtsam::FactorIndex factor;  // of its constraint in the incremental solver
     gtsam::Pose2 rel_pose;
     gtsam::Matrix rel_cov;
     gtsam::Pose2 est_pose;
 }; // struct NonsequentialNode
 
+// The scan of a node is in the keyframe store of the SLAM instance under its id. Its lookup table is dropped once the
+// scan ages out of the hot tier, and rebuilt while it is a loop closure candidate. Its descriptor is kept for good.
+// A pruned node is no longer a variable of the pose graph: its pose follows the kept node previous by rel_pose, and
+// the constraints that were tied to it are composed onto that node.
 struct SequentialNode {
     const int id;
     const Pose rel_odom;
-    const std::vector<Eigen::Vector2f> points; 
-    std::shared_ptr<rasterization::LookupTable> lookup_table;
+    std::unique_ptr<rasterization::LookupTable> lookup_table;
+    const scan_descriptor::ScanDescriptor descriptor;   // ranks the node as a loop closure candidate
     
     std::vector<NonsequentialNode> nodes;
     
     int graph_id;
+    int previous;   // node rel_pose is expressed from, the one before unless that one was pruned
+    gtsam::FactorIndex factor;  // of its sequential constraint, or the prior of the first node, in the incremental solver
     gtsam::Pose2 rel_pose;
     gtsam::Matrix rel_cov;
     gtsam::Pose2 est_pose;
+    std::atomic_bool pruned;    // set by the back end, the front end no longer matches against the node
 
-    SequentialNode(const int &identifier, const Pose &odom, const std::vector<Eigen::Vector2f> &cloud) 
-    : id(identifier), rel_odom(odom), points(cloud)
+    // nodes matched against submaps don't need a table of their own
+    SequentialNode(const int &identifier, const Pose &odom, const span::Span<Eigen::Vector2f> &cloud, const bool &build_table = true)
+    : id(identifier), rel_odom(odom), descriptor(cloud, SCAN_DESCRIPTOR_MAX_RANGE), previous(identifier - 1), pruned(false)
     {
         // raw_odometry = odom;
-        lookup_table = std::make_shared<rasterization::LookupTable>(points, LOOKUP_TABLE_RESOLUTION, LOOKUP_TABLE_SIGMA);
+        if (build_table) {
+            lookup_table = std::make_unique<rasterization::LookupTable>(cloud, LOOKUP_TABLE_RESOLUTION, LOOKUP_TABLE_SIGMA);
+        }
         // lookup_table->exportAsPPM("/home/dev/cs393r_starter/images/lookup_table.ppm");
     }
 }; // struct SequentialNode
 
+// Up to SUBMAP_SIZE consecutive scans merged into one table, expressed in the frame of the first of them (the anchor).
+// Once complete, its points move to the submap store of the SLAM instance under its index, and its table ages like
+// those of the nodes.
+struct Submap {
+    const int anchor;
+    std::vector<int> members;
+    std::vector<gtsam::Pose2> member_poses;    // where each member matched, in the anchor frame
+    std::vector<Eigen::Vector2f> points;    // until complete
+    std::unique_ptr<rasterization::LookupTable> lookup_table;
+
+    explicit Submap(const int &anchor_id)
+    : anchor(anchor_id) {}
+}; // struct Submap
+
 class SLAM {
  public:
   // Default Constructor.
   SLAM();
 
+  // Stops the back end thread once it has optimized every queued node.
+  ~SLAM();
+
   // Create visualization publisher
   void CreateVisPublisher(ros::NodeHandle* n);
 
@@ -125,14 +215,26 @@ class SLAM {
   void ObserveOdometry(const Eigen::Vector2f& odom_loc,
                        const float odom_angle);
 
-  // Get latest map.
-  std::vector<Eigen::Vector2f> GetMap();
+  // Get latest map, one point per MAP_RESOLUTION cell; evenly subsampled down to max_points when that is non-zero.
+  std::vector<Eigen::Vector2f> GetMap(const std::size_t &max_points = 0);
 
-  // Get latest robot pose.
+  // Get latest robot pose: the newest keyframe, as last optimized, followed by odometry up to the latest reading.
   void GetPose(Eigen::Vector2f* loc, float* angle);
 
+  // Save the session as a keyframe map: the optimized pose of every node, the covariance of its sequential
+  // constraint and its scan decimated to the lookup table resolution. Waits for the back end to take in every node.
+  bool SaveMap(const std::string &file);
+
+  // Localize against a keyframe map from SaveMap instead of mapping: every scan is matched against the nearest
+  // keyframes, whose lookup tables are built the first time they are needed.
+  bool LoadMap(const std::string &file);
+
+  // Optimize and assemble the map inline in ObserveLaser even with SLAM_ASYNC_BACKEND, so that a replayed bag builds
+  // the same map on every run. Call before the first scan.
+  void OptimizeSynchronously();
+
  private:
-  ros::Publisher vis_pub_;
+  visualization::VisualizationManager visualization_;
   amrl_msgs::VisualizationMsg vis_msg_;
 
   bool odom_initialized_; // odometry flag
@@ -140,35 +242,178 @@ class SLAM {
   Pose reference_odom_pose_;
   Pose odom_change_;
   bool ready_for_slam_update_;    // motion model 
+  float odom_translation_change_;     // odometry accumulated since the last keyframe
+  float odom_rotation_change_;
+  ScanSlice overlap_slice_;   // scratch buffer for keyframeOverlap
   Pose current_pose_;
+  laser_scan::ScanCloud scan_cloud_;  // reused by every accepted scan
+  pose_tracker::PoseTracker tracker_;   // for GetPose, at odometry rate
 
   int depth_;
   int gtsam_timer_;
-  int iteration_counter_;
-  std::vector<std::shared_ptr<SequentialNode>> chain_;
   std::shared_ptr<gtsam::Pose2> starting_pose_;
 
+  // front end, on the laser callback thread: the scans and constraints of every node, and their poses as last
+  // optimized by the back end with newer nodes chained on by odometry. est_pose of a node belongs to the back end
+  // once the node is queued. Nodes are handled by id and never move.
+  keyframe_store::KeyframeStore keyframes_;   // scans of the nodes
+  keyframe_store::KeyframeStore submap_clouds_;   // points of the complete submaps
+  std::deque<int> rehydrated_;    // nodes, submaps with SLAM_SUBMAPS, or map keyframes whose tables were built, oldest first
+  node_arena::Arena<SequentialNode> chain_;
+  std::vector<gtsam::Pose2> poses_;
+  std::vector<Submap> submaps_;     // with SLAM_SUBMAPS; the last one is the active submap
+  std::vector<int> node_submaps_;   // submap each state was inserted into
+
+  // poses_ indexed by position for loop closure search; rebuilt when a new optimized snapshot has been synced
+  spatial_hash::SpatialHash pose_index_;
+  std::shared_ptr<const std::vector<gtsam::Pose2>> synced_poses_;     // snapshot last applied to poses_
+  std::size_t synced_size_;     // size of poses_ when it was
+  std::shared_ptr<const std::vector<gtsam::Pose2>> indexed_poses_;    // snapshot pose_index_ was built from
+
+  // back end: optimizes the pose graph and assembles the map, on its own thread with SLAM_ASYNC_BACKEND
+  std::vector<SequentialNode *> graph_chain_;
+  std::deque<SequentialNode *> node_queue_;    // at most SLAM_BACKEND_QUEUE_SIZE nodes, guarded by backend_mutex_
+  std::mutex backend_mutex_;
+  std::condition_variable backend_cv_;    // signalled when a node is queued or taken, and when the back end is stopped
+  std::shared_ptr<const std::vector<gtsam::Pose2>> optimized_poses_;    // read and replaced with std::atomic_load/store
+  point_map::PointMap map_;
+  std::shared_ptr<const std::vector<Eigen::Vector2f>> map_points_;     // points of map_ for GetMap, std::atomic_load/store
+  bool backend_running_;    // guarded by backend_mutex_
+  bool async_backend_;    // SLAM_ASYNC_BACKEND unless OptimizeSynchronously was called
+  std::thread backend_;
+
+  // localization only, against a loaded keyframe map: its keyframes indexed by position, and the pose last matched
+  bool localization_only_;
+  std::vector<keyframe_map::Keyframe> map_keyframes_;
+  std::vector<std::unique_ptr<rasterization::LookupTable>> map_tables_;   // of map_keyframes_, null until used
+  spatial_hash::SpatialHash keyframe_index_;
+  gtsam::Pose2 localized_pose_;
+
+  // incremental backend: sequential nodes are keyed by id, non-sequential constraints by their graph_id
+  std::unique_ptr<gtsam::ISAM2> isam_;
+  std::size_t isam_nodes_;    // number of chain nodes whose factors are in isam_
+  int isam_nonsequential_keys_;   // next free key for non-sequential constraints
+
+  // pose graph pruning: nodes before pruning_decided_ have been kept or pruned, kept_ holds the ones that were kept
+  // and kept_index_ their poses, as of the last optimization
+  std::size_t pruning_decided_;
+  std::vector<int> kept_;
+  spatial_hash::SpatialHash kept_index_;
+  bool kept_index_stale_;
+
+  void startBackend();
+  void queueNode(SequentialNode *node);
+  void stopBackend();
+  void runBackend();
+  void updateBackend(SequentialNode *node);
+  void publishVisualization(const SequentialNode &new_state);
+  void syncOptimizedPoses();
+  void useOdometryConstraint(SequentialNode &node);
+  void pruneChain();
+  void removePrunedFactors(const std::size_t &first, gtsam::FactorIndices &removed);
+  bool redundant(const SequentialNode &node) const;
+  void keptConstraint(int &parent, gtsam::Pose2 &rel_pose, gtsam::Matrix &rel_cov) const;
+
   void optimizeChain();
   bool iterateGTSAM();
+  void optimizeIncremental();
+  void resetIncremental();
+  void addNodeFactors(
+      std::size_t index,
+      gtsam::NonlinearFactorGraph &graph,
+      gtsam::Values &initial_estimate,
+      std::vector<int> &nonsequential_ids);
+  bool applyEstimate(const gtsam::Values &estimate);
 
   void iterateSLAM(
     Pose &odom,
-    std::vector<Eigen::Vector2f> &cloud);
+    const std::vector<Eigen::Vector2f> &cloud);
+  void localize(
+    const Pose &odom,
+    const std::vector<Eigen::Vector2f> &cloud);
+
+  // share of the scan, in [0, 1], that the table the next keyframe would be matched against already explains at the
+  // pose odometry predicts
+  double keyframeOverlap(
+    const Pose &odom,
+    const span::Span<Eigen::Vector2f> &cloud);
   
   std::pair<gtsam::Pose2, gtsam::Matrix> pairwiseComparison(
-      std::shared_ptr<SequentialNode> &new_node,
-      std::shared_ptr<SequentialNode> &existing_node);
-
-  std::shared_ptr<std::vector<Candidate>> generateCandidates(
-      Pose odom,
-      std::vector<double> odom_mag,
-      std::vector<Eigen::Vector2f> points,
-      std::shared_ptr<rasterization::LookupTable> &ref,
+      const SequentialNode &new_node,
+      const SequentialNode &existing_node);
+
+  std::pair<gtsam::Pose2, gtsam::Matrix> submapComparison(
+      const SequentialNode &new_node,
+      Submap &submap);
+  // constraint from matching a state just placed by the active submap against an earlier one, false without a match
+  std::variant<bool, NonsequentialNode> submapConstraint(
+      const SequentialNode &state,
+      const int &anchor,
+      rasterization::LookupTable &ref);
+  // the scan goes in at submap_pose, the pose it matched at in the anchor frame
+  void insertIntoSubmap(const SequentialNode &state, const gtsam::Pose2 &submap_pose);
+
+  CandidateAccumulator searchCandidates(
+      const Pose &odom,
+      const std::vector<double> &odom_mag,
+      const span::Span<Eigen::Vector2f> &points,
+      rasterization::LookupTable &ref,
+      motion_model::MultivariateMotionModel &motion_model);
+
+  void scoreCandidates(
+      const Pose &odom,
+      const int &periods,
+      const SearchWindow &window,
+      const span::Span<Eigen::Vector2f> &points,
+      rasterization::LookupTable &ref,
+      motion_model::MultivariateMotionModel &motion_model,
+      CandidateAccumulator &candidates);
+
+  void rotateScan(
+      const Pose &odom,
+      const int &periods,
+      const int &theta_i,
+      const span::Span<Eigen::Vector2f> &points,
+      rasterization::LookupTable &ref,
+      ScanSlice &slice);
+
+  Candidate scoreCandidate(
+      const Pose &odom,
+      const int &periods,
+      const std::array<int, 3> &offset,
+      const ScanSlice &slice,
+      rasterization::LookupTable &ref,
+      motion_model::MultivariateMotionModel &motion_model);
+
+  // with the motion prior already evaluated
+  Candidate scoreCandidate(
+      const Pose &odom,
+      const int &periods,
+      const std::array<int, 3> &offset,
+      const ScanSlice &slice,
+      rasterization::LookupTable &ref,
+      const double &p_motion);
+
+  // angle of the theta_i-th slice of a search around odom, and the translation of its (x_i, y_i) candidate
+  float sliceAngle(const Pose &odom, const int &periods, const int &theta_i);
+  Eigen::Vector2f candidateTranslation(const Pose &odom, const int &periods, const int &x_i, const int &y_i);
+
+  std::array<int, 3> branchAndBound(
+      const Pose &odom,
+      const int &periods,
+      const SearchWindow &window,
+      const span::Span<Eigen::Vector2f> &points,
+      rasterization::LookupTable &ref,
       motion_model::MultivariateMotionModel &motion_model);
-  
-  std::variant<bool, Eigen::Matrix3d> calculateCovariance(std::shared_ptr<std::vector<Candidate>> &candidates);
 
-  void detectLoops(std::shared_ptr<SequentialNode> &state);
+  void updatePoseIndex();
+  void detectLoops(SequentialNode &state);
+  rasterization::LookupTable *loopClosureTable(const int &index);
+  void ageKeyframes();
+  std::variant<bool, NonsequentialNode> matchLoopClosure(
+      const SequentialNode &state,
+      const int &i,
+      rasterization::LookupTable &ref);
 
   Eigen::Matrix3f getTransformChain(int ind2, int ind1=0);
   Eigen::Matrix3f pose2Transform(const Pose &pose);
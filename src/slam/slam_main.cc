@@ -26,6 +26,8 @@
 #include <string.h>
 #include <inttypes.h>
 #include <termios.h>
+#include <atomic>
+#include <thread>
 #include <vector>
 
 #include "eigen3/Eigen/Dense"
@@ -42,14 +44,18 @@
 #include "rosbag/view.h"
 #include "ros/package.h"
 
+#include "bag_replay/bag_replay.h"
 #include "config_reader/config_reader.h"
+#include "laser_scan/mailbox.h"
 #include "shared/math/math_util.h"
 #include "shared/math/line2d.h"
 #include "shared/util/timer.h"
 
 #include "slam.h"
+#include "profiler/profiler.h"
 #include "vector_map/vector_map.h"
 #include "visualization/visualization.h"
+#include "visualization/visualization_manager.h"
 
 using amrl_msgs::VisualizationMsg;
 using geometry::line2f;
@@ -70,51 +76,68 @@ using visualization::DrawParticle;
 DEFINE_string(laser_topic, "/scan", "Name of ROS topic for LIDAR data");
 DEFINE_string(odom_topic, "/odom", "Name of ROS topic for odometry data");
 DEFINE_string(init_topic, "/set_pose", "Name of ROS topic for initialization");
+DEFINE_string(bag, "",
+              "Replay this bag as fast as possible instead of subscribing "
+              "to the topics, and print the time every callback took");
+DEFINE_string(save_map, "",
+              "Save the session as a keyframe map to this file on exit");
+DEFINE_string(load_map, "",
+              "Only localize against the keyframe map in this file");
+DEFINE_bool(latest_scan_only, false,
+            "Live, only stash the newest messages in the callbacks and run "
+            "SLAM on a worker thread, which skips the scans that arrive "
+            "while it is busy instead of falling behind them");
 
 DECLARE_int32(v);
+DECLARE_bool(visualization);
 
 bool run_ = true;
 slam::SLAM slam_;
-ros::Publisher visualization_publisher_;
+visualization::VisualizationManager visualization_;
 ros::Publisher localization_publisher_;
 VisualizationMsg vis_msg_;
 sensor_msgs::LaserScan last_laser_msg_;
 
+// With --latest_scan_only the callbacks only post here, for ProcessLatest.
+laser_scan::Mailbox<sensor_msgs::LaserScan> laser_mailbox_;
+laser_scan::Mailbox<nav_msgs::Odometry> odom_mailbox_;
+laser_scan::Mailbox<amrl_msgs::Localization2DMsg> init_mailbox_;
+std::atomic_bool worker_running_(false);
+
 void InitializeMsgs() {
   std_msgs::Header header;
   header.frame_id = "map";
   header.seq = 0;
 
-  vis_msg_ = visualization::NewVisualizationMessage("map", "slam");
+  // kept apart from the "slam" namespace the SLAM back end draws its own debugging markers in
+  vis_msg_ = visualization::NewVisualizationMessage("map", "slam_map");
 }
 
 void PublishMap() {
-  static double t_last = 0;
-  if (GetMonotonicTime() - t_last < 0.5) {
-    // Rate-limit visualization.
+  if (!visualization_.Due(vis_msg_.ns)) {
     return;
   }
-  t_last = GetMonotonicTime();
-  vis_msg_.header.stamp = ros::Time::now();
-  ClearVisualizationMsg(vis_msg_);
-
+  // The map is a persistent layer, only the parts of it that changed are sent.
   const vector<Vector2f> map = slam_.GetMap();
-  printf("Map: %lu points\n", map.size());
-  for (const Vector2f& p : map) {
-    visualization::DrawPoint(p, 0xC0C0C0, vis_msg_);
+  if (FLAGS_v > 0) {
+    printf("Map: %lu points\n", map.size());
   }
-  visualization_publisher_.publish(vis_msg_);
+  visualization_.PublishPoints(vis_msg_.ns, "map", map, 0xC0C0C0);
 }
 
-void PublishPose() {
+// Published for every odometry and laser message, stamped with its time.
+void PublishPose(const ros::Time& stamp) {
   Vector2f robot_loc(0, 0);
   float robot_angle(0);
   slam_.GetPose(&robot_loc, &robot_angle);
   amrl_msgs::Localization2DMsg localization_msg;
+  localization_msg.header.stamp = stamp;
   localization_msg.pose.x = robot_loc.x();
   localization_msg.pose.y = robot_loc.y();
   localization_msg.pose.theta = robot_angle;
-  localization_publisher_.publish(localization_msg);
+  if (localization_publisher_) {
+    localization_publisher_.publish(localization_msg);
+  }
 }
 
 void LaserCallback(const sensor_msgs::LaserScan& msg) {
@@ -128,8 +151,8 @@ void LaserCallback(const sensor_msgs::LaserScan& msg) {
       msg.range_max,
       msg.angle_min,
       msg.angle_max);
-  // PublishMap();    // TODO uncomment
-  PublishPose();
+  PublishMap();
+  PublishPose(msg.header.stamp);
 }
 
 void OdometryCallback(const nav_msgs::Odometry& msg) {
@@ -140,6 +163,7 @@ void OdometryCallback(const nav_msgs::Odometry& msg) {
   const float odom_angle =
       2.0 * atan2(msg.pose.pose.orientation.z, msg.pose.pose.orientation.w);
   slam_.ObserveOdometry(odom_loc, odom_angle);
+  PublishPose(msg.header.stamp);
 }
 
 void InitCallback(const amrl_msgs::Localization2DMsg& msg) {
@@ -152,33 +176,113 @@ void InitCallback(const amrl_msgs::Localization2DMsg& msg) {
   slam_.InitializePose(init_loc, init_angle);
 }
 
+// Worker of --latest_scan_only, the only thread that feeds SLAM. Odometry
+// poses are absolute, so the newest one carries all the motion since the
+// last one taken, and it is applied before the scan that follows it.
+void ProcessLatest() {
+  while (worker_running_) {
+    const amrl_msgs::Localization2DMsg* init = init_mailbox_.Take();
+    if (init != nullptr) InitCallback(*init);
+    const nav_msgs::Odometry* odom = odom_mailbox_.Take();
+    if (odom != nullptr) OdometryCallback(*odom);
+    const sensor_msgs::LaserScan* laser = laser_mailbox_.Take();
+    if (laser != nullptr) {
+      LaserCallback(*laser);
+      if (FLAGS_v > 0) {
+        printf("Scans dropped: %lu of %lu\n",
+               static_cast<unsigned long>(laser_mailbox_.Dropped()),
+               static_cast<unsigned long>(laser_mailbox_.Posted()));
+      }
+    }
+    if (init == nullptr && odom == nullptr && laser == nullptr) {
+      Sleep(0.001);
+    }
+  }
+}
+
+void PostLaser(const sensor_msgs::LaserScan& msg) {
+  laser_mailbox_.Post(msg);
+}
+
+void PostOdometry(const nav_msgs::Odometry& msg) {
+  odom_mailbox_.Post(msg);
+}
+
+void PostInit(const amrl_msgs::Localization2DMsg& msg) {
+  init_mailbox_.Post(msg);
+}
+
+bool ProcessBag(const string& file) {
+  bag_replay::BagReplay replay;
+  replay.Subscribe<amrl_msgs::Localization2DMsg>(FLAGS_init_topic,
+                                                 InitCallback);
+  replay.Subscribe<sensor_msgs::LaserScan>(FLAGS_laser_topic, LaserCallback);
+  replay.Subscribe<nav_msgs::Odometry>(FLAGS_odom_topic, OdometryCallback);
+  if (!replay.Run(file)) return false;
+  replay.PrintStatistics();
+  printf("%s", profiler::Report().c_str());
+  return true;
+}
+
+bool SaveMap() {
+  return FLAGS_save_map.empty() || slam_.SaveMap(FLAGS_save_map);
+}
+
 int main(int argc, char** argv) {
   google::ParseCommandLineFlags(&argc, &argv, false);
   // Initialize ROS.
   ros::init(argc, argv, "slam");
-  ros::NodeHandle n;
   InitializeMsgs();
+  if (!FLAGS_load_map.empty() && !slam_.LoadMap(FLAGS_load_map)) {
+    return 1;
+  }
+  if (!FLAGS_bag.empty()) {
+    // Offline nothing is advertised or drawn, so no ROS master is needed.
+    FLAGS_visualization = false;
+    slam_.OptimizeSynchronously();
+    if (!ProcessBag(FLAGS_bag)) return 1;
+    return SaveMap() ? 0 : 1;
+  }
+  ros::NodeHandle n;
 
-  visualization_publisher_ =
-      n.advertise<VisualizationMsg>("visualization", 1);
+  visualization_.Init(&n);
+  visualization_.SetRate(vis_msg_.ns, 2);
   localization_publisher_ =
       n.advertise<amrl_msgs::Localization2DMsg>("localization", 1);
 
   slam_.CreateVisPublisher(&n);
 
+  const bool latest_only = FLAGS_latest_scan_only;
   ros::Subscriber laser_sub = n.subscribe(
       FLAGS_laser_topic.c_str(),
       1,
-      LaserCallback);
+      latest_only ? PostLaser : LaserCallback);
   ros::Subscriber odom_sub = n.subscribe(
       FLAGS_odom_topic.c_str(),
       1,
-      OdometryCallback);
+      latest_only ? PostOdometry : OdometryCallback);
   ros::Subscriber initial_pose_sub = n.subscribe(
       FLAGS_init_topic.c_str(),
       1,
-      InitCallback);
+      latest_only ? PostInit : InitCallback);
+  std::thread worker;
+  if (latest_only) {
+    worker_running_ = true;
+    worker = std::thread(ProcessLatest);
+  }
+  profiler::StartReporting(&n);
   ros::spin();
+  profiler::StopReporting();
+  if (latest_only) {
+    worker_running_ = false;
+    worker.join();
+    printf("Scans: %lu received, %lu dropped; odometry: %lu received, "
+           "%lu dropped\n",
+           static_cast<unsigned long>(laser_mailbox_.Posted()),
+           static_cast<unsigned long>(laser_mailbox_.Dropped()),
+           static_cast<unsigned long>(odom_mailbox_.Posted()),
+           static_cast<unsigned long>(odom_mailbox_.Dropped()));
+  }
 
-  return 0;
+  return SaveMap() ? 0 : 1;
 }
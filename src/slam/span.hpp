@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace span {
+
+// Read-only view of contiguous elements owned elsewhere, as std::span of C++20. Vectors convert to it implicitly, so
+// functions taking a span accept either.
+template <typename T>
+class Span {
+public:
+    Span()
+    : _data(nullptr), _size(0) {}
+
+    Span(const T *data, const std::size_t &size)
+    : _data(data), _size(size) {}
+
+    Span(const std::vector<T> &values)
+    : _data(values.data()), _size(values.size()) {}
+
+    const T *data() const {return _data;}
+    std::size_t size() const {return _size;}
+    bool empty() const {return _size == 0;}
+
+    const T *begin() const {return _data;}
+    const T *end() const {return _data + _size;}
+    const T &operator[](const std::size_t &i) const {return _data[i];}
+
+    std::vector<T> copy() const {return std::vector<T>(begin(), end());}
+
+private:
+    const T *_data;
+    std::size_t _size;
+
+}; // class Span
+
+} // namespace span
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace spatial_hash {
+
+// Uniform grid of ids keyed by 2D position, for radius queries that only look at the cells around the query point.
+class SpatialHash {
+public:
+    explicit SpatialHash(const double &cell_size)
+    : _cell_size(cell_size) {}
+
+    void clear()
+    {
+        _cells.clear();
+        _size = 0;
+    }
+
+    void insert(const int &id, const double &x, const double &y)
+    {
+        _cells[key(cellIndex(x), cellIndex(y))].push_back(Entry {id, x, y});
+        _size++;
+    }
+
+    std::size_t size() const
+    {
+        return _size;
+    }
+
+    // ids within radius of (x, y), each with its distance, in no particular order
+    void query(const double &x, const double &y, const double &radius, std::vector<std::pair<int, double>> &results) const
+    {
+        results.clear();
+        const std::int64_t x_min {cellIndex(x - radius)};
+        const std::int64_t x_max {cellIndex(x + radius)};
+        const std::int64_t y_min {cellIndex(y - radius)};
+        const std::int64_t y_max {cellIndex(y + radius)};
+        for (std::int64_t i = x_min; i <= x_max; i++) {
+            for (std::int64_t j = y_min; j <= y_max; j++) {
+                const auto cell {_cells.find(key(i, j))};
+                if (cell == _cells.end()) {continue;}
+                for (const auto &entry : cell->second) {
+                    const double distance {std::hypot(entry.x - x, entry.y - y)};
+                    if (distance < radius) {
+                        results.emplace_back(entry.id, distance);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        int id;
+        double x;
+        double y;
+    };
+
+    const double _cell_size;
+    std::size_t _size {};
+    std::unordered_map<std::int64_t, std::vector<Entry>> _cells;
+
+    std::int64_t cellIndex(const double &v) const
+    {
+        return static_cast<std::int64_t>(std::floor(v / _cell_size));
+    }
+
+    static std::int64_t key(const std::int64_t &i, const std::int64_t &j)
+    {
+        // shifted unsigned, a negative index would make the signed shift undefined
+        return static_cast<std::int64_t>((static_cast<std::uint64_t>(i) << 32) ^ (static_cast<std::uint64_t>(j) & 0xFFFFFFFF));
+    }
+
+}; // class SpatialHash
+
+} // namespace spatial_hash
@@ -0,0 +1,412 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    compiled_map.cc
+\brief   Binary vector map with its cleaned lines, grid indices and
+         precomputed layers, loaded by memory mapping.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "compiled_map.h"
+#include "vector_map.h"
+
+using geometry::line2f;
+using std::string;
+using std::vector;
+using Eigen::Vector2f;
+
+namespace {
+
+const char kMagic[8] = {'V', 'M', 'A', 'P', 'B', 'I', 'N', '\0'};
+const uint32_t kVersion = 1;
+
+enum SectionType : uint32_t {
+  kLines = 1,          // params: inflation radius
+  kLineGrid = 2,       // params: inflation radius, cell size
+  kDistanceField = 3,  // params: resolution, max distance
+  kRangeTable = 4,     // params: resolution, angle count
+};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_sections;
+};
+
+struct GridHeader {
+  float origin[2];
+  float cell_size;
+  int32_t width;
+  int32_t height;
+  uint32_t num_lines;
+};
+
+struct FieldHeader {
+  float origin[2];
+  int32_t width;
+  int32_t height;
+};
+
+struct RangeTableHeader {
+  int32_t num_angles;
+  uint32_t num_rows;
+  uint32_t num_points;
+  uint32_t reserved;
+};
+
+// Payloads start on 8 byte boundaries.
+size_t Align(size_t size) {
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+bool SameParam(float a, float b) {
+  return std::fabs(a - b) <= 1e-6f * std::max(1.0f, std::fabs(a));
+}
+
+template <typename T>
+void Append(const T* values, size_t count, vector<char>* payload) {
+  const char* bytes = reinterpret_cast<const char*>(values);
+  payload->insert(payload->end(), bytes, bytes + count * sizeof(T));
+}
+
+vector<char> LinesPayload(const vector<line2f>& lines) {
+  vector<float> values;
+  values.reserve(4 * lines.size());
+  for (const line2f& l : lines) {
+    values.push_back(l.p0.x());
+    values.push_back(l.p0.y());
+    values.push_back(l.p1.x());
+    values.push_back(l.p1.y());
+  }
+  vector<char> payload;
+  Append(values.data(), values.size(), &payload);
+  return payload;
+}
+
+vector<char> GridPayload(const vector_map::LineGrid& grid) {
+  GridHeader header;
+  header.origin[0] = grid.Origin().x();
+  header.origin[1] = grid.Origin().y();
+  header.cell_size = grid.CellSize();
+  header.width = grid.Width();
+  header.height = grid.Height();
+  header.num_lines = grid.NumLines();
+  vector<char> payload;
+  Append(&header, 1, &payload);
+  Append(grid.CellStart().data(), grid.CellStart().size(), &payload);
+  Append(grid.CellLines().data(), grid.CellLines().size(), &payload);
+  return payload;
+}
+
+vector<char> FieldPayload(const vector_map::DistanceField& field) {
+  FieldHeader header;
+  header.origin[0] = field.Origin().x();
+  header.origin[1] = field.Origin().y();
+  header.width = field.Width();
+  header.height = field.Height();
+  vector<char> payload;
+  Append(&header, 1, &payload);
+  Append(field.Cells().data(), field.Cells().size(), &payload);
+  return payload;
+}
+
+// Header, then the row origins, angle rows, row starts and points of the
+// table.
+vector<char> RangeTablePayload(const vector_map::RangeTable& table) {
+  RangeTableHeader header;
+  header.num_angles = table.NumAngles();
+  header.num_rows = table.NumRows();
+  header.num_points = table.NumPoints();
+  header.reserved = 0;
+  vector<char> payload;
+  Append(&header, 1, &payload);
+  Append(table.RowOrigins(), table.NumAngles(), &payload);
+  Append(table.AngleRows(), table.NumAngles() + 1, &payload);
+  Append(table.RowStart(), table.NumRows() + 1, &payload);
+  Append(table.Points(), table.NumPoints(), &payload);
+  return payload;
+}
+
+}  // namespace
+
+namespace vector_map {
+
+CompiledMap::~CompiledMap() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+}
+
+std::shared_ptr<const CompiledMap> CompiledMap::Open(const string& file) {
+  const int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) return nullptr;
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      static_cast<size_t>(info.st_size) < sizeof(FileHeader)) {
+    close(fd);
+    return nullptr;
+  }
+  void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping stays valid without the descriptor.
+  close(fd);
+  if (data == MAP_FAILED) return nullptr;
+
+  std::shared_ptr<CompiledMap> map(new CompiledMap());
+  map->data_ = static_cast<const char*>(data);
+  map->size_ = info.st_size;
+
+  FileHeader header;
+  memcpy(&header, map->data_, sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion) {
+    fprintf(stderr, "ERROR: %s is not a version %u compiled map\n",
+            file.c_str(), kVersion);
+    return nullptr;
+  }
+  const size_t table_end =
+      sizeof(FileHeader) + header.num_sections * sizeof(Section);
+  if (table_end > map->size_) {
+    fprintf(stderr, "ERROR: compiled map %s is truncated\n", file.c_str());
+    return nullptr;
+  }
+  map->sections_.resize(header.num_sections);
+  memcpy(map->sections_.data(), map->data_ + sizeof(FileHeader),
+         header.num_sections * sizeof(Section));
+  for (const Section& section : map->sections_) {
+    if (section.offset % 8 != 0 || section.offset > map->size_ ||
+        section.size > map->size_ - section.offset) {
+      fprintf(stderr, "ERROR: compiled map %s is truncated\n", file.c_str());
+      return nullptr;
+    }
+  }
+  return map;
+}
+
+bool CompiledMap::Write(const string& file,
+                        const VectorMap& map,
+                        const vector<float>& inflation_radii,
+                        const vector<std::pair<float, float>>& distance_fields,
+                        const vector<std::pair<float, int>>& range_tables) {
+  vector<Section> sections;
+  vector<vector<char>> payloads;
+  auto add = [&](uint32_t type, float param0, float param1,
+                 vector<char>&& payload) {
+    Section section;
+    section.type = type;
+    section.reserved = 0;
+    section.params[0] = param0;
+    section.params[1] = param1;
+    section.offset = 0;
+    section.size = payload.size();
+    sections.push_back(section);
+    payloads.push_back(std::move(payload));
+  };
+
+  add(kLines, 0, 0, LinesPayload(map.lines));
+  add(kLineGrid, 0, map.line_grid.CellSize(), GridPayload(map.line_grid));
+  for (const float radius : inflation_radii) {
+    const VectorMap inflated = map.Inflate(radius);
+    add(kLines, radius, 0, LinesPayload(inflated.lines));
+    add(kLineGrid, radius, inflated.line_grid.CellSize(),
+        GridPayload(inflated.line_grid));
+  }
+  for (const auto& parameters : distance_fields) {
+    DistanceField field;
+    field.Build(map.lines, parameters.first, parameters.second);
+    add(kDistanceField, parameters.first, parameters.second,
+        FieldPayload(field));
+  }
+  for (const auto& parameters : range_tables) {
+    RangeTable table;
+    table.Build(map.lines, parameters.first, parameters.second);
+    add(kRangeTable, parameters.first, parameters.second,
+        RangeTablePayload(table));
+  }
+
+  size_t offset = Align(sizeof(FileHeader) + sections.size() * sizeof(Section));
+  for (Section& section : sections) {
+    section.offset = offset;
+    offset = Align(offset + section.size);
+  }
+
+  // Written next to the target and renamed over it, so that a node opening
+  // the map meanwhile never sees a partial file.
+  const string temp_file = file + ".tmp";
+  FILE* fid = fopen(temp_file.c_str(), "wb");
+  if (fid == NULL) {
+    fprintf(stderr, "ERROR: Unable to write compiled map %s\n",
+            temp_file.c_str());
+    return false;
+  }
+  FileHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.num_sections = sections.size();
+  bool ok = fwrite(&header, sizeof(header), 1, fid) == 1;
+  ok = ok && (sections.empty() || fwrite(sections.data(), sizeof(Section),
+                                         sections.size(), fid) ==
+                                      sections.size());
+  const char padding[8] = {0};
+  for (size_t i = 0; ok && i < sections.size(); ++i) {
+    const long position = ftell(fid);
+    ok = position >= 0 && static_cast<size_t>(position) <= sections[i].offset;
+    if (!ok) break;
+    const size_t gap = sections[i].offset - position;
+    ok = (gap == 0 || fwrite(padding, 1, gap, fid) == gap) &&
+         (payloads[i].empty() ||
+          fwrite(payloads[i].data(), 1, payloads[i].size(), fid) ==
+              payloads[i].size());
+  }
+  ok = (fclose(fid) == 0) && ok;
+  if (!ok || rename(temp_file.c_str(), file.c_str()) != 0) {
+    fprintf(stderr, "ERROR: Unable to write compiled map %s\n", file.c_str());
+    remove(temp_file.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool CompiledMap::GetLines(float radius, vector<line2f>* lines) const {
+  const Section* section = Find(kLines, radius, 0);
+  if (section == nullptr || section->size % (4 * sizeof(float)) != 0) {
+    return false;
+  }
+  const size_t num_lines = section->size / (4 * sizeof(float));
+  const float* values =
+      reinterpret_cast<const float*>(data_ + section->offset);
+  lines->clear();
+  lines->reserve(num_lines);
+  for (size_t i = 0; i < num_lines; ++i, values += 4) {
+    lines->push_back(line2f(values[0], values[1], values[2], values[3]));
+  }
+  return true;
+}
+
+bool CompiledMap::GetLineGrid(float radius,
+                              float cell_size,
+                              LineGrid* grid) const {
+  const Section* section = Find(kLineGrid, radius, cell_size);
+  if (section == nullptr || section->size < sizeof(GridHeader)) return false;
+  GridHeader header;
+  memcpy(&header, data_ + section->offset, sizeof(header));
+  const int* cell_start = reinterpret_cast<const int*>(
+      data_ + section->offset + sizeof(GridHeader));
+  const size_t num_starts =
+      static_cast<size_t>(header.width) * header.height + 1;
+  const size_t available = (section->size - sizeof(GridHeader)) / sizeof(int);
+  if (header.width < 0 || header.height < 0 || num_starts > available ||
+      cell_start[num_starts - 1] < 0 ||
+      num_starts + cell_start[num_starts - 1] > available) {
+    return false;
+  }
+  grid->Assign(Vector2f(header.origin[0], header.origin[1]), header.cell_size,
+               header.width, header.height, header.num_lines, cell_start,
+               cell_start + num_starts);
+  return true;
+}
+
+bool CompiledMap::GetDistanceField(float resolution,
+                                   float max_distance,
+                                   DistanceField* field) const {
+  const Section* section = Find(kDistanceField, resolution, max_distance);
+  if (section == nullptr || section->size < sizeof(FieldHeader)) return false;
+  FieldHeader header;
+  memcpy(&header, data_ + section->offset, sizeof(header));
+  const size_t num_cells = static_cast<size_t>(header.width) * header.height;
+  if (header.width < 0 || header.height < 0 ||
+      num_cells * sizeof(float) > section->size - sizeof(FieldHeader)) {
+    return false;
+  }
+  field->Assign(Vector2f(header.origin[0], header.origin[1]), resolution,
+                max_distance, header.width, header.height,
+                reinterpret_cast<const float*>(data_ + section->offset +
+                                               sizeof(FieldHeader)));
+  return true;
+}
+
+bool CompiledMap::GetRangeTable(RangeTable* table) const {
+  const Section* section = nullptr;
+  for (const Section& s : sections_) {
+    if (s.type == kRangeTable) {
+      section = &s;
+      break;
+    }
+  }
+  if (section == nullptr || section->size < sizeof(RangeTableHeader)) {
+    return false;
+  }
+  RangeTableHeader header;
+  memcpy(&header, data_ + section->offset, sizeof(header));
+  if (header.num_angles <= 0) return false;
+  const size_t num_angles = header.num_angles;
+  const size_t expected = sizeof(RangeTableHeader) +
+      num_angles * sizeof(float) + (num_angles + 1) * sizeof(uint32_t) +
+      (static_cast<size_t>(header.num_rows) + 1) * sizeof(uint32_t) +
+      static_cast<size_t>(header.num_points) * sizeof(float);
+  if (expected > section->size) return false;
+  const char* data = data_ + section->offset + sizeof(RangeTableHeader);
+  const float* row_origins = reinterpret_cast<const float*>(data);
+  const uint32_t* angle_rows =
+      reinterpret_cast<const uint32_t*>(row_origins + num_angles);
+  const uint32_t* row_start = angle_rows + num_angles + 1;
+  const float* points =
+      reinterpret_cast<const float*>(row_start + header.num_rows + 1);
+  // Indices are checked once here so that lookups need not.
+  if (angle_rows[0] != 0 || angle_rows[num_angles] != header.num_rows ||
+      row_start[0] != 0 || row_start[header.num_rows] != header.num_points) {
+    return false;
+  }
+  for (size_t k = 0; k < num_angles; ++k) {
+    if (angle_rows[k] > angle_rows[k + 1]) return false;
+  }
+  for (size_t r = 0; r < header.num_rows; ++r) {
+    if (row_start[r] > row_start[r + 1]) return false;
+  }
+  table->Assign(section->params[0], header.num_angles, header.num_rows,
+                header.num_points, row_origins, angle_rows, row_start, points,
+                shared_from_this());
+  return true;
+}
+
+const CompiledMap::Section* CompiledMap::Find(uint32_t type,
+                                              float param0,
+                                              float param1) const {
+  for (const Section& section : sections_) {
+    if (section.type == type && SameParam(section.params[0], param0) &&
+        SameParam(section.params[1], param1)) {
+      return &section;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace vector_map
@@ -0,0 +1,105 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    compiled_map.h
+\brief   Binary vector map with its cleaned lines, grid indices and
+         precomputed layers, loaded by memory mapping.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "math/line2d.h"
+#include "vector_map/distance_field.h"
+#include "vector_map/line_grid.h"
+#include "vector_map/range_table.h"
+
+#ifndef COMPILED_MAP_H
+#define COMPILED_MAP_H
+
+namespace vector_map {
+
+struct VectorMap;
+
+// Read-only view of a file written by CompiledMap::Write. The file is mapped
+// shared, so every process that opens the same map shares its pages, and
+// layers are only copied out when they are asked for. The layout is native
+// byte order: a header, a table of sections, then the section payloads.
+//
+// Layers are keyed by the parameters they were built with: lines and grid
+// indices by the radius the map was inflated by (0 for the cleaned map
+// itself), distance fields by their resolution and max distance, range
+// tables by their resolution and angle count.
+class CompiledMap : public std::enable_shared_from_this<CompiledMap> {
+ public:
+  ~CompiledMap();
+
+  // Map file, nullptr when it cannot be read or is not a compiled map of
+  // this version.
+  static std::shared_ptr<const CompiledMap> Open(const std::string& file);
+
+  // Write the cleaned lines and grid index of map, the map inflated by each
+  // of inflation_radii, a distance field of the map for every
+  // (resolution, max distance) pair and a range table for every
+  // (resolution, angle count) pair.
+  static bool Write(
+      const std::string& file,
+      const VectorMap& map,
+      const std::vector<float>& inflation_radii,
+      const std::vector<std::pair<float, float>>& distance_fields,
+      const std::vector<std::pair<float, int>>& range_tables);
+
+  bool GetLines(float radius, std::vector<geometry::line2f>* lines) const;
+
+  // Grid index over the lines of the same radius, false when there is none
+  // or it was built with another cell size.
+  bool GetLineGrid(float radius, float cell_size, LineGrid* grid) const;
+
+  bool GetDistanceField(float resolution,
+                        float max_distance,
+                        DistanceField* field) const;
+
+  // View of the first range table stored, which keeps the map mapped for as
+  // long as the table is used. False when there is none.
+  bool GetRangeTable(RangeTable* table) const;
+
+ private:
+  struct Section {
+    uint32_t type;
+    uint32_t reserved;
+    float params[2];
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  CompiledMap() : data_(nullptr), size_(0) {}
+
+  // Section of the given type and parameters, nullptr when missing.
+  const Section* Find(uint32_t type, float param0, float param1) const;
+
+  const char* data_;
+  size_t size_;
+  std::vector<Section> sections_;
+};
+
+}  // namespace vector_map
+
+#endif  // COMPILED_MAP_H
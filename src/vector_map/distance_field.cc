@@ -0,0 +1,109 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    distance_field.cc
+\brief   Grid of distances to the nearest line of a vector map.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/geometry.h"
+#include "shared/math/line2d.h"
+#include "distance_field.h"
+
+using geometry::line2f;
+using std::max;
+using std::min;
+using std::vector;
+using Eigen::Vector2f;
+
+namespace vector_map {
+
+void DistanceField::Build(const vector<line2f>& lines,
+                          float resolution,
+                          float max_distance) {
+  resolution_ = resolution;
+  inv_resolution_ = 1.0 / resolution;
+  max_distance_ = max_distance;
+  cells_.clear();
+  width_ = 0;
+  height_ = 0;
+  if (lines.empty()) return;
+
+  // Bounding box of the map, padded so that every cell closer than
+  // max_distance to a line lies inside the grid.
+  Vector2f min_corner = lines[0].p0;
+  Vector2f max_corner = lines[0].p0;
+  for (const line2f& l : lines) {
+    min_corner = min_corner.cwiseMin(l.p0).cwiseMin(l.p1);
+    max_corner = max_corner.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  const Vector2f padding(max_distance, max_distance);
+  origin_ = min_corner - padding;
+  const Vector2f size = max_corner + padding - origin_;
+  width_ = static_cast<int>(std::ceil(size.x() * inv_resolution_)) + 1;
+  height_ = static_cast<int>(std::ceil(size.y() * inv_resolution_)) + 1;
+  cells_.assign(width_ * height_, max_distance);
+
+  // Each line only affects the cells within max_distance of it, so sweep the
+  // padded bounding box of every line and keep the closest distance.
+  const float max_sq_distance = max_distance * max_distance;
+  for (const line2f& l : lines) {
+    const Vector2f l_min = l.p0.cwiseMin(l.p1) - padding - origin_;
+    const Vector2f l_max = l.p0.cwiseMax(l.p1) + padding - origin_;
+    const int x0 = max(0, static_cast<int>(l_min.x() * inv_resolution_));
+    const int y0 = max(0, static_cast<int>(l_min.y() * inv_resolution_));
+    const int x1 = min(width_ - 1,
+                       static_cast<int>(l_max.x() * inv_resolution_));
+    const int y1 = min(height_ - 1,
+                       static_cast<int>(l_max.y() * inv_resolution_));
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        const Vector2f center =
+            origin_ + resolution_ * Vector2f(x + 0.5, y + 0.5);
+        Vector2f projection;
+        float sq_distance = 0;
+        geometry::ProjectPointOntoLineSegment(
+            center, l.p0, l.p1, &projection, &sq_distance);
+        if (sq_distance >= max_sq_distance) continue;
+        float& cell = cells_[y * width_ + x];
+        cell = min(cell, std::sqrt(sq_distance));
+      }
+    }
+  }
+}
+
+void DistanceField::Assign(const Vector2f& origin,
+                           float resolution,
+                           float max_distance,
+                           int width,
+                           int height,
+                           const float* cells) {
+  origin_ = origin;
+  resolution_ = resolution;
+  inv_resolution_ = 1.0 / resolution;
+  max_distance_ = max_distance;
+  width_ = width;
+  height_ = height;
+  cells_.assign(cells, cells + width * height);
+}
+
+}  // namespace vector_map
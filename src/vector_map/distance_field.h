@@ -0,0 +1,93 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    distance_field.h
+\brief   Grid of distances to the nearest line of a vector map.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/line2d.h"
+
+#ifndef DISTANCE_FIELD_H
+#define DISTANCE_FIELD_H
+
+namespace vector_map {
+
+// Truncated Euclidean distance from the center of each grid cell to the
+// closest map line. Distances are clamped to max_distance, and queries
+// outside of the grid return max_distance.
+class DistanceField {
+ public:
+  DistanceField() :
+      origin_(0, 0),
+      resolution_(1),
+      inv_resolution_(1),
+      max_distance_(0),
+      width_(0),
+      height_(0) {}
+
+  // Rasterize the lines into a grid with the given cell size (m). The grid
+  // covers the bounding box of the lines, padded by max_distance.
+  void Build(const std::vector<geometry::line2f>& lines,
+             float resolution,
+             float max_distance);
+
+  // Distance (m) from p to the closest line, looked up from the cell that
+  // contains p.
+  float Distance(const Eigen::Vector2f& p) const {
+    const int x = static_cast<int>((p.x() - origin_.x()) * inv_resolution_);
+    const int y = static_cast<int>((p.y() - origin_.y()) * inv_resolution_);
+    if (p.x() < origin_.x() || p.y() < origin_.y() ||
+        x >= width_ || y >= height_) {
+      return max_distance_;
+    }
+    return cells_[y * width_ + x];
+  }
+
+  // Restore a field from its raw contents, width * height cells.
+  void Assign(const Eigen::Vector2f& origin,
+              float resolution,
+              float max_distance,
+              int width,
+              int height,
+              const float* cells);
+
+  bool Empty() const { return cells_.empty(); }
+  const Eigen::Vector2f& Origin() const { return origin_; }
+  float Resolution() const { return resolution_; }
+  float MaxDistance() const { return max_distance_; }
+  int Width() const { return width_; }
+  int Height() const { return height_; }
+  const std::vector<float>& Cells() const { return cells_; }
+
+ private:
+  // World location of the corner of cell (0, 0).
+  Eigen::Vector2f origin_;
+  float resolution_;
+  float inv_resolution_;
+  float max_distance_;
+  int width_;
+  int height_;
+  // Row-major distances, width_ * height_ entries.
+  std::vector<float> cells_;
+};
+
+}  // namespace vector_map
+
+#endif  // DISTANCE_FIELD_H
@@ -0,0 +1,255 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    line_batch_test.cc
+\brief   Checks that the batch segment queries of geometry::Line, and the
+         VectorMap queries built on them, answer exactly like testing
+         every line with the scalar line2f tests.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <random>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "shared/util/timer.h"
+#include "vector_map/vector_map.h"
+
+using geometry::Line;
+using geometry::LineBatch;
+using geometry::line2f;
+using std::vector;
+using Eigen::Vector2f;
+
+namespace {
+
+// Closest hit along v0 -> v1 over every line, as VectorMap::Intersection.
+int ReferenceIntersection(const vector<line2f>& lines,
+                          const Vector2f& v0,
+                          const Vector2f& v1,
+                          Vector2f* intersection) {
+  const Vector2f d = v1 - v0;
+  const float sq_length = d.squaredNorm();
+  float closest_t = 2;
+  int closest = -1;
+  Vector2f p(0, 0);
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (!lines[i].Intersection(v0, v1, &p)) continue;
+    const float t = (p - v0).dot(d) / sq_length;
+    if (t < closest_t) {
+      closest_t = t;
+      closest = i;
+      *intersection = p;
+    }
+  }
+  return closest;
+}
+
+bool ReferenceIntersects(const vector<line2f>& lines,
+                         const Vector2f& v0,
+                         const Vector2f& v1) {
+  for (const line2f& l : lines) {
+    if (l.Intersects(v0, v1)) return true;
+  }
+  return false;
+}
+
+// Random segments of up to max_length in a square of the given size.
+vector<line2f> RandomLines(int count,
+                           float size,
+                           float max_length,
+                           std::mt19937* rng) {
+  std::uniform_real_distribution<float> position(0, size);
+  std::uniform_real_distribution<float> length(0, max_length);
+  std::uniform_real_distribution<float> angle(-M_PI, M_PI);
+  vector<line2f> lines;
+  for (int i = 0; i < count; ++i) {
+    const Vector2f p0(position(*rng), position(*rng));
+    const float a = angle(*rng);
+    lines.push_back(
+        line2f(p0, p0 + length(*rng) * Vector2f(cos(a), sin(a))));
+  }
+  return lines;
+}
+
+// Axis aligned segments on a half meter lattice, so that queries on the same
+// lattice touch endpoints, run along lines and cross exactly at corners.
+vector<line2f> LatticeLines(int count, int size, std::mt19937* rng) {
+  std::uniform_int_distribution<int> position(0, size);
+  std::uniform_int_distribution<int> length(0, 6);
+  std::bernoulli_distribution horizontal(0.5);
+  vector<line2f> lines;
+  for (int i = 0; i < count; ++i) {
+    const Vector2f p0(0.5f * position(*rng), 0.5f * position(*rng));
+    const Vector2f d = horizontal(*rng) ? Vector2f(0.5f * length(*rng), 0)
+                                        : Vector2f(0, 0.5f * length(*rng));
+    lines.push_back(line2f(p0, p0 + d));
+  }
+  return lines;
+}
+
+// The batch calls over all of lines, and over a few ranges of them that do
+// not start or end on a vector boundary.
+bool CheckBatch(const char* name,
+                const vector<line2f>& lines,
+                const vector<line2f>& queries) {
+  LineBatch<float> batch;
+  for (const line2f& l : lines) batch.Append(l);
+  const size_t ranges[][2] = {{0, lines.size()}, {3, lines.size() - 5},
+                              {1, 12}, {7, 8}, {5, 5}};
+  for (const auto& range : ranges) {
+    const vector<line2f> sub(lines.begin() + range[0],
+                             lines.begin() + range[1]);
+    for (size_t i = 0; i < queries.size(); ++i) {
+      const Vector2f& v0 = queries[i].p0;
+      const Vector2f& v1 = queries[i].p1;
+      Vector2f expected_point(0, 0);
+      const int expected = ReferenceIntersection(sub, v0, v1,
+                                                 &expected_point);
+      float t = 2;
+      Vector2f point(0, 0);
+      const int hit = Line<float>::ClosestIntersection(
+          batch, range[0], range[1], v0, v1, &t, &point);
+      const int expected_hit =
+          (expected < 0) ? -1 : static_cast<int>(expected + range[0]);
+      if (hit != expected_hit || (hit >= 0 && point != expected_point)) {
+        printf("ERROR: %s: batch query %lu (%f,%f)-(%f,%f) hit line %d at "
+               "(%f,%f), expected line %d at (%f,%f)\n", name, i, v0.x(),
+               v0.y(), v1.x(), v1.y(), hit, point.x(), point.y(),
+               expected_hit, expected_point.x(), expected_point.y());
+        return false;
+      }
+      const bool intersects = Line<float>::AnyIntersects(
+          batch, range[0], range[1], v0, v1);
+      if (intersects != ReferenceIntersects(sub, v0, v1)) {
+        printf("ERROR: %s: batch query %lu (%f,%f)-(%f,%f) Intersects %d\n",
+               name, i, v0.x(), v0.y(), v1.x(), v1.y(), intersects);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Check(const char* name,
+           const vector<line2f>& lines,
+           const vector<line2f>& queries) {
+  if (!CheckBatch(name, lines, queries)) return false;
+  const vector_map::VectorMap map(lines);
+  int hits = 0;
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const Vector2f& v0 = queries[i].p0;
+    const Vector2f& v1 = queries[i].p1;
+    Vector2f expected_point(0, 0);
+    Vector2f point(0, 0);
+    const int expected = ReferenceIntersection(lines, v0, v1,
+                                               &expected_point);
+    int line = -1;
+    const bool hit = map.Intersection(v0, v1, &point, &line);
+    const bool intersects = map.Intersects(v0, v1);
+    const bool expected_intersects = ReferenceIntersects(lines, v0, v1);
+    hits += hit;
+    if (intersects != expected_intersects) {
+      printf("ERROR: %s: query %lu (%f,%f)-(%f,%f) Intersects %d, "
+             "expected %d\n", name, i, v0.x(), v0.y(), v1.x(), v1.y(),
+             intersects, expected_intersects);
+      return false;
+    }
+    // Lines split across cells may be hit at the same point through another
+    // index, only the point has to match then.
+    if (hit != (expected >= 0) || (hit && point != expected_point)) {
+      printf("ERROR: %s: query %lu (%f,%f)-(%f,%f) hit line %d at "
+             "(%f,%f), expected line %d at (%f,%f)\n", name, i, v0.x(),
+             v0.y(), v1.x(), v1.y(), line, point.x(), point.y(), expected,
+             expected_point.x(), expected_point.y());
+      return false;
+    }
+  }
+  printf("%s: %lu lines, %lu queries, %d hits\n", name, lines.size(),
+         queries.size(), hits);
+  return true;
+}
+
+// Queries of the same map through the batch, and through the scalar test
+// of every line of the same cells.
+void Benchmark(const vector<line2f>& lines, const vector<line2f>& queries) {
+  const vector_map::VectorMap map(lines);
+  Vector2f p(0, 0);
+  int hits = 0;
+  const double t_start = GetMonotonicTime();
+  for (const line2f& q : queries) {
+    const Vector2f d = q.p1 - q.p0;
+    const float sq_length = d.squaredNorm();
+    float closest_t = 2;
+    int closest_idx = -1;
+    Vector2f hit(0, 0);
+    map.line_grid.Traverse(q.p0, q.p1,
+        [&](const int* begin, const int* end, float t_exit) {
+      for (const int* i = begin; i != end; ++i) {
+        if (!map.lines[*i].Intersection(q.p0, q.p1, &hit)) continue;
+        const float t = (hit - q.p0).dot(d) / sq_length;
+        if (t < closest_t) {
+          closest_t = t;
+          closest_idx = *i;
+          p = hit;
+        }
+      }
+      return closest_t > t_exit;
+    });
+    hits -= closest_idx >= 0;
+  }
+  const double t_scalar = GetMonotonicTime();
+  for (const line2f& q : queries) {
+    hits += map.Intersection(q.p0, q.p1, &p);
+  }
+  const double t_batch = GetMonotonicTime();
+  printf("%lu queries: batch %.1f ms, scalar %.1f ms, %lu cell entries\n",
+         queries.size(), 1e3 * (t_batch - t_scalar),
+         1e3 * (t_scalar - t_start), map.line_grid.CellLines().size());
+  if (hits != 0) printf("ERROR: %d more hits through the batch\n", hits);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::mt19937 rng(1);
+  bool ok = true;
+  const vector<line2f> touching = {
+      line2f(0, 2, 2, 0), line2f(2, 2, 3, 3), line2f(1, 1, 3, 3),
+      line2f(3, 0, 3, 3), line2f(-1, -1, 0, 0), line2f(0, 0, 2, 2),
+      line2f(1, 0, 1, 2), line2f(0, 1, 2, 1), line2f(2, 0, 2, 2),
+      line2f(0, 2, 2, 2), line2f(4, 4, 5, 5), line2f(1, 1, 1, 1),
+      line2f(0.5f, 0.5f, 1.5f, 1.5f)};
+  ok = Check("touching", touching, touching) && ok;
+  for (int i = 0; i < 3; ++i) {
+    ok = Check("random", RandomLines(2000, 50, 3, &rng),
+               RandomLines(5000, 50, 10, &rng)) && ok;
+    ok = Check("lattice", LatticeLines(2000, 80, &rng),
+               LatticeLines(5000, 80, &rng)) && ok;
+  }
+  if (!ok) return 1;
+  // Sparse cells as in most maps, and crowded ones as in inflated maps.
+  Benchmark(RandomLines(5000, 100, 3, &rng), RandomLines(200000, 100, 10,
+                                                          &rng));
+  Benchmark(RandomLines(40000, 100, 3, &rng), RandomLines(200000, 100, 10,
+                                                           &rng));
+  printf("All line batch checks passed\n");
+  return 0;
+}
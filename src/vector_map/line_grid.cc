@@ -0,0 +1,178 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    line_grid.cc
+\brief   Uniform grid index over the lines of a vector map.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "line_grid.h"
+
+using geometry::line2f;
+using std::max;
+using std::min;
+using std::vector;
+using Eigen::Vector2f;
+
+namespace {
+
+// Conservative test of whether line l passes within margin of the box.
+bool Overlaps(const line2f& l,
+              const Vector2f& box_min,
+              const Vector2f& box_max,
+              float margin) {
+  const Vector2f l_min = l.p0.cwiseMin(l.p1);
+  const Vector2f l_max = l.p0.cwiseMax(l.p1);
+  if (l_max.x() < box_min.x() - margin || l_min.x() > box_max.x() + margin ||
+      l_max.y() < box_min.y() - margin || l_min.y() > box_max.y() + margin) {
+    return false;
+  }
+  // The line misses the box if all four corners lie strictly on one side.
+  const Vector2f n = l.UnitNormal();
+  const Vector2f corners[4] = {
+    box_min, box_max, Vector2f(box_min.x(), box_max.y()),
+    Vector2f(box_max.x(), box_min.y())
+  };
+  int above = 0;
+  int below = 0;
+  for (const Vector2f& c : corners) {
+    const float d = n.dot(c - l.p0);
+    if (d > margin) ++above;
+    if (d < -margin) ++below;
+  }
+  return above < 4 && below < 4;
+}
+
+}  // namespace
+
+namespace vector_map {
+
+void LineGrid::Build(const vector<line2f>& lines, float cell_size) {
+  static const float kMargin = 1e-3;
+  cell_size_ = cell_size;
+  inv_cell_size_ = 1.0 / cell_size;
+  num_lines_ = lines.size();
+  cell_start_.clear();
+  cell_lines_.clear();
+  width_ = 0;
+  height_ = 0;
+  if (lines.empty()) return;
+
+  Vector2f min_corner = lines[0].p0;
+  Vector2f max_corner = lines[0].p0;
+  for (const line2f& l : lines) {
+    min_corner = min_corner.cwiseMin(l.p0).cwiseMin(l.p1);
+    max_corner = max_corner.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  origin_ = min_corner - Vector2f(kMargin, kMargin);
+  const Vector2f size = max_corner - origin_;
+  width_ = static_cast<int>(std::floor(size.x() * inv_cell_size_)) + 1;
+  height_ = static_cast<int>(std::floor(size.y() * inv_cell_size_)) + 1;
+
+  // Two passes: count lines per cell, then fill the compacted buckets.
+  vector<std::pair<int, int>> entries;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const line2f& l = lines[i];
+    const Vector2f l_min = l.p0.cwiseMin(l.p1) - origin_;
+    const Vector2f l_max = l.p0.cwiseMax(l.p1) - origin_;
+    const int x0 = Clamp(static_cast<int>(
+        std::floor((l_min.x() - kMargin) * inv_cell_size_)), width_);
+    const int y0 = Clamp(static_cast<int>(
+        std::floor((l_min.y() - kMargin) * inv_cell_size_)), height_);
+    const int x1 = Clamp(static_cast<int>(
+        std::floor((l_max.x() + kMargin) * inv_cell_size_)), width_);
+    const int y1 = Clamp(static_cast<int>(
+        std::floor((l_max.y() + kMargin) * inv_cell_size_)), height_);
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        const Vector2f box_min = origin_ + cell_size_ * Vector2f(x, y);
+        const Vector2f box_max = box_min + Vector2f(cell_size_, cell_size_);
+        if (Overlaps(l, box_min, box_max, kMargin)) {
+          entries.push_back(std::make_pair(y * width_ + x, i));
+        }
+      }
+    }
+  }
+  cell_start_.assign(width_ * height_ + 1, 0);
+  for (const auto& e : entries) {
+    ++cell_start_[e.first + 1];
+  }
+  for (size_t i = 1; i < cell_start_.size(); ++i) {
+    cell_start_[i] += cell_start_[i - 1];
+  }
+  cell_lines_.resize(entries.size());
+  vector<int> fill(cell_start_.begin(), cell_start_.end() - 1);
+  // Entries were generated in ascending line order, so every bucket ends up
+  // sorted as well.
+  for (const auto& e : entries) {
+    cell_lines_[fill[e.first]++] = e.second;
+  }
+}
+
+void LineGrid::Assign(const Vector2f& origin,
+                      float cell_size,
+                      int width,
+                      int height,
+                      size_t num_lines,
+                      const int* cell_start,
+                      const int* cell_lines) {
+  origin_ = origin;
+  cell_size_ = cell_size;
+  inv_cell_size_ = 1.0 / cell_size;
+  width_ = width;
+  height_ = height;
+  num_lines_ = num_lines;
+  cell_start_.assign(cell_start, cell_start + width * height + 1);
+  cell_lines_.assign(cell_lines, cell_lines + cell_start_.back());
+}
+
+void LineGrid::GetLinesInBox(const Vector2f& box_min,
+                             const Vector2f& box_max,
+                             vector<int>* line_indices) const {
+  if (Empty()) return;
+  const Vector2f lo = box_min - origin_;
+  const Vector2f hi = box_max - origin_;
+  if (hi.x() < 0 || hi.y() < 0) return;
+  const int x0 = Clamp(static_cast<int>(std::floor(lo.x() * inv_cell_size_)),
+                       width_);
+  const int y0 = Clamp(static_cast<int>(std::floor(lo.y() * inv_cell_size_)),
+                       height_);
+  const int x1 = static_cast<int>(std::floor(hi.x() * inv_cell_size_));
+  const int y1 = static_cast<int>(std::floor(hi.y() * inv_cell_size_));
+  if (x0 > x1 || y0 > y1) return;
+  const size_t first = line_indices->size();
+  for (int y = y0; y <= min(y1, height_ - 1); ++y) {
+    for (int x = x0; x <= min(x1, width_ - 1); ++x) {
+      const int cell = y * width_ + x;
+      line_indices->insert(line_indices->end(),
+                           cell_lines_.begin() + cell_start_[cell],
+                           cell_lines_.begin() + cell_start_[cell + 1]);
+    }
+  }
+  std::sort(line_indices->begin() + first, line_indices->end());
+  line_indices->erase(
+      std::unique(line_indices->begin() + first, line_indices->end()),
+      line_indices->end());
+}
+
+}  // namespace vector_map
@@ -0,0 +1,176 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    line_grid.h
+\brief   Uniform grid index over the lines of a vector map.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/line2d.h"
+
+#ifndef LINE_GRID_H
+#define LINE_GRID_H
+
+namespace vector_map {
+
+// Buckets line indices into the square cells each line passes through, so
+// that ray and segment queries only test the lines in the cells they touch.
+// The grid stores indices only; queries are answered against the same lines
+// vector the grid was built from.
+class LineGrid {
+ public:
+  LineGrid() :
+      origin_(0, 0),
+      cell_size_(1),
+      inv_cell_size_(1),
+      width_(0),
+      height_(0),
+      num_lines_(0) {}
+
+  void Build(const std::vector<geometry::line2f>& lines, float cell_size);
+
+  bool Empty() const { return cell_start_.empty(); }
+
+  // Number of lines the grid was built from.
+  size_t NumLines() const { return num_lines_; }
+
+  // Raw contents, so that a built grid can be stored and restored as is.
+  const Eigen::Vector2f& Origin() const { return origin_; }
+  float CellSize() const { return cell_size_; }
+  int Width() const { return width_; }
+  int Height() const { return height_; }
+  const std::vector<int>& CellStart() const { return cell_start_; }
+  const std::vector<int>& CellLines() const { return cell_lines_; }
+
+  // Restore a grid from its raw contents, cell_start holds width * height + 1
+  // entries and cell_lines as many as its last one says.
+  void Assign(const Eigen::Vector2f& origin,
+              float cell_size,
+              int width,
+              int height,
+              size_t num_lines,
+              const int* cell_start,
+              const int* cell_lines);
+
+  // Appends the indices of lines that may overlap the axis-aligned box, in
+  // ascending order and without duplicates.
+  void GetLinesInBox(const Eigen::Vector2f& box_min,
+                     const Eigen::Vector2f& box_max,
+                     std::vector<int>* line_indices) const;
+
+  // Walks the cells traversed by the segment p0 -> p1 in order. For every
+  // cell, visit(begin, end, t_exit) is called with the range of line indices
+  // in the cell and the segment parameter (0 at p0, 1 at p1) at which the
+  // segment leaves the cell. Traversal stops when visit returns false.
+  template <typename Visitor>
+  void Traverse(const Eigen::Vector2f& p0,
+                const Eigen::Vector2f& p1,
+                Visitor visit) const {
+    if (Empty()) return;
+    const Eigen::Vector2f d = p1 - p0;
+    const Eigen::Vector2f extent(width_ * cell_size_, height_ * cell_size_);
+    static const float kInf = std::numeric_limits<float>::infinity();
+
+    // Clip the segment to the extent of the grid.
+    float t_min = 0;
+    float t_max = 1;
+    for (int k = 0; k < 2; ++k) {
+      const float lo = origin_[k];
+      const float hi = origin_[k] + extent[k];
+      if (d[k] == 0) {
+        if (p0[k] < lo || p0[k] > hi) return;
+        continue;
+      }
+      float ta = (lo - p0[k]) / d[k];
+      float tb = (hi - p0[k]) / d[k];
+      if (ta > tb) std::swap(ta, tb);
+      t_min = std::max(t_min, ta);
+      t_max = std::min(t_max, tb);
+    }
+    if (t_min > t_max) return;
+
+    const Eigen::Vector2f start = p0 + t_min * d - origin_;
+    int x = Clamp(static_cast<int>(std::floor(start.x() * inv_cell_size_)),
+                  width_);
+    int y = Clamp(static_cast<int>(std::floor(start.y() * inv_cell_size_)),
+                  height_);
+    const int step_x = (d.x() > 0) ? 1 : -1;
+    const int step_y = (d.y() > 0) ? 1 : -1;
+    // Segment parameter at the next vertical and horizontal cell boundary.
+    float t_next_x = kInf;
+    float t_next_y = kInf;
+    float t_delta_x = kInf;
+    float t_delta_y = kInf;
+    if (d.x() != 0) {
+      const float boundary = origin_.x() + (x + (step_x > 0 ? 1 : 0)) *
+          cell_size_;
+      t_next_x = (boundary - p0.x()) / d.x();
+      t_delta_x = cell_size_ / std::fabs(d.x());
+    }
+    if (d.y() != 0) {
+      const float boundary = origin_.y() + (y + (step_y > 0 ? 1 : 0)) *
+          cell_size_;
+      t_next_y = (boundary - p0.y()) / d.y();
+      t_delta_y = cell_size_ / std::fabs(d.y());
+    }
+
+    while (true) {
+      const int cell = y * width_ + x;
+      const float t_exit = std::min(std::min(t_next_x, t_next_y), t_max);
+      if (!visit(&cell_lines_[cell_start_[cell]],
+                 &cell_lines_[cell_start_[cell + 1]],
+                 t_exit)) {
+        return;
+      }
+      if (t_exit >= t_max) return;
+      if (t_next_x < t_next_y) {
+        x += step_x;
+        t_next_x += t_delta_x;
+      } else {
+        y += step_y;
+        t_next_y += t_delta_y;
+      }
+      if (x < 0 || y < 0 || x >= width_ || y >= height_) return;
+    }
+  }
+
+ private:
+  static int Clamp(int i, int size) {
+    return std::max(0, std::min(size - 1, i));
+  }
+
+  // World location of the corner of cell (0, 0).
+  Eigen::Vector2f origin_;
+  float cell_size_;
+  float inv_cell_size_;
+  int width_;
+  int height_;
+  size_t num_lines_;
+  // Lines in cell i are cell_lines_[cell_start_[i]] ...
+  // cell_lines_[cell_start_[i + 1] - 1], cells stored row-major.
+  std::vector<int> cell_start_;
+  std::vector<int> cell_lines_;
+};
+
+}  // namespace vector_map
+
+#endif  // LINE_GRID_H
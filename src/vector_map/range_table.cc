@@ -0,0 +1,193 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    range_table.cc
+\brief   Precomputed ray casting against a static map, as a compressed
+         directional distance transform.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "range_table.h"
+
+using geometry::line2f;
+using std::max;
+using std::min;
+using std::vector;
+using Eigen::Vector2f;
+
+namespace vector_map {
+
+void RangeTable::Build(const vector<line2f>& lines,
+                       float resolution,
+                       int num_angles) {
+  resolution_ = resolution;
+  inv_resolution_ = 1.0 / resolution;
+  num_angles_ = 0;
+  owner_.reset();
+  row_origin_storage_.clear();
+  angle_row_storage_.assign(1, 0);
+  row_start_storage_.assign(1, 0);
+  point_storage_.clear();
+  if (!lines.empty() && num_angles > 0 && resolution > 0) {
+    num_angles_ = num_angles;
+    BuildRotations();
+  }
+
+  vector<vector<float>> rows;
+  for (int k = 0; k < num_angles_; ++k) {
+    // Rotated so that the rays of the bin run along +x.
+    const float c = rotations_[k].x();
+    const float s = rotations_[k].y();
+    auto rotate = [c, s](const Vector2f& p) {
+      return Vector2f(c * p.x() + s * p.y(), -s * p.x() + c * p.y());
+    };
+    float min_y = rotate(lines[0].p0).y();
+    float max_y = min_y;
+    for (const line2f& l : lines) {
+      const float y0 = rotate(l.p0).y();
+      const float y1 = rotate(l.p1).y();
+      min_y = min(min_y, min(y0, y1));
+      max_y = max(max_y, max(y0, y1));
+    }
+    const int num_rows =
+        static_cast<int>(std::floor((max_y - min_y) * inv_resolution_)) + 1;
+    rows.assign(num_rows, vector<float>());
+
+    // Each line enters and leaves every row it crosses.
+    for (const line2f& l : lines) {
+      Vector2f q0 = rotate(l.p0);
+      Vector2f q1 = rotate(l.p1);
+      if (q0.y() > q1.y()) std::swap(q0, q1);
+      const int first = min(num_rows - 1, max(0, static_cast<int>(
+          std::floor((q0.y() - min_y) * inv_resolution_))));
+      const int last = min(num_rows - 1, max(0, static_cast<int>(
+          std::floor((q1.y() - min_y) * inv_resolution_))));
+      const float dy = q1.y() - q0.y();
+      for (int j = first; j <= last; ++j) {
+        if (dy <= 0) {
+          rows[j].push_back(q0.x());
+          rows[j].push_back(q1.x());
+          continue;
+        }
+        const float row_min = min_y + j * resolution_;
+        const float t0 = max(0.0f, min(1.0f, (row_min - q0.y()) / dy));
+        const float t1 =
+            max(0.0f, min(1.0f, (row_min + resolution_ - q0.y()) / dy));
+        rows[j].push_back(q0.x() + t0 * (q1.x() - q0.x()));
+        rows[j].push_back(q0.x() + t1 * (q1.x() - q0.x()));
+      }
+    }
+
+    row_origin_storage_.push_back(min_y);
+    for (vector<float>& row : rows) {
+      std::sort(row.begin(), row.end());
+      row.erase(std::unique(row.begin(), row.end()), row.end());
+      point_storage_.insert(point_storage_.end(), row.begin(), row.end());
+      row_start_storage_.push_back(point_storage_.size());
+    }
+    angle_row_storage_.push_back(row_start_storage_.size() - 1);
+  }
+
+  num_rows_ = row_start_storage_.size() - 1;
+  num_points_ = point_storage_.size();
+  row_origins_ = row_origin_storage_.data();
+  angle_rows_ = angle_row_storage_.data();
+  row_start_ = row_start_storage_.data();
+  points_ = point_storage_.data();
+}
+
+void RangeTable::Assign(float resolution,
+                        int num_angles,
+                        size_t num_rows,
+                        size_t num_points,
+                        const float* row_origins,
+                        const uint32_t* angle_rows,
+                        const uint32_t* row_start,
+                        const float* points,
+                        std::shared_ptr<const void> owner) {
+  row_origin_storage_.clear();
+  angle_row_storage_.clear();
+  row_start_storage_.clear();
+  point_storage_.clear();
+  resolution_ = resolution;
+  inv_resolution_ = 1.0 / resolution;
+  num_angles_ = num_angles;
+  num_rows_ = num_rows;
+  num_points_ = num_points;
+  row_origins_ = row_origins;
+  angle_rows_ = angle_rows;
+  row_start_ = row_start;
+  points_ = points;
+  owner_ = std::move(owner);
+  BuildRotations();
+}
+
+float RangeTable::Range(const Vector2f& loc,
+                        float angle,
+                        float range_min,
+                        float range_max) const {
+  if (Empty()) return range_max;
+  // Nearest bin over a full turn; the second half turn runs the rays of the
+  // first half backwards.
+  const int num_bins = 2 * num_angles_;
+  int k = static_cast<int>(
+      std::floor(angle * static_cast<float>(num_angles_ / M_PI) + 0.5f));
+  if (k < 0 || k >= num_bins) {
+    k %= num_bins;
+    if (k < 0) k += num_bins;
+  }
+  const bool backward = k >= num_angles_;
+  if (backward) k -= num_angles_;
+
+  const float c = rotations_[k].x();
+  const float s = rotations_[k].y();
+  const float x = c * loc.x() + s * loc.y();
+  const float y = -s * loc.x() + c * loc.y();
+  const float row = std::floor((y - row_origins_[k]) * inv_resolution_);
+  if (row < 0 || row >= angle_rows_[k + 1] - angle_rows_[k]) return range_max;
+  const size_t r = angle_rows_[k] + static_cast<size_t>(row);
+  const float* begin = points_ + row_start_[r];
+  const float* end = points_ + row_start_[r + 1];
+
+  float range = range_max;
+  if (!backward) {
+    const float* hit = std::lower_bound(begin, end, x + range_min);
+    if (hit != end) range = *hit - x;
+  } else {
+    const float* hit = std::upper_bound(begin, end, x - range_min);
+    if (hit != begin) range = x - *(hit - 1);
+  }
+  return min(range, range_max);
+}
+
+void RangeTable::BuildRotations() {
+  rotations_.resize(num_angles_);
+  for (int k = 0; k < num_angles_; ++k) {
+    const double a = M_PI * k / num_angles_;
+    rotations_[k] = Vector2f(cos(a), sin(a));
+  }
+}
+
+}  // namespace vector_map
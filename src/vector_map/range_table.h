@@ -0,0 +1,125 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    range_table.h
+\brief   Precomputed ray casting against a static map, as a compressed
+         directional distance transform.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/line2d.h"
+
+#ifndef RANGE_TABLE_H
+#define RANGE_TABLE_H
+
+namespace vector_map {
+
+// Expected range of a ray from any pose, after Walsh and Karaman, "CDDT:
+// Fast Approximate 2D Ray Casting for Accelerated Localization" (2018).
+// Directions are discretized into num_angles bins over half a turn. For each
+// bin the map is rotated so that its rays run along +x, cut into rows of
+// the given resolution, and every row keeps the sorted x at which lines enter
+// and leave it. A ray is then answered with a binary search in its row,
+// searching backwards for the opposite direction of the bin, so the table
+// grows with the length of the lines rather than with the area of the map.
+//
+// Ranges are within about resolution / tan(incidence) of exact ray casting,
+// plus the lateral error of the angle bin at that range.
+class RangeTable {
+ public:
+  RangeTable() :
+      resolution_(1),
+      inv_resolution_(1),
+      num_angles_(0),
+      num_rows_(0),
+      num_points_(0),
+      row_origins_(nullptr),
+      angle_rows_(nullptr),
+      row_start_(nullptr),
+      points_(nullptr) {}
+
+  RangeTable(const RangeTable&) = delete;
+  RangeTable& operator=(const RangeTable&) = delete;
+
+  void Build(const std::vector<geometry::line2f>& lines,
+             float resolution,
+             int num_angles);
+
+  // View of arrays laid out as the accessors below return them, e.g. in a
+  // memory mapped compiled map that owner keeps alive.
+  void Assign(float resolution,
+              int num_angles,
+              size_t num_rows,
+              size_t num_points,
+              const float* row_origins,
+              const uint32_t* angle_rows,
+              const uint32_t* row_start,
+              const float* points,
+              std::shared_ptr<const void> owner);
+
+  // Distance from loc along angle to the first line at least range_min
+  // away, range_max when there is none closer.
+  float Range(const Eigen::Vector2f& loc,
+              float angle,
+              float range_min,
+              float range_max) const;
+
+  bool Empty() const { return num_angles_ == 0; }
+  float Resolution() const { return resolution_; }
+  int NumAngles() const { return num_angles_; }
+  size_t NumRows() const { return num_rows_; }
+  size_t NumPoints() const { return num_points_; }
+  // y of the first row of each bin, in the rotated frame of the bin.
+  const float* RowOrigins() const { return row_origins_; }
+  // First row of each bin, num_angles + 1 entries.
+  const uint32_t* AngleRows() const { return angle_rows_; }
+  // First point of each row, num_rows + 1 entries.
+  const uint32_t* RowStart() const { return row_start_; }
+  // Sorted x of the line crossings of each row, in the rotated frame.
+  const float* Points() const { return points_; }
+
+ private:
+  // Cosine and sine of the angle of each bin.
+  void BuildRotations();
+
+  float resolution_;
+  float inv_resolution_;
+  int num_angles_;
+  size_t num_rows_;
+  size_t num_points_;
+  const float* row_origins_;
+  const uint32_t* angle_rows_;
+  const uint32_t* row_start_;
+  const float* points_;
+  std::vector<Eigen::Vector2f> rotations_;
+
+  // Arrays of a built table, or what keeps the viewed ones alive.
+  std::vector<float> row_origin_storage_;
+  std::vector<uint32_t> angle_row_storage_;
+  std::vector<uint32_t> row_start_storage_;
+  std::vector<float> point_storage_;
+  std::shared_ptr<const void> owner_;
+};
+
+}  // namespace vector_map
+
+#endif  // RANGE_TABLE_H
@@ -0,0 +1,160 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    range_table_test.cc
+\brief   Checks the predicted scans of a RangeTable against ray casting the
+         lines, and that a compiled map hands back the same table.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "shared/util/timer.h"
+#include "vector_map/compiled_map.h"
+#include "vector_map/range_table.h"
+#include "vector_map/vector_map.h"
+
+using geometry::line2f;
+using std::vector;
+using Eigen::Vector2f;
+
+namespace {
+
+// Walls of a grid of rooms with doorways, and clutter inside them.
+vector<line2f> RoomLines(int rooms, float room_size, std::mt19937* rng) {
+  std::uniform_real_distribution<float> unit(0, 1);
+  vector<line2f> lines;
+  const float size = rooms * room_size;
+  const float door = 0.3f * room_size;
+  for (int i = 0; i <= rooms; ++i) {
+    for (int j = 0; j < rooms; ++j) {
+      const float a = i * room_size;
+      const float b0 = j * room_size;
+      const float b1 = b0 + room_size;
+      const bool doorway = i > 0 && i < rooms;
+      const float split = b0 + (doorway ? 0.35f * room_size : room_size);
+      lines.push_back(line2f(a, b0, a, split));
+      lines.push_back(line2f(b0, a, split, a));
+      if (doorway) {
+        lines.push_back(line2f(a, split + door, a, b1));
+        lines.push_back(line2f(split + door, a, b1, a));
+      }
+    }
+  }
+  for (int k = 0; k < rooms * rooms * 3; ++k) {
+    const Vector2f p0(size * unit(*rng), size * unit(*rng));
+    const float angle = 2 * M_PI * unit(*rng);
+    lines.push_back(line2f(p0, p0 + 0.6f * Vector2f(cos(angle), sin(angle))));
+  }
+  return lines;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::mt19937 rng(1);
+  const float kRoomSize = 5;
+  const int kRooms = 6;
+  const vector<line2f> lines = RoomLines(kRooms, kRoomSize, &rng);
+  const float kResolution = 0.05;
+  const int kAngles = 360;
+  const float kRangeMin = 0.02;
+  const float kRangeMax = 10;
+
+  vector_map::VectorMap map(lines);
+  const double t_build = GetMonotonicTime();
+  std::shared_ptr<vector_map::RangeTable> table(new vector_map::RangeTable());
+  table->Build(map.lines, kResolution, kAngles);
+  printf("Range table of %lu lines: %lu rows, %lu points, built in %.0f ms\n",
+         map.lines.size(), table->NumRows(), table->NumPoints(),
+         1e3 * (GetMonotonicTime() - t_build));
+
+  std::uniform_real_distribution<float> position(0.2, kRooms * kRoomSize - 0.2);
+  std::uniform_real_distribution<float> heading(-M_PI, M_PI);
+  const int kPoses = 2000;
+  vector<Vector2f> locs;
+  vector<float> angles;
+  for (int i = 0; i < kPoses; ++i) {
+    locs.push_back(Vector2f(position(rng), position(rng)));
+    angles.push_back(heading(rng));
+  }
+  vector<float> ray_angles;
+  for (int j = 0; j < 270; ++j) {
+    ray_angles.push_back(-0.75 * M_PI + j * 1.5 * M_PI / 270);
+  }
+
+  vector<float> expected;
+  vector<float> ranges;
+  const double t_cast = GetMonotonicTime();
+  map.GetPredictedScans(locs, angles, ray_angles, kRangeMin, kRangeMax,
+                        &expected);
+  const double t_lookup = GetMonotonicTime();
+  map.range_table = table;
+  map.GetPredictedScans(locs, angles, ray_angles, kRangeMin, kRangeMax,
+                        &ranges);
+  const double t_done = GetMonotonicTime();
+
+  // Bins and rows snap the rays, so ranges only agree up to a few cells, and
+  // rays that graze an edge may hit on one side and miss on the other.
+  vector<float> errors;
+  for (size_t k = 0; k < ranges.size(); ++k) {
+    errors.push_back(std::fabs(ranges[k] - expected[k]));
+  }
+  std::sort(errors.begin(), errors.end());
+  const float median = errors[errors.size() / 2];
+  const float p90 = errors[errors.size() * 9 / 10];
+  printf("%lu rays: ray casting %.1f ms, table %.1f ms, error median %.3f m, "
+         "90%% %.3f m\n", ranges.size(), 1e3 * (t_lookup - t_cast),
+         1e3 * (t_done - t_lookup), median, p90);
+  bool ok = true;
+  if (median > kResolution || p90 > 4 * kResolution) {
+    printf("ERROR: table ranges are too far from ray casting\n");
+    ok = false;
+  }
+
+  // The compiled map stores the table and hands back a view of it.
+  const std::string file = "/tmp/range_table_test.bin";
+  vector_map::VectorMap compiled;
+  if (!vector_map::CompiledMap::Write(file, vector_map::VectorMap(lines), {},
+                                      {}, {std::make_pair(kResolution,
+                                                          kAngles)}) ||
+      !compiled.LoadCompiled(file) || compiled.range_table == nullptr) {
+    printf("ERROR: the compiled map has no range table\n");
+    return 1;
+  }
+  remove(file.c_str());
+  vector<float> compiled_ranges;
+  compiled.GetPredictedScans(locs, angles, ray_angles, kRangeMin, kRangeMax,
+                             &compiled_ranges);
+  if (compiled_ranges != ranges) {
+    printf("ERROR: the compiled range table answers differently\n");
+    ok = false;
+  }
+  if (!ok) return 1;
+  printf("All range table checks passed\n");
+  return 0;
+}
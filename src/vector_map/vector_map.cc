@@ -20,8 +20,13 @@
 //========================================================================
 
 #include "stdio.h"
+#include <sys/stat.h>
 
 #include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
 #include <utility>
 #include <vector>
 
@@ -33,6 +38,8 @@
 #include "shared/math/line2d.h"
 #include "shared/math/math_util.h"
 #include "shared/util/timer.h"
+#include "profiler/profiler.h"
+#include "compiled_map.h"
 #include "vector_map.h"
 
 using math_util::AngleMod;
@@ -54,6 +61,13 @@ using std::swap;
 DEFINE_double(min_line_length,
               0.05,
               "Minimum line length to consider for Analytic ray casting");
+DEFINE_double(map_index_cell_size,
+              1.0,
+              "Cell size (m) of the grid index over map lines");
+DEFINE_double(predicted_scan_tile_size,
+              1.0,
+              "Size (m) of the tiles whose poses share scene lines in "
+              "GetPredictedScans");
 
 namespace vector_map {
 
@@ -197,17 +211,27 @@ void TrimOcclusion(const Vector2f& loc,
 void VectorMap::GetSceneLines(const Vector2f& loc,
                               float max_range,
                               vector<line2f>* lines_list) const {
+  GetSceneLines(loc, max_range, lines_list, nullptr);
+}
+
+void VectorMap::GetSceneLines(const Vector2f& loc,
+                              float max_range,
+                              vector<line2f>* lines_list,
+                              vector<int>* line_idx) const {
   const float x_min = loc.x() - max_range;
   const float y_min = loc.y() - max_range;
   const float x_max = loc.x() + max_range;
   const float y_max = loc.y() + max_range;
   lines_list->clear();
-  for (const line2f& l : lines) {
+  if (line_idx != nullptr) line_idx->clear();
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const line2f& l = lines[i];
     if (l.p0.x() < x_min && l.p1.x() < x_min) continue;
     if (l.p0.y() < y_min && l.p1.y() < y_min) continue;
     if (l.p0.x() > x_max && l.p1.x() > x_max) continue;
     if (l.p0.y() > y_max && l.p1.y() > y_max) continue;
     lines_list->push_back(l);
+    if (line_idx != nullptr) line_idx->push_back(i);
   }
 }
 
@@ -254,6 +278,43 @@ void VectorMap::SceneRender(const Vector2f& loc,
   }
 }
 
+// Shortens *ray_end to the closest intersection of the ray from loc with any
+// map line other than skip_line_idx, and returns the index of that line, or
+// -1 if there is none.
+int GetRayIntersection(const VectorMap& map,
+                       const Vector2f& loc,
+                       const int skip_line_idx,
+                       Vector2f* ray_end) {
+  Vector2f intersection(0, 0);
+  int intersecting_line_idx = -1;
+  const Vector2f d = *ray_end - loc;
+  const float sq_length = d.squaredNorm();
+  float closest_t = 2;
+  Vector2f closest(0, 0);
+  const int* cell_lines = map.line_grid.CellLines().data();
+  map.line_grid.Traverse(loc, *ray_end,
+      [&](const int* begin, const int* end, float t_exit) {
+    Line<float>::ForEachCandidate(map.cell_segments, begin - cell_lines,
+        end - cell_lines, loc, *ray_end, [&](size_t slot) {
+      const int i = cell_lines[slot];
+      if (i == skip_line_idx) return true;
+      if (map.lines[i].Intersection(loc, *ray_end, &intersection)) {
+        const float t = (intersection - loc).dot(d) / sq_length;
+        if (t < closest_t) {
+          closest_t = t;
+          closest = intersection;
+          intersecting_line_idx = i;
+        }
+      }
+      return true;
+    });
+    // Lines in later cells can only be hit further along the ray.
+    return closest_t > t_exit;
+  });
+  if (intersecting_line_idx >= 0) *ray_end = closest;
+  return intersecting_line_idx;
+}
+
 int GetRayIntersection(const Vector2f& loc,
                        const size_t skip_line_idx,
                        const vector<line2f>& lines_list,
@@ -278,7 +339,17 @@ void VectorMap::RayCast(const Vector2f& loc,
 
   // Small optimization: ignore all lines not within max_range.
   vector<line2f> lines_list;
-  GetSceneLines(loc, max_range, &lines_list);
+  vector<int> scene_line_idx;
+  GetSceneLines(loc, max_range, &lines_list, &scene_line_idx);
+
+  // With the grid index, rays only test the lines in the cells they cross.
+  const bool use_index = IndexValid();
+  auto ray_intersection = [&](size_t i, Vector2f* ray_end) {
+    if (use_index) {
+      return GetRayIntersection(*this, loc, scene_line_idx[i], ray_end);
+    }
+    return GetRayIntersection(loc, i, lines_list, ray_end);
+  };
 
   // NOTE(joydeep): In this function, "iidx" refers to the index of
   // the line segment from lines_list that intersects with the associated
@@ -300,8 +371,8 @@ void VectorMap::RayCast(const Vector2f& loc,
     // Add rays from loc to just inside of the line segment.
     Vector2f r0 = l.p0 + dir;
     Vector2f r1 = l.p1 - dir;
-    int r0_iidx = GetRayIntersection(loc, i, lines_list, &r0);
-    int r1_iidx = GetRayIntersection(loc, i, lines_list, &r1);
+    int r0_iidx = ray_intersection(i, &r0);
+    int r1_iidx = ray_intersection(i, &r1);
     if (r0_iidx < 0) r0_iidx = i;
     if (r1_iidx < 0) r1_iidx = i;
     ray_cast_rays.push_back(RayCastRay(r0, r0_iidx));
@@ -310,8 +381,8 @@ void VectorMap::RayCast(const Vector2f& loc,
     // Add rays from loc to max_range just past the line segment.
     Vector2f end_p0 = loc + (l.p0 - dir - loc).normalized() * max_range;
     Vector2f end_p1 = loc + (l.p1 + dir - loc).normalized() * max_range;
-    const int end_p0_iidx = GetRayIntersection(loc, i, lines_list, &end_p0);
-    const int end_p1_iidx = GetRayIntersection(loc, i, lines_list, &end_p1);
+    const int end_p0_iidx = ray_intersection(i, &end_p0);
+    const int end_p1_iidx = ray_intersection(i, &end_p1);
     if (end_p0_iidx >= 0) {
       ray_cast_rays.push_back(RayCastRay(end_p0, end_p0_iidx));
     }
@@ -342,14 +413,73 @@ void VectorMap::Cleanup() {
   // const float kMinLineLength = 2.0 * kShrinkDistance;
   const float kMinLineLength = 0.05;
   vector<line2f> new_lines;
+  if (lines.empty()) return;
+
+  // Lines that pass are bucketed by the cells of a grid their bounding boxes
+  // cover. Two lines only intersect where their bounding boxes overlap, and
+  // any point of the overlap falls in a cell both cover, so every line only
+  // needs to be tested against the ones sharing a cell with it. Those are
+  // tested in the order they were added, the first hit splits the line, same
+  // as when testing all of them.
+  Vector2f min_corner = lines[0].p0;
+  Vector2f max_corner = lines[0].p0;
+  for (const line2f& l : lines) {
+    min_corner = min_corner.cwiseMin(l.p0).cwiseMin(l.p1);
+    max_corner = max_corner.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  const Vector2f extent = max_corner - min_corner;
+  const int cells_per_side = std::max(
+      1, std::min(1024, static_cast<int>(std::sqrt(lines.size()))));
+  float cell_size = std::max(extent.x(), extent.y()) / cells_per_side;
+  if (!(cell_size > 0)) cell_size = 1;
+  const float inv_cell_size = 1.0 / cell_size;
+  const int width = std::max(
+      1, std::min(cells_per_side,
+                  static_cast<int>(extent.x() * inv_cell_size) + 1));
+  const int height = std::max(
+      1, std::min(cells_per_side,
+                  static_cast<int>(extent.y() * inv_cell_size) + 1));
+  // Cell ranges are clamped to the grid, split lines may stick out of it
+  // by the shrink distance.
+  auto cell_range = [&](const line2f& l, int* x0, int* y0, int* x1, int* y1) {
+    const Vector2f l_min = l.p0.cwiseMin(l.p1) - min_corner;
+    const Vector2f l_max = l.p0.cwiseMax(l.p1) - min_corner;
+    auto clamp = [](float v, int size) {
+      return std::max(0, std::min(size - 1,
+                                  static_cast<int>(std::floor(v))));
+    };
+    *x0 = clamp(l_min.x() * inv_cell_size, width);
+    *y0 = clamp(l_min.y() * inv_cell_size, height);
+    *x1 = clamp(l_max.x() * inv_cell_size, width);
+    *y1 = clamp(l_max.y() * inv_cell_size, height);
+  };
+  vector<vector<int>> buckets(width * height);
+  vector<size_t> seen;        // Last line i each kept line was gathered for
+  vector<int> candidates;
+
   for (size_t i = 0; i < lines.size(); ++i) {
-    const line2f& l1 = lines[i];
+    // Copied, splits are appended to lines.
+    const line2f l1 = lines[i];
     if (l1.Length() < kMinLineLength) continue;
+    int x0, y0, x1, y1;
+    cell_range(l1, &x0, &y0, &x1, &y1);
+    candidates.clear();
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        for (const int j : buckets[y * width + x]) {
+          if (seen[j] != i) {
+            seen[j] = i;
+            candidates.push_back(j);
+          }
+        }
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
     // Check if l1 intersects with any line in new lines.
     Vector2f p;
     bool intersection = false;
-    for (const line2f l2 : new_lines) {
-      if (l2.Intersection(l1, &p)) {
+    for (const int j : candidates) {
+      if (new_lines[j].Intersection(l1, &p)) {
         const Vector2f shrink = kShrinkDistance * l1.Dir();
         const line2f a = line2f(l1.p0, p - shrink);
         const line2f b = line2f(p + shrink, l1.p1);
@@ -360,7 +490,16 @@ void VectorMap::Cleanup() {
       }
     }
     // No intersection, add it!
-    if (!intersection) new_lines.push_back(l1);
+    if (!intersection) {
+      const int j = new_lines.size();
+      new_lines.push_back(l1);
+      seen.push_back(i);
+      for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+          buckets[y * width + x].push_back(j);
+        }
+      }
+    }
   }
 
   for (line2f& l : new_lines) {
@@ -370,6 +509,20 @@ void VectorMap::Cleanup() {
 }
 
 void VectorMap::Load(const string& file) {
+  const string compiled_file = file + ".bin";
+  struct stat text_info;
+  struct stat compiled_info;
+  if (stat(file.c_str(), &text_info) == 0 &&
+      stat(compiled_file.c_str(), &compiled_info) == 0 &&
+      compiled_info.st_mtime >= text_info.st_mtime &&
+      LoadCompiled(compiled_file)) {
+    file_name = file;
+    return;
+  }
+  LoadText(file);
+}
+
+void VectorMap::LoadText(const string& file) {
   FILE* fid = fopen(file.c_str(), "r");
   if (fid == NULL) {
     fprintf(stderr, "ERROR: Unable to load map %s\n", file.c_str());
@@ -382,14 +535,151 @@ void VectorMap::Load(const string& file) {
   }
   fclose(fid);
   Cleanup();
+  BuildIndex();
+  compiled.reset();
+  range_table.reset();
   file_name = file;
 }
 
-bool VectorMap::Intersects(const Vector2f& v0, const Vector2f& v1) const {
+bool VectorMap::LoadCompiled(const string& file) {
+  std::shared_ptr<const CompiledMap> map = CompiledMap::Open(file);
+  vector<line2f> map_lines;
+  if (map == nullptr || !map->GetLines(0, &map_lines)) return false;
+  lines.swap(map_lines);
+  // The stored index is only reused when it has the cell size asked for.
+  if (map->GetLineGrid(0, FLAGS_map_index_cell_size, &line_grid) &&
+      line_grid.NumLines() == lines.size()) {
+    BuildCellSegments();
+  } else {
+    BuildIndex();
+  }
+  compiled = map;
+  std::shared_ptr<RangeTable> table(new RangeTable());
+  if (map->GetRangeTable(table.get())) {
+    range_table = table;
+  } else {
+    range_table.reset();
+  }
+  file_name = file;
+  return true;
+}
+
+void VectorMap::BuildIndex() {
+  line_grid.Build(lines, FLAGS_map_index_cell_size);
+  BuildCellSegments();
+}
+
+void VectorMap::BuildCellSegments() {
+  const vector<int>& cell_lines = line_grid.CellLines();
+  cell_segments.Clear();
+  cell_segments.Reserve(cell_lines.size());
+  for (const int i : cell_lines) cell_segments.Append(lines[i]);
+}
+
+VectorMap VectorMap::Inflate(float radius) const {
+  if (compiled != nullptr) {
+    VectorMap map;
+    if (compiled->GetLines(radius, &map.lines)) {
+      if (compiled->GetLineGrid(radius, FLAGS_map_index_cell_size,
+                                &map.line_grid) &&
+          map.line_grid.NumLines() == map.lines.size()) {
+        map.BuildCellSegments();
+      } else {
+        map.BuildIndex();
+      }
+      return map;
+    }
+  }
+  vector<line2f> inflated;
+  inflated.reserve(4 * lines.size());
   for (const line2f& l : lines) {
-    if (l.Intersects(v0, v1)) return true;
+    const float length = l.Length();
+    // Degenerate lines are inflated into an axis-aligned square.
+    const Vector2f along = (length > 0) ?
+        Vector2f(radius * (l.p1 - l.p0) / length) : Vector2f(radius, 0);
+    const Vector2f across(-along.y(), along.x());
+    const Vector2f p0 = l.p0 - along;
+    const Vector2f p1 = l.p1 + along;
+    inflated.push_back(line2f(p0 + across, p1 + across));
+    inflated.push_back(line2f(p0 - across, p1 - across));
+    inflated.push_back(line2f(p0 + across, p0 - across));
+    inflated.push_back(line2f(p1 + across, p1 - across));
+  }
+  return VectorMap(inflated);
+}
+
+void VectorMap::GetDistanceField(float resolution,
+                                 float max_distance,
+                                 DistanceField* field) const {
+  if (compiled != nullptr &&
+      compiled->GetDistanceField(resolution, max_distance, field)) {
+    return;
   }
-  return false;
+  field->Build(lines, resolution, max_distance);
+}
+
+bool VectorMap::Intersects(const Vector2f& v0, const Vector2f& v1) const {
+  if (!IndexValid()) {
+    for (const line2f& l : lines) {
+      if (l.Intersects(v0, v1)) return true;
+    }
+    return false;
+  }
+  const int* cell_lines = line_grid.CellLines().data();
+  bool intersects = false;
+  line_grid.Traverse(v0, v1, [&](const int* begin, const int* end, float) {
+    intersects = Line<float>::AnyIntersects(
+        cell_segments, begin - cell_lines, end - cell_lines, v0, v1);
+    return !intersects;
+  });
+  return intersects;
+}
+
+bool VectorMap::Intersection(const Vector2f& v0,
+                             const Vector2f& v1,
+                             Vector2f* intersection,
+                             int* line_idx) const {
+  const Vector2f d = v1 - v0;
+  const float sq_length = d.squaredNorm();
+  float closest_t = 2;
+  int closest_idx = -1;
+  Vector2f p(0, 0);
+  auto test_line = [&](int i) {
+    if (lines[i].Intersection(v0, v1, &p)) {
+      const float t = (p - v0).dot(d) / sq_length;
+      if (t < closest_t) {
+        closest_t = t;
+        closest_idx = i;
+        *intersection = p;
+      }
+    }
+  };
+  if (IndexValid()) {
+    const int* cell_lines = line_grid.CellLines().data();
+    line_grid.Traverse(v0, v1,
+        [&](const int* begin, const int* end, float t_exit) {
+      const int slot = Line<float>::ClosestIntersection(
+          cell_segments, begin - cell_lines, end - cell_lines, v0, v1,
+          &closest_t, intersection);
+      if (slot >= 0) closest_idx = cell_lines[slot];
+      return closest_t > t_exit;
+    });
+  } else {
+    for (size_t i = 0; i < lines.size(); ++i) test_line(i);
+  }
+  if (line_idx != nullptr) *line_idx = closest_idx;
+  return closest_idx >= 0;
+}
+
+void VectorMap::GetLinesInBox(const Vector2f& box_min,
+                              const Vector2f& box_max,
+                              vector<int>* line_indices) const {
+  line_indices->clear();
+  if (IndexValid()) {
+    line_grid.GetLinesInBox(box_min, box_max, line_indices);
+    return;
+  }
+  for (size_t i = 0; i < lines.size(); ++i) line_indices->push_back(i);
 }
 
 void VectorMap::GetPredictedScan(const Vector2f& loc,
@@ -399,8 +689,7 @@ void VectorMap::GetPredictedScan(const Vector2f& loc,
                                  float angle_max,
                                  int num_rays,
                                  vector<float>* scan_ptr) {
-  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
-  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
+  PROFILE_SCOPE("GetPredictedScan");
   vector<float>& scan = *scan_ptr;
   vector<line2f> raycast;
   SceneRender(loc, range_max, angle_min, angle_max, &raycast);
@@ -435,18 +724,224 @@ void VectorMap::GetPredictedScan(const Vector2f& loc,
   if (line_cast.empty()) {
     return;
   }
-  // Iterate over the ray cast, filling the angles
+  // Sweep the rays in order of angle. A line cast becomes active when the
+  // sweep reaches the start of its interval and expires past its end. Each
+  // ray takes the first active line cast in line_cast order, the same one
+  // testing them all in order finds. Wrapping intervals are split into the
+  // part up to pi and the part from -pi.
+  struct Interval {
+    float a0;
+    float a1;
+    int line;
+  };
+  const float kInf = std::numeric_limits<float>::infinity();
+  vector<Interval> intervals;
+  intervals.reserve(2 * line_cast.size());
+  for (size_t j = 0; j < line_cast.size(); ++j) {
+    const LineCast& l = line_cast[j];
+    if (l.wraps_around) {
+      intervals.push_back({l.a0, kInf, static_cast<int>(j)});
+      intervals.push_back({-kInf, l.a1, static_cast<int>(j)});
+    } else {
+      intervals.push_back({l.a0, l.a1, static_cast<int>(j)});
+    }
+  }
+  std::sort(intervals.begin(), intervals.end(),
+            [](const Interval& a, const Interval& b) { return a.a0 < b.a0; });
+
   scan.resize(num_rays);
   const float da = (angle_max - angle_min) / static_cast<float>(num_rays);
+  vector<float> ray_angles(num_rays);
   for (int i = 0; i < num_rays; ++i) {
-    const float a = AngleMod(angle_min + static_cast<float>(i) * da);
-    for (const LineCast& l : line_cast) {
-      if ((!l.wraps_around && l.a0 <= a && l.a1 >= a) ||
-          (l.wraps_around && (l.a0 <= a || l.a1 >= a))) {
-        const Vector2f n = l.line.UnitNormal();
-        const Vector2f r(cos(a), sin(a));
-        scan[i] = n.dot(l.line.p0) / n.dot(r);
-        break;
+    ray_angles[i] = AngleMod(angle_min + static_cast<float>(i) * da);
+  }
+  // Ray directions are rotated along from the first one instead of taking
+  // the cosine and sine of every ray, and reset every so often so that the
+  // error stays far below float precision.
+  const int kResetInterval = 64;
+  const double cos_da = cos(static_cast<double>(da));
+  const double sin_da = sin(static_cast<double>(da));
+  double ray_x = 0;
+  double ray_y = 0;
+  // Active line casts by index, with the end of their interval. Expired ones
+  // are only dropped once they reach the top.
+  std::priority_queue<std::pair<int, float>,
+                      vector<std::pair<int, float>>,
+                      std::greater<std::pair<int, float>>> active;
+  size_t next = 0;
+  for (int i = 0; i < num_rays; ++i) {
+    const float a = ray_angles[i];
+    if (i % kResetInterval == 0) {
+      ray_x = cos(angle_min + static_cast<double>(i) * da);
+      ray_y = sin(angle_min + static_cast<double>(i) * da);
+    } else {
+      const double x = ray_x * cos_da - ray_y * sin_da;
+      ray_y = ray_x * sin_da + ray_y * cos_da;
+      ray_x = x;
+    }
+    // The angles go up along the scan, except where it wraps around at pi
+    // and the sweep starts over.
+    if (i > 0 && a < ray_angles[i - 1]) {
+      next = 0;
+      active = decltype(active)();
+    }
+    for (; next < intervals.size() && intervals[next].a0 <= a; ++next) {
+      active.push(std::make_pair(intervals[next].line, intervals[next].a1));
+    }
+    while (!active.empty() && active.top().second < a) active.pop();
+    if (active.empty()) continue;
+    const LineCast& l = line_cast[active.top().first];
+    const Vector2f n = l.line.UnitNormal();
+    const Vector2f r(ray_x, ray_y);
+    scan[i] = n.dot(l.line.p0) / n.dot(r);
+  }
+}
+
+void VectorMap::GetPredictedScans(const vector<Vector2f>& locs,
+                                  const vector<float>& angles,
+                                  const vector<float>& ray_angles,
+                                  float range_min,
+                                  float range_max,
+                                  vector<float>* ranges_ptr) const {
+  PROFILE_SCOPE("GetPredictedScans");
+  vector<float>& ranges = *ranges_ptr;
+  const int num_poses = locs.size();
+  const int num_rays = ray_angles.size();
+  ranges.assign(static_cast<size_t>(num_poses) * num_rays, range_max);
+  if (num_poses == 0 || num_rays == 0 || lines.empty()) return;
+
+  // One lookup per ray in the precomputed table.
+  if (range_table != nullptr) {
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < num_poses; ++i) {
+      float* scan = &ranges[static_cast<size_t>(i) * num_rays];
+      for (int j = 0; j < num_rays; ++j) {
+        scan[j] = range_table->Range(locs[i], angles[i] + ray_angles[j],
+                                     range_min, range_max);
+      }
+    }
+    return;
+  }
+
+  // Ray angles and directions from the first ray, in the sensor frame.
+  vector<float> ray_offsets(num_rays);
+  vector<Vector2f> ray_dirs(num_rays);
+  for (int j = 0; j < num_rays; ++j) {
+    ray_offsets[j] = ray_angles[j] - ray_angles[0];
+    ray_dirs[j] = Vector2f(cos(ray_offsets[j]), sin(ray_offsets[j]));
+  }
+
+  // Group the poses by tile, and gather the lines within range_max of each
+  // tile once for all of its poses.
+  const float tile_size = FLAGS_predicted_scan_tile_size;
+  auto tile_of = [&](const Vector2f& loc) {
+    return std::make_pair(static_cast<int>(std::floor(loc.x() / tile_size)),
+                          static_cast<int>(std::floor(loc.y() / tile_size)));
+  };
+  vector<int> order(num_poses);
+  for (int i = 0; i < num_poses; ++i) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return tile_of(locs[a]) < tile_of(locs[b]);
+  });
+  vector<int> tile_start;
+  for (int k = 0; k < num_poses; ++k) {
+    if (k == 0 || tile_of(locs[order[k]]) != tile_of(locs[order[k - 1]])) {
+      tile_start.push_back(k);
+    }
+  }
+  const int num_tiles = tile_start.size();
+  tile_start.push_back(num_poses);
+  vector<vector<int>> tile_lines(num_tiles);
+  const bool use_index = IndexValid();
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic)
+#endif
+  for (int t = 0; t < num_tiles; ++t) {
+    const std::pair<int, int> tile = tile_of(locs[order[tile_start[t]]]);
+    const Vector2f box_min = tile_size * Vector2f(tile.first, tile.second) -
+        Vector2f(range_max, range_max);
+    const Vector2f box_max = box_min +
+        Vector2f(tile_size + 2 * range_max, tile_size + 2 * range_max);
+    if (use_index) {
+      line_grid.GetLinesInBox(box_min, box_max, &tile_lines[t]);
+      continue;
+    }
+    for (size_t i = 0; i < lines.size(); ++i) {
+      const line2f& l = lines[i];
+      if ((l.p0.x() < box_min.x() && l.p1.x() < box_min.x()) ||
+          (l.p0.y() < box_min.y() && l.p1.y() < box_min.y()) ||
+          (l.p0.x() > box_max.x() && l.p1.x() > box_max.x()) ||
+          (l.p0.y() > box_max.y() && l.p1.y() > box_max.y())) {
+        continue;
+      }
+      tile_lines[t].push_back(i);
+    }
+  }
+
+  // Every line is projected onto the rays it spans, keeping the closest hit
+  // of each ray, so no occlusion has to be resolved between lines.
+  const float kAngleMargin = 1e-4;
+  const float sq_range_max = Sq(range_max);
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic, 16)
+#endif
+  for (int k = 0; k < num_poses; ++k) {
+    const int i = order[k];
+    const int t = std::upper_bound(tile_start.begin(), tile_start.end(), k) -
+        tile_start.begin() - 1;
+    const Vector2f& loc = locs[i];
+    const Eigen::Rotation2Df to_sensor(-angles[i] - ray_angles[0]);
+    float* scan = &ranges[static_cast<size_t>(i) * num_rays];
+    // Closest hit per ray, then the rays between first and last.
+    auto project = [&](const Vector2f& q0, const Vector2f& e, int first,
+                       int last) {
+      for (int j = std::max(first, 0); j <= std::min(last, num_rays - 1);
+           ++j) {
+        const Vector2f& u = ray_dirs[j];
+        const float denom = Cross(u, e);
+        if (denom == 0) continue;
+        const float s = Cross(q0, u) / denom;
+        const float range = Cross(q0, e) / denom;
+        if (s >= 0 && s <= 1 && range >= range_min && range < scan[j]) {
+          scan[j] = range;
+        }
+      }
+    };
+    for (const int line_idx : tile_lines[t]) {
+      const line2f& l = lines[line_idx];
+      // Lines beyond range_max of the pose itself are not seen.
+      const Vector2f e_map = l.p1 - l.p0;
+      const float sq_length = e_map.squaredNorm();
+      const float along = (sq_length > 0) ?
+          std::max(0.f, std::min(1.f, (loc - l.p0).dot(e_map) / sq_length)) :
+          0.f;
+      if ((l.p0 + along * e_map - loc).squaredNorm() > sq_range_max) continue;
+
+      // Ends in the frame of the first ray, counterclockwise from q0 to q1.
+      Vector2f q0 = to_sensor * (l.p0 - loc);
+      Vector2f q1 = to_sensor * (l.p1 - loc);
+      const float cross = Cross(q0, q1);
+      if (cross == 0) continue;
+      if (cross < 0) swap(q0, q1);
+      float a0 = atan2(q0.y(), q0.x());
+      float span = atan2(q1.y(), q1.x()) - a0;
+      if (span < 0) span += 2 * M_PI;
+      if (a0 < 0) a0 += 2 * M_PI;
+      const Vector2f e = q1 - q0;
+      // Rays spanned by the line, and again a turn earlier for scans that
+      // wrap around.
+      for (const float start : {a0, a0 - static_cast<float>(2 * M_PI)}) {
+        const int first = std::lower_bound(ray_offsets.begin(),
+                                           ray_offsets.end(),
+                                           start - kAngleMargin) -
+            ray_offsets.begin();
+        const int last = std::upper_bound(ray_offsets.begin(),
+                                          ray_offsets.end(),
+                                          start + span + kAngleMargin) -
+            ray_offsets.begin() - 1;
+        project(q0, e, first, last);
       }
     }
   }
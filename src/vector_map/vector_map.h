@@ -19,17 +19,23 @@
 */
 //========================================================================
 
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "eigen3/Eigen/Dense"
 #include "math/line2d.h"
+#include "vector_map/distance_field.h"
+#include "vector_map/line_grid.h"
+#include "vector_map/range_table.h"
 
 #ifndef VECTOR_MAP_H
 #define VECTOR_MAP_H
 
 namespace vector_map {
 
+class CompiledMap;
+
 // Checks if any part of trim_line is occluded by test_line when seen from
 // loc, and if so, trim_line is trimmed accordingly, adding sub-lines to
 // scene_lines if necessary.
@@ -41,7 +47,9 @@ void TrimOcclusion(const Eigen::Vector2f& loc,
 struct VectorMap {
   VectorMap() {}
   explicit VectorMap(const std::vector<geometry::line2f>& lines) :
-      lines(lines) {}
+      lines(lines) {
+    BuildIndex();
+  }
   explicit VectorMap(const std::string& file) {
     Load(file);
   }
@@ -50,6 +58,12 @@ struct VectorMap {
                      float max_range,
                      std::vector<geometry::line2f>* lines_list) const;
 
+  // Same as above, also returning the index in lines of each scene line.
+  void GetSceneLines(const Eigen::Vector2f& loc,
+                     float max_range,
+                     std::vector<geometry::line2f>* lines_list,
+                     std::vector<int>* line_idx) const;
+
 
   void SceneRender(const Eigen::Vector2f& loc,
                    float max_range,
@@ -69,13 +83,87 @@ struct VectorMap {
                         float angle_max,
                         int num_rays,
                         std::vector<float>* scan);
+
+  // Predicted scans from many sensor poses at once, e.g. one per particle.
+  // ray_angles are the beam angles relative to the sensor heading, ascending
+  // and within one turn of the first. The range of ray j from pose i goes to
+  // (*ranges)[i * ray_angles.size() + j]: the distance to the first line hit
+  // between range_min and range_max, or range_max when there is none.
+  // Poses in the same tile of the map share the lines gathered around it,
+  // and are processed in parallel. With a range_table every ray is looked
+  // up in it instead.
+  void GetPredictedScans(const std::vector<Eigen::Vector2f>& locs,
+                         const std::vector<float>& angles,
+                         const std::vector<float>& ray_angles,
+                         float range_min,
+                         float range_max,
+                         std::vector<float>* ranges) const;
   void Cleanup();
 
+  // Load a text map. When a compiled map <file>.bin sits next to it and is
+  // not older, it is loaded instead, which skips the parsing, the cleanup and
+  // the index build.
   void Load(const std::string& file);
 
+  // Same as above, always parsing the text.
+  void LoadText(const std::string& file);
+
+  // Load a map written by CompiledMap::Write. Returns false, leaving the map
+  // untouched, when file is missing or invalid.
+  bool LoadCompiled(const std::string& file);
+
+  // Rebuild the grid index; required after lines are modified directly.
+  void BuildIndex();
+
+  // Configuration space for a robot that must keep radius away from every
+  // line: each line is replaced by the four sides of the rectangle around it
+  // that extends radius past its ends and to either side. Segment queries
+  // against the returned map then only need to test the robot center.
+  VectorMap Inflate(float radius) const;
+
+  // Distance field of the lines, taken from the compiled map when it holds
+  // one with the same parameters.
+  void GetDistanceField(float resolution,
+                        float max_distance,
+                        DistanceField* field) const;
+
   bool Intersects(const Eigen::Vector2f& v0, const Eigen::Vector2f& v1) const ;
+
+  // Find the intersection with the map closest to v0 along v0 -> v1. Returns
+  // false if the segment does not hit any line.
+  bool Intersection(const Eigen::Vector2f& v0,
+                    const Eigen::Vector2f& v1,
+                    Eigen::Vector2f* intersection,
+                    int* line_idx = nullptr) const;
+
+  // Indices of the lines that may lie inside the axis-aligned box. Callers
+  // should still run an exact test on each returned line.
+  void GetLinesInBox(const Eigen::Vector2f& box_min,
+                     const Eigen::Vector2f& box_max,
+                     std::vector<int>* line_indices) const;
+
   std::vector<geometry::line2f> lines;
   std::string file_name;
+  // Grid index over lines, built by Load().
+  LineGrid line_grid;
+  // Coordinates of the lines of every cell of line_grid, in the order of its
+  // CellLines(), for the segment queries to test a cell at a time.
+  geometry::LineBatch<float> cell_segments;
+  // Compiled map the lines came from, nullptr for text maps. Copies of the
+  // map share it.
+  std::shared_ptr<const CompiledMap> compiled;
+  // Precomputed ray casting of the lines, from the compiled map when it
+  // stores one, nullptr otherwise. Copies of the map share it.
+  std::shared_ptr<const RangeTable> range_table;
+
+ private:
+  // Fill cell_segments for the current line_grid.
+  void BuildCellSegments();
+
+  bool IndexValid() const {
+    return !line_grid.Empty() && line_grid.NumLines() == lines.size() &&
+        cell_segments.Size() == line_grid.CellLines().size();
+  }
 };
 
 
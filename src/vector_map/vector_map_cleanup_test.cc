@@ -0,0 +1,158 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    vector_map_cleanup_test.cc
+\brief   Checks that VectorMap::Cleanup splits lines exactly like the
+         original test of every line against all kept ones.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <random>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "shared/util/timer.h"
+#include "vector_map/vector_map.h"
+
+using geometry::line2f;
+using std::vector;
+using Eigen::Vector2f;
+
+namespace {
+
+// The original quadratic cleanup.
+vector<line2f> ReferenceCleanup(vector<line2f> lines) {
+  const float kShrinkDistance = 1e-4;
+  const float kMinLineLength = 0.05;
+  vector<line2f> new_lines;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const line2f l1 = lines[i];
+    if (l1.Length() < kMinLineLength) continue;
+    Vector2f p;
+    bool intersection = false;
+    for (const line2f& l2 : new_lines) {
+      if (l2.Intersection(l1, &p)) {
+        const Vector2f shrink = kShrinkDistance * l1.Dir();
+        lines.push_back(line2f(l1.p0, p - shrink));
+        lines.push_back(line2f(p + shrink, l1.p1));
+        intersection = true;
+        break;
+      }
+    }
+    if (!intersection) new_lines.push_back(l1);
+  }
+  for (line2f& l : new_lines) {
+    const float len = l.Length();
+    const Vector2f dir = l.Dir();
+    if (len < 2.0 * kShrinkDistance) continue;
+    l.p0 += kShrinkDistance * dir;
+    l.p1 -= kShrinkDistance * dir;
+  }
+  return new_lines;
+}
+
+// Random segments of up to max_length in a square of the given size.
+vector<line2f> RandomLines(int count,
+                           float size,
+                           float max_length,
+                           std::mt19937* rng) {
+  std::uniform_real_distribution<float> position(0, size);
+  std::uniform_real_distribution<float> length(0, max_length);
+  std::uniform_real_distribution<float> angle(-M_PI, M_PI);
+  vector<line2f> lines;
+  for (int i = 0; i < count; ++i) {
+    const Vector2f p0(position(*rng), position(*rng));
+    const float a = angle(*rng);
+    lines.push_back(
+        line2f(p0, p0 + length(*rng) * Vector2f(cos(a), sin(a))));
+  }
+  return lines;
+}
+
+// Axis aligned walls on a lattice, as drawn by hand or exported from CAD:
+// shared corners, T-junctions, crossings and collinear overlaps.
+vector<line2f> LatticeLines(int count, int size, std::mt19937* rng) {
+  std::uniform_int_distribution<int> position(0, size);
+  std::uniform_int_distribution<int> length(1, 6);
+  std::bernoulli_distribution horizontal(0.5);
+  vector<line2f> lines;
+  for (int i = 0; i < count; ++i) {
+    const Vector2f p0(0.5f * position(*rng), 0.5f * position(*rng));
+    const Vector2f d = horizontal(*rng) ? Vector2f(0.5f * length(*rng), 0)
+                                        : Vector2f(0, 0.5f * length(*rng));
+    lines.push_back(line2f(p0, p0 + d));
+  }
+  return lines;
+}
+
+bool Same(const line2f& a, const line2f& b) {
+  return a.p0 == b.p0 && a.p1 == b.p1;
+}
+
+bool Check(const char* name, const vector<line2f>& lines) {
+  const double t_start = GetMonotonicTime();
+  const vector<line2f> expected = ReferenceCleanup(lines);
+  const double t_reference = GetMonotonicTime();
+  vector_map::VectorMap map;
+  map.lines = lines;
+  map.Cleanup();
+  const double t_cleanup = GetMonotonicTime();
+
+  printf("%s: %lu lines cleaned to %lu, reference %.1f ms, Cleanup %.1f ms\n",
+         name, lines.size(), expected.size(), 1e3 * (t_reference - t_start),
+         1e3 * (t_cleanup - t_reference));
+  if (map.lines.size() != expected.size()) {
+    printf("ERROR: %s: %lu lines, expected %lu\n", name, map.lines.size(),
+           expected.size());
+    return false;
+  }
+  for (size_t i = 0; i < expected.size(); ++i) {
+    if (!Same(map.lines[i], expected[i])) {
+      printf("ERROR: %s: line %lu is (%f,%f)-(%f,%f), expected "
+             "(%f,%f)-(%f,%f)\n",
+             name, i, map.lines[i].p0.x(), map.lines[i].p0.y(),
+             map.lines[i].p1.x(), map.lines[i].p1.y(), expected[i].p0.x(),
+             expected[i].p0.y(), expected[i].p1.x(), expected[i].p1.y());
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::mt19937 rng(1);
+  bool ok = true;
+  ok = Check("empty", vector<line2f>()) && ok;
+  ok = Check("point", vector<line2f>(1, line2f(1, 1, 1, 1))) && ok;
+  ok = Check("cross", {line2f(0, 0, 2, 2), line2f(0, 2, 2, 0)}) && ok;
+  ok = Check("vertical", {line2f(1, 0, 1, 5), line2f(0, 2, 3, 2),
+                          line2f(1, 1, 1, 4)}) && ok;
+  for (int i = 0; i < 5; ++i) {
+    ok = Check("short", RandomLines(500, 20, 1, &rng)) && ok;
+    ok = Check("long", RandomLines(300, 20, 15, &rng)) && ok;
+    ok = Check("lattice", LatticeLines(1000, 40, &rng)) && ok;
+  }
+  ok = Check("large", RandomLines(5000, 200, 4, &rng)) && ok;
+  if (!ok) return 1;
+  printf("All cleanup checks passed\n");
+  return 0;
+}
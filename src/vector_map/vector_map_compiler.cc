@@ -0,0 +1,125 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    vector_map_compiler.cc
+\brief   Compile a text vector map into the binary format that
+         VectorMap::Load picks up next to it.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdio.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+#include "shared/util/timer.h"
+#include "vector_map/compiled_map.h"
+#include "vector_map/vector_map.h"
+
+using std::string;
+using std::vector;
+
+DEFINE_string(map, "", "Text vector map file to compile");
+DEFINE_string(output, "", "Compiled map to write, <map>.bin when unset so that loading the text map picks it up");
+DEFINE_string(inflations, "", "Comma separated radii (m) to store inflated copies of the map for, e.g. the "
+              "collision proximity of the global planner");
+DEFINE_string(distance_fields, "", "Comma separated resolution:max_distance pairs (m) to store distance fields "
+              "for, e.g. the likelihood field of the particle filter");
+DEFINE_string(range_tables, "", "Comma separated resolution:angles pairs (m, bins over half a turn) to store "
+              "precomputed ray casting for, e.g. 0.05:360 for the beam model of the particle filter; the first one "
+              "is used when the map is loaded");
+
+namespace {
+
+vector<string> Split(const string& list) {
+  vector<string> items;
+  std::stringstream ss(list);
+  string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  if (FLAGS_map.empty()) {
+    std::cerr << "Usage: vector_map_compiler --map <vector map file> [--output <file>] [--inflations r,...] "
+              << "[--distance_fields resolution:max_distance,...] [--range_tables resolution:angles,...]" << std::endl;
+    return 1;
+  }
+
+  vector<float> inflations;
+  for (const string& item : Split(FLAGS_inflations)) {
+    inflations.push_back(std::stof(item));
+  }
+  vector<std::pair<float, float>> distance_fields;
+  for (const string& item : Split(FLAGS_distance_fields)) {
+    float resolution = 0;
+    float max_distance = 0;
+    if (sscanf(item.c_str(), "%f:%f", &resolution, &max_distance) != 2 || resolution <= 0) {
+      std::cerr << "Invalid distance field " << item << ", expected resolution:max_distance" << std::endl;
+      return 1;
+    }
+    distance_fields.push_back(std::make_pair(resolution, max_distance));
+  }
+  vector<std::pair<float, int>> range_tables;
+  for (const string& item : Split(FLAGS_range_tables)) {
+    float resolution = 0;
+    int angles = 0;
+    if (sscanf(item.c_str(), "%f:%d", &resolution, &angles) != 2 || resolution <= 0 || angles <= 0) {
+      std::cerr << "Invalid range table " << item << ", expected resolution:angles" << std::endl;
+      return 1;
+    }
+    range_tables.push_back(std::make_pair(resolution, angles));
+  }
+
+  // The text is parsed even if a compiled map already sits next to it
+  vector_map::VectorMap map;
+  const double t_start = GetMonotonicTime();
+  map.LoadText(FLAGS_map);
+  const double t_loaded = GetMonotonicTime();
+
+  const string output = FLAGS_output.empty() ? FLAGS_map + ".bin" : FLAGS_output;
+  if (!vector_map::CompiledMap::Write(output, map, inflations, distance_fields, range_tables)) {
+    return 1;
+  }
+  const double t_written = GetMonotonicTime();
+
+  vector_map::VectorMap compiled;
+  if (!compiled.LoadCompiled(output) || compiled.lines.size() != map.lines.size()) {
+    std::cerr << "Unable to read back " << output << std::endl;
+    return 1;
+  }
+  const double t_read = GetMonotonicTime();
+
+  printf("%lu lines, %lu inflations, %lu distance fields, %lu range tables written to %s\n", map.lines.size(),
+         inflations.size(), distance_fields.size(), range_tables.size(), output.c_str());
+  if (compiled.range_table != nullptr) {
+    printf("Range table: %d angles, %lu rows, %lu points (%.1f MB)\n", compiled.range_table->NumAngles(),
+           compiled.range_table->NumRows(), compiled.range_table->NumPoints(),
+           1e-6 * (compiled.range_table->NumRows() + compiled.range_table->NumPoints()) * 4);
+  }
+  printf("Text load %.1f ms, compile %.1f ms, compiled load %.2f ms\n", 1e3 * (t_loaded - t_start),
+         1e3 * (t_written - t_loaded), 1e3 * (t_read - t_written));
+  return 0;
+}
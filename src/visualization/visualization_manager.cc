@@ -0,0 +1,196 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    visualization_manager.cc
+\brief   Rate limited, decimated publishing of visualization messages, with
+         persistent layers that only send the tiles that changed.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "gflags/gflags.h"
+#include "amrl_msgs/VisualizationMsg.h"
+#include "ros/ros.h"
+
+#include "shared/util/timer.h"
+#include "visualization.h"
+#include "visualization_manager.h"
+
+using amrl_msgs::VisualizationMsg;
+using Eigen::Vector2f;
+using std::string;
+using std::vector;
+
+DEFINE_bool(visualization, true,
+            "Publish visualization messages");
+DEFINE_uint64(visualization_max_elements, 10000,
+              "Most points, lines and arcs sent in one visualization message, "
+              "0 for no limit");
+DEFINE_double(visualization_resolution, 0.05,
+              "Cell size (m) persistent point layers are decimated to");
+DEFINE_double(visualization_tile_size, 10.0,
+              "Size (m) of the tiles persistent point layers are sent in");
+
+namespace {
+
+// Every stride'th element of v.
+template <typename T>
+void Decimate(size_t stride, vector<T>* v) {
+  size_t kept = 0;
+  for (size_t i = 0; i < v->size(); i += stride) (*v)[kept++] = (*v)[i];
+  v->resize(kept);
+}
+
+uint64_t Hash(uint64_t hash, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  // FNV-1a over the four bytes.
+  for (int i = 0; i < 4; ++i, bits >>= 8) {
+    hash = (hash ^ (bits & 0xFF)) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+}  // namespace
+
+namespace visualization {
+
+void VisualizationManager::Init(ros::NodeHandle* n) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  publisher_ = n->advertise<VisualizationMsg>("visualization", 1);
+  initialized_ = true;
+}
+
+void VisualizationManager::SetRate(const string& ns, float rate) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  periods_[ns] = (rate > 0) ? 1.0 / rate : 0.0;
+}
+
+bool VisualizationManager::Due(const string& ns) const {
+  if (!FLAGS_visualization) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto period = periods_.find(ns);
+  const auto last = last_publish_.find(ns);
+  return period == periods_.end() || last == last_publish_.end() ||
+      GetMonotonicTime() - last->second >= period->second;
+}
+
+void VisualizationManager::Publish(const VisualizationMsg& msg) {
+  if (!FLAGS_visualization) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  const size_t budget = FLAGS_visualization_max_elements;
+  const size_t size = msg.points.size() + msg.lines.size() + msg.arcs.size();
+  if (budget == 0 || size <= budget) {
+    PublishLocked(msg);
+    return;
+  }
+  // Callers may keep adding to msg, only the copy sent is decimated.
+  const size_t stride = (size + budget - 1) / budget;
+  VisualizationMsg decimated = msg;
+  Decimate(stride, &decimated.points);
+  Decimate(stride, &decimated.lines);
+  Decimate(stride, &decimated.arcs);
+  PublishLocked(decimated);
+}
+
+void VisualizationManager::PublishPoints(const string& ns,
+                                         const string& frame,
+                                         const vector<Vector2f>& points,
+                                         uint32_t color) {
+  if (!FLAGS_visualization) return;
+  const float resolution = FLAGS_visualization_resolution;
+  const int cells_per_tile = std::max(1, static_cast<int>(std::round(
+      FLAGS_visualization_tile_size / resolution)));
+  auto floor_div = [](int a, int b) {
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+  };
+
+  // Order the points by tile and cell, keeping the first point of each cell,
+  // so that the tiles do not depend on the order the points came in.
+  struct Entry {
+    Tile tile;
+    int x;
+    int y;
+    size_t index;
+  };
+  vector<Entry> entries;
+  entries.reserve(points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    const int x = static_cast<int>(std::floor(points[i].x() / resolution));
+    const int y = static_cast<int>(std::floor(points[i].y() / resolution));
+    entries.push_back({Tile(floor_div(x, cells_per_tile),
+                            floor_div(y, cells_per_tile)), x, y, i});
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) {
+    return std::tie(a.tile, a.x, a.y, a.index) <
+        std::tie(b.tile, b.x, b.y, b.index);
+  });
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<Tile, uint64_t>& published = layers_[ns];
+  std::map<Tile, uint64_t> tiles;
+  VisualizationMsg msg = NewVisualizationMessage(frame, ns);
+  msg.header.stamp = ros::Time::now();
+  for (size_t begin = 0; begin < entries.size();) {
+    const Tile tile = entries[begin].tile;
+    ClearVisualizationMsg(msg);
+    uint64_t hash = 0xCBF29CE484222325ull;
+    size_t end = begin;
+    for (; end < entries.size() && entries[end].tile == tile; ++end) {
+      if (end > begin && entries[end].x == entries[end - 1].x &&
+          entries[end].y == entries[end - 1].y) {
+        continue;
+      }
+      const Vector2f& p = points[entries[end].index];
+      hash = Hash(Hash(hash, p.x()), p.y());
+      DrawPoint(p, color, msg);
+    }
+    begin = end;
+    tiles[tile] = hash;
+    const auto previous = published.find(tile);
+    if (previous != published.end() && previous->second == hash) continue;
+    msg.ns = ns + "/" + std::to_string(tile.first) + "_" +
+        std::to_string(tile.second);
+    PublishLocked(msg);
+  }
+  // Tiles that emptied out are cleared with a message without points.
+  for (const auto& tile : published) {
+    if (tiles.count(tile.first) > 0) continue;
+    ClearVisualizationMsg(msg);
+    msg.ns = ns + "/" + std::to_string(tile.first.first) + "_" +
+        std::to_string(tile.first.second);
+    PublishLocked(msg);
+  }
+  published.swap(tiles);
+  last_publish_[ns] = GetMonotonicTime();
+}
+
+void VisualizationManager::PublishLocked(const VisualizationMsg& msg) {
+  last_publish_[msg.ns] = GetMonotonicTime();
+  if (initialized_) publisher_.publish(msg);
+}
+
+}  // namespace visualization
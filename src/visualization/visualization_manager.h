@@ -0,0 +1,93 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    visualization_manager.h
+\brief   Rate limited, decimated publishing of visualization messages, with
+         persistent layers that only send the tiles that changed.
+\author  Daniel Meza, Jared Rosenbaum, Steven Swanbeck, (C) 2024
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "amrl_msgs/VisualizationMsg.h"
+#include "ros/ros.h"
+
+#ifndef VISUALIZATION_MANAGER_H
+#define VISUALIZATION_MANAGER_H
+
+namespace visualization {
+
+// Owns the visualization publisher of a node. Messages are rate limited per
+// namespace and decimated to an element budget (--visualization_max_elements)
+// before they go out, and nothing is sent at all with --novisualization.
+//
+// Nodes should check Due() before drawing, so that messages that would be
+// dropped are never built.
+class VisualizationManager {
+ public:
+  VisualizationManager() {}
+
+  // Advertise the visualization topic on n. Messages are dropped until then.
+  void Init(ros::NodeHandle* n);
+
+  // Publish namespace ns at most rate times a second, 0 for every time.
+  void SetRate(const std::string& ns, float rate);
+
+  // Whether visualization is enabled and a message of namespace ns would not
+  // exceed its rate.
+  bool Due(const std::string& ns) const;
+
+  // Publish msg, keeping an evenly spread subset of its elements when it
+  // holds more than the budget. Rates are not checked here, messages that
+  // must go out (e.g. clearing a namespace) are still sent.
+  void Publish(const amrl_msgs::VisualizationMsg& msg);
+
+  // Persistent layer of points, e.g. a map that grows. The points are
+  // decimated to one per cell of --visualization_resolution and split into
+  // square tiles of --visualization_tile_size, each sent in a namespace of its
+  // own, "<ns>/<x>_<y>". Only the tiles whose points changed since the last
+  // call are published, tiles that no longer hold points are cleared.
+  void PublishPoints(const std::string& ns,
+                     const std::string& frame,
+                     const std::vector<Eigen::Vector2f>& points,
+                     uint32_t color);
+
+ private:
+  typedef std::pair<int, int> Tile;
+
+  // Publish msg as is, with the lock held.
+  void PublishLocked(const amrl_msgs::VisualizationMsg& msg);
+
+  mutable std::mutex mutex_;
+  ros::Publisher publisher_;
+  bool initialized_ = false;
+  // Minimum time between messages, and time of the last one, per namespace.
+  std::map<std::string, double> periods_;
+  std::map<std::string, double> last_publish_;
+  // Hash of the points of every published tile, per persistent layer.
+  std::map<std::string, std::map<Tile, uint64_t>> layers_;
+};
+
+}  // namespace visualization
+
+#endif  // VISUALIZATION_MANAGER_H